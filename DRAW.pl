@@ -14,9 +14,18 @@ $config{'5'}  = "Kueche";
 $config{'datadir'}   = "/srv/klimalogger/data/";
 $config{'outputdir'} = "/srv/klimalogger/web/out/";
 
+# draw from the tsdb database of ingest_tfa instead, without rrdtool
+#$config{'tsdb'}      = "/srv/klimalogger/db/";
+
 #### END CONFIG     ####
 
 
+if ( defined $config{'tsdb'} ) {
+	my @labels = map { ('-l', "$_=$config{$_}") } grep { defined $config{$_} } ('in', 1 .. 5);
+	exec('/srv/klimalogger/bin/draw_tfa', @labels, $config{'tsdb'}, $config{'outputdir'});
+	die "Can't run draw_tfa: $!";
+}
+
 
 while ( my $db = <$config{'datadir'}/sensor_*.rrd> ) {
 	$db =~ s/.*sensor_([\da-z]+)\.rrd.*/$1/g;
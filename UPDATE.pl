@@ -1,6 +1,5 @@
 #!/usr/bin/perl -w
 use strict;
-use Time::Local;
 
 my %config;
 my %input;
@@ -22,47 +21,39 @@ while ( my $file = <$data_dir/sensor_*.rrd> ) {
 
 
 # store decoded data in %input
-open (FH, "/srv/klimalogger/bin/decode_tfa $ARGV[0] 2>/dev/null |");
+open (FH, "/srv/klimalogger/bin/decode_tfa --format=csv $ARGV[0] 2>/dev/null |");
+my $header = <FH>;
+chomp $header;
+my @columns = split( /,/, $header );
 while ( <FH> ) {
+	chomp;
+	my %record;
+	@record{@columns} = split( /,/, $_, -1 );
 
-	if ( /^\d+ (\d+).(\d+).(\d+) (\d+):(\d+) (.*)/ ) { 
-		my $timestamp;
-		my ( $sec, $min, $hour, $mday, $mon, $year ) =
-			( 0, $5, $4, $1, $2, $3 );
-		my $data = $6;
-
-		$timestamp =  timelocal( $sec, $min, $hour, $mday,
-				      $mon - 1, $year);
-
-		$input{$timestamp} = $data;
-	}
-
+	$input{$record{'time'}} = \%record;
 }
 close FH;
 
 
 # rrdtool likes its timestamps ascending
 my %updatestrs;
-foreach my $key ( sort(keys %input) ) {
-	my ( @tmp_temp, @tmp_hum, @tmp_pairs );
-
-	@tmp_pairs = ( $input{$key} =~ m/[TH][in\d]+: [\d\.\-]+/g );
-
-	foreach ( @tmp_pairs ) {
-		my ( $dtype, $sens, $value ) =
-			( /([TH])([in\d]+): ([\d\.\-]+)/ );
-
-		if ( $dtype eq 'T' ) {
-			$tmp_temp[ $sens eq 'in' ? 0 : $sens ] = $value;
-		} else {
-			$tmp_hum [ $sens eq 'in' ? 0 : $sens ] = $value;
-		}
-	}
-
-	for ( my $i=0; $i < @tmp_temp or $i < @tmp_hum; $i++ ) {
-		my $sens = ( $i == 0 ? 'in' : $i );
-		my $temp = defined $tmp_temp[$i] ? $tmp_temp[$i] : 'U';
-		my $hum  = defined $tmp_hum[$i]  ? $tmp_hum[$i]  : 'U';
+foreach my $key ( sort { $a <=> $b } keys %input ) {
+	my $record = $input{$key};
+
+	my $i = 0;
+	foreach my $sens ( 'in', 1 .. 5 ) {
+		my $bit = $i++;
+		next if not exists $record->{"t_$sens"};
+
+		# readings failing the plausibility checks of decode_tfa
+		# (INVALID_* in validate.h) are dropped
+		my $flags = $record->{'flags'} || 0;
+		last if $flags & 0x0001;
+
+		my $temp = $record->{"t_$sens"};
+		my $hum  = $record->{"h_$sens"};
+		$temp = 'U' if $temp eq '' or $flags & (0x0010 << $bit);
+		$hum  = 'U' if $hum eq '' or $flags & (0x0400 << $bit);
 
 		# no need to add UNKNOWN values
 		next if $temp eq $hum and $temp eq 'U';
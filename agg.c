@@ -0,0 +1,165 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "record.h"
+#include "agg.h"
+
+/* rows covered by one unit of level */
+static uint64_t level_span(int level) {
+	uint64_t span = AGG_FANOUT;
+
+	while (level-- > 0) span *= AGG_FANOUT;
+	return span;
+}
+
+void agg_init(AggSummary* s) {
+	memset(s, 0, sizeof(*s));
+}
+
+void agg_add(AggSummary* s, int16_t t, uint8_t h) {
+	if (t != RECORD_NA_T) {
+		if (s->t_count == 0 || t < s->t_min) s->t_min = t;
+		if (s->t_count == 0 || t > s->t_max) s->t_max = t;
+		s->t_sum += t;
+		s->t_count++;
+	}
+	if (h != RECORD_NA) {
+		if (s->h_count == 0 || h < s->h_min) s->h_min = h;
+		if (s->h_count == 0 || h > s->h_max) s->h_max = h;
+		s->h_sum += h;
+		s->h_count++;
+	}
+}
+
+void agg_merge(AggSummary* dst, const AggSummary* src) {
+	if (src->t_count > 0) {
+		if (dst->t_count == 0 || src->t_min < dst->t_min) dst->t_min = src->t_min;
+		if (dst->t_count == 0 || src->t_max > dst->t_max) dst->t_max = src->t_max;
+		dst->t_sum += src->t_sum;
+		dst->t_count += src->t_count;
+	}
+	if (src->h_count > 0) {
+		if (dst->h_count == 0 || src->h_min < dst->h_min) dst->h_min = src->h_min;
+		if (dst->h_count == 0 || src->h_max > dst->h_max) dst->h_max = src->h_max;
+		dst->h_sum += src->h_sum;
+		dst->h_count += src->h_count;
+	}
+}
+
+int agg_open(AggIndex* a, const char* dir, uint64_t rows, int writable) {
+	char path[PATH_MAX];
+	int i;
+
+	memset(a, 0, sizeof(*a));
+	for (i = 0; i < AGG_LEVELS; i++) a->fd[i] = -1;
+	a->rows = rows;
+	a->valid = 1;
+
+	for (i = 0; i < AGG_LEVELS; i++) {
+		uint64_t span = level_span(i);
+		uint64_t units = (rows + span - 1) / span;
+		off_t size;
+
+		snprintf(path, sizeof(path), "%s/agg.%d", dir, i);
+		a->fd[i] = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+		if (a->fd[i] == -1) {
+			if (!writable && errno == ENOENT) {
+				a->valid = 0;
+				continue;
+			}
+			agg_close(a);
+			return -1;
+		}
+
+		size = lseek(a->fd[i], 0, SEEK_END);
+		if (size != units * sizeof(AggSummary)) {
+			a->valid = 0;
+			continue;
+		}
+		agg_init(&a->cur[i]);
+		if (rows > 0 && pread(a->fd[i], &a->cur[i], sizeof(AggSummary),
+				size - sizeof(AggSummary)) != sizeof(AggSummary)) {
+			agg_close(a);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int agg_flush(AggIndex* a) {
+	int i;
+
+	if (a->rows == 0) return 0;
+	for (i = 0; i < AGG_LEVELS; i++) {
+		off_t pos = ((a->rows - 1) / level_span(i)) * sizeof(AggSummary);
+
+		if (a->fd[i] == -1) continue;
+		if (pwrite(a->fd[i], &a->cur[i], sizeof(AggSummary), pos) != sizeof(AggSummary))
+			return -1;
+	}
+	return 0;
+}
+
+int agg_close(AggIndex* a) {
+	int i, rc = 0;
+
+	for (i = 0; i < AGG_LEVELS; i++) {
+		if (a->fd[i] != -1 && close(a->fd[i]) == -1) rc = -1;
+		a->fd[i] = -1;
+	}
+	return rc;
+}
+
+int agg_reset(AggIndex* a) {
+	int i;
+
+	for (i = 0; i < AGG_LEVELS; i++) {
+		if (ftruncate(a->fd[i], 0) == -1) return -1;
+		agg_init(&a->cur[i]);
+	}
+	a->rows = 0;
+	a->valid = 1;
+	return 0;
+}
+
+int agg_append(AggIndex* a, int16_t t, uint8_t h) {
+	int i;
+
+	for (i = 0; i < AGG_LEVELS; i++) {
+		uint64_t span = level_span(i);
+
+		if (a->rows > 0 && a->rows % span == 0) {
+			// the block is complete, store it and start the next one
+			off_t pos = (a->rows / span - 1) * sizeof(AggSummary);
+
+			if (pwrite(a->fd[i], &a->cur[i], sizeof(AggSummary), pos) != sizeof(AggSummary))
+				return -1;
+			agg_init(&a->cur[i]);
+		}
+		agg_add(&a->cur[i], t, h);
+	}
+	a->rows++;
+	return 0;
+}
+
+int agg_units(AggIndex* a, int level, uint64_t idx, long n, AggSummary* out) {
+	uint64_t span = level_span(level);
+	uint64_t cur = a->rows > 0 ? (a->rows - 1) / span : 0;
+	long stored = n;
+	ssize_t len;
+
+	// the block rows are being appended to may not be written yet
+	if (a->rows > 0 && idx + n > cur) stored = cur - idx;
+	if (stored > 0) {
+		len = stored * sizeof(AggSummary);
+		if (pread(a->fd[level], out, len, idx * sizeof(AggSummary)) != len)
+			return -1;
+	}
+	if (stored < n) out[stored] = a->cur[level];
+	return 0;
+}
@@ -0,0 +1,64 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_AGG_H_
+#define _INCLUDE_AGG_H_
+
+#include <stdint.h>
+#include <limits.h>
+
+/* Block summary index over the rows of a series.
+ *
+ * Level 0 holds one AggSummary per AGG_FANOUT rows, level 1 one per
+ * AGG_FANOUT^2 rows and so on, each in its own file (agg.<level>). An
+ * aggregate over any row range combines at most 2*(AGG_FANOUT-1) units per
+ * level plus the rows at the edges, so it costs O(AGG_FANOUT * log n)
+ * instead of a scan. The summaries of the blocks rows are appended to are
+ * updated in place.
+ */
+
+#define AGG_FANOUT 64
+#define AGG_LEVELS 5
+
+typedef struct _AggSummary {
+	int64_t t_sum;          /* tenths of deg C */
+	int64_t h_sum;
+	uint32_t t_count;
+	uint32_t h_count;
+	int16_t t_min, t_max;
+	uint8_t h_min, h_max;
+	uint8_t reserved[2];
+} AggSummary;
+
+typedef struct _AggIndex {
+	int fd[AGG_LEVELS];
+	int valid;              /* index matches the rows of the series */
+	uint64_t rows;          /* rows summarized */
+	AggSummary cur[AGG_LEVELS];     /* block the next row goes to */
+} AggIndex;
+
+/* reset a summary to "no readings" */
+extern void agg_init(AggSummary* s);
+
+/* add one reading (RECORD_NA_T / RECORD_NA are ignored) */
+extern void agg_add(AggSummary* s, int16_t t, uint8_t h);
+
+/* add the readings summarized by src to dst */
+extern void agg_merge(AggSummary* dst, const AggSummary* src);
+
+/* open the index files in dir for a series of rows rows. if the files do
+ * not match rows, valid is 0 and the index has to be rebuilt by
+ * agg_reset() and agg_append() of every row (writable only). */
+extern int agg_open(AggIndex* a, const char* dir, uint64_t rows, int writable);
+extern int agg_flush(AggIndex* a);
+extern int agg_close(AggIndex* a);
+
+/* drop all summaries */
+extern int agg_reset(AggIndex* a);
+
+/* add the next row */
+extern int agg_append(AggIndex* a, int16_t t, uint8_t h);
+
+/* read n units of level starting at unit idx into out[] */
+extern int agg_units(AggIndex* a, int level, uint64_t idx, long n, AggSummary* out);
+
+#endif /* _INCLUDE_AGG_H_ */
@@ -0,0 +1,454 @@
+/* vim:set expandtab! ts=4: */
+
+/* alert_tfa - rolling min/max/mean/rate of change of the readings of one
+ * or more stations, and an event whenever a reading or the mean of a
+ * window crosses the alarm limits set on the station. Records come from
+ * dumps, or from streams (files, fifos, stdin) in decode_tfa --format=bin
+ * format as they arrive. Records not newer than the ones before are
+ * skipped, so streams should be in time order, like batch_tfa writes
+ * them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "dump.h"
+#include "output.h"
+#include "validate.h"
+#include "rolling.h"
+
+#define LEVEL_OK   0
+#define LEVEL_HIGH 1
+#define LEVEL_LOW  2
+
+static const char* level_name[] = { "ok", "high", "low" };
+
+typedef struct _Series {
+	Rolling r;
+	/* level of the last reading, then of each window's mean */
+	unsigned char level[1 + ROLLING_WINDOWS];
+} Series;
+
+typedef struct _Station {
+	const char* name;
+	const char* path;
+	int fd;                 /* stream, -1 for dumps or once it ended */
+	unsigned char buf[64 * sizeof(RecordBin)];
+	size_t have, used;
+	int header_read;
+	int sensors;
+	int64_t last;           /* newest record so far */
+	/* alarm limits, RECORD_NA_T / RECORD_NA if not known */
+	int16_t t_max[RECORD_SENSORS], t_min[RECORD_SENSORS];
+	int16_t h_max[RECORD_SENSORS], h_min[RECORD_SENSORS];
+	Series t[RECORD_SENSORS], h[RECORD_SENSORS];
+} Station;
+
+static int nwindows;
+static int64_t window_length[ROLLING_WINDOWS];
+static const char* window_name[ROLLING_WINDOWS];
+
+static void print_usage() {
+	fprintf(stderr, "Usage: alert_tfa [--windows <time>,...] [--limits <tfa.dump.filename>] [--summary] [<name>=]<dumpdir|tfa.dump.filename|stream|->...\n");
+	fprintf(stderr, "  windows: up to %d, like 15m,1h,24h (the default); units s, m, h, d\n", ROLLING_WINDOWS);
+	fprintf(stderr, "  limits: the dump to take the alarm limits of stream inputs from\n");
+	exit(EXIT_FAILURE);
+}
+
+/* parse a window length like 900, 15m or 1h, 0 on error */
+static int64_t parse_length(const char* arg, const char** end) {
+	char* e;
+	long long n = strtoll(arg, &e, 10);
+
+	*end = e;
+	if (e == arg || n <= 0) return 0;
+	switch (*e) {
+	case 's': (*end)++; return n;
+	case 'm': (*end)++; return n * 60;
+	case 'h': (*end)++; return n * 3600;
+	case 'd': (*end)++; return n * 86400;
+	default: return n;
+	}
+}
+
+static void parse_windows(const char* arg) {
+	const char* end;
+	char* name;
+
+	nwindows = 0;
+	while (nwindows < ROLLING_WINDOWS) {
+		window_length[nwindows] = parse_length(arg, &end);
+		if (window_length[nwindows] == 0 || (*end != 0 && *end != ',')) break;
+		name = strndup(arg, end - arg);
+		if (name == NULL) {
+			perror("strndup");
+			exit(EXIT_FAILURE);
+		}
+		window_name[nwindows++] = name;
+		if (*end == 0) return;
+		arg = end + 1;
+	}
+	fprintf(stderr, "E: bad windows %s\n", arg);
+	print_usage();
+}
+
+static void set_limits(Station* st, const DumpInfo* info) {
+	int i;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		st->t_max[i] = info->t_max[i];
+		st->t_min[i] = info->t_min[i];
+		st->h_max[i] = info->h_max[i] == RECORD_NA ? RECORD_NA_T : info->h_max[i];
+		st->h_min[i] = info->h_min[i] == RECORD_NA ? RECORD_NA_T : info->h_min[i];
+	}
+}
+
+static int read_limits(const char* path, DumpInfo* info) {
+	unsigned char data[DUMP_SIZE];
+	FILE* f = fopen(path, "r");
+	size_t len;
+
+	if (f == NULL) return -1;
+	len = fread(data, 1, DUMP_SIZE, f);
+	fclose(f);
+	if (dump_info(data, len, info) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static void print_value(double v, int tenths) {
+	if (tenths) printf(" %.1f", v / 10);
+	else printf(" %.0f", v);
+}
+
+static int level_of(double v, int lo, int hi) {
+	if (hi != RECORD_NA_T && v > hi) return LEVEL_HIGH;
+	if (lo != RECORD_NA_T && v < lo) return LEVEL_LOW;
+	return LEVEL_OK;
+}
+
+/* print an event if level k of a series changed */
+static void check_level(Station* st, int sensor, Series* s, int tenths,
+		int k, int64_t time, double v, int lo, int hi) {
+	int level = level_of(v, lo, hi);
+
+	if (level == s->level[k]) return;
+	s->level[k] = level;
+
+	printf("%lld %s %s %s %s %s", (long long)time, st->name, sensor_name(sensor),
+			tenths ? "t" : "h", k == 0 ? "now" : window_name[k - 1], level_name[level]);
+	print_value(v, tenths);
+	if (lo != RECORD_NA_T) print_value(lo, tenths);
+	else printf(" U");
+	if (hi != RECORD_NA_T) print_value(hi, tenths);
+	else printf(" U");
+	printf("\n");
+}
+
+/* one reading (or none, v == na) of a series at time */
+static int update(Station* st, int sensor, Series* s, int tenths,
+		int64_t time, int v, int na, int lo, int hi) {
+	int k;
+
+	if (v == na) {
+		rolling_expire(&s->r, time);
+	} else {
+		if (rolling_add(&s->r, time, v) == -1) return -1;
+		check_level(st, sensor, s, tenths, 0, time, v, lo, hi);
+	}
+
+	// an emptied window keeps its level until readings come back
+	for (k = 0; k < nwindows; k++) {
+		RollingStats stats;
+
+		if (rolling_stats(&s->r, k, &stats) > 0)
+			check_level(st, sensor, s, tenths, k + 1, time, stats.mean, lo, hi);
+	}
+	return 0;
+}
+
+static int feed(Station* st, const RecordBin* b, int sensors) {
+	int i;
+
+	if (b->flags & INVALID_TIME || b->time <= st->last) return 0;
+	st->last = b->time;
+
+	for (i = 0; i < sensors && i < RECORD_SENSORS; i++) {
+		int t = b->flags & INVALID_T(i) ? RECORD_NA_T : b->t[i];
+		int h = b->flags & INVALID_H(i) ? RECORD_NA : b->h[i];
+
+		if (update(st, i, &st->t[i], 1, b->time, t, RECORD_NA_T, st->t_min[i], st->t_max[i]) == -1
+				|| update(st, i, &st->h[i], 0, b->time, h, RECORD_NA, st->h_min[i], st->h_max[i]) == -1)
+			return -1;
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static int feed_dump(Station* st, const char* path, TimeCache* tc) {
+	unsigned char data[DUMP_SIZE];
+	RecordBin* all;
+	RecordBin* ord;
+	DumpHeader h;
+	DumpInfo info;
+	size_t n, i;
+	FILE* f;
+	size_t len;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "E: cannot open file %s\n", path);
+		return -1;
+	}
+	len = fread(data, 1, DUMP_SIZE, f);
+	fclose(f);
+	if (dump_header(data, len, &h) == -1 || dump_info(data, len, &info) == -1) {
+		fprintf(stderr, "W: %s: don't understand the data, skipping.\n", path);
+		return 0;
+	}
+	// the limits may have been changed on the station since the last dump
+	set_limits(st, &info);
+
+	all = malloc(h.records * sizeof(RecordBin));
+	ord = malloc(h.records * sizeof(RecordBin));
+	if (all == NULL || ord == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	n = dump_order(all, dump_decode(data, len, &h, all, tc), &h, ord);
+	for (i = 0; i < n; i++) {
+		if (feed(st, &ord[i], h.sensors) == -1) break;
+	}
+	free(all);
+	free(ord);
+	return i < n ? -1 : 0;
+}
+
+/* take what there is to read from a stream. returns 0 at the end of it,
+ * -1 on error. */
+static int feed_stream(Station* st) {
+	ssize_t n;
+
+	memmove(st->buf, st->buf + st->used, st->have - st->used);
+	st->have -= st->used;
+	st->used = 0;
+	n = read(st->fd, st->buf + st->have, sizeof(st->buf) - st->have);
+	if (n <= 0) {
+		if (n == -1) perror(st->path);
+		else if (st->have > 0) fprintf(stderr, "W: %s: ends in a partial record.\n", st->path);
+		return n;
+	}
+	st->have += n;
+
+	if (!st->header_read) {
+		RecordBinHeader h;
+
+		if (st->have < sizeof(h)) return 1;
+		memcpy(&h, st->buf, sizeof(h));
+		if (memcmp(h.magic, RECORD_BIN_MAGIC, 4) != 0 || h.version != RECORD_BIN_VERSION
+				|| h.record_size != sizeof(RecordBin)) {
+			fprintf(stderr, "E: %s is not in decode_tfa --format=bin format.\n", st->path);
+			return -1;
+		}
+		st->sensors = h.sensors;
+		st->header_read = 1;
+		st->used = sizeof(h);
+	}
+	while (st->have - st->used >= sizeof(RecordBin)) {
+		RecordBin b;
+
+		memcpy(&b, st->buf + st->used, sizeof(b));
+		st->used += sizeof(b);
+		if (feed(st, &b, st->sensors) == -1) return -1;
+	}
+	return 1;
+}
+
+static int is_stream(const char* path) {
+	struct stat st;
+
+	if (strcmp(path, "-") == 0) return 1;
+	if (stat(path, &st) == -1) return 0;
+	return S_ISFIFO(st.st_mode) || (S_ISREG(st.st_mode) && !dump_filename(
+			strrchr(path, '/') ? strrchr(path, '/') + 1 : path));
+}
+
+static void print_summary(Station* stations, int nstations) {
+	int i, j, k;
+
+	printf("# station sensor quantity window readings min max mean rate/h\n");
+	for (i = 0; i < nstations; i++) {
+		for (j = 0; j < 2 * RECORD_SENSORS; j++) {
+			Series* s = j % 2 == 0 ? &stations[i].t[j / 2] : &stations[i].h[j / 2];
+
+			for (k = 0; k < nwindows; k++) {
+				RollingStats stats;
+
+				if (rolling_stats(&s->r, k, &stats) == 0) continue;
+				printf("%s %s %s %s %u", stations[i].name, sensor_name(j / 2),
+						j % 2 == 0 ? "t" : "h", window_name[k], stats.count);
+				print_value(stats.min, j % 2 == 0);
+				print_value(stats.max, j % 2 == 0);
+				printf(" %.2f", j % 2 == 0 ? stats.mean / 10 : stats.mean);
+				if (stats.rate == stats.rate) printf(" %.2f\n", j % 2 == 0 ? stats.rate / 10 : stats.rate);
+				else printf(" U\n");
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Station* stations;
+	struct pollfd* pfd;
+	TimeCache tc;
+	DumpInfo limits;
+	const char* limits_path = NULL;
+	int summary = 0;
+	int nstations, i, j, ch, rc = 0;
+
+	static const struct option options[] = {
+		{ "windows", required_argument, NULL, 'w' },
+		{ "limits", required_argument, NULL, 'l' },
+		{ "summary", no_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	parse_windows("15m,1h,24h");
+	while ((ch = getopt_long(argc, argv, "w:l:s", options, NULL)) != -1) {
+		switch (ch) {
+		case 'w':
+			parse_windows(optarg);
+			break;
+		case 'l':
+			limits_path = optarg;
+			break;
+		case 's':
+			summary = 1;
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (optind >= argc) print_usage();
+
+	memset(&limits, 0, sizeof(limits));
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		limits.t_max[i] = limits.t_min[i] = RECORD_NA_T;
+		limits.h_max[i] = limits.h_min[i] = RECORD_NA;
+	}
+	if (limits_path != NULL && read_limits(limits_path, &limits) == -1) {
+		fprintf(stderr, "E: can't read the alarm limits from %s: %s\n", limits_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	nstations = argc - optind;
+	stations = calloc(nstations, sizeof(Station));
+	pfd = calloc(nstations, sizeof(struct pollfd));
+	if (stations == NULL || pfd == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nstations; i++) {
+		Station* st = &stations[i];
+		char* arg = argv[optind + i];
+		char* eq = strchr(arg, '=');
+
+		st->name = arg;
+		st->path = arg;
+		if (eq != NULL) {
+			*eq = 0;
+			st->path = eq + 1;
+		}
+		st->fd = -1;
+		st->last = INT64_MIN;
+		set_limits(st, &limits);
+		for (j = 0; j < RECORD_SENSORS; j++) {
+			if (rolling_init(&st->t[j].r, nwindows, window_length) == -1
+					|| rolling_init(&st->h[j].r, nwindows, window_length) == -1) {
+				perror("rolling_init");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	printf("# time station sensor quantity window level value min max\n");
+	fflush(stdout);
+
+	// dumps first, in time order per station
+	timecache_init(&tc);
+	for (i = 0; i < nstations; i++) {
+		Station* st = &stations[i];
+		char** files = NULL;
+		int nfiles = 0;
+
+		if (is_stream(st->path)) {
+			// a fifo opens only once there is a writer, unless non-blocking
+			st->fd = strcmp(st->path, "-") == 0 ? 0 : open(st->path, O_RDONLY | O_NONBLOCK);
+			if (st->fd == -1 || fcntl(st->fd, F_SETFL, 0) == -1) {
+				fprintf(stderr, "E: can't open %s: %s\n", st->path, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (dump_scan(st->path, &files, &nfiles) == -1) {
+			perror(st->path);
+			exit(EXIT_FAILURE);
+		}
+		for (j = 0; j < nfiles; j++) {
+			if (feed_dump(st, files[j], &tc) == -1) rc = 1;
+			free(files[j]);
+		}
+		free(files);
+	}
+
+	// then the streams, as records come in
+	for (;;) {
+		int n = 0;
+
+		for (i = 0; i < nstations; i++) {
+			if (stations[i].fd == -1) continue;
+			pfd[n].fd = stations[i].fd;
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			n++;
+		}
+		if (n == 0) break;
+		if (poll(pfd, n, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			rc = 1;
+			break;
+		}
+		for (i = 0, j = 0; i < nstations; i++) {
+			Station* st = &stations[i];
+			int r;
+
+			if (st->fd == -1) continue;
+			if (!(pfd[j++].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			r = feed_stream(st);
+			if (r <= 0) {
+				if (r == -1) rc = 1;
+				if (st->fd != 0) close(st->fd);
+				st->fd = -1;
+			}
+		}
+	}
+
+	if (summary) print_summary(stations, nstations);
+	for (i = 0; i < nstations; i++) {
+		for (j = 0; j < RECORD_SENSORS; j++) {
+			rolling_free(&stations[i].t[j].r);
+			rolling_free(&stations[i].h[j].r);
+		}
+	}
+	free(stations);
+	free(pfd);
+	return rc;
+}
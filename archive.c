@@ -0,0 +1,255 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "hash.h"
+
+/* map the first len bytes of the file, keeping the old mapping if that
+ * fails */
+static int archive_map(Archive* a, size_t len) {
+	unsigned char* map = NULL;
+
+	if (len > 0) {
+		map = mmap(NULL, len, PROT_READ, MAP_SHARED, a->fd, 0);
+		if (map == MAP_FAILED) return -1;
+	}
+	if (a->map != NULL) munmap(a->map, a->map_len);
+	a->map = map;
+	a->map_len = len;
+	return 0;
+}
+
+static void add_offset(Archive* a, off_t offset) {
+	a->offsets = realloc(a->offsets, (a->count + 1) * sizeof(off_t));
+	if (a->offsets == NULL) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	a->offsets[a->count++] = offset;
+}
+
+int archive_open(Archive* a, const char* path, int writable,
+		int keyframe_interval) {
+	struct stat st;
+	off_t pos;
+
+	memset(a, 0, sizeof(*a));
+	a->writable = writable;
+	a->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (a->fd == -1) return -1;
+	if (fstat(a->fd, &st) == -1) goto fail;
+
+	if (st.st_size == 0) {
+		if (!writable) {
+			errno = EINVAL;
+			goto fail;
+		}
+		ArchiveHeader* h = &a->header;
+
+		memcpy(h->magic, ARCHIVE_MAGIC, 4);
+		h->version = ARCHIVE_VERSION;
+		h->block_size = ARCHIVE_BLOCK;
+		h->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : ARCHIVE_KEYFRAME;
+		if (write(a->fd, h, sizeof(*h)) != sizeof(*h))
+			goto fail;
+		a->end = sizeof(a->header);
+		if (archive_map(a, a->end) == -1) goto fail;
+		return 0;
+	}
+
+	// entries cut off below stay mapped, but are never looked at
+	a->end = st.st_size;
+	if (archive_map(a, a->end) == -1) goto fail;
+	if (a->end < sizeof(ArchiveHeader)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	memcpy(&a->header, a->map, sizeof(a->header));
+	if (memcmp(a->header.magic, ARCHIVE_MAGIC, 4) != 0
+			|| a->header.version != ARCHIVE_VERSION
+			|| a->header.block_size == 0
+			|| a->header.keyframe_interval == 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	// walk the entry headers, a torn entry at the end (interrupted add)
+	// is ignored and will be overwritten by the next add
+	pos = sizeof(ArchiveHeader);
+	while (pos + sizeof(ArchiveEntry) <= a->end) {
+		const ArchiveEntry* e = (const ArchiveEntry*)(a->map + pos);
+
+		if (pos + sizeof(ArchiveEntry) + e->length > a->end) break;
+		add_offset(a, pos);
+		pos += sizeof(ArchiveEntry) + e->length;
+	}
+	a->end = pos;
+
+	// so are entries at the end that do not restore to their hash (written
+	// in part before a crash): back to the last one that does
+	while (a->count > 0) {
+		int size = archive_get(a, a->count - 1, a->last);
+
+		if (size != -1) {
+			a->last_size = size;
+			a->last_hash = archive_entry(a, a->count - 1)->hash;
+			break;
+		}
+		a->end = a->offsets[--a->count];
+	}
+	if (a->end < st.st_size) {
+		fprintf(stderr, "W: %s: dropped %lld damaged bytes at the end.\n",
+				path, (long long)(st.st_size - a->end));
+		if (writable && ftruncate(a->fd, a->end) == -1) goto fail;
+	}
+	return 0;
+
+fail:
+	archive_close(a);
+	return -1;
+}
+
+void archive_close(Archive* a) {
+	if (a->map != NULL) munmap(a->map, a->map_len);
+	if (a->fd != -1) close(a->fd);
+	free(a->offsets);
+	a->map = NULL;
+	a->offsets = NULL;
+	a->fd = -1;
+}
+
+const ArchiveEntry* archive_entry(Archive* a, int i) {
+	return (const ArchiveEntry*)(a->map + a->offsets[i]);
+}
+
+int archive_find(Archive* a, const char* name) {
+	int i;
+
+	for (i = a->count - 1; i >= 0; i--) {
+		if (strncmp(archive_entry(a, i)->name, name, sizeof(((ArchiveEntry*)0)->name)) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* apply the delta of length bytes at payload to image[size], -1 if the
+ * bitmap and the blocks do not add up to length */
+static int apply_delta(const Archive* a, unsigned char* image,
+		const unsigned char* payload, size_t length, size_t size) {
+	size_t block = a->header.block_size;
+	size_t nblocks = (size + block - 1) / block;
+	size_t used = (nblocks + 7) / 8;
+	size_t i;
+
+	if (used > length) return -1;
+	for (i = 0; i < nblocks; i++) {
+		size_t len = block;
+
+		if (!(payload[i / 8] & (1 << (i % 8)))) continue;
+		if (i * block + len > size) len = size - i * block;
+		if (len > length - used) return -1;
+		memcpy(image + i * block, payload + used, len);
+		used += len;
+	}
+	return used == length ? 0 : -1;
+}
+
+int archive_get(Archive* a, int i, unsigned char* image) {
+	const ArchiveEntry* e;
+	int j;
+
+	if (i < 0 || i >= a->count) return -1;
+	e = archive_entry(a, i);
+	if (e->key > i) return -1;
+
+	for (j = e->key; j <= i; j++) {
+		const ArchiveEntry* d = archive_entry(a, j);
+		const unsigned char* payload = (const unsigned char*)(d + 1);
+
+		if (d->size > DUMP_SIZE) return -1;
+		if (d->type == ENTRY_KEY) {
+			if (d->length != d->size) return -1;
+			memcpy(image, payload, d->size);
+		} else if (d->type == ENTRY_DELTA) {
+			if (apply_delta(a, image, payload, d->length, d->size) == -1) return -1;
+		}
+	}
+
+	if (hash_fnv1a(HASH_INIT, image, e->size) != e->hash) return -1;
+	return e->size;
+}
+
+int archive_add(Archive* a, const char* name,
+		const unsigned char* image, size_t size) {
+	ArchiveEntry e;
+	unsigned char payload[DUMP_SIZE + DUMP_SIZE / 8];
+	size_t block = a->header.block_size;
+	const ArchiveEntry* prev = NULL;
+
+	if (!a->writable || size > DUMP_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&e, 0, sizeof(e));
+	strncpy(e.name, name, sizeof(e.name) - 1);
+	e.hash = hash_fnv1a(HASH_INIT, image, size);
+	e.size = size;
+
+	if (a->count > 0) prev = archive_entry(a, a->count - 1);
+
+	if (prev != NULL && prev->size == size && a->last_hash == e.hash
+			&& memcmp(a->last, image, size) == 0) {
+		e.type = ENTRY_SAME;
+		e.key = prev->key;
+	} else if (prev == NULL || prev->size != size
+			|| a->count - prev->key >= a->header.keyframe_interval) {
+		e.type = ENTRY_KEY;
+		e.key = a->count;
+		e.length = size;
+		memcpy(payload, image, size);
+	} else {
+		size_t nblocks = (size + block - 1) / block;
+		size_t i;
+
+		e.type = ENTRY_DELTA;
+		e.key = prev->key;
+		e.length = (nblocks + 7) / 8;
+		memset(payload, 0, e.length);
+		for (i = 0; i < nblocks; i++) {
+			size_t len = block;
+
+			if (i * block + len > size) len = size - i * block;
+			if (memcmp(a->last + i * block, image + i * block, len) == 0) continue;
+			payload[i / 8] |= 1 << (i % 8);
+			memcpy(payload + e.length, image + i * block, len);
+			e.length += len;
+		}
+	}
+
+	// the new entry is mapped before it is counted, so archive_entry()
+	// always finds its entries in the mapping
+	if (pwrite(a->fd, &e, sizeof(e), a->end) != sizeof(e)
+			|| pwrite(a->fd, payload, e.length, a->end + sizeof(e)) != e.length
+			|| archive_map(a, a->end + sizeof(e) + e.length) == -1) {
+		int err = errno;
+
+		ftruncate(a->fd, a->end);
+		errno = err;
+		return -1;
+	}
+	add_offset(a, a->end);
+	a->end += sizeof(e) + e.length;
+
+	memcpy(a->last, image, size);
+	a->last_size = size;
+	a->last_hash = e.hash;
+	return e.type;
+}
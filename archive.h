@@ -0,0 +1,87 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_ARCHIVE_H_
+#define _INCLUDE_ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dump.h"
+
+/* Delta compressed archive of eeprom images.
+ *
+ * The file starts with an ArchiveHeader, followed by ArchiveEntry records,
+ * each followed by entry.length bytes of payload:
+ *
+ *  ENTRY_KEY    the complete image
+ *  ENTRY_DELTA  a bitmap of the blocks that differ from the previous image,
+ *               followed by the contents of those blocks
+ *  ENTRY_SAME   no payload, the image is identical to the previous one
+ *
+ * Every keyframe_interval entries a keyframe is written, so restoring any
+ * image applies at most keyframe_interval-1 deltas.
+ */
+
+#define ARCHIVE_MAGIC "TFAA"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK 64        /* eeprom page size */
+#define ARCHIVE_KEYFRAME 48     /* one keyframe per day of half hourly dumps */
+
+#define ENTRY_KEY   0
+#define ENTRY_DELTA 1
+#define ENTRY_SAME  2
+
+typedef struct _ArchiveHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t block_size;
+	uint16_t keyframe_interval;
+	uint8_t reserved[6];
+} ArchiveHeader;
+
+typedef struct _ArchiveEntry {
+	char name[40];          /* file name of the dump, NUL terminated */
+	uint64_t hash;          /* hash_fnv1a() of the image */
+	uint32_t size;          /* image size */
+	uint32_t length;        /* payload bytes following the entry */
+	uint32_t key;           /* entry number of the keyframe this depends on */
+	uint8_t type;           /* ENTRY_* */
+	uint8_t reserved[3];
+} ArchiveEntry;
+
+typedef struct _Archive {
+	int fd;
+	int writable;
+	ArchiveHeader header;
+	unsigned char* map;
+	size_t map_len;
+	size_t end;             /* file size */
+	off_t* offsets;         /* offset of each ArchiveEntry */
+	int count;
+	unsigned char last[DUMP_SIZE];  /* image of the last entry */
+	size_t last_size;
+	uint64_t last_hash;
+} Archive;
+
+/* open an archive, creating it if writable and it does not exist yet. a new
+ * archive uses keyframe_interval (0 for ARCHIVE_KEYFRAME). returns -1 and
+ * sets errno on failure. */
+extern int archive_open(Archive* a, const char* path, int writable,
+		int keyframe_interval);
+extern void archive_close(Archive* a);
+
+/* entry i of the archive, pointing into the mapping. archive_open() and
+ * archive_add() map every entry they count, so this cannot fail. */
+extern const ArchiveEntry* archive_entry(Archive* a, int i);
+
+/* index of the last entry named name, -1 if there is none */
+extern int archive_find(Archive* a, const char* name);
+
+/* restore image i into image[DUMP_SIZE]. returns its size, or -1 if the
+ * archive is damaged. */
+extern int archive_get(Archive* a, int i, unsigned char* image);
+
+/* append an image. returns the entry type written, -1 on error. */
+extern int archive_add(Archive* a, const char* name,
+		const unsigned char* image, size_t size);
+
+#endif /* _INCLUDE_ARCHIVE_H_ */
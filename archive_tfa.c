@@ -0,0 +1,188 @@
+/* vim:set expandtab! ts=4: */
+
+/* archive_tfa - keep tfa.dump.* images in a delta compressed archive, see
+ * archive.h for the format. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include "archive.h"
+
+static const char* type_names[] = { "key", "delta", "same" };
+
+static void print_usage() {
+	fprintf(stderr, "Usage: archive_tfa [-k keyframe_interval] add <archive> <dumpdir|tfa.dump.filename>...\n");
+	fprintf(stderr, "       archive_tfa list <archive>\n");
+	fprintf(stderr, "       archive_tfa extract <archive> <outdir> [name...]\n");
+	fprintf(stderr, "       archive_tfa cat <archive> <name>\n");
+	exit(EXIT_FAILURE);
+}
+
+static void open_archive(Archive* a, const char* path, int writable, int keyframe) {
+	if (archive_open(a, path, writable, keyframe) == -1) {
+		fprintf(stderr, "E: can't open archive %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static const char* basename_of(const char* path) {
+	const char* p = strrchr(path, '/');
+	return p ? p + 1 : path;
+}
+
+static int cmd_add(Archive* a, char** files, int nfiles) {
+	unsigned char image[DUMP_SIZE];
+	char last[sizeof(((ArchiveEntry*)0)->name)] = "";
+	size_t added = 0, stored = 0;
+	int i, failed = 0;
+
+	if (a->count > 0) strcpy(last, archive_entry(a, a->count - 1)->name);
+
+	for (i = 0; i < nfiles; i++) {
+		const char* name = basename_of(files[i]);
+		FILE* f;
+		size_t len;
+		size_t end = a->end;
+
+		// the archive is in time order, which is name order for dumps
+		if (strcmp(name, last) <= 0) {
+			fprintf(stderr, "I: %s is not newer than %s, skipping.\n", name, last);
+			continue;
+		}
+
+		f = fopen(files[i], "r");
+		if (f == NULL) {
+			fprintf(stderr, "E: cannot open file %s\n", files[i]);
+			failed++;
+			continue;
+		}
+		len = fread(image, 1, DUMP_SIZE, f);
+		fclose(f);
+
+		if (archive_add(a, name, image, len) == -1) {
+			fprintf(stderr, "E: can't add %s: %s\n", files[i], strerror(errno));
+			return 1;
+		}
+		strcpy(last, archive_entry(a, a->count - 1)->name);
+		added += len;
+		stored += a->end - end;
+	}
+
+	fprintf(stderr, "Added %lu bytes of dumps as %lu bytes.\n",
+		(unsigned long)added, (unsigned long)stored);
+	return failed ? 1 : 0;
+}
+
+static int cmd_list(Archive* a) {
+	int i;
+
+	for (i = 0; i < a->count; i++) {
+		const ArchiveEntry* e = archive_entry(a, i);
+
+		printf("%5d %-5s %6u %016llx %s\n", i, type_names[e->type % 3],
+			e->length, (unsigned long long)e->hash, e->name);
+	}
+	return 0;
+}
+
+static int write_image(Archive* a, int i, const char* dir) {
+	unsigned char image[DUMP_SIZE];
+	const ArchiveEntry* e = archive_entry(a, i);
+	char path[1024];
+	FILE* f;
+	int len;
+
+	len = archive_get(a, i, image);
+	if (len == -1) {
+		fprintf(stderr, "E: entry %d (%s) is damaged.\n", i, e->name);
+		return -1;
+	}
+
+	if (dir == NULL) {
+		return fwrite(image, len, 1, stdout) == 1 ? 0 : -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+	f = fopen(path, "w");
+	if (f == NULL || fwrite(image, len, 1, f) != 1) {
+		fprintf(stderr, "E: can't write %s\n", path);
+		if (f != NULL) fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int cmd_extract(Archive* a, const char* dir, char** names, int nnames) {
+	int i, failed = 0;
+
+	if (nnames == 0) {
+		for (i = 0; i < a->count; i++) {
+			if (write_image(a, i, dir) == -1) failed++;
+		}
+		return failed ? 1 : 0;
+	}
+
+	for (i = 0; i < nnames; i++) {
+		int n = archive_find(a, basename_of(names[i]));
+
+		if (n == -1) {
+			fprintf(stderr, "E: %s is not in the archive.\n", names[i]);
+			failed++;
+			continue;
+		}
+		if (write_image(a, n, dir) == -1) failed++;
+	}
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	Archive a;
+	const char* cmd;
+	int keyframe = 0;
+	int c, rc;
+
+	while ((c = getopt(argc, argv, "k:")) != -1) {
+		switch (c) {
+		case 'k':
+			keyframe = atoi(optarg);
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind < 2) print_usage();
+	cmd = argv[optind];
+
+	if (strcmp(cmd, "add") == 0) {
+		char** files = NULL;
+		int nfiles = 0;
+		int i;
+
+		for (i = optind + 2; i < argc; i++) {
+			if (dump_scan(argv[i], &files, &nfiles) == -1) {
+				perror(argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		open_archive(&a, argv[optind+1], 1, keyframe);
+		rc = cmd_add(&a, files, nfiles);
+	} else if (strcmp(cmd, "list") == 0) {
+		open_archive(&a, argv[optind+1], 0, 0);
+		rc = cmd_list(&a);
+	} else if (strcmp(cmd, "extract") == 0 && argc - optind >= 3) {
+		open_archive(&a, argv[optind+1], 0, 0);
+		rc = cmd_extract(&a, argv[optind+2], argv + optind + 3, argc - optind - 3);
+	} else if (strcmp(cmd, "cat") == 0 && argc - optind == 3) {
+		open_archive(&a, argv[optind+1], 0, 0);
+		rc = cmd_extract(&a, NULL, argv + optind + 2, 1);
+	} else {
+		print_usage();
+		return 1;
+	}
+
+	archive_close(&a);
+	return rc;
+}
@@ -0,0 +1,236 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "record.h"
+#include "dump.h"
+#include "hash.h"
+#include "batch.h"
+
+#define EMPTY_SLOT INT64_MIN
+
+/* records are compared without their flags: the spike check depends on
+ * the record before, which differs between dumps. the flags of duplicates
+ * are merged. */
+#define RECORD_KEY offsetof(RecordBin, flags)
+
+typedef struct _RecordSet {
+	RecordBin* slots;
+	size_t size;        /* power of two */
+	size_t used;
+} RecordSet;
+
+typedef struct _Work {
+	char** files;
+	int nfiles;
+	atomic_int next_file;
+} Work;
+
+typedef struct _Worker {
+	pthread_t thread;
+	Work* work;
+	RecordSet set;
+	int sensors;
+	int failed;
+} Worker;
+
+static void set_init(RecordSet* s, size_t size) {
+	size_t i;
+
+	s->slots = malloc(size * sizeof(RecordBin));
+	if (s->slots == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < size; i++) s->slots[i].time = EMPTY_SLOT;
+	s->size = size;
+	s->used = 0;
+}
+
+static void set_insert(RecordSet* s, const RecordBin* b);
+
+static void set_grow(RecordSet* s) {
+	RecordSet bigger;
+	size_t i;
+
+	set_init(&bigger, s->size * 2);
+	for (i = 0; i < s->size; i++) {
+		if (s->slots[i].time != EMPTY_SLOT) set_insert(&bigger, &s->slots[i]);
+	}
+	free(s->slots);
+	*s = bigger;
+}
+
+/* records are equal if timestamp and payload are; the slot index is zeroed
+ * by the caller since it differs between dumps */
+static void set_insert(RecordSet* s, const RecordBin* b) {
+	size_t i;
+
+	if (2 * (s->used + 1) > s->size) set_grow(s);
+
+	i = hash_fnv1a(HASH_INIT, b, RECORD_KEY) & (s->size - 1);
+	while (s->slots[i].time != EMPTY_SLOT) {
+		if (memcmp(&s->slots[i], b, RECORD_KEY) == 0) {
+			s->slots[i].flags |= b->flags;
+			return;
+		}
+		i = (i + 1) & (s->size - 1);
+	}
+	s->slots[i] = *b;
+	s->used++;
+}
+
+static int decode_file(Worker* w, const char* filename, RecordBin* buf, TimeCache* tc) {
+	struct stat st;
+	unsigned char* data;
+	DumpHeader h;
+	int fd;
+	int i, n;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror(filename);
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror(filename);
+		return -1;
+	}
+
+	if (dump_header(data, st.st_size, &h) == -1) {
+		fprintf(stderr, "W: %s: don't understand the data, skipping.\n", filename);
+		munmap(data, st.st_size);
+		return -1;
+	}
+
+	n = dump_decode(data, st.st_size, &h, buf, tc);
+	munmap(data, st.st_size);
+
+	for (i = 0; i < n; i++) {
+		buf[i].index = 0;
+		set_insert(&w->set, &buf[i]);
+	}
+	if (h.sensors > w->sensors) w->sensors = h.sensors;
+	return 0;
+}
+
+static void* worker_main(void* arg) {
+	Worker* w = arg;
+	RecordBin* buf;
+	TimeCache tc;
+	int i;
+
+	// enough for the smallest record length
+	buf = malloc((DUMP_SIZE / 10) * sizeof(RecordBin));
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	timecache_init(&tc);
+
+	while ((i = atomic_fetch_add(&w->work->next_file, 1)) < w->work->nfiles) {
+		if (decode_file(w, w->work->files[i], buf, &tc) == -1) w->failed++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int compare_records(const void* a, const void* b) {
+	const RecordBin* ra = a;
+	const RecordBin* rb = b;
+
+	if (ra->time != rb->time) return ra->time < rb->time ? -1 : 1;
+	return memcmp(ra, rb, RECORD_KEY);
+}
+
+int batch_decode(char** files, int nfiles, int threads, Batch* b) {
+	Worker* workers;
+	Work work;
+	RecordBin* all;
+	size_t total, n, i;
+	int t;
+
+	memset(b, 0, sizeof(*b));
+	if (threads > nfiles) threads = nfiles;
+	if (threads < 1) threads = 1;
+
+	work.files = files;
+	work.nfiles = nfiles;
+	atomic_init(&work.next_file, 0);
+
+	workers = calloc(threads, sizeof(Worker));
+	if (workers == NULL) return -1;
+	for (t = 0; t < threads; t++) {
+		workers[t].work = &work;
+		set_init(&workers[t].set, 4096);
+		if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	total = 0;
+	for (t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		total += workers[t].set.used;
+		b->failed += workers[t].failed;
+		if (workers[t].sensors > b->sensors) b->sensors = workers[t].sensors;
+	}
+
+	// merge the per thread sets, duplicates across threads are next to
+	// each other after sorting
+	all = malloc((total + 1) * sizeof(RecordBin));
+	if (all == NULL) {
+		for (t = 0; t < threads; t++) free(workers[t].set.slots);
+		free(workers);
+		errno = ENOMEM;
+		return -1;
+	}
+	n = 0;
+	for (t = 0; t < threads; t++) {
+		for (i = 0; i < workers[t].set.size; i++) {
+			if (workers[t].set.slots[i].time != EMPTY_SLOT)
+				all[n++] = workers[t].set.slots[i];
+		}
+		free(workers[t].set.slots);
+	}
+	free(workers);
+	qsort(all, n, sizeof(RecordBin), compare_records);
+
+	total = 0;
+	for (i = 0; i < n; i++) {
+		if (total > 0 && memcmp(&all[total-1], &all[i], RECORD_KEY) == 0) {
+			all[total-1].flags |= all[i].flags;
+			continue;
+		}
+		all[total++] = all[i];
+	}
+	for (i = 0; i < total; i++) all[i].index = i;
+
+	b->records = all;
+	b->count = total;
+	return 0;
+}
+
+void batch_free(Batch* b) {
+	free(b->records);
+	b->records = NULL;
+	b->count = 0;
+}
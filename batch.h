@@ -0,0 +1,30 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_BATCH_H_
+#define _INCLUDE_BATCH_H_
+
+#include <stddef.h>
+#include "output.h"
+
+/* Decoding of many dumps into one time ordered series.
+ *
+ * Consecutive dumps share almost all of their records, so every worker
+ * thread keeps a hash set of the records it has seen and only the (few)
+ * distinct records are merged and sorted at the end.
+ */
+
+typedef struct _Batch {
+	RecordBin* records;     /* malloc'ed, time ordered, index = position */
+	size_t count;
+	int sensors;            /* most sensors of any dump, 0 if none */
+	int failed;             /* dumps that could not be decoded */
+} Batch;
+
+/* decode files[0..nfiles-1] with up to threads threads into b. records
+ * with equal time and readings are merged, ORing their flags. returns -1
+ * (with errno set) if memory runs out. */
+extern int batch_decode(char** files, int nfiles, int threads, Batch* b);
+
+extern void batch_free(Batch* b);
+
+#endif /* _INCLUDE_BATCH_H_ */
@@ -0,0 +1,86 @@
+/* vim:set expandtab! ts=4: */
+
+/* batch_tfa - decode a whole archive of tfa.dump.* files into one time
+ * ordered series.
+ *
+ * The decoding itself is in batch.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "record.h"
+#include "output.h"
+#include "dump.h"
+#include "batch.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: batch_tfa [-j threads] [--format=text|csv|ndjson|bin] <dumpdir|tfa.dump.filename>...\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	char** files = NULL;
+	int nfiles = 0;
+	Batch b;
+	size_t i;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int format = FORMAT_TEXT;
+	int sensors;
+	int c;
+
+	static const struct option options[] = {
+		{ "format", required_argument, NULL, 'f' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "f:j:", options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			format = output_format(optarg);
+			if (format < 0) {
+				fprintf(stderr, "E: unknown output format %s\n", optarg);
+				print_usage();
+			}
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (optind >= argc) print_usage();
+	if (threads < 1) threads = 1;
+
+	for (; optind < argc; optind++) {
+		if (dump_scan(argv[optind], &files, &nfiles) == -1) {
+			perror(argv[optind]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (threads > nfiles) threads = nfiles > 0 ? nfiles : 1;
+	fprintf(stderr, "Decoding %d dumps using %d threads.\n", nfiles, threads);
+
+	if (batch_decode(files, nfiles, threads, &b) == -1) {
+		fprintf(stderr, "E: can't merge the records: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "Merged %lu distinct records.\n", (unsigned long)b.count);
+
+	sensors = b.sensors > 0 ? b.sensors : RECORD_SENSORS;
+	output_header(stdout, format, sensors);
+	for (i = 0; i < b.count; i++) {
+		output_record_bin(stdout, format, &b.records[i], sensors);
+	}
+
+	if (b.failed > 0) {
+		fprintf(stderr, "W: %d dumps could not be decoded.\n", b.failed);
+		return 1;
+	}
+	return(0);
+}
@@ -0,0 +1,246 @@
+/* vim:set expandtab! ts=4: */
+
+/* bench_tfa - throughput of the decoding path on synthetic eeprom images
+ * (see synth.h), for every sensor count: parsing (dump_decode(), which
+ * includes the timestamps and plausibility checks) and formatting (each
+ * output format) are timed separately.
+ *
+ * With -o, the images are written to a directory instead, for
+ * compare_tfa.py to check decode_tfa against decode_tfa.py. Each comes
+ * with damaged copies: a few bytes overwritten (.bytes), a few bits
+ * flipped (.bits) and cut short (.cut), half of the damage in the header.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include "record.h"
+#include "output.h"
+#include "dump.h"
+#include "synth.h"
+#include "util.h"
+
+#define IMAGES 32
+#define FORMATS 4
+#define MUTATIONS 8             /* most bytes or bits changed per copy */
+
+typedef struct _Image {
+	unsigned char data[SYNTH_IMAGE_SIZE];
+	DumpHeader h;
+	int records;
+} Image;
+
+static const char* format_names[FORMATS] = { "text", "csv", "ndjson", "bin" };
+
+static void print_usage() {
+	fprintf(stderr, "Usage: bench_tfa [-n images] [-t seconds] [-s sensors] [-r seed]\n");
+	fprintf(stderr, "       bench_tfa -o <dir> [-n images] [-s sensors] [-r seed]\n");
+	exit(EXIT_FAILURE);
+}
+
+/* a mix of partly filled, just full and wrapped around logs, with gaps */
+static void make_images(Image* images, int n, int sensors, unsigned int* seed) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		SynthOptions o;
+		DumpHeader h;
+
+		memset(&o, 0, sizeof(o));
+		o.sensors = sensors;
+		o.interval = rand_r(seed) % 13;
+		o.gap_percent = rand_r(seed) % 4;
+		o.partial_percent = 25;
+		o.start = 1199142000 + rand_r(seed) % (10 * 365 * 86400);
+
+		// the slot count only depends on the sensor count
+		synth_image(images[i].data, &o, seed);
+		dump_header(images[i].data, SYNTH_IMAGE_SIZE, &h);
+		switch (i % 4) {
+		case 0: o.records = 1 + rand_r(seed) % (h.records - 1); break;
+		case 1: o.records = h.records - 1; break;
+		default: o.records = h.records + rand_r(seed) % (4 * h.records); break;
+		}
+		images[i].records = synth_image(images[i].data, &o, seed);
+		images[i].h = h;
+	}
+}
+
+/* an offset to damage, in the header half of the time */
+static int damage_offset(unsigned int* seed) {
+	if (rand_r(seed) % 2) return rand_r(seed) % DUMP_DATA_OFFSET;
+	return rand_r(seed) % SYNTH_IMAGE_SIZE;
+}
+
+/* a damaged copy of image in out: kind 0 overwrites bytes, 1 flips bits,
+ * 2 cuts it short. returns its length. */
+static size_t mutate(const unsigned char* image, unsigned char* out, int kind,
+		unsigned int* seed) {
+	int i, n = 1 + rand_r(seed) % MUTATIONS;
+
+	memcpy(out, image, SYNTH_IMAGE_SIZE);
+	switch (kind) {
+	case 0:
+		for (i = 0; i < n; i++) out[damage_offset(seed)] = rand_r(seed);
+		break;
+	case 1:
+		for (i = 0; i < n; i++) out[damage_offset(seed)] ^= 1 << (rand_r(seed) % 8);
+		break;
+	default:
+		return rand_r(seed) % SYNTH_IMAGE_SIZE;
+	}
+	return SYNTH_IMAGE_SIZE;
+}
+
+static int write_file(const char* path, const unsigned char* data, size_t len) {
+	FILE* f = fopen(path, "w");
+
+	if (f == NULL || (len > 0 && fwrite(data, len, 1, f) != 1)) {
+		perror(path);
+		if (f != NULL) fclose(f);
+		return -1;
+	}
+	return fclose(f);
+}
+
+static int write_images(const char* dir, Image* images, int n, int sensors,
+		unsigned int* seed) {
+	static const char* kinds[] = { "bytes", "bits", "cut" };
+	unsigned char damaged[SYNTH_IMAGE_SIZE];
+	char path[4096];
+	int i, k;
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s/synth.%d.%04d", dir, sensors, i);
+		if (write_file(path, images[i].data, SYNTH_IMAGE_SIZE) == -1) return -1;
+
+		for (k = 0; k < 3; k++) {
+			size_t len = mutate(images[i].data, damaged, k, seed);
+
+			snprintf(path, sizeof(path), "%s/synth.%d.%04d.%s", dir, sensors, i, kinds[k]);
+			if (write_file(path, damaged, len) == -1) return -1;
+		}
+	}
+	return 0;
+}
+
+static void print_rate(const char* what, double records, double bytes, double t) {
+	printf("  %-8s %10.2f Mrec/s %10.1f MB/s\n", what, records / t / 1e6, bytes / t / 1e6);
+}
+
+static void bench(Image* images, int n, int sensors, double seconds) {
+	RecordBin* out = malloc(n * (DUMP_SIZE / 10) * sizeof(RecordBin));
+	int* decoded = malloc(n * sizeof(int));
+	size_t buf_len = 64 << 20;
+	char* buf = malloc(buf_len);
+	double records, bytes, start, t;
+	TimeCache tc;
+	int i, j, f;
+
+	if (out == NULL || decoded == NULL || buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	timecache_init(&tc);
+
+	printf("%d sensors, %d slots of %d bytes:\n", sensors, images[0].h.records,
+			images[0].h.record_len);
+
+	// parse: record slots of the images in, RecordBin out
+	records = bytes = 0;
+	start = util_now();
+	do {
+		for (i = 0; i < n; i++) {
+			decoded[i] = dump_decode(images[i].data, SYNTH_IMAGE_SIZE, &images[i].h,
+					out + i * (DUMP_SIZE / 10), &tc);
+			records += decoded[i];
+			bytes += images[i].h.records * images[i].h.record_len;
+		}
+		t = util_now() - start;
+	} while (t < seconds);
+	print_rate("parse", records, bytes, t);
+
+	// format: RecordBin in, output bytes out
+	for (f = 0; f < FORMATS; f++) {
+		FILE* mem = fmemopen(buf, buf_len, "w");
+
+		if (mem == NULL) {
+			perror("fmemopen");
+			exit(EXIT_FAILURE);
+		}
+		records = bytes = 0;
+		start = util_now();
+		do {
+			for (i = 0; i < n; i++) {
+				rewind(mem);
+				for (j = 0; j < decoded[i]; j++) {
+					output_record_bin(mem, f, out + i * (DUMP_SIZE / 10) + j, sensors);
+				}
+				records += decoded[i];
+				bytes += ftell(mem);
+			}
+			t = util_now() - start;
+		} while (t < seconds);
+		fclose(mem);
+		print_rate(format_names[f], records, bytes, t);
+	}
+
+	free(out);
+	free(decoded);
+	free(buf);
+}
+
+int main(int argc, char *argv[]) {
+	Image* images;
+	const char* dir = NULL;
+	unsigned int seed = time(NULL);
+	double seconds = 0.5;
+	int n = IMAGES;
+	int first = 1, last = RECORD_SENSORS;
+	int c, sensors;
+
+	while ((c = getopt(argc, argv, "n:t:s:r:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 's':
+			first = last = atoi(optarg);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (optind != argc || n < 1 || first < 1 || last > RECORD_SENSORS) print_usage();
+
+	images = malloc(n * sizeof(Image));
+	if (images == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "Seed %u.\n", seed);
+
+	for (sensors = first; sensors <= last; sensors++) {
+		make_images(images, n, sensors, &seed);
+		if (dir != NULL) {
+			if (write_images(dir, images, n, sensors, &seed) == -1) exit(EXIT_FAILURE);
+		} else {
+			bench(images, n, sensors, seconds);
+		}
+	}
+
+	free(images);
+	return 0;
+}
@@ -0,0 +1,379 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "catalog.h"
+#include "validate.h"
+#include "hash.h"
+
+static int catalog_map(Catalog* c) {
+	if (c->map != NULL) munmap(c->map, c->map_len);
+	c->map = NULL;
+	c->map_len = c->end;
+	if (c->map_len == 0) return 0;
+
+	c->map = mmap(NULL, c->map_len, PROT_READ, MAP_SHARED, c->fd, 0);
+	if (c->map == MAP_FAILED) {
+		c->map = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void add_offset(Catalog* c, off_t offset) {
+	c->offsets = realloc(c->offsets, (c->count + 1) * sizeof(off_t));
+	if (c->offsets == NULL) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	c->offsets[c->count++] = offset;
+}
+
+int catalog_open(Catalog* c, const char* path, int writable) {
+	struct stat st;
+	off_t pos;
+
+	memset(c, 0, sizeof(*c));
+	c->writable = writable;
+	c->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (c->fd == -1) return -1;
+	if (fstat(c->fd, &st) == -1) goto fail;
+
+	if (st.st_size == 0) {
+		if (!writable) {
+			errno = EINVAL;
+			goto fail;
+		}
+		CatalogHeader* h = &c->header;
+
+		memcpy(h->magic, CATALOG_MAGIC, 4);
+		h->version = CATALOG_VERSION;
+		h->stride = CATALOG_STRIDE;
+		if (write(c->fd, h, sizeof(*h)) != sizeof(*h))
+			goto fail;
+		c->end = sizeof(c->header);
+		return catalog_map(c);
+	}
+
+	c->end = st.st_size;
+	if (catalog_map(c) == -1) goto fail;
+	if (c->end < sizeof(CatalogHeader)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	memcpy(&c->header, c->map, sizeof(c->header));
+	if (memcmp(c->header.magic, CATALOG_MAGIC, 4) != 0
+			|| c->header.version != CATALOG_VERSION
+			|| c->header.stride == 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	// a torn entry at the end (interrupted add) is ignored and will be
+	// overwritten by the next add
+	pos = sizeof(CatalogHeader);
+	while (pos + sizeof(CatalogEntry) <= c->end) {
+		const CatalogEntry* e = (const CatalogEntry*)(c->map + pos);
+		size_t len = sizeof(CatalogEntry) + e->times * sizeof(int64_t);
+
+		if (pos + len > c->end) break;
+		add_offset(c, pos);
+		pos += len;
+	}
+	c->end = pos;
+	if (writable && c->end < st.st_size && ftruncate(c->fd, c->end) == -1)
+		goto fail;
+	return 0;
+
+fail:
+	{
+		int err = errno;
+		catalog_close(c);
+		errno = err;
+	}
+	return -1;
+}
+
+void catalog_close(Catalog* c) {
+	if (c->map != NULL) munmap(c->map, c->map_len);
+	if (c->fd != -1) close(c->fd);
+	free(c->offsets);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+}
+
+const CatalogEntry* catalog_entry(const Catalog* c, int i) {
+	return (const CatalogEntry*)(c->map + c->offsets[i]);
+}
+
+const int64_t* catalog_times(const Catalog* c, int i) {
+	return (const int64_t*)(c->map + c->offsets[i] + sizeof(CatalogEntry));
+}
+
+int catalog_add(Catalog* c, const CatalogEntry* e, const int64_t* times) {
+	size_t len = e->times * sizeof(int64_t);
+
+	if (pwrite(c->fd, e, sizeof(*e), c->end) != sizeof(*e)
+			|| pwrite(c->fd, times, len, c->end + sizeof(*e)) != len) {
+		if (errno == 0) errno = EIO;
+		return -1;
+	}
+	add_offset(c, c->end);
+	c->end += sizeof(*e) + len;
+	return catalog_map(c);
+}
+
+int catalog_index(const unsigned char* data, size_t len,
+		const char* name, CatalogEntry* e, int64_t* times) {
+	RecordBin* all;
+	RecordBin* ord;
+	DumpHeader h;
+	TimeCache tc;
+	size_t count, k;
+	int n;
+
+	if (dump_header(data, len, &h) == -1) return -1;
+
+	all = malloc(h.records * sizeof(RecordBin));
+	ord = malloc(h.records * sizeof(RecordBin));
+	if (all == NULL || ord == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	timecache_init(&tc);
+	n = dump_decode(data, len, &h, all, &tc);
+	count = dump_order(all, n, &h, ord);
+
+	memset(e, 0, sizeof(*e));
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->hash = hash_fnv1a(HASH_INIT, data, len);
+	e->size = len;
+	e->sensors = h.sensors;
+	e->record_len = h.record_len;
+	e->interval = h.interval;
+	e->records = count;
+	e->wrap = DUMP_DATA_OFFSET;
+
+	if (count > 0) {
+		int slot;
+
+		// the records from before the wrap around come first, the newer
+		// ones start again at slot 0
+		if (ord[0].index != 0) {
+			for (e->older = 1; e->older < count && ord[e->older].index > ord[0].index; e->older++);
+			e->wrap = dump_slot(&h, ord[0].index);
+		}
+		// the interim EOF follows the newest record, wrapped or not
+		slot = ord[count - 1].index + 1;
+		if (slot >= h.records) slot = 0;
+		e->eof = dump_slot(&h, slot);
+
+		e->first = e->last = ord[0].time;
+		for (k = 0; k < count; k++) {
+			if (ord[k].time < e->first) e->first = ord[k].time;
+			if (ord[k].time > e->last) e->last = ord[k].time;
+			if (k % CATALOG_STRIDE == 0) times[e->times++] = ord[k].time;
+		}
+	} else {
+		e->eof = DUMP_DATA_OFFSET;
+	}
+
+	free(all);
+	free(ord);
+	return 0;
+}
+
+static const char* basename_of(const char* path) {
+	const char* p = strrchr(path, '/');
+	return p ? p + 1 : path;
+}
+
+/* write the sidecar of a dump, through a temporary file so a reader never
+ * sees half of it */
+static int write_sidecar(const char* sidecar, const CatalogEntry* e,
+		const int64_t* times) {
+	char tmp[PATH_MAX + 8];
+	Catalog c;
+	int err;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", sidecar);
+	unlink(tmp);
+	if (catalog_open(&c, tmp, 1) == -1) return -1;
+	if (catalog_add(&c, e, times) == -1 || fsync(c.fd) == -1) {
+		err = errno;
+		catalog_close(&c);
+		unlink(tmp);
+		errno = err;
+		return -1;
+	}
+	catalog_close(&c);
+	return rename(tmp, sidecar);
+}
+
+int catalog_index_file(const char* path, CatalogEntry* e, int64_t* times) {
+	unsigned char data[DUMP_SIZE];
+	char sidecar[PATH_MAX];
+	struct stat st;
+	Catalog c;
+	FILE* f;
+	size_t len;
+
+	if (stat(path, &st) == -1) return -1;
+	snprintf(sidecar, sizeof(sidecar), "%s%s", path, CATALOG_SUFFIX);
+
+	if (catalog_open(&c, sidecar, 0) == 0) {
+		const CatalogEntry* s = c.count == 1 ? catalog_entry(&c, 0) : NULL;
+
+		if (s != NULL && s->size == st.st_size && s->mtime == st.st_mtime
+				&& c.header.stride == CATALOG_STRIDE && s->times <= CATALOG_MAX_TIMES) {
+			*e = *s;
+			memcpy(times, catalog_times(&c, 0), s->times * sizeof(int64_t));
+			catalog_close(&c);
+			return 0;
+		}
+		catalog_close(&c);
+	}
+
+	f = fopen(path, "r");
+	if (f == NULL) return -1;
+	len = fread(data, 1, DUMP_SIZE, f);
+	fclose(f);
+	if (catalog_index(data, len, basename_of(path), e, times) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	e->mtime = st.st_mtime;
+
+	if (write_sidecar(sidecar, e, times) == -1)
+		fprintf(stderr, "W: can't write %s: %s\n", sidecar, strerror(errno));
+	return 0;
+}
+
+static int add_range(CatalogRange** ranges, int* n, int* size, int entry,
+		int64_t from, int64_t to, uint32_t offset, uint32_t length) {
+	CatalogRange* r;
+
+	if (*n == *size) {
+		*size = *size ? 2 * *size : 16;
+		r = realloc(*ranges, *size * sizeof(CatalogRange));
+		if (r == NULL) return -1;
+		*ranges = r;
+	}
+	r = &(*ranges)[(*n)++];
+	r->entry = entry;
+	r->from = from;
+	r->to = to;
+	r->offset = offset;
+	r->length = length;
+	return 0;
+}
+
+/* the bytes of entry i holding its records with from <= time < to: one
+ * range, or two if they wrap around the end of the log */
+static int add_ranges(const Catalog* c, int i, int64_t from, int64_t to,
+		CatalogRange** ranges, int* n, int* size) {
+	const CatalogEntry* e = catalog_entry(c, i);
+	const int64_t* times = catalog_times(c, i);
+	int stride = c->header.stride;
+	int j, k0, k1;
+
+	for (j = 0; j + 1 < e->times && times[j + 1] <= from; j++);
+	k0 = j * stride;
+	for (j = 0; j < e->times && times[j] < to; j++);
+	k1 = j < e->times ? j * stride : e->records;
+
+	if (k0 < e->older) {
+		int end = k1 < e->older ? k1 : e->older;
+		if (add_range(ranges, n, size, i, from, to, e->wrap + k0 * e->record_len,
+				(end - k0) * e->record_len) == -1)
+			return -1;
+	}
+	if (k1 > e->older) {
+		int start = k0 > e->older ? k0 : e->older;
+		if (add_range(ranges, n, size, i, from, to,
+				DUMP_DATA_OFFSET + (start - e->older) * e->record_len,
+				(k1 - start) * e->record_len) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static const Catalog* sort_catalog;
+
+static int compare_first(const void* a, const void* b) {
+	int64_t fa = catalog_entry(sort_catalog, *(const int*)a)->first;
+	int64_t fb = catalog_entry(sort_catalog, *(const int*)b)->first;
+
+	return fa < fb ? -1 : fa > fb;
+}
+
+int catalog_query(const Catalog* c, int64_t from, int64_t to,
+		int all, CatalogRange** ranges) {
+	int* order;
+	int n = 0, size = 0, count = 0;
+	int i, best = -1;
+	int64_t cur = from;
+
+	*ranges = NULL;
+	if (all) {
+		for (i = 0; i < c->count; i++) {
+			const CatalogEntry* e = catalog_entry(c, i);
+
+			if (e->records == 0 || e->first >= to || e->last < from) continue;
+			if (add_ranges(c, i, e->first > from ? e->first : from,
+					e->last < to ? e->last + 1 : to, ranges, &n, &size) == -1)
+				goto fail;
+		}
+		return n;
+	}
+
+	order = malloc((c->count + 1) * sizeof(int));
+	if (order == NULL) goto fail;
+	for (i = 0; i < c->count; i++) {
+		if (catalog_entry(c, i)->records > 0) order[count++] = i;
+	}
+	sort_catalog = c;
+	qsort(order, count, sizeof(int), compare_first);
+
+	// greedy cover: of the dumps starting before the uncovered part, the
+	// one reaching furthest. dumps on the same records (half hourly ones
+	// share most of them) are touched once.
+	i = 0;
+	while (cur < to) {
+		const CatalogEntry* e;
+		int64_t end;
+
+		for (; i < count && catalog_entry(c, order[i])->first <= cur; i++) {
+			if (best == -1 || catalog_entry(c, order[i])->last > catalog_entry(c, best)->last)
+				best = order[i];
+		}
+		if (best == -1 || catalog_entry(c, best)->last < cur) {
+			// a gap no dump covers
+			if (i == count) break;
+			cur = catalog_entry(c, order[i])->first;
+			continue;
+		}
+
+		e = catalog_entry(c, best);
+		end = e->last < to ? e->last + 1 : to;
+		if (add_ranges(c, best, cur, end, ranges, &n, &size) == -1) {
+			free(order);
+			goto fail;
+		}
+		cur = end;
+	}
+	free(order);
+	return n;
+
+fail:
+	free(*ranges);
+	*ranges = NULL;
+	return -1;
+}
@@ -0,0 +1,109 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_CATALOG_H_
+#define _INCLUDE_CATALOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dump.h"
+
+/* Catalog of a dump directory: what time range each dump covers, and
+ * where its records are, without decoding it again.
+ *
+ * The file starts with a CatalogHeader, followed by CatalogEntry records,
+ * each followed by entry.times timestamps: those of every
+ * header.stride-th record of the dump, in time order. New dumps are
+ * appended. Every dump also gets a sidecar, tfa.dump.*.cat next to it,
+ * in the same format with just its own entry, so a dump is indexed only
+ * once, wherever its entry goes.
+ *
+ * In time order the records of a dump are the entry.older ones from
+ * entry.wrap on, then the rest from DUMP_DATA_OFFSET on, record_len bytes
+ * each.
+ */
+
+#define CATALOG_MAGIC "TFAC"
+#define CATALOG_VERSION 1
+#define CATALOG_STRIDE 32       /* records per timestamp of the time index */
+#define CATALOG_SUFFIX ".cat"
+
+/* timestamps of a dump with the most records, 10 bytes each */
+#define CATALOG_MAX_TIMES ((DUMP_SIZE - DUMP_DATA_OFFSET) / 10 / CATALOG_STRIDE + 1)
+
+typedef struct _CatalogHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t stride;
+	uint8_t reserved[8];
+} CatalogHeader;
+
+typedef struct _CatalogEntry {
+	char name[40];          /* file name of the dump, NUL terminated */
+	uint64_t hash;          /* hash_fnv1a() of the image */
+	int64_t first, last;    /* time of the oldest and newest record */
+	int64_t mtime;          /* modification time of the dump when indexed */
+	uint32_t size;          /* image size */
+	uint32_t wrap;          /* offset of the oldest record */
+	uint32_t eof;           /* offset of the interim EOF, the slot after
+	                           the newest record, wrapping to the first */
+	uint16_t records;       /* records in the dump, 0 if none decode */
+	uint16_t older;         /* records from wrap on, before the log wraps */
+	uint16_t interval;      /* log interval in minutes */
+	uint8_t sensors;
+	uint8_t record_len;
+	uint16_t times;         /* timestamps following the entry */
+	uint8_t reserved[10];
+} CatalogEntry;
+
+typedef struct _Catalog {
+	int fd;
+	int writable;
+	CatalogHeader header;
+	unsigned char* map;
+	size_t map_len;
+	size_t end;             /* file size */
+	off_t* offsets;         /* offset of each CatalogEntry */
+	int count;
+} Catalog;
+
+/* the part of a query one dump answers: the records with from <= time <
+ * to are in the length bytes at offset (with up to a stride of others on
+ * either side, the caller skips those) */
+typedef struct _CatalogRange {
+	int entry;
+	int64_t from, to;
+	uint32_t offset;
+	uint32_t length;
+} CatalogRange;
+
+/* open a catalog, creating it if writable and it does not exist yet.
+ * returns -1 and sets errno on failure. */
+extern int catalog_open(Catalog* c, const char* path, int writable);
+extern void catalog_close(Catalog* c);
+
+/* entry i of the catalog and its timestamps (pointing into the mapping) */
+extern const CatalogEntry* catalog_entry(const Catalog* c, int i);
+extern const int64_t* catalog_times(const Catalog* c, int i);
+
+/* append an entry with e->times timestamps. returns -1 on error. */
+extern int catalog_add(Catalog* c, const CatalogEntry* e, const int64_t* times);
+
+/* index the image of len bytes at data into e and times[CATALOG_MAX_TIMES].
+ * returns -1 if the image is not understood. */
+extern int catalog_index(const unsigned char* data, size_t len,
+		const char* name, CatalogEntry* e, int64_t* times);
+
+/* index the dump file at path, taking the entry from its sidecar if that
+ * is up to date, and writing the sidecar if not. returns -1 (with errno
+ * set) if the dump can not be read or is not understood. */
+extern int catalog_index_file(const char* path, CatalogEntry* e,
+		int64_t* times);
+
+/* the dumps holding the records with from <= time < to: the fewest that
+ * cover the range, each for the part no earlier one covers; or, if all is
+ * set, every dump with records in it. *ranges is malloc'ed, in time
+ * order. returns the number of ranges, -1 if memory runs out. */
+extern int catalog_query(const Catalog* c, int64_t from, int64_t to,
+		int all, CatalogRange** ranges);
+
+#endif /* _INCLUDE_CATALOG_H_ */
@@ -0,0 +1,292 @@
+/* vim:set expandtab! ts=4: */
+
+/* catalog_tfa - index tfa.dump.* files by the time they cover, and find
+ * the dumps (and the bytes in them) holding a time range, see catalog.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "catalog.h"
+#include "validate.h"
+#include "util.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: catalog_tfa index <dumpdir|tfa.dump.filename>...\n");
+	fprintf(stderr, "       catalog_tfa add <catalog> <dumpdir|tfa.dump.filename>...\n");
+	fprintf(stderr, "       catalog_tfa list <catalog>\n");
+	fprintf(stderr, "       catalog_tfa query [--all] [--dumps <dumpdir>] [--format=text|csv|ndjson|bin] <catalog> <from> [to]\n");
+	fprintf(stderr, "  from, to: unix time, \"now\" or relative to now, like -1d\n");
+	exit(EXIT_FAILURE);
+}
+
+static void open_catalog(Catalog* c, const char* path, int writable) {
+	if (catalog_open(c, path, writable) == -1) {
+		fprintf(stderr, "E: can't open catalog %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void scan(char** paths, int npaths, char*** files, int* nfiles) {
+	int i;
+
+	for (i = 0; i < npaths; i++) {
+		if (dump_scan(paths[i], files, nfiles) == -1) {
+			perror(paths[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static int cmd_index(char** files, int nfiles) {
+	int64_t times[CATALOG_MAX_TIMES];
+	CatalogEntry e;
+	int i, failed = 0;
+
+	for (i = 0; i < nfiles; i++) {
+		if (catalog_index_file(files[i], &e, times) == -1) {
+			fprintf(stderr, "E: can't index %s: %s\n", files[i], strerror(errno));
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+static int cmd_add(Catalog* c, char** files, int nfiles) {
+	int64_t times[CATALOG_MAX_TIMES];
+	char last[sizeof(((CatalogEntry*)0)->name)] = "";
+	int i, added = 0, failed = 0;
+
+	if (c->count > 0) strcpy(last, catalog_entry(c, c->count - 1)->name);
+
+	for (i = 0; i < nfiles; i++) {
+		const char* name = strrchr(files[i], '/') ? strrchr(files[i], '/') + 1 : files[i];
+		CatalogEntry e;
+
+		// the catalog is in time order, which is name order for dumps
+		if (strcmp(name, last) <= 0) continue;
+
+		if (catalog_index_file(files[i], &e, times) == -1) {
+			fprintf(stderr, "E: can't index %s: %s\n", files[i], strerror(errno));
+			failed++;
+			continue;
+		}
+		if (catalog_add(c, &e, times) == -1) {
+			fprintf(stderr, "E: can't add %s: %s\n", files[i], strerror(errno));
+			return 1;
+		}
+		strcpy(last, e.name);
+		added++;
+	}
+
+	fprintf(stderr, "Added %d dumps, %d in the catalog.\n", added, c->count);
+	return failed ? 1 : 0;
+}
+
+static void print_time(int64_t t) {
+	char buf[32];
+	time_t tt = t;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime(&tt));
+	printf(" %s", buf);
+}
+
+static int cmd_list(Catalog* c) {
+	int i;
+
+	for (i = 0; i < c->count; i++) {
+		const CatalogEntry* e = catalog_entry(c, i);
+
+		printf("%5d %-24s %d %4u", i, e->name, e->sensors, e->records);
+		if (e->records > 0) {
+			print_time(e->first);
+			print_time(e->last);
+		}
+		printf(" wrap %04x eof %04x %016llx\n", e->wrap, e->eof, (unsigned long long)e->hash);
+	}
+	return 0;
+}
+
+/* decode the records of a range from the dump, mapping only those pages */
+static int decode_range(const Catalog* c, const CatalogRange* r,
+		const char* dir, int format) {
+	const CatalogEntry* e = catalog_entry(c, r->entry);
+	char path[1024];
+	unsigned char* map;
+	struct stat st;
+	DumpHeader h;
+	Validator v;
+	TimeCache tc;
+	uint32_t pos;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: can't open %s: %s\n", path, strerror(errno));
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	if (st.st_size != e->size || st.st_mtime != e->mtime) {
+		fprintf(stderr, "E: %s changed since it was indexed.\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	if (dump_header(map, st.st_size, &h) == -1) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	// the alarm limits for the checks are in the header
+	timecache_init(&tc);
+	validate_init(&v, map, DUMP_DATA_OFFSET);
+	for (pos = r->offset; pos + h.record_len <= r->offset + r->length; pos += h.record_len) {
+		int index = (pos - DUMP_DATA_OFFSET) / h.record_len;
+		Record rec;
+		RecordBin b;
+		time_t t;
+
+		if (record_parse(map + pos, &rec, h.sensors - 1) == -1) continue;
+		t = record_time(&rec, &tc);
+		if (t < r->from || t >= r->to) continue;
+
+		output_bin(&b, index, &rec, t);
+		validate_record(&v, map + pos, h.record_len, &b);
+		if (format == FORMAT_TEXT) output_record(stdout, format, index, &rec, t, h.sensors);
+		else output_record_bin(stdout, format, &b, h.sensors);
+	}
+	munmap(map, st.st_size);
+	return 0;
+}
+
+static int cmd_query(Catalog* c, const char* catalog, int64_t from, int64_t to,
+		int all, const char* dir, int format) {
+	CatalogRange* ranges;
+	char* catalog_dir = NULL;
+	int n, i, sensors = 0, failed = 0;
+
+	n = catalog_query(c, from, to, all, &ranges);
+	if (n == -1) {
+		perror("catalog_query");
+		return 1;
+	}
+
+	if (format == -1) {
+		for (i = 0; i < n; i++) {
+			const CatalogEntry* e = catalog_entry(c, ranges[i].entry);
+
+			printf("%s %u %u", e->name, ranges[i].offset, ranges[i].length);
+			print_time(ranges[i].from);
+			print_time(ranges[i].to);
+			printf("\n");
+		}
+		free(ranges);
+		return 0;
+	}
+
+	// the dumps are next to the catalog, unless told otherwise
+	if (dir == NULL) {
+		char* slash;
+
+		catalog_dir = strdup(catalog);
+		slash = strrchr(catalog_dir, '/');
+		if (slash != NULL) *slash = 0;
+		else strcpy(catalog_dir, ".");
+		dir = catalog_dir;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (catalog_entry(c, ranges[i].entry)->sensors > sensors)
+			sensors = catalog_entry(c, ranges[i].entry)->sensors;
+	}
+	output_header(stdout, format, sensors > 0 ? sensors : 1);
+	for (i = 0; i < n; i++) {
+		if (decode_range(c, &ranges[i], dir, format) == -1) failed++;
+	}
+
+	free(catalog_dir);
+	free(ranges);
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	Catalog c;
+	const char* cmd;
+	const char* dir = NULL;
+	int format = -1;
+	int all = 0;
+	int ch, rc;
+
+	static const struct option options[] = {
+		{ "all", no_argument, NULL, 'a' },
+		{ "dumps", required_argument, NULL, 'd' },
+		{ "format", required_argument, NULL, 'f' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((ch = getopt_long(argc, argv, "ad:f:", options, NULL)) != -1) {
+		switch (ch) {
+		case 'a':
+			all = 1;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'f':
+			format = output_format(optarg);
+			if (format < 0) {
+				fprintf(stderr, "E: unknown output format %s\n", optarg);
+				print_usage();
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind < 2) print_usage();
+	cmd = argv[optind];
+
+	if (strcmp(cmd, "index") == 0) {
+		char** files = NULL;
+		int nfiles = 0;
+
+		scan(argv + optind + 1, argc - optind - 1, &files, &nfiles);
+		return cmd_index(files, nfiles);
+	} else if (strcmp(cmd, "add") == 0) {
+		char** files = NULL;
+		int nfiles = 0;
+
+		scan(argv + optind + 2, argc - optind - 2, &files, &nfiles);
+		open_catalog(&c, argv[optind+1], 1);
+		rc = cmd_add(&c, files, nfiles);
+	} else if (strcmp(cmd, "list") == 0) {
+		open_catalog(&c, argv[optind+1], 0);
+		rc = cmd_list(&c);
+	} else if (strcmp(cmd, "query") == 0 && (argc - optind == 3 || argc - optind == 4)) {
+		time_t now = time(NULL);
+		int64_t from = util_parse_time(argv[optind+2], now);
+		int64_t to = argc - optind == 4 ? util_parse_time(argv[optind+3], now) : now;
+
+		if (from == -1 || to == -1) print_usage();
+		open_catalog(&c, argv[optind+1], 0);
+		rc = cmd_query(&c, argv[optind+1], from, to, all, dir, format);
+	} else {
+		print_usage();
+		return 1;
+	}
+
+	catalog_close(&c);
+	return rc;
+}
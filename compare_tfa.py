@@ -0,0 +1,198 @@
+#!/usr/bin/python3
+
+# Cross-check of decode_tfa against decode_tfa.py, the reference decoder.
+#
+# Both decode the same eeprom images, synthetic ones from "bench_tfa -o"
+# (all sensor counts, wrapped around logs with the interim EOF, readings
+# missing for a while) or the dumps given on the command line, and the
+# records they find are compared reading by reading.
+#
+# bench_tfa -o also writes damaged copies of each image (bytes overwritten,
+# bits flipped, cut short). On those the two are only expected to fail
+# gracefully: decode_tfa must not crash or hang, and the readings it does
+# not flag as implausible must be the ones decode_tfa.py reads at the same
+# time, where it gets that far. How each of them takes the damage (decoded,
+# rejected with an error, crashed) is counted.
+#
+# decode_tfa.py is Python 2, -p names the interpreter to run it with.
+#
+# usage: compare_tfa.py [-n images] [-r seed] [-p python2] [dump...]
+
+import getopt
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+# both decoders see the station's local time as UTC, so no DST gaps
+env = dict(os.environ, TZ="UTC")
+
+# decode_tfa.py has to decode on its own instead of through libtfa.so
+py_env = dict(env, TFA_LIBRARY=os.devnull)
+
+# suffixes of the damaged copies bench_tfa -o writes
+DAMAGED = (".bytes", ".bits", ".cut")
+
+# how a decoder took an image
+DECODED, REJECTED, CRASHED = "decoded", "rejected", "crashed"
+
+TIMEOUT = 60
+
+class Failure(Exception):
+    def __init__(self, outcome, message):
+        Exception.__init__(self, message)
+        self.outcome = outcome
+
+def run(args, env=env):
+    try:
+        p = subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                           env=env, universal_newlines=True, errors="replace",
+                           timeout=TIMEOUT)
+    except subprocess.TimeoutExpired:
+        raise Failure(CRASHED, "%s hung" % os.path.basename(args[-2]))
+    return p
+
+def reading(s, scale):
+    if s == "":
+        return None
+    return int(round(float(s) * scale))
+
+def decode_c(fname):
+    """(timestamp, T..., H...) per record and whether it is flagged, from
+    the CSV output of decode_tfa"""
+    p = run([os.path.join(here, "decode_tfa"), "--format=csv", fname])
+    if p.returncode < 0:
+        raise Failure(CRASHED, "decode_tfa killed by signal %d" % -p.returncode)
+    if p.returncode != 0:
+        raise Failure(REJECTED, "decode_tfa: %s" % (p.stderr.strip() or p.stdout.strip()))
+    records = []
+    lines = p.stdout.splitlines()
+    header = lines[0].split(",")
+    sensors = (len(header) - 3) // 2
+    for line in lines[1:]:
+        f = line.split(",")
+        ts = time.strftime("%Y-%m-%dT%H:%M:%S", time.gmtime(int(f[1])))
+        T = [reading(f[2 + 2 * i], 10) for i in range(sensors)]
+        H = [reading(f[3 + 2 * i], 1) for i in range(sensors)]
+        records.append(((ts, T, H), int(f[-1]) != 0))
+    return records
+
+def decode_py(python, fname):
+    """the same, from the output of decode_tfa.py. its own RuntimeError is
+    how it rejects an image, any other exception is a crash."""
+    p = run([python, os.path.join(here, "decode_tfa.py"), fname], py_env)
+    if p.returncode != 0:
+        err = p.stderr.strip().splitlines() or ["exit status %d" % p.returncode]
+        outcome = REJECTED if err[-1].startswith("RuntimeError") else CRASHED
+        raise Failure(outcome, "decode_tfa.py: %s" % err[-1])
+    records = []
+    lines = p.stdout.splitlines()
+    start = [i for i, l in enumerate(lines) if l.startswith("i|timestamp")][0]
+    for line in lines[start + 1:]:
+        f = line.split("|")
+        sensors = (len(f) - 2) // 2
+        T = [reading(f[2 + 2 * i], 10) for i in range(sensors)]
+        H = [reading(f[3 + 2 * i], 1) for i in range(sensors)]
+        records.append((f[1], T, H))
+    return records
+
+def decode(fn, *args):
+    try:
+        return DECODED, fn(*args), None
+    except Failure as e:
+        return e.outcome, None, str(e)
+
+def compare(python, fname, verbose, outcomes):
+    c_outcome, c, c_err = decode(decode_c, fname)
+    py_outcome, py, py_err = decode(decode_py, python, fname)
+    damaged = fname.endswith(DAMAGED)
+    problems = []
+
+    if damaged:
+        outcomes.append((c_outcome, py_outcome))
+        if c_outcome == CRASHED:
+            problems.append(c_err)
+        elif c_outcome == DECODED and py_outcome == DECODED:
+            # what decode_tfa trusts, decode_tfa.py has to agree with where
+            # it read something at that time (damage can leave it reading
+            # fewer slots, and two records with the same time)
+            by_time = {}
+            for r in py:
+                by_time.setdefault(r[0], []).append(r)
+            for r, flagged in c:
+                if not flagged and r[0] in by_time and r not in by_time[r[0]]:
+                    problems.append("%s %r %r unflagged, decode_tfa.py %r %r" % (r + by_time[r[0]][0][1:]))
+    elif c_err or py_err:
+        problems += [e for e in (c_err, py_err) if e]
+    else:
+        c = [r for r, flagged in c]
+        if len(c) != len(py):
+            problems.append("%d records, decode_tfa.py %d" % (len(c), len(py)))
+        # decode_tfa lists the records in slot order, decode_tfa.py oldest first
+        c.sort(key=lambda r: r[0])
+        for a, b in zip(c, py):
+            if a != b:
+                problems.append("%s %r %r, decode_tfa.py %s %r %r" % (a + b))
+
+    if problems:
+        print("%s: %d differences" % (fname, len(problems)))
+        for p in problems[:verbose]:
+            print("  " + p)
+    return len(problems) == 0
+
+def print_outcomes(outcomes):
+    for who, i in (("decode_tfa", 0), ("decode_tfa.py", 1)):
+        counts = [sum(1 for o in outcomes if o[i] == k) for k in (DECODED, REJECTED, CRASHED)]
+        print("  %-13s decoded %d, rejected %d, crashed %d" % ((who,) + tuple(counts)))
+
+def usage():
+    sys.stderr.write("usage: compare_tfa.py [-n images] [-r seed] [-p python2] [-v lines] [dump...]\n")
+    sys.exit(2)
+
+def main():
+    try:
+        opts, files = getopt.getopt(sys.argv[1:], "n:r:p:v:")
+    except getopt.GetoptError:
+        usage()
+    images, seed, python, verbose = "32", None, "python2", 5
+    for o, a in opts:
+        if o == "-n": images = a
+        elif o == "-r": seed = a
+        elif o == "-p": python = a
+        elif o == "-v": verbose = int(a)
+
+    tmp = None
+    if not files:
+        tmp = tempfile.mkdtemp(prefix="compare_tfa.")
+        args = [os.path.join(here, "bench_tfa"), "-o", tmp, "-n", images]
+        if seed is not None:
+            args += ["-r", seed]
+        p = subprocess.Popen(args, env=env, stderr=subprocess.PIPE, universal_newlines=True)
+        sys.stdout.write(p.communicate()[1])
+        files = sorted(os.path.join(tmp, f) for f in os.listdir(tmp))
+
+    failed = failed_damaged = 0
+    outcomes = []
+    try:
+        for fname in files:
+            if not compare(python, fname, verbose, outcomes):
+                if fname.endswith(DAMAGED):
+                    failed_damaged += 1
+                else:
+                    failed += 1
+    finally:
+        if tmp is not None:
+            shutil.rmtree(tmp)
+    whole = len(files) - len(outcomes)
+    print("%d of %d images decoded the same." % (whole - failed, whole))
+    if outcomes:
+        print("%d of %d damaged images taken gracefully:" % (len(outcomes) - failed_damaged, len(outcomes)))
+        print_outcomes(outcomes)
+    sys.exit(1 if failed or failed_damaged else 0)
+
+if __name__ == '__main__':
+    main()
@@ -3,26 +3,57 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "record.h"
+#include "output.h"
+#include "dump.h"
+#include "validate.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: decode_tfa [--format=text|csv|ndjson|bin] tfa.dump.filename\n");
+	exit(EXIT_FAILURE);
+}
 
 int main(int argc, char *argv[]) {
 	FILE *fileptr;
-	unsigned char data[32768];
-	int sensors;
-	int block_size = 0;
+	unsigned char data[DUMP_SIZE];
+	DumpHeader h;
+	Validator v;
+	int empty = 0;
+	int invalid = 0;
 
 	int i;
 	int len;
 
-	int data_offset = 0x64;
+	int format = FORMAT_TEXT;
+	int c;
+	TimeCache tc;
 
 	char* filename;
 
-	if (argc != 2) {
-	  fprintf(stderr, "Usage: decode_tfa tfa.dump.filename\n");
-	  exit(EXIT_FAILURE);
+	static const struct option options[] = {
+		{ "format", required_argument, NULL, 'f' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "f:", options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			format = output_format(optarg);
+			if (format < 0) {
+				fprintf(stderr, "E: unknown output format %s\n", optarg);
+				print_usage();
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (optind != argc - 1) {
+		print_usage();
 	}
-	filename = argv[1];
+	filename = argv[optind];
 
 	fileptr = fopen(filename, "r");
 	if (fileptr == NULL) {
@@ -30,69 +61,38 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	len = fread(data, 1, 32768, fileptr);
+	len = fread(data, 1, DUMP_SIZE, fileptr);
 
-	sensors = data[0x0C];
-	fprintf(stderr, "Found %d external sensors.\n", sensors);
-	sensors++;
-	fprintf(stderr, " ==== %d total sensors.\n", sensors);
-
-	if (sensors != 6) {
-		fprintf(stderr, "Sorry, I don't understand the data, if there are other than \n");
-		fprintf(stderr, " 5 external sensors configured!\n");
+	if (dump_header(data, len, &h) == -1) {
+		fprintf(stderr, "Sorry, I don't understand the data, found sensor byte %02x.\n", data[0x0C]);
 		return 2;
 	}
+	fprintf(stderr, "Found %d external sensors.\n", h.sensors - 1);
+	fprintf(stderr, " ==== %d total sensors.\n", h.sensors);
 
-	if (sensors >= 4) block_size = 15;
-	if (sensors == 6) block_size = 20;
-
-	if (block_size == 0) {
-		fprintf(stderr, "Blocksize = 0, probably did not recognize Sensor count.\n");
-		return 2;
-	}
-
-	for (i=0; i<=(int)(len/block_size);i++) {
+	timecache_init(&tc);
+	validate_init(&v, data, len);
+	output_header(stdout, format, h.sensors);
 
+	for (i = 0; i < h.records; i++) {
 		Record r;
-		unsigned char* ptr = data + (i*block_size) + data_offset;
-		int rc;
+		RecordBin b;
 
-		if (i >= 999 && ptr[0] == 0xff) {
-			// end of ring buffer:
-			// klimalogger only stores 999 entries, and bytes are marked with 0xff(?)
-			break;
-		}
-
-		rc = record_parse(ptr, &r, sensors-1);
-		if (rc == -1) {
-			fprintf(stderr, "I: WRAPAROUND\n");
+		if (record_parse(data + dump_slot(&h, i), &r, h.sensors - 1) == -1) {
+			// unwritten slot, the ring buffer wraps around here
+			if (!empty) fprintf(stderr, "I: WRAPAROUND\n");
+			empty = 1;
 			continue;
 		}
+		empty = 0;
+
+		output_bin(&b, i, &r, record_time(&r, &tc));
+		if (validate_record(&v, data + dump_slot(&h, i), h.record_len, &b)) invalid++;
 
-		printf("%04d %02d.%02d.20%02d %02d:%02d ",
-			i, r.date_d, r.date_m, r.date_y, r.time_h, r.time_m);
-
-		printTemp("in", r.t_in);
-		printHumidity("in", r.h_in);
-		printTemp("1", r.t_1);
-		printHumidity("1", r.h_1);
-		printTemp("2", r.t_2);
-		printHumidity("2", r.h_2);
-		printTemp("3", r.t_3);
-		printHumidity("3", r.h_3);
-		printTemp("4", r.t_4);
-		printHumidity("4", r.h_4);
-		printTemp("5", r.t_5);
-		printHumidity("5", r.h_5);
-
-//		printf(" Tin: %02.1f T1: %02.1f Fin: %d F1: %d T2: %02.1f F2: %d", t_in, t_1, h_in, h_1, t_2, h_2);
-//		printf(" T3: %02.1f F3: %d ", t_3, h_3);
-		printf("\n");
-/*		printf("  %02x  %02x %02x  %02x %02x \n",
-			ptr[10], ptr[11],
-			ptr[12], ptr[13], ptr[14]
-			); */
+		if (format == FORMAT_TEXT) output_record(stdout, format, i, &r, b.time, h.sensors);
+		else output_record_bin(stdout, format, &b, h.sensors);
 	}
+	if (invalid > 0) fprintf(stderr, "W: %d records failed the plausibility checks.\n", invalid);
 
 	return(0);
 }
@@ -8,6 +8,12 @@ import sys
 import datetime
 from operator import add,itemgetter,mul
 
+# the C decoder (tfa.py, libtfa.so), if it has been built
+try:
+    import tfa
+except (ImportError, OSError):
+    tfa = None
+
 def byte2nibble(byte):
     assert 0 <= byte <= 0xff
     l = byte & 0xf
@@ -50,6 +56,28 @@ def parse_T(nibbles):
     return sum(map(mul,nibbles,[1,10,100]))-300
 
 
+INVALID_BCD = 0x2   # see validate.h
+
+def fast_records(fast, slots, data, record_len, sensor_cnt, parse_record):
+    """(ts,T,H) of the slots, readings from the C decoder; records with
+    nibbles above 9 go through parse_record, to fail the same way"""
+    if list(fast.index) != slots:
+        return [parse_record(data[100+i*record_len:100+(i+1)*record_len], sensor_cnt)
+                for i in slots]
+    t = [fast.t[n] for n in xrange(sensor_cnt+1)]
+    h = [fast.h[n] for n in xrange(sensor_cnt+1)]
+    result = []
+    for k,i in enumerate(slots):
+        ofs = 100+i*record_len
+        if fast.flags[k] & INVALID_BCD:
+            result.append(parse_record(data[ofs:ofs+record_len], sensor_cnt))
+            continue
+        ts = parse_timestamp(data[ofs:ofs+5])
+        T = [(None if c[k] == tfa.NA_T else c[k]) for c in t]
+        H = [(None if c[k] == tfa.NA else c[k]) for c in h]
+        result.append( (ts,T,H) )
+    return result
+
 def parse_file(fname):
     print "="*79
 
@@ -61,6 +89,7 @@ def parse_file(fname):
     if eof_marker < 0:
         raise RuntimeError("EOF Marker not found")
 
+    raw = data
     data = map(ord, data)
 
 
@@ -165,6 +194,14 @@ def parse_file(fname):
     records_pre = []
     records = []
 
+    # with the C decoder, the loop below only looks for the EOF slots and
+    # the readings are taken from its columns
+    fast = None
+    if tfa is not None:
+        fast = tfa.decode(raw)
+        slots_pre = []
+        slots = []
+
     for i,ofs in enumerate(xrange(100,eof_marker,record_len)):
         rdata = data[ofs:ofs+record_len]
 
@@ -172,7 +209,10 @@ def parse_file(fname):
             print "natural (final) EOF encountered at offset 0x%x (i=%d)" % (ofs,i)
             break
 
-        ts,T,H = parse_record(rdata, sensor_cnt)
+        if fast is not None:
+            ts = rdata[0] != 0xff
+        else:
+            ts,T,H = parse_record(rdata, sensor_cnt)
 
         if not ts:
             if not buffer_overflowed or seen_eof:
@@ -183,11 +223,19 @@ def parse_file(fname):
             seen_eof = True
             continue
 
+        if fast is not None:
+            (slots_pre if seen_eof else slots).append(i)
+            continue
+
         if seen_eof:
             records_pre.append( (ts,T,H) )
         else:
             records.append( (ts,T,H) )
 
+    if fast is not None:
+        records_pre = fast_records(fast, slots_pre + slots, data, record_len,
+                                   sensor_cnt, parse_record)
+
 
     print "-"*79
 
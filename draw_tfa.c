@@ -0,0 +1,484 @@
+/* vim:set expandtab! ts=4: */
+
+/* draw_tfa - render the Day/Week/Month/Year temperature and humidity graphs
+ * of DRAW.pl from a tsdb database, without rrdtool.
+ *
+ * Every sensor is handled by its own thread, which reads the last year of
+ * readings once and reduces them to the pixel width of each graph, keeping
+ * the min and max of every pixel column (or, with -a lttb, the readings
+ * chosen by largest triangle three buckets) so spikes stay visible.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "record.h"
+#include "output.h"
+#include "tsdb.h"
+#include "graph.h"
+
+/* readings further apart are not connected, like the heartbeat of the
+ * rrd databases UPDATE.pl creates */
+#define HEARTBEAT 3600
+
+#define MARGIN_LEFT   70
+#define MARGIN_RIGHT  20
+#define MARGIN_TOP    24
+#define MARGIN_BOTTOM 44
+
+#define ALGO_MINMAX 0
+#define ALGO_LTTB   1
+
+#define UNIT_HOUR  0
+#define UNIT_DAY   1
+#define UNIT_WEEK  2
+#define UNIT_MONTH 3
+
+typedef struct _Window {
+	const char* name;
+	int unit;               /* the window is count units back from the end */
+	int count;
+	int grid_unit, grid_count;
+	int label_unit, label_count;
+	const char* label_format;
+} Window;
+
+static const Window windows[] = {
+	{ "Day",   UNIT_HOUR, 24,  UNIT_HOUR, 1,  UNIT_HOUR, 4,  "%H:%M" },
+	{ "Week",  UNIT_DAY, 7,    UNIT_HOUR, 6,  UNIT_DAY, 1,   "%a %d" },
+	{ "Month", UNIT_MONTH, 1,  UNIT_DAY, 1,   UNIT_WEEK, 1,  "Week %V" },
+	{ "Year",  UNIT_MONTH, 12, UNIT_MONTH, 1, UNIT_MONTH, 1, "%b" },
+};
+#define WINDOWS (sizeof(windows) / sizeof(windows[0]))
+
+#define TEMPERATURE 0
+#define HUMIDITY    1
+
+typedef struct _Quantity {
+	const char* name;
+	const char* unit;
+	int color;
+} Quantity;
+
+static const Quantity quantities[] = {
+	{ "Temperature", "Degree Celsius", GRAPH_RED },
+	{ "Humidity", "%", GRAPH_GREEN },
+};
+
+typedef struct _Job {
+	pthread_t thread;
+	int sensor;
+	int graphs;
+	int failed;
+} Job;
+
+static Tsdb db;
+static const char* outdir;
+static const char* labels[RECORD_SENSORS];
+static int width = 650;
+static int height = 160;
+static int algorithm = ALGO_MINMAX;
+static time_t end;
+
+static void print_usage() {
+	fprintf(stderr, "Usage: draw_tfa [-w width] [-h height] [-e end] [-a minmax|lttb]\n");
+	fprintf(stderr, "                [-l sensor=label]... <dbdir> <outputdir>\n");
+	exit(EXIT_FAILURE);
+}
+
+/* the last tick <= t */
+static time_t tick_align(time_t t, int unit, int count) {
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	tm.tm_sec = 0;
+	tm.tm_min = 0;
+	switch (unit) {
+	case UNIT_HOUR:
+		tm.tm_hour -= tm.tm_hour % count;
+		break;
+	case UNIT_DAY:
+		tm.tm_hour = 0;
+		break;
+	case UNIT_WEEK:
+		tm.tm_hour = 0;
+		tm.tm_mday -= (tm.tm_wday + 6) % 7;     // monday
+		break;
+	case UNIT_MONTH:
+		tm.tm_hour = 0;
+		tm.tm_mday = 1;
+		tm.tm_mon -= tm.tm_mon % count;
+		break;
+	}
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/* t moved by n * count units, in local time */
+static time_t tick_add(time_t t, int unit, int count, int n) {
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	switch (unit) {
+	case UNIT_HOUR: tm.tm_hour += n * count; break;
+	case UNIT_DAY: tm.tm_mday += n * count; break;
+	case UNIT_WEEK: tm.tm_mday += 7 * n * count; break;
+	case UNIT_MONTH: tm.tm_mon += n * count; break;
+	}
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/* a round grid step giving about lines lines over range */
+static double nice_step(double range, int lines) {
+	double raw = range / lines;
+	double mag = pow(10, floor(log10(raw)));
+	double f = raw / mag;
+
+	if (f <= 1) f = 1;
+	else if (f <= 2) f = 2;
+	else if (f <= 5) f = 5;
+	else f = 10;
+	return f * mag;
+}
+
+typedef struct _Plot {
+	GraphImage img;
+	int64_t start, end;
+	double lo, hi;
+	int color;
+} Plot;
+
+static int plot_x(const Plot* p, int64_t t) {
+	return MARGIN_LEFT + (t - p->start) * width / (p->end - p->start);
+}
+
+static int plot_y(const Plot* p, double v) {
+	return MARGIN_TOP + height - 1 - (int)lround((v - p->lo) / (p->hi - p->lo) * (height - 1));
+}
+
+static void draw_axes(Plot* p, const Window* w) {
+	GraphImage* img = &p->img;
+	int bottom = MARGIN_TOP + height - 1;
+	int right = MARGIN_LEFT + width - 1;
+	double step, v;
+	time_t t;
+	char label[32];
+	struct tm tm;
+
+	graph_fill(img, MARGIN_LEFT, MARGIN_TOP, width, height, GRAPH_CANVAS);
+
+	// time axis: minor grid, then major grid with labels
+	for (t = tick_align(p->start, w->grid_unit, w->grid_count); t < p->end;
+			t = tick_add(t, w->grid_unit, w->grid_count, 1)) {
+		if (t > p->start) graph_vgrid(img, plot_x(p, t), MARGIN_TOP, bottom, GRAPH_GRID);
+	}
+	for (t = tick_align(p->start, w->label_unit, w->label_count); t < p->end;
+			t = tick_add(t, w->label_unit, w->label_count, 1)) {
+		int x;
+
+		if (t <= p->start) continue;
+		x = plot_x(p, t);
+		graph_vgrid(img, x, MARGIN_TOP, bottom, GRAPH_MGRID);
+		localtime_r(&t, &tm);
+		strftime(label, sizeof(label), w->label_format, &tm);
+		graph_text(img, x - graph_text_width(label) / 2, bottom + 4, label, GRAPH_FONT);
+	}
+
+	// value axis
+	step = nice_step(p->hi - p->lo, height / 32);
+	for (v = ceil(p->lo / step - 1e-9) * step; v <= p->hi + 1e-9; v += step) {
+		int y = plot_y(p, v);
+
+		if (step * 2 * (height - 1) / (p->hi - p->lo) >= 20 && v + step / 2 < p->hi)
+			graph_hgrid(img, MARGIN_LEFT, right, plot_y(p, v + step / 2), GRAPH_GRID);
+		graph_hgrid(img, MARGIN_LEFT, right, y, GRAPH_MGRID);
+		snprintf(label, sizeof(label), "%.*f", step < 1 ? 1 : 0, fabs(v) < step / 2 ? 0.0 : v);
+		graph_text(img, MARGIN_LEFT - 4 - graph_text_width(label), y - 3, label, GRAPH_FONT);
+	}
+
+	graph_line(img, MARGIN_LEFT, MARGIN_TOP, MARGIN_LEFT, bottom, GRAPH_FRAME, 1);
+	graph_line(img, MARGIN_LEFT, bottom, right, bottom, GRAPH_FRAME, 1);
+}
+
+static void draw_minmax(Plot* p, const int64_t* time, const float* value, long n) {
+	GraphColumn* cols = malloc(width * sizeof(GraphColumn));
+	int64_t prev_time = 0;
+	int prev_x = 0, prev_y = 0, have_prev = 0;
+	int x;
+
+	if (cols == NULL) return;
+	graph_minmax(time, value, n, p->start, p->end, width, cols);
+
+	for (x = 0; x < width; x++) {
+		const GraphColumn* c = &cols[x];
+		int px = MARGIN_LEFT + x;
+
+		if (c->count == 0) continue;
+		if (have_prev && c->first_time - prev_time <= HEARTBEAT)
+			graph_line(&p->img, prev_x, prev_y, px, plot_y(p, c->first), p->color, 2);
+		graph_line(&p->img, px, plot_y(p, c->min), px, plot_y(p, c->max), p->color, 2);
+		prev_x = px;
+		prev_y = plot_y(p, c->last);
+		prev_time = c->last_time;
+		have_prev = 1;
+	}
+	free(cols);
+}
+
+static void draw_lttb(Plot* p, const int64_t* time, const float* value, long n) {
+	int64_t* t = malloc(n * sizeof(int64_t));
+	float* v = malloc(n * sizeof(float));
+	long* keep = malloc(n * sizeof(long));
+	long i, j, k, m = 0;
+
+	if (t == NULL || v == NULL || keep == NULL) goto out;
+
+	for (i = 0; i < n; i++) {
+		if (time[i] < p->start || time[i] >= p->end || isnan(value[i])) continue;
+		t[m] = time[i];
+		v[m++] = value[i];
+	}
+
+	// every run of readings without a gap gets its share of 2 points per
+	// pixel column
+	for (i = 0; i < m; i = j) {
+		long threshold, kept;
+
+		for (j = i + 1; j < m && t[j] - t[j-1] <= HEARTBEAT; j++);
+		threshold = (long)((double)(j - i) * 2 * width / m) + 2;
+		kept = graph_lttb(t + i, v + i, j - i, threshold, keep);
+		for (k = 0; k < kept; k++) {
+			long a = i + keep[k > 0 ? k - 1 : 0];
+			long b = i + keep[k];
+
+			graph_line(&p->img, plot_x(p, t[a]), plot_y(p, v[a]),
+					plot_x(p, t[b]), plot_y(p, v[b]), p->color, 2);
+		}
+	}
+
+out:
+	free(t);
+	free(v);
+	free(keep);
+}
+
+static void format_value(char* buf, size_t len, const char* name, double v) {
+	snprintf(buf, len, " %s: %4.1f", name, v);
+}
+
+static int draw(int sensor, const Window* w, const Quantity* q,
+		int64_t start, const int64_t* time, const float* value, long n,
+		const AggSummary* s, const TsdbPoint* last) {
+	Plot p;
+	char buf[256], path[4096];
+	double min = NAN, max = NAN, avg = NAN, cur = NAN;
+	const char* label = labels[sensor] ? labels[sensor] : sensor_name(sensor);
+	int x, y, rc;
+
+	if (q == &quantities[TEMPERATURE]) {
+		if (s->t_count > 0) {
+			min = s->t_min / 10.0;
+			max = s->t_max / 10.0;
+			avg = s->t_sum / 10.0 / s->t_count;
+		}
+		if (tsdb_t(last) != RECORD_NA_T) cur = last->t / 10.0;
+	} else {
+		if (s->h_count > 0) {
+			min = s->h_min;
+			max = s->h_max;
+			avg = (double)s->h_sum / s->h_count;
+		}
+		if (tsdb_h(last) != RECORD_NA) cur = last->h;
+	}
+
+	if (graph_image_init(&p.img, MARGIN_LEFT + width + MARGIN_RIGHT,
+			MARGIN_TOP + height + MARGIN_BOTTOM) == -1) return -1;
+	p.start = start;
+	p.end = end;
+	p.color = q->color;
+	if (isnan(min)) {
+		p.lo = 0;
+		p.hi = 1;
+	} else {
+		double step = nice_step(max - min > 0 ? max - min : 1, height / 32);
+
+		p.lo = floor(min / step) * step;
+		p.hi = ceil(max / step) * step;
+		if (p.hi <= p.lo) {
+			p.lo -= step;
+			p.hi += step;
+		}
+	}
+
+	draw_axes(&p, w);
+	if (algorithm == ALGO_LTTB) draw_lttb(&p, time, value, n);
+	else draw_minmax(&p, time, value, n);
+
+	snprintf(buf, sizeof(buf), " %s - Sensor %s (%s) ", w->name, label, q->name);
+	graph_text(&p.img, (p.img.width - graph_text_width(buf)) / 2, 8, buf, GRAPH_FONT);
+	graph_text_up(&p.img, 8, MARGIN_TOP + (height + graph_text_width(q->unit)) / 2,
+			q->unit, GRAPH_FONT);
+
+	// legend, like the GPRINT lines of DRAW.pl
+	y = MARGIN_TOP + height + 24;
+	x = MARGIN_LEFT;
+	graph_fill(&p.img, x, y, 8, 8, GRAPH_FRAME);
+	graph_fill(&p.img, x + 1, y + 1, 6, 6, q->color);
+	x += 12 + graph_text(&p.img, x + 12, y, q->name, GRAPH_FONT);
+	x += GRAPH_FONT_W;
+	format_value(buf, sizeof(buf), "Min", min);
+	x += graph_text(&p.img, x, y, buf, GRAPH_FONT);
+	format_value(buf, sizeof(buf), "Max", max);
+	x += graph_text(&p.img, x, y, buf, GRAPH_FONT);
+	format_value(buf, sizeof(buf), "Avg", avg);
+	x += graph_text(&p.img, x, y, buf, GRAPH_FONT);
+	if (w == &windows[0]) {
+		format_value(buf, sizeof(buf), "Current", cur);
+		graph_text(&p.img, x, y, buf, GRAPH_FONT);
+	}
+
+	snprintf(path, sizeof(path), "%s/graph_%s_%s_%s.png",
+			outdir, sensor_name(sensor), w->name, q->name);
+	rc = graph_write_png(&p.img, path);
+	if (rc == -1) fprintf(stderr, "E: writing %s failed: %s\n", path, strerror(errno));
+	graph_image_free(&p.img);
+	return rc;
+}
+
+static void* job_main(void* arg) {
+	Job* job = arg;
+	int sensor = job->sensor;
+	int64_t first = tick_add(end, windows[WINDOWS-1].unit, windows[WINDOWS-1].count, -1);
+	uint64_t row = tsdb_find(&db, sensor, first);
+	long n = tsdb_rows(&db, sensor) - row;
+	TsdbPoint* points = malloc((n + 1) * sizeof(TsdbPoint));
+	int64_t* time = malloc((n + 1) * sizeof(int64_t));
+	float* temp = malloc((n + 1) * sizeof(float));
+	float* hum = malloc((n + 1) * sizeof(float));
+	unsigned int i, j;
+	long k;
+
+	if (points == NULL || time == NULL || temp == NULL || hum == NULL) {
+		fprintf(stderr, "E: out of memory\n");
+		job->failed++;
+		goto out;
+	}
+
+	// the whole year is read once, the shorter windows are its tail
+	n = tsdb_read(&db, sensor, row, n, points);
+	if (n == -1) {
+		fprintf(stderr, "E: reading sensor %s failed: %s\n", sensor_name(sensor), strerror(errno));
+		job->failed++;
+		goto out;
+	}
+	for (k = 0; k < n; k++) {
+		time[k] = points[k].time;
+		temp[k] = tsdb_t(&points[k]) == RECORD_NA_T ? NAN : points[k].t / 10.0;
+		hum[k] = tsdb_h(&points[k]) == RECORD_NA ? NAN : points[k].h;
+	}
+
+	for (i = 0; i < WINDOWS; i++) {
+		const Window* w = &windows[i];
+		int64_t start = tick_add(end, w->unit, w->count, -1);
+		AggSummary s;
+		TsdbPoint last;
+
+		if (tsdb_aggregate(&db, sensor, start, (int64_t)end + 1, &s, &last) == -1) {
+			fprintf(stderr, "E: reading sensor %s failed: %s\n", sensor_name(sensor), strerror(errno));
+			job->failed++;
+			continue;
+		}
+		for (j = 0; j < 2; j++) {
+			if (draw(sensor, w, &quantities[j], start, time, j == TEMPERATURE ? temp : hum,
+					n, &s, &last) == -1) job->failed++;
+			else job->graphs++;
+		}
+	}
+
+out:
+	free(points);
+	free(time);
+	free(temp);
+	free(hum);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	Job jobs[RECORD_SENSORS];
+	int njobs = 0, graphs = 0, failed = 0;
+	int c, i;
+
+	static const struct option options[] = {
+		{ "width", required_argument, NULL, 'w' },
+		{ "height", required_argument, NULL, 'h' },
+		{ "end", required_argument, NULL, 'e' },
+		{ "algorithm", required_argument, NULL, 'a' },
+		{ "label", required_argument, NULL, 'l' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	end = time(NULL);
+	while ((c = getopt_long(argc, argv, "w:h:e:a:l:", options, NULL)) != -1) {
+		char* eq;
+
+		switch (c) {
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'e':
+			end = atoll(optarg);
+			break;
+		case 'a':
+			if (strcmp(optarg, "minmax") == 0) algorithm = ALGO_MINMAX;
+			else if (strcmp(optarg, "lttb") == 0) algorithm = ALGO_LTTB;
+			else print_usage();
+			break;
+		case 'l':
+			eq = strchr(optarg, '=');
+			if (eq == NULL) print_usage();
+			*eq = 0;
+			for (i = 0; i < RECORD_SENSORS; i++) {
+				if (strcmp(optarg, sensor_name(i)) == 0) labels[i] = eq + 1;
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind != 2 || width < 64 || height < 64) print_usage();
+	outdir = argv[optind + 1];
+
+	if (tsdb_open(&db, argv[optind], 0) == -1) {
+		fprintf(stderr, "E: can't open database %s: %s\n", argv[optind], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (tsdb_rows(&db, i) == 0) continue;
+		memset(&jobs[njobs], 0, sizeof(Job));
+		jobs[njobs].sensor = i;
+		if (pthread_create(&jobs[njobs].thread, NULL, job_main, &jobs[njobs]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		njobs++;
+	}
+	for (i = 0; i < njobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		graphs += jobs[i].graphs;
+		failed += jobs[i].failed;
+	}
+	tsdb_close(&db);
+
+	fprintf(stderr, "Rendered %d graphs for %d sensors.\n", graphs, njobs);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dump.h"
+#include "validate.h"
+
+/* record length by number of external sensors */
+static const int record_lengths[] = { 10, 10, 13, 15, 18, 20 };
+
+/* log interval in minutes by LI code */
+static const int intervals[] = {
+	1, 5, 10, 15, 20, 30, 60, 2*60, 4*60, 6*60, 8*60, 12*60, 24*60
+};
+
+/* offsets of the alarm limits, see documentation.txt */
+#define ALARM_H_OFFSET 0x21     /* Hmax, Hmin per sensor */
+#define ALARM_T_OFFSET 0x2D     /* rsvd, Tmax, rsvd|Tmax, Tmin|rsvd, Tmin */
+
+static int bcd(unsigned char b) {
+	return (b >> 4) * 10 + (b & 0x0F);
+}
+
+static int bcd_ok(unsigned char b) {
+	return (b >> 4) <= 9 && (b & 0x0F) <= 9;
+}
+
+int dump_header(const unsigned char* data, size_t len, DumpHeader* h) {
+	int external;
+
+	if (len < DUMP_DATA_OFFSET) return -1;
+
+	external = data[0x0C] & 0x0F;
+	if (external > 5) return -1;
+
+	h->sensors = external + 1;
+	h->record_len = record_lengths[external];
+	if (len > DUMP_EOF_OFFSET) len = DUMP_EOF_OFFSET;
+	h->records = (len - DUMP_DATA_OFFSET) / h->record_len;
+
+	h->interval = 0;
+	if ((data[0x08] & 0x0F) < sizeof(intervals)/sizeof(intervals[0]))
+		h->interval = intervals[data[0x08] & 0x0F];
+
+	h->log_count = bcd(data[0x0A]) * 100 + bcd(data[0x09]);
+	h->overflow = (data[0x0B] & 0x04) != 0;
+	return 0;
+}
+
+int dump_info(const unsigned char* data, size_t len, DumpInfo* info) {
+	TimeCache tc;
+	Record r;
+	int i;
+
+	if (len < DUMP_DATA_OFFSET) return -1;
+
+	// weekday and date are shifted by a nibble against the time
+	memset(&r, 0, sizeof(r));
+	r.time_m = bcd(data[0x00]);
+	r.time_h = bcd(data[0x01]);
+	r.date_d = (data[0x02] >> 4) + (data[0x03] & 0x0F) * 10;
+	r.date_m = (data[0x03] >> 4) + (data[0x04] & 0x0F) * 10;
+	r.date_y = (data[0x04] >> 4) + (data[0x05] & 0x0F) * 10;
+	info->weekday = data[0x02] & 0x0F;
+	info->time = -1;
+	if (bcd_ok(data[0x00]) && bcd_ok(data[0x01]) && bcd_ok(data[0x02] & 0xF0)
+			&& bcd_ok(data[0x03]) && bcd_ok(data[0x04]) && bcd_ok(data[0x05] & 0x0F)
+			&& r.date_m >= 1 && r.date_m <= 12 && r.date_d >= 1) {
+		timecache_init(&tc);
+		info->time = record_time(&r, &tc);
+	}
+	info->timezone = (signed char)data[0x06];
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		const unsigned char* a = data + ALARM_T_OFFSET + 5 * i;
+		const unsigned char* h = data + ALARM_H_OFFSET + 2 * i;
+
+		info->t_max[i] = info->t_min[i] = RECORD_NA_T;
+		if (bcd_ok(a[1]) && bcd_ok(a[2])) {
+			info->t_max[i] = (a[1] & 0x0F) + (a[1] >> 4) * 10 + (a[2] & 0x0F) * 100 - 300;
+		}
+		if (bcd_ok(a[3]) && bcd_ok(a[4])) {
+			info->t_min[i] = (a[3] >> 4) + (a[4] >> 4) * 100 + (a[4] & 0x0F) * 10 - 300;
+		}
+		info->h_max[i] = bcd_ok(h[0]) ? bcd(h[0]) : RECORD_NA;
+		info->h_min[i] = bcd_ok(h[1]) ? bcd(h[1]) : RECORD_NA;
+	}
+	memcpy(info->sensor_id, data + 0x4B, RECORD_SENSORS - 1);
+	info->valid = data[0x50] & 0x1F;
+	return 0;
+}
+
+int dump_decode(const unsigned char* data, size_t len,
+		const DumpHeader* h, RecordBin* out, TimeCache* tc) {
+	Validator v;
+	int i;
+	int n = 0;
+
+	validate_init(&v, data, len);
+	for (i = 0; i < h->records; i++) {
+		Record r;
+
+		if (record_parse(data + dump_slot(h, i), &r, h->sensors - 1) == -1)
+			continue;
+		output_bin(&out[n], i, &r, record_time(&r, tc));
+		validate_record(&v, data + dump_slot(h, i), h->record_len, &out[n]);
+		n++;
+	}
+	return n;
+}
+
+/* an unwritten slot, see record_parse() */
+#define SLOT_EMPTY(data, h, i) (((data)[dump_slot(h, i)] & 0xF0) == 0xF0)
+
+/* the slot of the k-th record walking back from the newest one, -1 past
+ * the oldest */
+static int walk_slot(int k, int first_empty, int second_empty) {
+	if (k < first_empty) return first_empty - 1 - k;
+	if (second_empty - 1 - (k - first_empty) > first_empty) return second_empty - 1 - (k - first_empty);
+	return -1;
+}
+
+/* decode slot i into b. returns 1 if its timestamp passes the checks */
+static int decode_slot(const unsigned char* data, const DumpHeader* h,
+		const Validator* v, int i, RecordBin* b, TimeCache* tc) {
+	Record r;
+
+	record_parse(data + dump_slot(h, i), &r, h->sensors - 1);
+	output_bin(b, i, &r, record_time(&r, tc));
+	return validate_time(v, data + dump_slot(h, i), b);
+}
+
+int dump_decode_since(const unsigned char* data, size_t len,
+		const DumpHeader* h, int64_t since, RecordBin* out, TimeCache* tc) {
+	Validator v;
+	RecordBin before, older;
+	int first_empty, second_empty, i, k, sound;
+	int n = 0;
+
+	// the same order as dump_order(): slot 0 up to the interim EOF are the
+	// newest records, the ones after it (if the log wrapped) older
+	for (first_empty = 0; first_empty < h->records && !SLOT_EMPTY(data, h, first_empty); first_empty++);
+	second_empty = first_empty + 1;
+	if (h->overflow) {
+		while (second_empty < h->records && !SLOT_EMPTY(data, h, second_empty)) second_empty++;
+	}
+
+	validate_init(&v, data, len);
+	before.index = UINT32_MAX;
+	for (k = 0; (i = walk_slot(k, first_empty, second_empty)) != -1; k++) {
+		sound = decode_slot(data, h, &v, i, &before, tc);
+		// only a timestamp that passes the checks and sits between those of
+		// its neighbours ends the walk. a garbled one is passed on, for the
+		// caller to drop the readings it has already seen.
+		if (before.time <= since && sound && (n == 0 || before.time < out[n - 1].time)) {
+			i = walk_slot(k + 1, first_empty, second_empty);
+			if (i == -1 || (decode_slot(data, h, &v, i, &older, tc) && older.time < before.time))
+				break;
+		}
+		out[n++] = before;
+		before.index = UINT32_MAX;
+	}
+
+	// oldest first, checked in that order
+	for (i = 0; i < n / 2; i++) {
+		RecordBin t = out[i];
+		out[i] = out[n - 1 - i];
+		out[n - 1 - i] = t;
+	}
+	if (before.index != UINT32_MAX)
+		validate_record(&v, data + dump_slot(h, before.index), h->record_len, &before);
+	for (i = 0; i < n; i++)
+		validate_record(&v, data + dump_slot(h, out[i].index), h->record_len, &out[i]);
+	return n;
+}
+
+size_t dump_order(const RecordBin* in, int n, const DumpHeader* h,
+		RecordBin* out) {
+	int first_empty = n, second_empty, i;
+	size_t count = 0;
+
+	for (i = 0; i < n; i++) {
+		if (in[i].index != i) {
+			first_empty = i;
+			break;
+		}
+	}
+	if (h->overflow) {
+		second_empty = n;
+		for (i = first_empty; i < n; i++) {
+			if (in[i].index != i + 1) {
+				second_empty = i;
+				break;
+			}
+		}
+		for (i = first_empty; i < second_empty; i++) out[count++] = in[i];
+	}
+	for (i = 0; i < first_empty; i++) out[count++] = in[i];
+	return count;
+}
+
+int dump_filename(const char* name) {
+	const char* p;
+
+	if (strncmp(name, "tfa.dump.", 9) != 0 || name[9] == 0) return 0;
+	for (p = name + 9; *p; p++) {
+		if ((*p < '0' || *p > '9') && *p != '.') return 0;
+	}
+	return 1;
+}
+
+static void add_file(char*** files, int* count, char* name) {
+	*files = realloc(*files, (*count + 2) * sizeof(char*));
+	if (*files == NULL) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	(*files)[(*count)++] = name;
+	(*files)[*count] = NULL;
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int dump_scan(const char* path, char*** files, int* count) {
+	struct stat st;
+	struct dirent* de;
+	DIR* dir;
+	int first = *count;
+
+	if (stat(path, &st) == -1) return -1;
+
+	if (!S_ISDIR(st.st_mode)) {
+		add_file(files, count, strdup(path));
+		return 0;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) return -1;
+	while ((de = readdir(dir)) != NULL) {
+		char* name;
+
+		if (!dump_filename(de->d_name)) continue;
+		name = malloc(strlen(path) + strlen(de->d_name) + 2);
+		sprintf(name, "%s/%s", path, de->d_name);
+		add_file(files, count, name);
+	}
+	closedir(dir);
+
+	if (*count > first)
+		qsort(*files + first, *count - first, sizeof(char*), compare_names);
+	return 0;
+}
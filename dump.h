@@ -0,0 +1,78 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_DUMP_H_
+#define _INCLUDE_DUMP_H_
+
+#include <stddef.h>
+#include "record.h"
+#include "output.h"
+
+/* layout of a tfa.dump.* eeprom image, see documentation.txt */
+#define DUMP_SIZE        32768
+#define DUMP_DATA_OFFSET 0x64
+#define DUMP_EOF_OFFSET  0x7ffb
+
+typedef struct _DumpHeader {
+	int sensors;        /* sensors with data, including the internal one */
+	int record_len;     /* bytes per record */
+	int records;        /* record slots in the log area */
+	int interval;       /* log interval in minutes */
+	int log_count;      /* unread records */
+	int overflow;       /* log area has wrapped around */
+} DumpHeader;
+
+/* the rest of the parameter section */
+typedef struct _DumpInfo {
+	time_t time;        /* station clock at the last record, -1 if unreadable */
+	int weekday;        /* 1 = monday */
+	int timezone;       /* hours */
+	/* alarm limits, RECORD_NA_T / RECORD_NA if unreadable */
+	short t_max[RECORD_SENSORS], t_min[RECORD_SENSORS];    /* tenths of deg C */
+	unsigned char h_max[RECORD_SENSORS], h_min[RECORD_SENSORS];    /* %RH */
+	unsigned char sensor_id[RECORD_SENSORS - 1];
+	int valid;          /* bit i: external sensor i+1 is registered */
+} DumpInfo;
+
+/* decode the parameter section of an eeprom image. returns -1 if the image
+ * is too short or the sensor count is not understood. */
+extern int dump_header(const unsigned char* data, size_t len, DumpHeader* h);
+
+/* decode the parts of the parameter section dump_header() leaves out.
+ * returns -1 if the image is too short. */
+extern int dump_info(const unsigned char* data, size_t len, DumpInfo* info);
+
+/* offset of record slot i in the image */
+#define dump_slot(h, i) (DUMP_DATA_OFFSET + (i) * (h)->record_len)
+
+/* decode all written record slots of an image into out[], which must have
+ * room for h->records entries, with the plausibility checks of validate.h
+ * in out[].flags. returns the number of records decoded. */
+extern int dump_decode(const unsigned char* data, size_t len,
+		const DumpHeader* h, RecordBin* out, TimeCache* tc);
+
+/* decode only the records of an image newer than since, oldest first, into
+ * out[] (room for h->records entries), with the plausibility checks
+ * continuing from the record before them. the log is walked back from the
+ * newest record, so an image with few new records is mostly not touched.
+ * the walk stops only at a record with a sound timestamp that is older than
+ * the one after it, so some records not newer than since can be among
+ * them. returns the number of records decoded. */
+extern int dump_decode_since(const unsigned char* data, size_t len,
+		const DumpHeader* h, int64_t since, RecordBin* out, TimeCache* tc);
+
+/* put the records of dump_decode() in time order, the order decode_tfa.py
+ * lists them in: the records after the interim EOF (left over from before
+ * the log wrapped around, if the overflow flag is set), then the ones from
+ * slot 0 up to it. returns the number of records in out. */
+extern size_t dump_order(const RecordBin* in, int n, const DumpHeader* h,
+		RecordBin* out);
+
+/* 1 if name looks like a dump file: tfa.dump.YYYYMMDD.HHMM */
+extern int dump_filename(const char* name);
+
+/* append path to *files, or the dump files in it (sorted by name) if it
+ * is a directory. *files is realloc'ed and NULL terminated, *count is the
+ * number of entries. returns -1 if path can not be read. */
+extern int dump_scan(const char* path, char*** files, int* count);
+
+#endif /* _INCLUDE_DUMP_H_ */
@@ -11,37 +11,726 @@
  */
 
 #include "eeprom.h"
+#include "dump.h"
+#include "validate.h"
+#include "ring.h"
+#include "latest.h"
+#include "util.h"
 #include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #define MAX_RETRIES 10
 #define BUFSIZE 32768
+#define DUMP_LEN 0x7FFF
+#define BLOCK_LEN 1000
+#define SNAPSHOT_ATTEMPTS 3
+
+/* with --samples, the bytes of a block in doubt are read again in runs of
+ * up to REREAD_MAX bytes, which take in gaps shorter than REREAD_GAP (a
+ * read costs about as much as 4 bytes to set up) */
+#define REREAD_ATTEMPTS 4
+#define REREAD_MAX 64
+#define REREAD_GAP 4
+
+/* log count and flags in the header, see documentation.txt */
+#define LOG_COUNT_OFFSET 0x09
+#define FLAGS_OFFSET 0x0B
+#define FLAG_OVERFLOW 0x04
+
+/* the bus reader passes the image on to the writer thread while it is
+ * read, one record (or CHUNK_LEN bytes outside the log area) at a time.
+ * the ring has room for a whole image, so the reader never waits. */
+#define CHUNK_LEN 20
+#define RING_CHUNKS 4096
+#define WRITER_POLL_US 10000
+
+typedef struct _Chunk {
+	int offset;
+	int len;
+	unsigned char data[CHUNK_LEN];
+} Chunk;
+
+typedef struct _Stream {
+	Ring ring;
+	atomic_int done;        /* nothing more will be pushed */
+	/* reader side */
+	const unsigned char* image;
+	int base;               /* address of the running eeprom read */
+	int pushed;             /* image[..pushed] is in the ring */
+	int record_len;         /* layout of the log area, once the header is read */
+	int log_end;
+	int dropped;            /* chunks the ring had no room for */
+	const unsigned char* votes; /* of the running read with --samples */
+	int held;               /* a chunk in doubt waits for the block to be settled */
+	/* writer side */
+	int fd;                 /* the dump file */
+	FILE* out;              /* decoded records, NULL if not wanted */
+	int format;
+	int failed;             /* writing the dump failed */
+} Stream;
+
+static WEATHERSTATION ws;
+static char* serial_device;
+static Stream stream;
+static FILE* info;
+static LatestBus bus;   /* how the dump goes on the bus, for --publish */
+static int samples = 1;
+static int doubtful;    /* bytes in doubt after the votes of the first read */
+static int reread;      /* bytes read again */
+static int unresolved;  /* bytes still in doubt */
 
 void print_usage() {
-	fprintf(stderr, "Usage: dump_tfa /dev/ttyS0 <dumpfile>\n");
+	fprintf(stderr, "Usage: dump_tfa [--since <previous dumpfile>] [--reset] [--samples n] [--decode <file> [--format=text|csv|ndjson|bin]] [--publish <station>] /dev/ttyS0 [<dumpfile>]\n");
 	exit(EXIT_FAILURE);
 }
 
+/* end of the chunk starting at p: record slots go as a whole */
+static int chunk_end(int p) {
+	if (stream.record_len > 0 && p >= DUMP_DATA_OFFSET && p < stream.log_end)
+		return p + stream.record_len - (p - DUMP_DATA_OFFSET) % stream.record_len;
+	if (stream.record_len > 0 && p >= stream.log_end)
+		return p + CHUNK_LEN - (p - stream.log_end) % CHUNK_LEN;
+	return (p / CHUNK_LEN + 1) * CHUNK_LEN;
+}
+
+static void stream_push(int end) {
+	Chunk c;
+
+	c.offset = stream.pushed;
+	c.len = end - stream.pushed;
+	memcpy(c.data, stream.image + c.offset, c.len);
+	if (ring_push(&stream.ring, &c) == -1) stream.dropped++;
+	stream.pushed = end;
+
+	// DUMP_DATA_OFFSET is a multiple of CHUNK_LEN
+	if (end == DUMP_DATA_OFFSET) {
+		DumpHeader h;
+
+		stream.record_len = 0;
+		if (dump_header(stream.image, DUMP_LEN, &h) == 0) {
+			stream.record_len = h.record_len;
+			stream.log_end = dump_slot(&h, h.records);
+		}
+	}
+}
+
+/* 1 if a byte of the running read in [p, end) is in doubt */
+static int stream_doubtful(int p, int end) {
+	for (p = p > stream.base ? p : stream.base; p < end; p++) {
+		if (EEPROM_DOUBTFUL(stream.votes[p - stream.base], samples)) return 1;
+	}
+	return 0;
+}
+
+/* called by eeprom_read_votes() after every byte */
+static void stream_notify(size_t done, void* arg) {
+	int end;
+
+	while (!stream.held && (end = chunk_end(stream.pushed)) <= stream.base + (int)done) {
+		if (stream.votes != NULL && stream_doubtful(stream.pushed, end)) {
+			stream.held = 1;
+			break;
+		}
+		stream_push(end);
+	}
+}
+
+/* push the rest of a read, the last chunk may be short */
+static void stream_flush(int to) {
+	while (stream.pushed < to) {
+		int end = chunk_end(stream.pushed);
+		stream_push(end < to ? end : to);
+	}
+}
+
+/* what the writer did with a record slot */
+#define SLOT_UNREAD 0
+#define SLOT_READ 1     /* and decoded, if it held a record */
+#define SLOT_HELD 2     /* may be read again, see stream_writer() */
+
+/* decode the record in slot of image to --decode. returns 1 if it failed
+ * the plausibility checks. */
+static int emit_slot(const unsigned char* image, int slot, const DumpHeader* h,
+		Validator* v, TimeCache* tc) {
+	const unsigned char* raw = image + dump_slot(h, slot);
+	Record r;
+	RecordBin b;
+	int invalid;
+
+	record_parse(raw, &r, h->sensors - 1);
+	output_bin(&b, slot, &r, record_time(&r, tc));
+	invalid = validate_record(v, raw, h->record_len, &b);
+
+	if (stream.format == FORMAT_TEXT) output_record(stream.out, stream.format, slot, &r, b.time, h->sensors);
+	else output_record_bin(stream.out, stream.format, &b, h->sensors);
+	fflush(stream.out);
+	return invalid;
+}
+
+/* writer thread: writes the chunks to the dump file where they belong,
+ * and decodes the record slots among them, in the order they are read.
+ *
+ * a slot the station writes while it is read comes out torn, and
+ * read_consistent() reads it again. those are held back and decoded at
+ * the end, as they were read last: the records from the newest one in the
+ * header on (as old as the header, or logged while the image was read),
+ * and the slot after each of them, whatever it holds. */
+static void* stream_writer(void* arg) {
+	unsigned char image[BUFSIZE];
+	unsigned char* state = NULL;
+	int* held = NULL;
+	int nheld = 0;
+	DumpHeader h;
+	DumpInfo info;
+	Validator v;
+	TimeCache tc;
+	Chunk c;
+	int decode = stream.out != NULL;
+	int prev_slot = -1;     /* the record slot read last, -1 if it was empty */
+	time_t prev_time = 0;
+	int empty = 0;
+	int invalid = 0;
+	int i;
+
+	timecache_init(&tc);
+	memset(&h, 0, sizeof(h));
+	info.time = -1;
+	for (;;) {
+		int done = atomic_load_explicit(&stream.done, memory_order_acquire);
+		int slot = -1;
+
+		if (ring_pop(&stream.ring, &c) == -1) {
+			if (done) break;
+			usleep(WRITER_POLL_US);
+			continue;
+		}
+
+		if (pwrite(stream.fd, c.data, c.len, c.offset) != c.len && !stream.failed) {
+			perror("E: writing the dump");
+			stream.failed = 1;
+		}
+		if (!decode) continue;
+
+		if (h.record_len > 0 && c.offset >= DUMP_DATA_OFFSET && c.len == h.record_len
+				&& (c.offset - DUMP_DATA_OFFSET) % h.record_len == 0) {
+			slot = (c.offset - DUMP_DATA_OFFSET) / h.record_len;
+			if (slot >= h.records) slot = -1;
+		}
+		// a slot is read again if --since falls back to a full read
+		if (slot != -1 && state[slot] != SLOT_UNREAD && memcmp(image + c.offset, c.data, c.len) == 0)
+			continue;
+		memcpy(image + c.offset, c.data, c.len);
+
+		if (c.offset + c.len == DUMP_DATA_OFFSET) {
+			DumpHeader nh;
+
+			if (dump_header(image, DUMP_LEN, &nh) == -1
+					|| (h.record_len > 0 && nh.record_len != h.record_len)) {
+				fprintf(stderr, "W: don't understand the header, not decoding.\n");
+				decode = 0;
+			} else if (h.record_len == 0) {
+				h = nh;
+				fprintf(stderr, "Found %d external sensors.\n", h.sensors - 1);
+				state = calloc(h.records, 1);
+				held = malloc(h.records * sizeof(int));
+				if (state == NULL || held == NULL) {
+					perror("malloc");
+					exit(EXIT_FAILURE);
+				}
+				validate_init(&v, image, DUMP_DATA_OFFSET);
+				output_header(stream.out, stream.format, h.sensors);
+				// the newest record before the station could log another
+				if (dump_info(image, DUMP_DATA_OFFSET, &info) == -1) info.time = -1;
+			}
+		} else if (slot != -1) {
+			int after_newest = prev_slot == (slot + h.records - 1) % h.records
+					&& info.time != -1 && prev_time >= info.time;
+			Record r;
+			time_t t;
+
+			if (state[slot] == SLOT_UNREAD) state[slot] = SLOT_READ;
+			prev_slot = -1;
+			if (record_parse(c.data, &r, h.sensors - 1) == -1) {
+				// unwritten slot, the ring buffer wraps around here
+				if (!empty) fprintf(stderr, "I: WRAPAROUND\n");
+				empty = 1;
+				continue;
+			}
+			empty = 0;
+			t = record_time(&r, &tc);
+			prev_slot = slot;
+			prev_time = t;
+
+			if (state[slot] == SLOT_HELD) continue;
+			if (after_newest || (info.time != -1 && t >= info.time)) {
+				state[slot] = SLOT_HELD;
+				held[nheld++] = slot;
+				continue;
+			}
+			if (emit_slot(image, slot, &h, &v, &tc)) invalid++;
+		}
+	}
+	for (i = 0; i < nheld; i++) {
+		Record r;
+
+		// read again, the slot may have come out erased
+		if (record_parse(image + dump_slot(&h, held[i]), &r, h.sensors - 1) == 0
+				&& emit_slot(image, held[i], &h, &v, &tc))
+			invalid++;
+	}
+	if (invalid > 0) fprintf(stderr, "W: %d records failed the plausibility checks.\n", invalid);
+	free(state);
+	free(held);
+	return NULL;
+}
+
+/* start over after the eeprom did not acknowledge */
+static void reopen_station() {
+	double start;
+
+	close_weatherstation(ws);
+	start = util_now();
+	ws = open_weatherstation(serial_device);
+	bus.connect += util_now() - start;
+}
+
+/* read the bytes of a block the votes left in doubt (votes[]) again, in
+ * short reads of the runs of them. a byte two reads agree on is taken as
+ * it is, otherwise the read with the larger majority wins. returns the
+ * bytes still in doubt. */
+static int reread_doubtful(unsigned char* buf, unsigned char* votes, int address, int len) {
+	unsigned char again[REREAD_MAX], again_votes[REREAD_MAX];
+	int attempt, i, k, left = 0;
+
+	for (i = 0; i < len; i++) {
+		if (EEPROM_DOUBTFUL(votes[i], samples)) left++;
+	}
+	doubtful += left;
+
+	for (attempt = 0; attempt < REREAD_ATTEMPTS && left > 0; attempt++) {
+		for (i = 0; i < len; ) {
+			int start = i, end;
+
+			if (!EEPROM_DOUBTFUL(votes[i], samples)) {
+				i++;
+				continue;
+			}
+			for (end = ++i; i < len && i - start < REREAD_MAX && i - end < REREAD_GAP; i++) {
+				if (EEPROM_DOUBTFUL(votes[i], samples)) end = i + 1;
+			}
+			i = end;
+
+			nanodelay();
+			eeprom_seek(ws, address + start);
+			if (eeprom_read_votes(ws, again, again_votes, end - start, NULL, NULL) != end - start) {
+				// the eeprom is left in the middle of the read
+				fprintf(stderr, "W: eeprom ack failed, reading again after reopening.\n");
+				bus.ack_failures++;
+				bus.retries++;
+				reopen_station();
+				continue;
+			}
+			reread += end - start;
+			bus.bytes += end - start;
+
+			for (k = start; k < end; k++) {
+				unsigned char b = again[k - start];
+
+				if (!EEPROM_DOUBTFUL(votes[k], samples)) continue;
+				if (b == buf[k] || again_votes[k - start] > votes[k]) {
+					votes[k] = b == buf[k] ? samples : again_votes[k - start];
+					buf[k] = b;
+					if (!EEPROM_DOUBTFUL(votes[k], samples)) left--;
+				}
+			}
+		}
+	}
+	unresolved += left;
+	return left;
+}
+
+/* read len bytes at address into buf, in blocks. the station is reopened
+ * if the eeprom does not acknowledge. reads into the image are streamed
+ * to the writer thread as they go; with --samples, the bytes of a block
+ * in doubt are read again before their chunks go. returns -1 if bytes
+ * are missing. */
+static int read_range(unsigned char* buf, int address, int len, int streamed) {
+	static unsigned char votes[BLOCK_LEN];
+	int done = 0;
+	int retries = 0;
+	double start = util_now();
+
+	if (streamed) stream.pushed = address;
+	while (done < len) {
+		int got_len;
+		int this_len = BLOCK_LEN;
+		if (done + this_len > len)
+			this_len = len - done;
+
+		// nothing that may block while reading the image
+		if (!streamed)
+			fprintf(info, "   ... reading %d bytes beginning from %d\n", this_len, address + done);
+
+		nanodelay();
+		eeprom_seek(ws, address + done);
+		stream.base = address + done;
+		stream.votes = samples > 1 ? votes : NULL;
+		stream.held = 0;
+		got_len = eeprom_read_votes(ws, buf + done, samples > 1 ? votes : NULL, this_len,
+				streamed ? stream_notify : NULL, NULL);
+		if (got_len != this_len) {
+			if (got_len == -1) bus.ack_failures++;
+			if (got_len == -1 && retries < MAX_RETRIES) {
+				retries++;
+				bus.retries++;
+				fprintf(stderr, "W: eeprom ack failed, retrying read (retries left: %d).\n", MAX_RETRIES-retries);
+				reopen_station();
+				continue;
+			}
+			fprintf(info, "   >>> got     %d bytes\n", got_len);
+			bus.read += util_now() - start;
+			return -1;
+		}
+
+		// the chunks held back go once the block is settled
+		if (samples > 1) {
+			reread_doubtful(buf + done, votes, address + done, this_len);
+			stream.votes = NULL;
+			stream.held = 0;
+			if (streamed) stream_notify(this_len, NULL);
+		}
+		done += this_len;
+		bus.bytes += this_len;
+		retries = 0;
+	}
+	if (streamed) stream_flush(address + len);
+	bus.read += util_now() - start;
+	return 0;
+}
+
+static int read_file(const char* filename, unsigned char* data) {
+	FILE* f = fopen(filename, "r");
+	int ok;
+
+	if (f == NULL) return -1;
+	ok = fread(data, DUMP_LEN, 1, f) == 1;
+	fclose(f);
+	return ok ? 0 : -1;
+}
+
+/* decode all records of an image, indexed by slot; slots without a
+ * record get time 0 */
+static RecordBin* decode_slots(const unsigned char* data, const DumpHeader* h) {
+	RecordBin* out = malloc(h->records * sizeof(RecordBin));
+	RecordBin* slots = calloc(h->records, sizeof(RecordBin));
+	TimeCache tc;
+	int i, n;
+
+	if (out == NULL || slots == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	timecache_init(&tc);
+	n = dump_decode(data, DUMP_LEN, h, out, &tc);
+	for (i = 0; i < n; i++) slots[out[i].index] = out[i];
+	free(out);
+	return slots;
+}
+
+/* slot of the newest record, -1 if there is none */
+static int newest_slot(const RecordBin* slots, const DumpHeader* h) {
+	int newest = -1;
+	int i;
+
+	for (i = 0; i < h->records; i++) {
+		if (slots[i].time != 0 && (newest == -1 || slots[i].time > slots[newest].time))
+			newest = i;
+	}
+	return newest;
+}
+
+/* read only what was logged since prev was dumped (and the log reset): the
+ * header, prev's newest record to see it is still in place, the new records
+ * and the slot after them, which the station keeps erased. everything
+ * else is taken from prev. returns -1 if the image can not be put together
+ * that way, then the whole eeprom has to be read. */
+static int read_since(unsigned char* data, const unsigned char* prev) {
+	DumpHeader h, ph;
+	RecordBin* slots;
+	TimeCache tc;
+	time_t last = 0;
+	int newest, count, first, i;
+
+	memcpy(data, prev, DUMP_LEN);
+	if (read_range(data, 0, DUMP_DATA_OFFSET, 1) == -1) return -1;
+	if (dump_header(data, DUMP_LEN, &h) == -1 || dump_header(prev, DUMP_LEN, &ph) == -1
+			|| h.record_len != ph.record_len) {
+		fprintf(stderr, "I: the sensor count changed, reading everything.\n");
+		return -1;
+	}
+	// the station stops counting when the log overflows
+	if (h.overflow || h.log_count + 2 > h.records) {
+		fprintf(stderr, "I: %d records logged, reading everything.\n", h.log_count);
+		return -1;
+	}
+
+	slots = decode_slots(prev, &ph);
+	newest = newest_slot(slots, &ph);
+	free(slots);
+	if (newest == -1) return -1;
+
+	fprintf(info, "Reading %d new records.\n", h.log_count);
+	count = h.log_count + 2;
+	for (first = newest; count > 0; first = 0) {
+		int n = first + count > h.records ? h.records - first : count;
+
+		if (read_range(data + dump_slot(&h, first), dump_slot(&h, first), n * h.record_len, 1) == -1)
+			return -1;
+		count -= n;
+	}
+
+	// the new records have to follow prev's newest one
+	if (memcmp(data + dump_slot(&h, newest), prev + dump_slot(&h, newest), h.record_len) != 0) {
+		fprintf(stderr, "I: the newest record of the previous dump is gone, reading everything.\n");
+		return -1;
+	}
+	timecache_init(&tc);
+	for (i = 0; i <= h.log_count + 1; i++) {
+		const unsigned char* raw = data + dump_slot(&h, (newest + i) % h.records);
+		Record r;
+		time_t t;
+
+		if (i == h.log_count + 1) {
+			if ((raw[0] & 0xF0) != 0xF0) {
+				fprintf(stderr, "I: more records than counted, reading everything.\n");
+				return -1;
+			}
+			break;
+		}
+		if (record_parse(raw, &r, h.sensors - 1) == -1) {
+			fprintf(stderr, "I: fewer records than counted, reading everything.\n");
+			return -1;
+		}
+		t = record_time(&r, &tc);
+		if (i > 0 && t <= last) {
+			fprintf(stderr, "I: the new records are out of order, reading everything.\n");
+			return -1;
+		}
+		last = t;
+	}
+	return 0;
+}
+
+/* records logged between header before and the header of image after,
+ * -1 if unknown */
+static int logged_between(const unsigned char* before, const unsigned char* after,
+		double elapsed) {
+	DumpHeader h1, h2;
+	DumpInfo i1, i2;
+
+	if (dump_header(before, DUMP_DATA_OFFSET, &h1) == -1
+			|| dump_header(after, DUMP_LEN, &h2) == -1
+			|| h1.record_len != h2.record_len || h2.interval <= 0)
+		return -1;
+	// the station stops counting when the log overflows
+	if (!h2.overflow && h2.log_count + 2 <= h2.records && h2.log_count >= h1.log_count)
+		return h2.log_count - h1.log_count;
+	// otherwise by the time of the last record, or how long the read took
+	if (dump_info(before, DUMP_DATA_OFFSET, &i1) == 0 && dump_info(after, DUMP_DATA_OFFSET, &i2) == 0
+			&& i1.time != -1 && i2.time >= i1.time)
+		return (i2.time - i1.time + h2.interval * 60 - 1) / (h2.interval * 60);
+	return elapsed / (h2.interval * 60) + 1;
+}
+
+/* the station goes on logging while the image is read, so a slot near the
+ * newest record may come out half old and half new. if the header changed
+ * meanwhile, read the slots that can have been written since it was read
+ * again: the newest record it knew of, those logged after it and the erased
+ * slot after those; then the header, until it holds still. returns 1 if
+ * data is a consistent snapshot, 0 if not, -1 if a read failed. */
+static int read_consistent(unsigned char* data, double start) {
+	unsigned char before[DUMP_DATA_OFFSET];
+	int attempt;
+
+	for (attempt = 0; attempt < SNAPSHOT_ATTEMPTS; attempt++) {
+		RecordBin* slots;
+		DumpHeader h;
+		DumpInfo last;
+		int n, first, count, i;
+
+		memcpy(before, data, DUMP_DATA_OFFSET);
+		if (read_range(data, 0, DUMP_DATA_OFFSET, 1) == -1) return -1;
+		if (memcmp(before, data, DUMP_DATA_OFFSET) == 0) return 1;
+
+		n = logged_between(before, data, util_now() - start);
+		if (n == -1 || dump_header(data, DUMP_LEN, &h) == -1) {
+			fprintf(stderr, "W: the header changed while dumping, can't tell what was logged.\n");
+			return 0;
+		}
+		if (n + 2 > h.records) n = h.records - 2;
+
+		// the newest record before the read, by its time in the header
+		slots = decode_slots(data, &h);
+		first = -1;
+		if (dump_info(before, DUMP_DATA_OFFSET, &last) == 0 && last.time != -1) {
+			for (i = 0; i < h.records && first == -1; i++) {
+				if (slots[i].time == last.time) first = i;
+			}
+		}
+		count = n + 2;
+		if (first == -1) {
+			// or around the newest one in the image, either way
+			first = newest_slot(slots, &h);
+			if (first == -1) first = 0;
+			first = (first - n + h.records) % h.records;
+			count = 2 * n + 2 < h.records ? 2 * n + 2 : h.records;
+		}
+		free(slots);
+
+		fprintf(stderr, "I: %d records logged while dumping, reading %d slots again.\n", n, count);
+		while (count > 0) {
+			int k = first + count > h.records ? h.records - first : count;
+
+			if (read_range(data + dump_slot(&h, first), dump_slot(&h, first), k * h.record_len, 1) == -1)
+				return -1;
+			count -= k;
+			first = 0;
+		}
+	}
+	fprintf(stderr, "W: the station kept logging, the dump may hold a torn record.\n");
+	return 0;
+}
+
+/* a dump is only acknowledged if the header did not change while it was
+ * read (no record was logged meanwhile), the EOF marker is in place and
+ * the records logged since the last reset decode cleanly */
+static int verify_dump(const unsigned char* data) {
+	unsigned char header[DUMP_DATA_OFFSET];
+	RecordBin* slots;
+	DumpHeader h;
+	int newest, i, bad = 0;
+
+	if (read_range(header, 0, DUMP_DATA_OFFSET, 0) == -1) return -1;
+	if (memcmp(header, data, DUMP_DATA_OFFSET) != 0) {
+		fprintf(stderr, "W: the header changed while dumping.\n");
+		return -1;
+	}
+	if (data[DUMP_EOF_OFFSET] != 0x5A || data[DUMP_EOF_OFFSET + 1] != 0x2F
+			|| dump_header(data, DUMP_LEN, &h) == -1) {
+		fprintf(stderr, "W: the dump does not look like an eeprom image.\n");
+		return -1;
+	}
+
+	slots = decode_slots(data, &h);
+	newest = newest_slot(slots, &h);
+	for (i = 0; newest != -1 && i < h.log_count && i < h.records; i++) {
+		const RecordBin* b = &slots[(newest - i + h.records) % h.records];
+
+		if (b->time == 0 || (b->flags & (INVALID_TIME | INVALID_BCD))) bad++;
+	}
+	free(slots);
+	if (bad > 0) {
+		fprintf(stderr, "W: %d of the %d new records are damaged.\n", bad, h.log_count);
+		return -1;
+	}
+	return 0;
+}
+
+/* acknowledge the dumped records: zero the log count and clear the
+ * overflow flag, so the station counts only the records logged after
+ * this dump (and --since reads only those) */
+static int reset_log(const unsigned char* data) {
+	unsigned char now[FLAGS_OFFSET + 1];
+	unsigned char reset[3], check[3];
+
+	// one more record logged, and it would never be read
+	if (read_range(now, 0, sizeof(now), 0) == -1 || memcmp(now, data, sizeof(now)) != 0) {
+		fprintf(stderr, "W: a record was logged since the dump, not resetting the log.\n");
+		return -1;
+	}
+
+	reset[0] = reset[1] = 0x00;
+	reset[2] = data[FLAGS_OFFSET] & ~FLAG_OVERFLOW;
+	if (eeprom_write(ws, LOG_COUNT_OFFSET, reset, sizeof(reset)) != sizeof(reset)
+			|| read_range(check, LOG_COUNT_OFFSET, sizeof(check), 0) == -1
+			|| memcmp(check, reset, sizeof(check)) != 0) {
+		fprintf(stderr, "E: resetting the log failed.\n");
+		return -1;
+	}
+	fprintf(info, "Reset the log count (was %02x%02x).\n", data[LOG_COUNT_OFFSET + 1], data[LOG_COUNT_OFFSET]);
+	return 0;
+}
+
 int main(int argc, char *argv[]) {
-	WEATHERSTATION ws;
 	FILE *fileptr;
 	unsigned char data[BUFSIZE];
-
-	int start_adr, len;
-	int block_len = 1000;
-	int retries = 0;
+	unsigned char prev[BUFSIZE];
 	char* filename;
-	char* serial_device;
+	char* since = NULL;
+	char* decode = NULL;
+	char* station = NULL;
+	pthread_t writer;
+	double start = util_now(), connect, read_start;
+	int reset = 0;
+	int ok = 1;
+	int c;
+
+	static const struct option options[] = {
+		{ "since", required_argument, NULL, 's' },
+		{ "reset", no_argument, NULL, 'r' },
+		{ "decode", required_argument, NULL, 'd' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "publish", required_argument, NULL, 'p' },
+		{ "samples", required_argument, NULL, 'n' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	info = stdout;
+	stream.format = FORMAT_TEXT;
+	while ((c = getopt_long(argc, argv, "s:rd:f:p:n:", options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			since = optarg;
+			break;
+		case 'r':
+			reset = 1;
+			break;
+		case 'd':
+			decode = optarg;
+			break;
+		case 'f':
+			stream.format = output_format(optarg);
+			if (stream.format < 0) {
+				fprintf(stderr, "E: unknown output format %s\n", optarg);
+				print_usage();
+			}
+			break;
+		case 'p':
+			station = optarg;
+			break;
+		case 'n':
+			samples = atoi(optarg);
+			if (samples < 1 || samples > EEPROM_MAX_SAMPLES) {
+				fprintf(stderr, "E: samples must be 1..%d\n", EEPROM_MAX_SAMPLES);
+				print_usage();
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
 
-	if (argc != 2 && argc != 3) {
+	if (argc - optind != 1 && argc - optind != 2) {
 		fprintf(stderr, "E: no serial device specified.\n");
 		print_usage();
 	}
 
-	serial_device = argv[1];
+	serial_device = argv[optind];
 
-	if (argc >= 3) {
-		filename = argv[2];
+	if (argc - optind >= 2) {
+		filename = argv[optind + 1];
 	} else {
 		// generate filename based on current time
 		time_t t;
@@ -57,60 +746,114 @@ int main(int argc, char *argv[]) {
 		strftime(filename+strlen(filename), sizeof(filename)-strlen(filename), "%Y%m%d.%H%M", tm);
 	}
 
-	// need root for (timing) portio
-	if (geteuid() != 0) {
+	memset(prev, 0xFF, BUFSIZE);
+	if (since != NULL && read_file(since, prev) == -1) {
+		fprintf(stderr, "E: cannot read previous dump %s\n", since);
+		exit(EXIT_FAILURE);
+	}
+
+	if (decode != NULL && strcmp(decode, "-") == 0) {
+		// the records go to stdout, everything else to stderr
+		stream.out = stdout;
+		info = stderr;
+	} else if (decode != NULL) {
+		stream.out = fopen(decode, "w");
+		if (stream.out == NULL) {
+			fprintf(stderr, "E: cannot open %s\n", decode);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// need root for (timing) portio, but not for an emulator
+	if (!device_is_emulator(serial_device) && geteuid() != 0) {
 		fprintf(stderr, "E: this program needs root privileges to do direct port I/O.\n");
 		exit(EXIT_FAILURE);
 	}
 
 	// Setup serial port
+	eeprom_set_samples(samples);
+	bus.time = time(NULL);
+	connect = util_now();
 	ws = open_weatherstation(serial_device);
+	bus.connect += util_now() - connect;
 
 	// Setup file
 	fileptr = fopen(filename, "w");
 	if (fileptr == NULL) {
-		printf("Cannot open file %s\n", filename);
+		fprintf(info, "Cannot open file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	// the writer thread writes and decodes the image while it is read
+	stream.image = data;
+	stream.fd = fileno(fileptr);
+	atomic_init(&stream.done, 0);
+	if (ring_init(&stream.ring, RING_CHUNKS, sizeof(Chunk)) == -1
+			|| pthread_create(&writer, NULL, stream_writer, NULL) != 0) {
+		perror("E: starting the writer thread");
 		exit(EXIT_FAILURE);
 	}
 
 	// Start.
-	start_adr = 0;
-	len = 0x7FFF; // 1802*3; //(0x7ef4+259) - start_adr;
-	printf("Dumping %d bytes to %s.\n", len, filename);
+	read_start = util_now();
 	memset(data, 0xAA, BUFSIZE);
+	if (since == NULL || read_since(data, prev) == -1) {
+		memset(data, 0xAA, BUFSIZE);
+		fprintf(info, "Dumping %d bytes to %s.\n", DUMP_LEN, filename);
+		if (read_range(data, 0, DUMP_LEN, 1) == -1) {
+			fprintf(stderr, "E: got less than requested bytes, dump is probably unusable.\n");
+			ok = 0;
+		}
+	}
+	if (ok) {
+		int rc = read_consistent(data, read_start);
 
-	while (start_adr < len) {
-		int got_len;
-		int this_len = block_len;
-		if (start_adr + block_len > len)
-			this_len = len-start_adr;
+		if (rc == -1) {
+			fprintf(stderr, "E: reading the slots again failed, dump is probably unusable.\n");
+			ok = 0;
+		}
+		bus.consistent = rc == 1;
+	}
 
-		printf("   ... reading %d bytes beginning from %d\n", this_len, start_adr);
+	if (doubtful > 0) {
+		fprintf(stderr, "%s: %d bytes in doubt, %d bytes read again, %d still in doubt.\n",
+				unresolved > 0 ? "W" : "I", doubtful, reread, unresolved);
+	}
 
-		nanodelay();
-		eeprom_seek(ws, start_adr);
-		got_len = eeprom_read(ws, data+start_adr, this_len);
-		if (got_len != this_len) {
-			if (got_len == -1 && retries < MAX_RETRIES) {
-				retries++;
-				fprintf(stderr, "W: eeprom ack failed, retrying read (retries left: %d).\n", MAX_RETRIES-retries);
-				close_weatherstation(ws);
-				ws = open_weatherstation("/dev/ttyS0");
-				continue;
-			}
-			printf("   >>> got     %d bytes\n", got_len);
-			fprintf(stderr, "E: got less than requested bytes, dump is probably unusable.\n");
-			break;
-		}
+	bus.ok = ok;
+	atomic_store_explicit(&stream.done, 1, memory_order_release);
+	pthread_join(writer, NULL);
+	ring_free(&stream.ring);
 
-		start_adr += block_len;
-		retries = 0;
+	// the parts taken from the previous dump (or not read at all) were
+	// not streamed
+	if ((since != NULL || !ok || stream.dropped > 0)
+			&& pwrite(stream.fd, data, DUMP_LEN, 0) != DUMP_LEN && !stream.failed) {
+		perror("E: writing the dump");
+		stream.failed = 1;
 	}
+	if (fclose(fileptr) != 0 || stream.failed) ok = 0;
+	if (stream.out != NULL && stream.out != stdout) fclose(stream.out);
 
-	fwrite(data, len, 1, fileptr);
+	// how the bus did, next to the newest record ingest_tfa publishes, see
+	// latest.h
+	if (station != NULL) {
+		Latest latest;
+
+		if (latest_open(&latest, station, 1) == -1) {
+			fprintf(stderr, "W: can't open the shared memory of %s: %s\n", station, strerror(errno));
+		} else {
+			bus.duration = util_now() - start;
+			latest_publish_bus(&latest, &bus);
+			latest_close(&latest);
+		}
+	}
+
+	if (reset && ok) {
+		ok = verify_dump(data) == 0 && reset_log(data) == 0;
+		if (!ok) fprintf(stderr, "W: the log was not reset.\n");
+	}
 
 	close_weatherstation(ws);
-	fclose(fileptr);
-	return(0);
+	return ok ? 0 : 1;
 }
-
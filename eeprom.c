@@ -11,6 +11,9 @@
 
 #include "eeprom.h"
 
+/* looks at CTS per bit read, see eeprom_set_samples() */
+static int samples = 1;
+
 /********************************************************************
  * read_data reads data from the WS2300 based on a given address,
  * number of data read, and a an already open serial port
@@ -25,6 +28,43 @@
  *
  ********************************************************************/
 int eeprom_read(WEATHERSTATION ws, unsigned char *buf, size_t count) {
+  return eeprom_read_votes(ws, buf, NULL, count, NULL, NULL);
+}
+
+/********************************************************************
+ * eeprom_read_notify reads like eeprom_read, and calls notify after
+ * every byte, so a caller can pass on what is read while the rest
+ * of the transfer is still running. notify must not block, the
+ * eeprom does not wait.
+ *
+ * Inputs:  ws - handle of the open weather station
+ *          buf, count - where to read to, how many bytes
+ *          notify - called with the number of bytes in buf so far
+ *                   and arg, may be NULL
+ *
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+int eeprom_read_notify(WEATHERSTATION ws, unsigned char *buf, size_t count,
+                       void (*notify)(size_t done, void *arg), void *arg) {
+  return eeprom_read_votes(ws, buf, NULL, count, notify, arg);
+}
+
+/********************************************************************
+ * eeprom_read_votes reads like eeprom_read_notify, and tells how sure
+ * each byte is: the smallest majority any of its bits was read with,
+ * out of the samples set by eeprom_set_samples() (EEPROM_DOUBTFUL()).
+ *
+ * Inputs:  ws - handle of the open weather station
+ *          buf, count - where to read to, how many bytes
+ *          votes - count bytes for the majorities, may be NULL
+ *          notify, arg - as for eeprom_read_notify
+ *
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+int eeprom_read_votes(WEATHERSTATION ws, unsigned char *buf, unsigned char *votes,
+                      size_t count, void (*notify)(size_t done, void *arg), void *arg) {
   unsigned char command = 0xa1;
   int i;
 
@@ -32,7 +72,13 @@ int eeprom_read(WEATHERSTATION ws, unsigned char *buf, size_t count) {
     return -1;
 
   for (i = 0; i < count; i++) {
-    buf[i] = read_byte(ws);
+    int agree;
+
+    buf[i] = read_byte_votes(ws, &agree);
+    if (votes != NULL)
+      votes[i] = agree;
+    if (notify != NULL)
+      notify(i + 1, arg);
     if (i + 1 < count)
       read_next_byte_seq(ws);
     //printf("%i\n",readdata[i]);
@@ -42,10 +88,95 @@ int eeprom_read(WEATHERSTATION ws, unsigned char *buf, size_t count) {
   return i;
 }
 
+/********************************************************************
+ * eeprom_set_samples sets how many times CTS is looked at for every
+ * bit read (and acknowledge), spread over the high phase of the clock.
+ * The bit goes by the majority, so a marginal line has to be wrong
+ * more often than not to corrupt a byte. 1, the default, is the
+ * single look of old.
+ *
+ * Inputs:  n - samples per bit, 1..EEPROM_MAX_SAMPLES
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void eeprom_set_samples(int n) {
+  if (n < 1)
+    n = 1;
+  if (n > EEPROM_MAX_SAMPLES)
+    n = EEPROM_MAX_SAMPLES;
+  samples = n;
+}
+
 int eeprom_seek(WEATHERSTATION ws, off_t pos) {
   return write_data(ws, pos, 0, NULL);
 }
 
+/********************************************************************
+ * eeprom_write writes a buffer to the eeprom in page writes.
+ * Every write is split at the page boundaries (the address counter of
+ * the AT24C256 wraps around within a page), and after each page the
+ * write cycle is waited for by ACK polling instead of a fixed sleep.
+ *
+ * Inputs:  ws - handle of the open weather station
+ *          address - eeprom address to start at
+ *          buf, count - data to write
+ *
+ * Returns: number of bytes written, -1 if the eeprom did not
+ *          acknowledge or did not finish a write cycle
+ *
+ ********************************************************************/
+int eeprom_write(WEATHERSTATION ws, int address, const unsigned char *buf, size_t count) {
+  size_t done = 0;
+  char str[40];
+
+  while (done < count) {
+    int page_left = EEPROM_PAGE_SIZE - (address + done) % EEPROM_PAGE_SIZE;
+    int len = count - done < page_left ? count - done : page_left;
+    int ack, i;
+
+    sprintf(str,"Write page %i+%i",(int)(address + done),len);
+    print_log(2,str);
+
+    ack = write_byte(ws,0xa0);
+    ack = ack && write_byte(ws,(address + done) / 256);
+    ack = ack && write_byte(ws,(address + done) % 256);
+    for (i = 0; ack && i < len; i++)
+      ack = write_byte(ws,buf[done + i]);
+
+    // the stop condition starts the write cycle
+    stop_start_seq(ws);
+    if (!ack || eeprom_poll(ws) == -1)
+      return -1;
+    done += len;
+  }
+  return done;
+}
+
+/********************************************************************
+ * eeprom_poll waits for the end of a write cycle: while it runs, the
+ * eeprom does not acknowledge its address.
+ *
+ * Inputs:  ws - handle of the open weather station
+ *
+ * Returns: number of polls, -1 if the eeprom stayed busy for
+ *          EEPROM_WRITE_POLLS polls
+ *
+ ********************************************************************/
+int eeprom_poll(WEATHERSTATION ws) {
+  int i;
+
+  for (i = 1; i <= EEPROM_WRITE_POLLS; i++) {
+    int ack = write_byte(ws,0xa0);
+
+    stop_start_seq(ws);
+    if (ack)
+      return i;
+  }
+  print_log(1,"eeprom_poll timeout");
+  return -1;
+}
+
 
 /********************************************************************
  * write_data writes data to the WS2300.
@@ -83,16 +214,7 @@ int write_data(WEATHERSTATION ws, int address, int number, unsigned char *writed
     }
   }
   
-  set_DTR(ws,0);
-  nanodelay();
-  set_RTS(ws,0);
-  nanodelay();
-  set_RTS(ws,1);
-  nanodelay();
-  set_DTR(ws,1);
-  nanodelay();
-  set_RTS(ws,0);
-  nanodelay();
+  stop_start_seq(ws);
   
 //return -1 for errors
   return i;
@@ -121,6 +243,59 @@ void read_last_byte_seq(WEATHERSTATION ws) {
   nanodelay();
 }
 
+/********************************************************************
+ * stop_start_seq
+ * Ends a transfer with a stop condition and takes the bus again with a
+ * start condition, ready for the next control byte
+ *
+ * Inputs:  ws - handle of the open weather station
+ *
+ * Returns: nothing
+ *
+ ********************************************************************/
+void stop_start_seq(WEATHERSTATION ws) {
+  print_log(3,"stop_start_seq");
+  set_DTR(ws,0);
+  nanodelay();
+  set_RTS(ws,0);
+  nanodelay();
+  set_RTS(ws,1);
+  nanodelay();
+  set_DTR(ws,1);
+  nanodelay();
+  set_RTS(ws,0);
+  nanodelay();
+}
+
+/********************************************************************
+ * sample_CTS
+ * Looks at CTS samples times, a delay apart
+ *
+ * Inputs:  ws - handle of the open weather station
+ *
+ * Output:  agree - how many samples the majority had
+ *
+ * Returns: CTS by the majority
+ *
+ ********************************************************************/
+static int sample_CTS(WEATHERSTATION ws, int *agree) {
+  int high = 0;
+  int i;
+
+  if (samples == 1) {
+    *agree = 1;
+    return get_CTS(ws) != 0;
+  }
+
+  for (i = 0; i < samples; i++) {
+    if (i > 0)
+      nanodelay();
+    high += get_CTS(ws) != 0;
+  }
+  *agree = 2 * high > samples ? high : samples - high;
+  return 2 * high > samples;
+}
+
 /********************************************************************
  * read_bit  
  * Reads one bit from the COM
@@ -132,12 +307,29 @@ void read_last_byte_seq(WEATHERSTATION ws) {
  ********************************************************************/
 
 int read_bit(WEATHERSTATION ws) {
+  int agree;
+
+  return read_bit_votes(ws, &agree);
+}
+
+/********************************************************************
+ * read_bit_votes
+ * Reads one bit like read_bit, by the majority of the samples
+ *
+ * Inputs:  ws - handle of the open weather station
+ *
+ * Output:  agree - how many samples the majority had
+ *
+ * Returns: bit read from the COM
+ *
+ ********************************************************************/
+int read_bit_votes(WEATHERSTATION ws, int *agree) {
   int bit_value;
   char str[20];
   
   set_DTR(ws,0);
   nanodelay();
-  bit_value = get_CTS(ws);
+  bit_value = sample_CTS(ws, agree);
   nanodelay();
   set_DTR(ws,1);
   nanodelay();
@@ -182,14 +374,36 @@ void write_bit(WEATHERSTATION ws,int bit) {
  *
  ********************************************************************/
 int read_byte(WEATHERSTATION ws) {
+  int agree;
+
+  return read_byte_votes(ws, &agree);
+}
+
+/********************************************************************
+ * read_byte_votes
+ * Reads one byte like read_byte, bit by bit by the majority
+ *
+ * Inputs:  ws - handle of the open weather station
+ *
+ * Output:  agree - the smallest majority of its bits
+ *
+ * Returns: byte read from the COM
+ *
+ ********************************************************************/
+int read_byte_votes(WEATHERSTATION ws, int *agree) {
   int byte = 0;
   int i;
   char str[20];
   
+  *agree = samples;
   for (i = 0; i < 8; i++)
   {
+    int bit_agree;
+
     byte *= 2;
-    byte += read_bit(ws);
+    byte += read_bit_votes(ws, &bit_agree);
+    if (bit_agree < *agree)
+      *agree = bit_agree;
   }
   sprintf(str,"Read byte %i",byte);
   print_log(3,str);
@@ -208,7 +422,7 @@ int read_byte(WEATHERSTATION ws) {
  *
  ********************************************************************/
 int write_byte(WEATHERSTATION ws, int byte) {
-  int status;
+  int status, agree;
   int i;
   char str[20];
 
@@ -224,7 +438,7 @@ int write_byte(WEATHERSTATION ws, int byte) {
 
   set_RTS(ws,0);
   nanodelay();
-  status = get_CTS(ws);
+  status = sample_CTS(ws, &agree);
   //TODO: checking value of status, error routine
   nanodelay();
   set_DTR(ws,0);
@@ -16,13 +16,32 @@
 
 #define MAXRETRIES          20
 
+/* AT24C256: writes wrap around within a page, the write cycle after each
+ * page takes up to 5 ms */
+#define EEPROM_PAGE_SIZE    64
+#define EEPROM_WRITE_POLLS  200
+
+/* multi-sample reads, see eeprom_set_samples(): a byte is in doubt if one
+ * of its bits was outvoted by more than a quarter of the samples */
+#define EEPROM_MAX_SAMPLES  15
+#define EEPROM_DOUBTFUL(agree, samples) ((samples) - (agree) > (samples) / 4)
+
 
 /* Generic functions */
 
 int eeprom_read(WEATHERSTATION ws, unsigned char *buf, size_t count);
+int eeprom_read_notify(WEATHERSTATION ws, unsigned char *buf, size_t count,
+                       void (*notify)(size_t done, void *arg), void *arg);
+int eeprom_read_votes(WEATHERSTATION ws, unsigned char *buf, unsigned char *votes,
+                      size_t count, void (*notify)(size_t done, void *arg), void *arg);
+void eeprom_set_samples(int n);
 int eeprom_seek(WEATHERSTATION ws, off_t pos);
+int eeprom_write(WEATHERSTATION ws, int address, const unsigned char *buf, size_t count);
+int eeprom_poll(WEATHERSTATION ws);
+
 
 
+int device_is_emulator(char *device);
 
 WEATHERSTATION open_weatherstation(char *device);
 
@@ -37,10 +56,13 @@ int write_data(WEATHERSTATION ws, int address, int number,
 
 void read_next_byte_seq(WEATHERSTATION ws);
 void read_last_byte_seq(WEATHERSTATION ws);
+void stop_start_seq(WEATHERSTATION ws);
 
 int read_bit(WEATHERSTATION ws);
+int read_bit_votes(WEATHERSTATION ws, int *agree);
 void write_bit(WEATHERSTATION ws,int bit);
 int read_byte(WEATHERSTATION ws);
+int read_byte_votes(WEATHERSTATION ws, int *agree);
 int write_byte(WEATHERSTATION ws,int byte);
 void print_log(int log_level, char* str);
 
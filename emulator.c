@@ -0,0 +1,299 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "emulator.h"
+
+#define EEPROM_ADDRESS 0xA0
+
+/* states of the I2C slave */
+enum { IDLE, ADDRESS, ADDRESS_HI, ADDRESS_LO, WRITE, READ };
+
+static int64_t now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int rf_busy(const Emulator* e) {
+	if (e->o.busy_ms <= 0 || e->o.busy_period_ms <= 0) return 0;
+	return (now_us() / 1000 + e->busy_phase_ms) % e->o.busy_period_ms < e->o.busy_ms;
+}
+
+void emulator_init(Emulator* e, const unsigned char* image, const EmulatorOptions* o) {
+	unsigned int seed = o->seed;
+
+	memset(e, 0, sizeof(*e));
+	memcpy(e->image, image, EMULATOR_SIZE);
+	e->o = *o;
+	// the stations of a fleet are not busy all at once
+	if (o->busy_period_ms > 0) e->busy_phase_ms = rand_r(&seed) % o->busy_period_ms;
+	e->o.seed = seed;
+}
+
+/* the page written so far goes into the image, and the write cycle
+ * starts */
+static void commit(Emulator* e) {
+	int i;
+
+	if (e->state != WRITE || e->page_len == 0) return;
+	for (i = 0; i < e->page_len && i < sizeof(e->page); i++)
+		e->image[(e->page_start & ~63) | ((e->page_start + i) & 63)] = e->page[i];
+	e->bytes_written += e->page_len;
+	e->page_len = 0;
+	e->write_until_us = now_us() + EMULATOR_WRITE_CYCLE_US;
+}
+
+/* a byte received; returns 1 to acknowledge it */
+static int received(Emulator* e, int byte) {
+	switch (e->state) {
+	case ADDRESS:
+		if ((byte & 0xFE) != EEPROM_ADDRESS || now_us() < e->write_until_us || rf_busy(e)) {
+			e->nacks++;
+			e->state = IDLE;
+			return 0;
+		}
+		e->state = byte & 1 ? READ : ADDRESS_HI;
+		return 1;
+	case ADDRESS_HI:
+		e->address = (byte << 8) & (EMULATOR_SIZE - 1);
+		e->state = ADDRESS_LO;
+		return 1;
+	case ADDRESS_LO:
+		e->address |= byte;
+		e->page_start = e->address;
+		e->page_len = 0;
+		e->state = WRITE;
+		return 1;
+	case WRITE:
+		// the address counter wraps around within the page
+		if (e->page_len < sizeof(e->page)) e->page[e->page_len++] = byte;
+		return 1;
+	}
+	return 0;
+}
+
+static void clock_rise(Emulator* e, int sda) {
+	if (e->state == IDLE) return;
+	if (e->state == READ) {
+		if (e->bit < 8) e->bit++;
+		else if (e->bit == 8) {
+			e->nack = sda;
+			e->bit = 9;
+		}
+		return;
+	}
+	if (e->bit < 8) {
+		e->shift = (e->shift << 1) | sda;
+		if (++e->bit == 8) e->ack = received(e, e->shift & 0xFF);
+	} else if (e->bit == 8) {
+		e->bit = 9;
+	}
+}
+
+static void clock_fall(Emulator* e) {
+	if (e->state == IDLE) {
+		e->slave_sda = 1;
+		return;
+	}
+	if (e->state == READ && e->bit < 8 && e->ack == 0) {
+		// shift out the next bit of the byte read
+		e->slave_sda = (e->image[e->address] >> (7 - e->bit)) & 1;
+	} else if (e->state == READ && e->bit == 8 && e->ack == 0) {
+		// the master ACKs
+		e->slave_sda = 1;
+	} else if (e->bit == 8) {
+		e->slave_sda = !e->ack;
+	} else if (e->bit == 9) {
+		e->bit = 0;
+		e->shift = 0;
+		if (e->state == READ && e->ack) {
+			// the ACK of the read address: the first byte goes out
+			e->ack = 0;
+		} else if (e->state == READ && e->nack) {
+			e->state = IDLE;
+			e->slave_sda = 1;
+			return;
+		} else if (e->state == READ) {
+			e->address = (e->address + 1) & (EMULATOR_SIZE - 1);
+		}
+		if (e->state == READ) {
+			e->bytes_read++;
+			e->slave_sda = e->image[e->address] >> 7;
+		} else {
+			e->slave_sda = 1;
+		}
+	}
+}
+
+/* apply a line change of the host, and what the slave makes of it */
+static void change(Emulator* e, int scl, int sda) {
+	int bus_sda = e->sda && e->slave_sda;
+	int new_sda = sda && e->slave_sda;
+
+	e->changes++;
+	if (e->scl && scl && bus_sda != new_sda) {
+		// START (SDA falls) or STOP (SDA rises) while SCL is high. the
+		// host ends a page write with stop_start_seq(), where the
+		// START follows a clock pulse instead of a STOP; either one
+		// ends the write.
+		commit(e);
+		e->state = new_sda ? IDLE : ADDRESS;
+		e->bit = 0;
+		e->shift = 0;
+		e->ack = 0;
+		e->slave_sda = 1;
+	} else if (!e->scl && scl) {
+		clock_rise(e, new_sda);
+	} else if (e->scl && !scl) {
+		e->scl = scl;
+		e->sda = sda;
+		clock_fall(e);
+		return;
+	}
+	e->scl = scl;
+	e->sda = sda;
+}
+
+static int status(Emulator* e) {
+	int s = 0;
+
+	e->status++;
+	// the station answers the 'U's on TxD with a pulse on DSR (pulling
+	// SCL down), once it is done with RF reception
+	if (e->handshake == 1 && e->scl && e->sda && !rf_busy(e)) {
+		e->handshake = 2;
+		s |= EMULATOR_DSR;
+	} else if (!e->scl) {
+		s |= EMULATOR_DSR;
+	}
+	if (!(e->sda && e->slave_sda)) s |= EMULATOR_CTS;
+	if (e->o.noise_ppm > 0 && rand_r(&e->o.seed) % 1000000 < e->o.noise_ppm) {
+		s ^= EMULATOR_CTS;
+		e->flips++;
+	}
+
+	if (e->o.jitter_us > 0) {
+		int us = rand_r(&e->o.seed) % (e->o.jitter_us + 1);
+		struct timespec ts = { 0, us * 1000L };
+
+		nanosleep(&ts, NULL);
+	}
+	return s;
+}
+
+int emulator_listen(const char* path) {
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+	if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1 || listen(fd, 1) == -1) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+/* one connection, until the host closes it */
+static void serve(Emulator* e, int fd) {
+	unsigned char buf[4096];
+	ssize_t len;
+
+	// lines released, bus idle
+	e->scl = e->sda = e->slave_sda = 1;
+	e->handshake = 0;
+	e->state = IDLE;
+	e->bit = 0;
+	e->connections++;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0 || (len == -1 && errno == EINTR)) {
+		ssize_t i;
+
+		for (i = 0; i < len; i++) {
+			int c = buf[i];
+
+			if (c < 0x80) {
+				if (e->handshake == 0) e->handshake = 1;
+			} else if ((c & ~1) == EMULATOR_DTR) {
+				change(e, !(c & 1), e->sda);
+			} else if ((c & ~1) == EMULATOR_RTS) {
+				change(e, e->scl, !(c & 1));
+			} else if (c == EMULATOR_STATUS) {
+				unsigned char s = status(e);
+
+				if (write(fd, &s, 1) != 1) return;
+			}
+		}
+	}
+}
+
+int emulator_serve(Emulator* e, int fd) {
+	for (;;) {
+		int c = accept(fd, NULL, NULL);
+
+		if (c == -1 && errno == EINTR) continue;
+		if (c == -1) return -1;
+		serve(e, c);
+		close(c);
+	}
+}
+
+int emulator_connect(const char* path) {
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+	if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+void emulator_line(int fd, int command) {
+	unsigned char c = command;
+
+	while (write(fd, &c, 1) == -1 && errno == EINTR);
+}
+
+int emulator_status(int fd) {
+	unsigned char c = EMULATOR_STATUS;
+	ssize_t len;
+
+	emulator_line(fd, c);
+	while ((len = read(fd, &c, 1)) == -1 && errno == EINTR);
+	return len == 1 ? c : 0;
+}
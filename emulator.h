@@ -0,0 +1,91 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_EMULATOR_H_
+#define _INCLUDE_EMULATOR_H_
+
+#include <stdint.h>
+
+/* Emulated Klima Logger, for load tests without hardware (fleet_tfa).
+ *
+ * A pty has no modem control lines, so the emulator listens on a unix
+ * socket instead of a serial port; open_weatherstation() connects to it
+ * when the device is a socket, and the four lines go over the connection
+ * one byte per change: bytes below 0x80 are data on TxD, EMULATOR_DTR and
+ * EMULATOR_RTS (| 1 to set) change a line, EMULATOR_STATUS asks for DSR
+ * and CTS, which come back as one byte. Every change and every look at a
+ * line costs the host a system call, like the ioctl()s on a serial port.
+ *
+ * Behind the lines is the protocol of documentation.txt: DSR answers the
+ * 'U's on TxD with a pulse, and DTR/RTS (inverted SCL/SDA) drive an I2C
+ * slave at address 0xA0 in front of the 32k image, with sequential reads,
+ * page writes and the 5 ms write cycle, during which the address is not
+ * acknowledged. The station is busy with RF reception for busy_ms of
+ * every busy_period_ms: the handshake waits for the end of it, and the
+ * address is not acknowledged either. Status answers are delayed by up
+ * to jitter_us, and noise_ppm per million of them have CTS flipped, like a
+ * marginal line.
+ */
+
+#define EMULATOR_SIZE 0x8000
+
+#define EMULATOR_DTR    0x80    /* | 1: set */
+#define EMULATOR_RTS    0x82
+#define EMULATOR_STATUS 0x84
+/* bits of the status answer */
+#define EMULATOR_DSR    0x01
+#define EMULATOR_CTS    0x02
+
+#define EMULATOR_WRITE_CYCLE_US 5000
+
+typedef struct _EmulatorOptions {
+	int jitter_us;
+	int noise_ppm;
+	int busy_ms;
+	int busy_period_ms;
+	unsigned int seed;
+} EmulatorOptions;
+
+typedef struct _Emulator {
+	unsigned char image[EMULATOR_SIZE];
+	EmulatorOptions o;
+	int64_t busy_phase_ms;  /* where in the busy period the station started */
+	/* lines as the host drives them, 1 = SCL (SDA) released */
+	int scl, sda;
+	int slave_sda;          /* 0 while the slave pulls SDA down */
+	int handshake;          /* 0 no request, 1 requested, 2 answered */
+	/* I2C slave */
+	int state;
+	int bit;                /* clock pulses of the byte so far, 9 with ACK */
+	int shift;
+	int ack;
+	int nack;               /* by the master, after a byte read */
+	int address;
+	unsigned char page[64];
+	int page_start, page_len;
+	int64_t write_until_us; /* end of the write cycle */
+	/* counters */
+	uint64_t connections;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t nacks;         /* addresses not acknowledged */
+	uint64_t changes;       /* line changes */
+	uint64_t status;        /* status requests */
+	uint64_t flips;         /* status answers with CTS flipped */
+} Emulator;
+
+extern void emulator_init(Emulator* e, const unsigned char* image, const EmulatorOptions* o);
+
+/* listen on a unix socket at path. returns the socket, -1 on failure. */
+extern int emulator_listen(const char* path);
+
+/* serve the connections to listening socket fd one after the other (a
+ * station has one cable) until killed. returns -1 if accept() fails. */
+extern int emulator_serve(Emulator* e, int fd);
+
+/* host side, for linux3600.c: connect to the emulator at path, change a
+ * line, and get the DSR/CTS status bits */
+extern int emulator_connect(const char* path);
+extern void emulator_line(int fd, int command);
+extern int emulator_status(int fd);
+
+#endif /* _INCLUDE_EMULATOR_H_ */
@@ -0,0 +1,389 @@
+/* vim:set expandtab! ts=4: */
+
+/* fleet_tfa - load test of the serial stack against a fleet of emulated
+ * stations (see emulator.h), to size collection hosts without hardware.
+ *
+ * For every station count, that many emulators are started, each on its
+ * own socket with its own image, and the command is run against each of
+ * them, all at once, --runs times in a row; {} in the command stands for
+ * the socket of the station and {n} for its number. The output of the
+ * commands goes to <dir>/station.<n>.log. For each station count it
+ * reports the bytes read off the emulated eeproms per second, the CPU the
+ * commands took per station (in % of one CPU), the CPU of the emulators,
+ * the addresses they did not acknowledge, and the latency of the runs.
+ *
+ * With --serve it runs one emulated station on a socket until killed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "dump.h"
+#include "synth.h"
+#include "emulator.h"
+#include "util.h"
+
+#define MAX_STATIONS 1024
+#define MAX_COUNTS 32
+
+typedef struct _Station {
+	pid_t emulator;
+	pid_t collector;
+	int runs;               /* done */
+	double start;           /* of the running one */
+	char path[4096];
+} Station;
+
+static void print_usage() {
+	fprintf(stderr, "Usage: fleet_tfa [--stations 1,2,4,8] [--runs n] [--image dump] [--sensors n] [--jitter us] [--noise ppm] [--busy ms/period_ms] [--dir dir] -- <command> [<arg>|{}|{n}]...\n");
+	fprintf(stderr, "       fleet_tfa --serve <socket> [--image dump] [--sensors n] [--jitter us] [--noise ppm] [--busy ms/period_ms]\n");
+	fprintf(stderr, "  {} is the socket of a station, {n} its number\n");
+	exit(EXIT_FAILURE);
+}
+
+static double cpu_seconds(const struct rusage* ru) {
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+		+ ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static int compare_double(const void* a, const void* b) {
+	double da = *(const double*)a, db = *(const double*)b;
+
+	return da < db ? -1 : da > db;
+}
+
+/* the image of station n: the dump, or a synthetic one with a full log */
+static int make_image(unsigned char* image, const char* dump, int sensors, int n) {
+	unsigned int seed = n + 1;
+	SynthOptions o;
+	DumpHeader h;
+
+	memset(image, 0xFF, EMULATOR_SIZE);
+	if (dump != NULL) {
+		FILE* f = fopen(dump, "r");
+		size_t len;
+
+		if (f == NULL) return -1;
+		len = fread(image, 1, EMULATOR_SIZE, f);
+		fclose(f);
+		return len >= DUMP_DATA_OFFSET ? 0 : -1;
+	}
+
+	memset(&o, 0, sizeof(o));
+	o.sensors = sensors;
+	o.records = 1;
+	o.interval = 1;
+	o.gap_percent = 1;
+	o.partial_percent = 25;
+	synth_image(image, &o, &seed);
+	dump_header(image, SYNTH_IMAGE_SIZE, &h);
+	o.records = h.records - 1;
+	o.start = time(NULL) - o.records * h.interval * 60;
+	synth_image(image, &o, &seed);
+	return 0;
+}
+
+static pid_t start_emulator(Emulator* e, const char* path) {
+	int fd = emulator_listen(path);
+	pid_t pid;
+
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	pid = fork();
+	if (pid == 0) {
+		emulator_serve(e, fd);
+		perror("E: emulator");
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+	return pid;
+}
+
+/* arg with {} and {n} replaced, in a new string */
+static char* expand(const char* arg, const char* path, int n) {
+	size_t len = strlen(arg) + 1;
+	const char* p;
+	char* out;
+	char* q;
+
+	for (p = strchr(arg, '{'); p != NULL; p = strchr(p + 1, '{'))
+		len += strlen(path) + 16;
+	q = out = malloc(len);
+	if (out == NULL) return NULL;
+	for (p = arg; *p != 0; ) {
+		if (strncmp(p, "{}", 2) == 0) {
+			q += sprintf(q, "%s", path);
+			p += 2;
+		} else if (strncmp(p, "{n}", 3) == 0) {
+			q += sprintf(q, "%d", n);
+			p += 3;
+		} else {
+			*q++ = *p++;
+		}
+	}
+	*q = 0;
+	return out;
+}
+
+static pid_t start_collector(char** command, const Station* s, int n, const char* dir) {
+	char* argv[256];
+	char log[4096];
+	pid_t pid;
+	int i, fd;
+
+	pid = fork();
+	if (pid == 0) {
+		for (i = 0; command[i] != NULL && i < 255; i++) {
+			argv[i] = expand(command[i], s->path, n);
+			if (argv[i] == NULL) _exit(127);
+		}
+		argv[i] = NULL;
+
+		snprintf(log, sizeof(log), "%s/station.%d.log", dir, n);
+		fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd != -1) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	return pid;
+}
+
+/* n stations, runs runs each. returns -1 if they could not be started. */
+static int fleet(int n, int runs, Emulator* emulators, Station* stations,
+		char** command, const char* dir) {
+	double* latency = malloc(n * runs * sizeof(double));
+	double start, wall, cpu = 0, emulator_cpu = 0;
+	uint64_t bytes = 0, nacks = 0;
+	struct rusage ru;
+	int active = 0, done = 0, failed = 0;
+	int i, status;
+	pid_t pid;
+
+	if (latency == NULL) return -1;
+	for (i = 0; i < n; i++) {
+		Station* s = &stations[i];
+
+		snprintf(s->path, sizeof(s->path), "%s/station.%d", dir, i);
+		s->emulator = start_emulator(&emulators[i], s->path);
+		if (s->emulator == -1) return -1;
+		s->runs = 0;
+	}
+
+	start = util_now();
+	for (i = 0; i < n; i++) {
+		stations[i].start = util_now();
+		stations[i].collector = start_collector(command, &stations[i], i, dir);
+		if (stations[i].collector != -1) active++;
+	}
+	while (active > 0 && (pid = wait4(-1, &status, 0, &ru)) != -1) {
+		Station* s = NULL;
+
+		for (i = 0; i < n && s == NULL; i++) {
+			if (stations[i].collector == pid) s = &stations[i];
+			else if (stations[i].emulator == pid) {
+				fprintf(stderr, "E: the emulator of station %d died.\n", i);
+				stations[i].emulator = -1;
+			}
+		}
+		if (s == NULL) continue;
+
+		latency[done++] = util_now() - s->start;
+		cpu += cpu_seconds(&ru);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+		if (++s->runs < runs) {
+			s->start = util_now();
+			s->collector = start_collector(command, s, s - stations, dir);
+			if (s->collector != -1) continue;
+		}
+		s->collector = -1;
+		active--;
+	}
+	wall = util_now() - start;
+
+	for (i = 0; i < n; i++) {
+		if (stations[i].emulator == -1) continue;
+		kill(stations[i].emulator, SIGTERM);
+		if (wait4(stations[i].emulator, &status, 0, &ru) != -1) emulator_cpu += cpu_seconds(&ru);
+		unlink(stations[i].path);
+		bytes += emulators[i].bytes_read;
+		nacks += emulators[i].nacks;
+	}
+
+	if (done == 0) {
+		free(latency);
+		return -1;
+	}
+	qsort(latency, done, sizeof(double), compare_double);
+	printf("%8d %6d %6d %8.1f %8.2f %8.1f %8.1f %8llu %8.2f %8.2f %8.2f %8.2f\n",
+			n, done, failed, wall, bytes / wall / 1024, cpu / wall / n * 100,
+			emulator_cpu / wall * 100, (unsigned long long)nacks,
+			latency[done / 2], latency[done * 9 / 10], latency[done * 99 / 100],
+			latency[done - 1]);
+	fflush(stdout);
+	free(latency);
+	return 0;
+}
+
+/* "busy_ms/period_ms" */
+static void parse_busy(const char* arg, EmulatorOptions* o) {
+	if (sscanf(arg, "%d/%d", &o->busy_ms, &o->busy_period_ms) != 2
+			|| o->busy_ms < 0 || o->busy_period_ms <= o->busy_ms) {
+		fprintf(stderr, "E: --busy wants <ms>/<period in ms>\n");
+		print_usage();
+	}
+}
+
+int main(int argc, char *argv[]) {
+	static unsigned char image[EMULATOR_SIZE];
+	int counts[MAX_COUNTS];
+	EmulatorOptions o;
+	Emulator* emulators;
+	Station* stations;
+	const char* dump = NULL;
+	const char* serve = NULL;
+	char* list = "1,2,4,8";
+	char* dir = NULL;
+	char* p;
+	int ncounts = 0, max = 0;
+	int runs = 3;
+	int sensors = 5;
+	int c, i;
+
+	static const struct option options[] = {
+		{ "stations", required_argument, NULL, 'n' },
+		{ "runs", required_argument, NULL, 'r' },
+		{ "image", required_argument, NULL, 'i' },
+		{ "sensors", required_argument, NULL, 's' },
+		{ "jitter", required_argument, NULL, 'j' },
+		{ "noise", required_argument, NULL, 'N' },
+		{ "busy", required_argument, NULL, 'b' },
+		{ "dir", required_argument, NULL, 'd' },
+		{ "serve", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	memset(&o, 0, sizeof(o));
+	o.seed = time(NULL);
+	while ((c = getopt_long(argc, argv, "+n:r:i:s:j:N:b:d:S:", options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			list = optarg;
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'i':
+			dump = optarg;
+			break;
+		case 's':
+			sensors = atoi(optarg);
+			break;
+		case 'j':
+			o.jitter_us = atoi(optarg);
+			break;
+		case 'N':
+			o.noise_ppm = atoi(optarg);
+			break;
+		case 'b':
+			parse_busy(optarg, &o);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'S':
+			serve = optarg;
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (runs < 1 || sensors < 1 || sensors > RECORD_SENSORS || o.jitter_us < 0
+			|| o.noise_ppm < 0 || o.noise_ppm > 1000000) print_usage();
+
+	if (serve != NULL) {
+		Emulator* e = malloc(sizeof(Emulator));
+		int fd;
+
+		if (optind != argc || e == NULL) print_usage();
+		if (make_image(image, dump, sensors, 0) == -1) {
+			fprintf(stderr, "E: cannot read %s\n", dump);
+			exit(EXIT_FAILURE);
+		}
+		emulator_init(e, image, &o);
+		fd = emulator_listen(serve);
+		if (fd == -1) {
+			perror(serve);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "I: emulated station on %s.\n", serve);
+		emulator_serve(e, fd);
+		perror("E: emulator");
+		return 1;
+	}
+	if (optind == argc) print_usage();
+
+	for (p = strtok(list, ","); p != NULL && ncounts < MAX_COUNTS; p = strtok(NULL, ",")) {
+		counts[ncounts] = atoi(p);
+		if (counts[ncounts] < 1 || counts[ncounts] > MAX_STATIONS) print_usage();
+		if (counts[ncounts] > max) max = counts[ncounts];
+		ncounts++;
+	}
+	if (ncounts == 0) print_usage();
+
+	if (dir == NULL) {
+		static char tmp[] = "/tmp/fleet_tfa.XXXXXX";
+
+		dir = mkdtemp(tmp);
+		if (dir == NULL) {
+			perror("mkdtemp");
+			exit(EXIT_FAILURE);
+		}
+	} else if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "I: sockets and logs in %s.\n", dir);
+
+	// the emulators count into shared memory, for the report
+	emulators = mmap(NULL, max * sizeof(Emulator), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	stations = calloc(max, sizeof(Station));
+	if (emulators == MAP_FAILED || stations == NULL) {
+		perror("E: memory");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("stations   runs failed   wall/s     kB/s  cpu/st%%   emu%%     nacks   p50/s    p90/s    p99/s    max/s\n");
+	for (c = 0; c < ncounts; c++) {
+		for (i = 0; i < counts[c]; i++) {
+			EmulatorOptions so = o;
+
+			if (make_image(image, dump, sensors, i) == -1) {
+				fprintf(stderr, "E: cannot read %s\n", dump);
+				exit(EXIT_FAILURE);
+			}
+			so.seed = o.seed + i;
+			emulator_init(&emulators[i], image, &so);
+		}
+		if (fleet(counts[c], runs, emulators, stations, argv + optind, dir) == -1)
+			exit(EXIT_FAILURE);
+	}
+	return 0;
+}
@@ -0,0 +1,341 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "graph.h"
+
+static const unsigned char palette[GRAPH_COLORS][3] = {
+	{ 0xF0, 0xF0, 0xF0 },   /* GRAPH_BACK */
+	{ 0xFF, 0xFF, 0xFF },   /* GRAPH_CANVAS */
+	{ 0xC8, 0xC8, 0xC8 },   /* GRAPH_GRID */
+	{ 0xE0, 0x90, 0x90 },   /* GRAPH_MGRID */
+	{ 0x00, 0x00, 0x00 },   /* GRAPH_FONT */
+	{ 0x40, 0x40, 0x40 },   /* GRAPH_FRAME */
+	{ 0xFF, 0x00, 0x00 },   /* GRAPH_RED */
+	{ 0x00, 0xFF, 0x00 },   /* GRAPH_GREEN */
+};
+
+/* 5x7 font for ' ' to '~', one byte per column, bit 0 is the top row */
+static const unsigned char font[95][5] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 },
+	{ 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 },
+	{ 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+	{ 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },
+	{ 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 },
+	{ 0x14, 0x08, 0x3E, 0x08, 0x14 }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+	{ 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 },
+	{ 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },
+	{ 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 },
+	{ 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 },
+	{ 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 },
+	{ 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E },
+	{ 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },
+	{ 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+	{ 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },
+	{ 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E },
+	{ 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+	{ 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 },
+	{ 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x49, 0x49, 0x7A },
+	{ 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 },
+	{ 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 },
+	{ 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x0C, 0x02, 0x7F },
+	{ 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+	{ 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E },
+	{ 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 },
+	{ 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F },
+	{ 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F },
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 },
+	{ 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 },
+	{ 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 },
+	{ 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },
+	{ 0x7F, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 },
+	{ 0x38, 0x44, 0x44, 0x48, 0x7F }, { 0x38, 0x54, 0x54, 0x54, 0x18 },
+	{ 0x08, 0x7E, 0x09, 0x01, 0x02 }, { 0x0C, 0x52, 0x52, 0x52, 0x3E },
+	{ 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 },
+	{ 0x20, 0x40, 0x44, 0x3D, 0x00 }, { 0x7F, 0x10, 0x28, 0x44, 0x00 },
+	{ 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x18, 0x04, 0x78 },
+	{ 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 },
+	{ 0x7C, 0x14, 0x14, 0x14, 0x08 }, { 0x08, 0x14, 0x14, 0x18, 0x7C },
+	{ 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+	{ 0x04, 0x3F, 0x44, 0x40, 0x20 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C },
+	{ 0x1C, 0x20, 0x40, 0x20, 0x1C }, { 0x3C, 0x40, 0x30, 0x40, 0x3C },
+	{ 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0C, 0x50, 0x50, 0x50, 0x3C },
+	{ 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 },
+	{ 0x00, 0x00, 0x7F, 0x00, 0x00 }, { 0x00, 0x41, 0x36, 0x08, 0x00 },
+	{ 0x08, 0x04, 0x08, 0x10, 0x08 },
+};
+
+int graph_image_init(GraphImage* img, int width, int height) {
+	img->width = width;
+	img->height = height;
+	img->pixels = malloc((size_t)width * height);
+	if (img->pixels == NULL) return -1;
+	memset(img->pixels, GRAPH_BACK, (size_t)width * height);
+	return 0;
+}
+
+void graph_image_free(GraphImage* img) {
+	free(img->pixels);
+	img->pixels = NULL;
+}
+
+static inline void plot(GraphImage* img, int x, int y, int color) {
+	if (x < 0 || y < 0 || x >= img->width || y >= img->height) return;
+	img->pixels[y * img->width + x] = color;
+}
+
+void graph_fill(GraphImage* img, int x, int y, int w, int h, int color) {
+	int i, j;
+
+	for (j = y; j < y + h; j++) {
+		for (i = x; i < x + w; i++) plot(img, i, j, color);
+	}
+}
+
+void graph_line(GraphImage* img, int x0, int y0, int x1, int y1,
+		int color, int width) {
+	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy, e2;
+
+	// bresenham, with a width x width pen
+	for (;;) {
+		graph_fill(img, x0, y0, width, width, color);
+		if (x0 == x1 && y0 == y1) break;
+		e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+void graph_hgrid(GraphImage* img, int x0, int x1, int y, int color) {
+	int x;
+
+	for (x = x0; x <= x1; x += 2) plot(img, x, y, color);
+}
+
+void graph_vgrid(GraphImage* img, int x, int y0, int y1, int color) {
+	int y;
+
+	for (y = y0; y <= y1; y += 2) plot(img, x, y, color);
+}
+
+static const unsigned char* glyph(char c) {
+	if (c < ' ' || c > '~') c = '?';
+	return font[c - ' '];
+}
+
+int graph_text(GraphImage* img, int x, int y, const char* s, int color) {
+	int x0 = x;
+	int i, j;
+
+	for (; *s; s++, x += GRAPH_FONT_W) {
+		const unsigned char* g = glyph(*s);
+
+		for (i = 0; i < 5; i++) {
+			for (j = 0; j < 7; j++) {
+				if (g[i] & (1 << j)) plot(img, x + i, y + j, color);
+			}
+		}
+	}
+	return x - x0;
+}
+
+int graph_text_up(GraphImage* img, int x, int y, const char* s, int color) {
+	int y0 = y;
+	int i, j;
+
+	for (; *s; s++, y -= GRAPH_FONT_W) {
+		const unsigned char* g = glyph(*s);
+
+		for (i = 0; i < 5; i++) {
+			for (j = 0; j < 7; j++) {
+				if (g[i] & (1 << j)) plot(img, x + j, y - i, color);
+			}
+		}
+	}
+	return y0 - y;
+}
+
+int graph_text_width(const char* s) {
+	return strlen(s) * GRAPH_FONT_W;
+}
+
+static int write_chunk(FILE* f, const char* type, const unsigned char* data,
+		uint32_t len) {
+	uint32_t n = htonl(len);
+	uLong crc;
+
+	crc = crc32(0, (const Bytef*)type, 4);
+	if (len > 0) crc = crc32(crc, data, len);
+	crc = htonl(crc);
+
+	if (fwrite(&n, 4, 1, f) != 1 || fwrite(type, 4, 1, f) != 1) return -1;
+	if (len > 0 && fwrite(data, len, 1, f) != 1) return -1;
+	if (fwrite(&crc, 4, 1, f) != 1) return -1;
+	return 0;
+}
+
+int graph_write_png(GraphImage* img, const char* path) {
+	static const unsigned char signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+	};
+	unsigned char ihdr[13];
+	size_t row = img->width + 1;
+	size_t raw_len = row * img->height;
+	unsigned char* raw;
+	unsigned char* packed;
+	uLongf packed_len = compressBound(raw_len);
+	char tmp[4096];
+	uint32_t v;
+	FILE* f;
+	int y, rc = -1;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	raw = malloc(raw_len);
+	packed = malloc(packed_len);
+	if (raw == NULL || packed == NULL) {
+		free(raw);
+		free(packed);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// every row is prefixed with filter type 0 (none)
+	for (y = 0; y < img->height; y++) {
+		raw[y * row] = 0;
+		memcpy(raw + y * row + 1, img->pixels + y * img->width, img->width);
+	}
+	if (compress2(packed, &packed_len, raw, raw_len, Z_BEST_SPEED) != Z_OK) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	v = htonl(img->width);
+	memcpy(ihdr, &v, 4);
+	v = htonl(img->height);
+	memcpy(ihdr + 4, &v, 4);
+	ihdr[8] = 8;            // bit depth
+	ihdr[9] = 3;            // indexed color
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	f = fopen(tmp, "w");
+	if (f == NULL) goto out;
+	if (fwrite(signature, sizeof(signature), 1, f) != 1
+			|| write_chunk(f, "IHDR", ihdr, sizeof(ihdr)) == -1
+			|| write_chunk(f, "PLTE", &palette[0][0], sizeof(palette)) == -1
+			|| write_chunk(f, "IDAT", packed, packed_len) == -1
+			|| write_chunk(f, "IEND", NULL, 0) == -1) {
+		fclose(f);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(f) != 0 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		goto out;
+	}
+	rc = 0;
+
+out:
+	free(raw);
+	free(packed);
+	return rc;
+}
+
+void graph_minmax(const int64_t* time, const float* value, long n,
+		int64_t start, int64_t end, int width, GraphColumn* cols) {
+	long i;
+	int x;
+
+	memset(cols, 0, width * sizeof(GraphColumn));
+	if (end <= start) return;
+
+	for (i = 0; i < n; i++) {
+		GraphColumn* c;
+
+		if (time[i] < start || time[i] >= end || isnan(value[i])) continue;
+		x = (time[i] - start) * width / (end - start);
+		c = &cols[x];
+		if (c->count++ == 0) {
+			c->min = c->max = c->first = value[i];
+			c->first_time = time[i];
+		} else {
+			if (value[i] < c->min) c->min = value[i];
+			if (value[i] > c->max) c->max = value[i];
+		}
+		c->last = value[i];
+		c->last_time = time[i];
+	}
+}
+
+long graph_lttb(const int64_t* time, const float* value, long n,
+		long threshold, long* out) {
+	double every;
+	long a = 0, count = 0;
+	long i, j;
+
+	if (threshold >= n || threshold < 3) {
+		for (i = 0; i < n; i++) out[i] = i;
+		return n;
+	}
+
+	// first and last reading are always kept, the rest is split in
+	// threshold-2 buckets; from each the reading spanning the largest
+	// triangle with the last one chosen and the average of the next bucket
+	every = (double)(n - 2) / (threshold - 2);
+	out[count++] = 0;
+	for (i = 0; i < threshold - 2; i++) {
+		long lo = (long)(i * every) + 1;
+		long hi = (long)((i + 1) * every) + 1;
+		long next_lo = hi;
+		long next_hi = (long)((i + 2) * every) + 1;
+		double avg_x = 0, avg_y = 0, ax, ay, best = -1;
+		long best_j = lo;
+
+		if (next_hi > n) next_hi = n;
+		for (j = next_lo; j < next_hi; j++) {
+			avg_x += time[j] - time[0];
+			avg_y += value[j];
+		}
+		if (next_hi > next_lo) {
+			avg_x /= next_hi - next_lo;
+			avg_y /= next_hi - next_lo;
+		} else {
+			avg_x = time[n - 1] - time[0];
+			avg_y = value[n - 1];
+		}
+
+		ax = time[a] - time[0];
+		ay = value[a];
+		for (j = lo; j < hi; j++) {
+			double area = fabs((ax - avg_x) * (value[j] - ay)
+					- (ax - (time[j] - time[0])) * (avg_y - ay));
+
+			if (area > best) {
+				best = area;
+				best_j = j;
+			}
+		}
+		out[count++] = a = best_j;
+	}
+	out[count++] = n - 1;
+	return count;
+}
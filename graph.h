@@ -0,0 +1,74 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_GRAPH_H_
+#define _INCLUDE_GRAPH_H_
+
+#include <stdint.h>
+
+/* Minimal raster graphics for draw_tfa: a palette image, lines, boxes, a
+ * built-in 5x7 font and PNG output, plus the kernels that reduce a series
+ * to the pixel width of a graph. */
+
+#define GRAPH_FONT_W 6          /* glyph cell, including spacing */
+#define GRAPH_FONT_H 10
+
+/* palette, in the colors rrdtool uses */
+#define GRAPH_BACK   0
+#define GRAPH_CANVAS 1
+#define GRAPH_GRID   2
+#define GRAPH_MGRID  3
+#define GRAPH_FONT   4
+#define GRAPH_FRAME  5
+#define GRAPH_RED    6
+#define GRAPH_GREEN  7
+#define GRAPH_COLORS 8
+
+typedef struct _GraphImage {
+	int width;
+	int height;
+	unsigned char* pixels;  /* palette index per pixel, row by row */
+} GraphImage;
+
+/* one pixel column of a series reduced by graph_minmax() */
+typedef struct _GraphColumn {
+	long count;             /* 0 if the column has no readings */
+	float min, max;
+	float first, last;
+	int64_t first_time, last_time;
+} GraphColumn;
+
+/* allocate an image filled with GRAPH_BACK. returns -1 if out of memory. */
+extern int graph_image_init(GraphImage* img, int width, int height);
+extern void graph_image_free(GraphImage* img);
+
+/* drawing, clipped to the image */
+extern void graph_fill(GraphImage* img, int x, int y, int w, int h, int color);
+extern void graph_line(GraphImage* img, int x0, int y0, int x1, int y1,
+		int color, int width);
+/* dotted lines for the grid */
+extern void graph_hgrid(GraphImage* img, int x0, int x1, int y, int color);
+extern void graph_vgrid(GraphImage* img, int x, int y0, int y1, int color);
+
+/* text with its top left corner at x, y; graph_text_up() runs bottom to
+ * top with its bottom left corner at x, y. returns the width in pixels. */
+extern int graph_text(GraphImage* img, int x, int y, const char* s, int color);
+extern int graph_text_up(GraphImage* img, int x, int y, const char* s, int color);
+extern int graph_text_width(const char* s);
+
+/* write the image as PNG, via a temporary file renamed into place so web
+ * clients never see a partial image. returns -1 and sets errno on error. */
+extern int graph_write_png(GraphImage* img, const char* path);
+
+/* reduce the n readings (time ascending, NaN for missing) to width columns
+ * over [start, end), keeping min, max, first and last of each column so
+ * spikes stay visible. */
+extern void graph_minmax(const int64_t* time, const float* value, long n,
+		int64_t start, int64_t end, int width, GraphColumn* cols);
+
+/* largest triangle three buckets: choose threshold of the n readings
+ * (which must not contain NaN) that keep the shape of the series. writes
+ * their indices to out and returns their number. */
+extern long graph_lttb(const int64_t* time, const float* value, long n,
+		long threshold, long* out);
+
+#endif /* _INCLUDE_GRAPH_H_ */
@@ -0,0 +1,13 @@
+/* vim:set expandtab! ts=4: */
+
+#include "hash.h"
+
+uint64_t hash_fnv1a(uint64_t h, const void* data, size_t len) {
+	const unsigned char* p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
@@ -0,0 +1,14 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_HASH_H_
+#define _INCLUDE_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+/* 64 bit FNV-1a. pass HASH_INIT as h, or a previous result to continue */
+extern uint64_t hash_fnv1a(uint64_t h, const void* data, size_t len);
+
+#endif /* _INCLUDE_HASH_H_ */
@@ -0,0 +1,689 @@
+/* vim:set expandtab! ts=4: */
+
+/* ingest_tfa - append the records of dumps to a tsdb database, see tsdb.h.
+ * Records already stored are skipped, so the same dumps can be ingested
+ * over and over. "-" reads the binary output of decode_tfa or batch_tfa
+ * from stdin.
+ *
+ * With --watch it keeps running, and ingests every dump written to the
+ * dump directory as soon as it is closed (inotify). Only the records newer
+ * than the per-sensor watermarks (kept in <dbdir>/watermarks) are decoded;
+ * they also go to the --output files, and --exec runs a command in the
+ * background after new records came in, like draw_tfa to refresh the
+ * graphs. --publish puts the newest record into shared memory for
+ * latest_tfa, see latest.h, and --listen serves it to Prometheus, with the
+ * bus statistics dump_tfa published for the station and those of the
+ * ingest, see metrics.h. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include "record.h"
+#include "output.h"
+#include "dump.h"
+#include "tsdb.h"
+#include "validate.h"
+#include "latest.h"
+#include "metrics.h"
+#include "util.h"
+
+#define MAX_SINKS 8
+#define WATERMARK_FILE "watermarks"
+
+typedef struct _Sink {
+	FILE* f;
+	int format;
+} Sink;
+
+/* what the metrics are made of */
+typedef struct _WatchStats {
+	const char* station;
+	Latest* latest;
+	Metrics* metrics;
+	uint64_t dumps;         /* ingested */
+	uint64_t failed;        /* dumps that could not be read */
+	uint64_t records;       /* new ones */
+	double batch;           /* seconds for the last batch of dumps */
+	int64_t batch_time;     /* when it was done */
+} WatchStats;
+
+/* the --exec command, run in the background so the poll loop goes on
+ * answering scrapes. the batches that come in while it runs are refreshed
+ * together once it is done. */
+typedef struct _Refresh {
+	const char* command;
+	pid_t pid;              /* of the running command, 0 if none */
+	long count;             /* new records it has not been run for */
+	int64_t first, last;
+} Refresh;
+
+static volatile sig_atomic_t stop;
+
+/* SIGCHLD wakes up poll() through this pipe */
+static int sigchld_pipe[2] = { -1, -1 };
+
+static void print_usage() {
+	fprintf(stderr, "Usage: ingest_tfa <dbdir> <dumpdir|tfa.dump.filename|->...\n");
+	fprintf(stderr, "       ingest_tfa --watch [--output <format>:<file>]... [--exec <command>] [--publish <station> [--listen <[host]:port|path>]] <dbdir> <dumpdir>\n");
+	exit(EXIT_FAILURE);
+}
+
+static int compare_time(const void* a, const void* b) {
+	const RecordBin* ra = a;
+	const RecordBin* rb = b;
+
+	if (ra->time != rb->time) return ra->time < rb->time ? -1 : 1;
+	return 0;
+}
+
+static long ingest_dump(Tsdb* db, const char* filename, TimeCache* tc) {
+	unsigned char data[DUMP_SIZE];
+	RecordBin records[DUMP_SIZE / 10];
+	DumpHeader h;
+	FILE* f;
+	size_t len;
+	long added = 0;
+	int i, n;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "E: cannot open file %s\n", filename);
+		return -1;
+	}
+	len = fread(data, 1, DUMP_SIZE, f);
+	fclose(f);
+
+	if (dump_header(data, len, &h) == -1) {
+		fprintf(stderr, "W: %s: don't understand the data, skipping.\n", filename);
+		return -1;
+	}
+
+	// records wrap around in the ring buffer
+	n = dump_decode(data, len, &h, records, tc);
+	qsort(records, n, sizeof(RecordBin), compare_time);
+
+	for (i = 0; i < n; i++) {
+		int rc = tsdb_append(db, &records[i], h.sensors);
+
+		if (rc == -1) return -1;
+		added += rc;
+	}
+	return added;
+}
+
+static long ingest_stream(Tsdb* db, FILE* f) {
+	RecordBinHeader h;
+	RecordBin b;
+	long added = 0;
+
+	if (fread(&h, sizeof(h), 1, f) != 1
+			|| memcmp(h.magic, RECORD_BIN_MAGIC, 4) != 0
+			|| h.version != RECORD_BIN_VERSION
+			|| h.record_size != sizeof(RecordBin)) {
+		fprintf(stderr, "E: stdin is not in decode_tfa --format=bin format.\n");
+		return -1;
+	}
+	while (fread(&b, sizeof(b), 1, f) == 1) {
+		int rc = tsdb_append(db, &b, h.sensors);
+
+		if (rc == -1) return -1;
+		added += rc;
+	}
+	return added;
+}
+
+/* a watermark ahead of the clock came from a broken timestamp and would
+ * hold back every reading until then */
+static int watermark_valid(int64_t t) {
+	return t != INT64_MIN && t <= time(NULL) + VALID_TIME_AHEAD;
+}
+
+/* the watermarks: per sensor the time of the newest reading passed on */
+static void load_watermarks(Tsdb* db, int64_t* watermark) {
+	char path[PATH_MAX + 16];
+	char name[8];
+	long long t;
+	FILE* f;
+	int i;
+
+	for (i = 0; i < RECORD_SENSORS; i++) watermark[i] = tsdb_last(db, i);
+
+	snprintf(path, sizeof(path), "%s/%s", db->path, WATERMARK_FILE);
+	f = fopen(path, "r");
+	if (f == NULL) return;
+	while (fscanf(f, "%7s %lld", name, &t) == 2) {
+		for (i = 0; i < RECORD_SENSORS; i++) {
+			if (strcmp(name, sensor_name(i)) == 0 && watermark_valid(t)) watermark[i] = t;
+		}
+	}
+	fclose(f);
+}
+
+static int save_watermarks(Tsdb* db, const int64_t* watermark) {
+	char path[PATH_MAX + 16], tmp[PATH_MAX + 32];
+	FILE* f;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%s", db->path, WATERMARK_FILE);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL) return -1;
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (watermark_valid(watermark[i])) fprintf(f, "%s %lld\n", sensor_name(i), (long long)watermark[i]);
+	}
+	if (fclose(f) == EOF) return -1;
+	return rename(tmp, path);
+}
+
+/* pass the records of a dump newer than the watermarks on to the database,
+ * the sinks and (the newest one) to latest, unless that is NULL. returns
+ * the number of records, -1 on error. */
+static long watch_dump(Tsdb* db, const char* filename, int64_t* watermark,
+		Sink* sinks, int nsinks, Latest* latest, int64_t* first, int64_t* last,
+		TimeCache* tc) {
+	unsigned char data[DUMP_SIZE];
+	RecordBin records[DUMP_SIZE / 10];
+	int64_t since = INT64_MIN;
+	DumpHeader h;
+	FILE* f;
+	size_t len;
+	long count = 0;
+	int i, j, n;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "E: cannot open file %s\n", filename);
+		return -1;
+	}
+	len = fread(data, 1, DUMP_SIZE, f);
+	fclose(f);
+
+	if (dump_header(data, len, &h) == -1) {
+		fprintf(stderr, "W: %s: don't understand the data, skipping.\n", filename);
+		return -1;
+	}
+
+	// sensors that never had a reading do not hold the others back
+	for (i = 0; i < h.sensors; i++) {
+		if (watermark[i] != INT64_MIN && (since == INT64_MIN || watermark[i] < since))
+			since = watermark[i];
+	}
+	n = dump_decode_since(data, len, &h, since, records, tc);
+
+	for (i = 0; i < n; i++) {
+		RecordBin b = records[i];
+		int new = 0;
+
+		// a broken timestamp moves no watermark and goes nowhere
+		if (b.flags & INVALID_TIME) continue;
+		if (tsdb_append(db, &b, h.sensors) == -1) return -1;
+
+		// readings not newer than their sensor's watermark were passed on
+		// with an earlier dump
+		for (j = 0; j < RECORD_SENSORS; j++) {
+			if (j >= h.sensors || b.time <= watermark[j]) {
+				b.t[j] = RECORD_NA_T;
+				b.h[j] = RECORD_NA;
+			} else if (b.t[j] != RECORD_NA_T || b.h[j] != RECORD_NA) {
+				watermark[j] = b.time;
+				new = 1;
+			}
+		}
+		if (!new) continue;
+
+		for (j = 0; j < nsinks; j++) output_record_bin(sinks[j].f, sinks[j].format, &b, RECORD_SENSORS);
+		if (*first == INT64_MIN || b.time < *first) *first = b.time;
+		if (b.time > *last) *last = b.time;
+		count++;
+	}
+
+	for (i = n - 1; latest != NULL && count > 0 && i >= 0; i--) {
+		if (!(records[i].flags & INVALID_TIME)) {
+			latest_publish_record(latest, data, &h, &records[i]);
+			break;
+		}
+	}
+	return count;
+}
+
+/* start the refresh command, with the time range of the new records in
+ * the environment. returns its pid, 0 if it could not be started. */
+static pid_t run_command(const char* command, long count, int64_t first,
+		int64_t last) {
+	char buf[32];
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 0;
+	}
+	if (pid == 0) {
+		snprintf(buf, sizeof(buf), "%ld", count);
+		setenv("TFA_NEW_RECORDS", buf, 1);
+		snprintf(buf, sizeof(buf), "%lld", (long long)first);
+		setenv("TFA_NEW_FIRST", buf, 1);
+		snprintf(buf, sizeof(buf), "%lld", (long long)last);
+		setenv("TFA_NEW_LAST", buf, 1);
+		execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+/* run the command for the records it has not seen, unless it is running */
+static void start_refresh(Refresh* r) {
+	if (r->pid != 0 || r->count == 0) return;
+	r->pid = run_command(r->command, r->count, r->first, r->last);
+	if (r->pid != 0) r->count = 0;
+}
+
+/* refresh for count new records from first to last */
+static void refresh(Refresh* r, long count, int64_t first, int64_t last) {
+	if (r->command == NULL || count == 0) return;
+	if (r->count == 0 || first < r->first) r->first = first;
+	if (r->count == 0 || last > r->last) r->last = last;
+	r->count += count;
+	start_refresh(r);
+}
+
+/* collect the command if it is done (or wait for it), and start it again
+ * for the records that came in meanwhile */
+static void reap_refresh(Refresh* r, int wait) {
+	pid_t pid;
+	int status;
+
+	if (r->pid == 0) return;
+	while ((pid = waitpid(r->pid, &status, wait ? 0 : WNOHANG)) == -1 && errno == EINTR);
+	if (pid == 0) return;
+	if (pid == -1) perror("waitpid");
+	else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fprintf(stderr, "W: %s failed.\n", r->command);
+	r->pid = 0;
+	if (!wait) start_refresh(r);
+}
+
+static void on_signal(int sig) {
+	stop = 1;
+}
+
+static void on_sigchld(int sig) {
+	int err = errno;
+
+	// a full pipe already has a wakeup in it
+	write(sigchld_pipe[1], "", 1);
+	errno = err;
+}
+
+/* the metrics, from what is at hand: the newest reading and the bus
+ * statistics in shared memory, and the counts of the ingest */
+static void render_metrics(FILE* out, void* arg) {
+	const WatchStats* ws = arg;
+	const char* st = ws->station;
+	LatestReading r;
+	LatestBus b;
+	int i;
+
+	if (latest_read(ws->latest, &r) == 0) {
+		metrics_header(out, "tfa_temperature_celsius", "gauge", "Temperature of a sensor in the newest record.");
+		for (i = 0; i < r.sensors; i++) {
+			if (r.bin.t[i] != RECORD_NA_T)
+				fprintf(out, "tfa_temperature_celsius{station=\"%s\",sensor=\"%s\"} %.1f\n",
+						st, sensor_name(i), r.bin.t[i] / 10.0);
+		}
+		metrics_header(out, "tfa_humidity_percent", "gauge", "Relative humidity of a sensor in the newest record.");
+		for (i = 0; i < r.sensors; i++) {
+			if (r.bin.h[i] != RECORD_NA)
+				fprintf(out, "tfa_humidity_percent{station=\"%s\",sensor=\"%s\"} %d\n",
+						st, sensor_name(i), r.bin.h[i]);
+		}
+		metrics_header(out, "tfa_record_timestamp_seconds", "gauge", "Time of the newest record.");
+		fprintf(out, "tfa_record_timestamp_seconds{station=\"%s\"} %lld\n", st, (long long)r.time);
+		metrics_header(out, "tfa_record_age_seconds", "gauge", "Age of the newest record.");
+		fprintf(out, "tfa_record_age_seconds{station=\"%s\"} %lld\n", st, (long long)(time(NULL) - r.time));
+		metrics_header(out, "tfa_log_records", "gauge", "Records in the log of the station.");
+		fprintf(out, "tfa_log_records{station=\"%s\"} %d\n", st, r.log_count);
+		metrics_header(out, "tfa_log_overflow", "gauge", "1 if the log of the station wrapped around.");
+		fprintf(out, "tfa_log_overflow{station=\"%s\"} %d\n", st, r.overflow != 0);
+	}
+
+	if (latest_read_bus(ws->latest, &b) == 0) {
+		metrics_header(out, "tfa_dump_timestamp_seconds", "gauge", "Time of the last dump.");
+		fprintf(out, "tfa_dump_timestamp_seconds{station=\"%s\"} %lld\n", st, (long long)b.time);
+		metrics_header(out, "tfa_dump_ok", "gauge", "1 if the last dump got all bytes.");
+		fprintf(out, "tfa_dump_ok{station=\"%s\"} %u\n", st, b.ok);
+		metrics_header(out, "tfa_dump_consistent", "gauge", "1 if the last dump is a consistent snapshot of the log.");
+		fprintf(out, "tfa_dump_consistent{station=\"%s\"} %u\n", st, b.consistent);
+		metrics_header(out, "tfa_dump_duration_seconds", "gauge", "Duration of the last dump.");
+		fprintf(out, "tfa_dump_duration_seconds{station=\"%s\"} %.6f\n", st, b.duration);
+		metrics_header(out, "tfa_dump_connect_seconds", "gauge", "Time the last dump spent opening the station.");
+		fprintf(out, "tfa_dump_connect_seconds{station=\"%s\"} %.6f\n", st, b.connect);
+		metrics_header(out, "tfa_dump_read_seconds", "gauge", "Time the last dump spent reading the eeprom.");
+		fprintf(out, "tfa_dump_read_seconds{station=\"%s\"} %.6f\n", st, b.read);
+		metrics_header(out, "tfa_dump_bytes_per_second", "gauge", "Bus throughput of the last dump.");
+		fprintf(out, "tfa_dump_bytes_per_second{station=\"%s\"} %.1f\n", st, b.read > 0 ? b.bytes / b.read : 0);
+		metrics_header(out, "tfa_dump_retries", "gauge", "Reopens of the station in the last dump.");
+		fprintf(out, "tfa_dump_retries{station=\"%s\"} %u\n", st, b.retries);
+		metrics_header(out, "tfa_dumps_total", "counter", "Dumps taken.");
+		fprintf(out, "tfa_dumps_total{station=\"%s\"} %u\n", st, b.count);
+		metrics_header(out, "tfa_dumps_failed_total", "counter", "Dumps with bytes missing.");
+		fprintf(out, "tfa_dumps_failed_total{station=\"%s\"} %llu\n", st, (unsigned long long)b.failed_total);
+		metrics_header(out, "tfa_bus_bytes_total", "counter", "Bytes read from the eeprom.");
+		fprintf(out, "tfa_bus_bytes_total{station=\"%s\"} %llu\n", st, (unsigned long long)b.bytes_total);
+		metrics_header(out, "tfa_bus_retries_total", "counter", "Reopens of the station after a failed read.");
+		fprintf(out, "tfa_bus_retries_total{station=\"%s\"} %llu\n", st, (unsigned long long)b.retries_total);
+		metrics_header(out, "tfa_bus_ack_failures_total", "counter", "Reads the eeprom did not acknowledge.");
+		fprintf(out, "tfa_bus_ack_failures_total{station=\"%s\"} %llu\n", st, (unsigned long long)b.ack_failures_total);
+	}
+
+	metrics_header(out, "tfa_ingest_dumps_total", "counter", "Dumps ingested.");
+	fprintf(out, "tfa_ingest_dumps_total{station=\"%s\"} %llu\n", st, (unsigned long long)ws->dumps);
+	metrics_header(out, "tfa_ingest_failed_total", "counter", "Dumps that could not be ingested.");
+	fprintf(out, "tfa_ingest_failed_total{station=\"%s\"} %llu\n", st, (unsigned long long)ws->failed);
+	metrics_header(out, "tfa_ingest_records_total", "counter", "New records ingested.");
+	fprintf(out, "tfa_ingest_records_total{station=\"%s\"} %llu\n", st, (unsigned long long)ws->records);
+	metrics_header(out, "tfa_ingest_batch_seconds", "gauge", "Duration of the last batch of dumps ingested.");
+	fprintf(out, "tfa_ingest_batch_seconds{station=\"%s\"} %.6f\n", st, ws->batch);
+	metrics_header(out, "tfa_ingest_batch_timestamp_seconds", "gauge", "Time the last batch of dumps was ingested.");
+	fprintf(out, "tfa_ingest_batch_timestamp_seconds{station=\"%s\"} %lld\n", st, (long long)ws->batch_time);
+	metrics_header(out, "tfa_metrics_scrapes_total", "counter", "Scrapes answered, before this one.");
+	fprintf(out, "tfa_metrics_scrapes_total{station=\"%s\"} %llu\n", st, (unsigned long long)ws->metrics->scrapes);
+}
+
+/* count a dump ingested by watch_dump() */
+static void count_dump(WatchStats* stats, long n) {
+	stats->dumps++;
+	if (n < 0) stats->failed++;
+	else stats->records += n;
+}
+
+/* write everything out before the watermarks move on, then refresh */
+static int finish_batch(Tsdb* db, const int64_t* watermark, Sink* sinks,
+		int nsinks, Refresh* r, long count, int64_t first, int64_t last) {
+	int i;
+
+	if (count == 0) return 0;
+	for (i = 0; i < nsinks; i++) fflush(sinks[i].f);
+	if (tsdb_flush(db) == -1 || save_watermarks(db, watermark) == -1) {
+		fprintf(stderr, "E: writing database %s failed: %s\n", db->path, strerror(errno));
+		return -1;
+	}
+	refresh(r, count, first, last);
+	return 0;
+}
+
+/* ingest the dumps in dir (the newer records of each), then every dump
+ * written to it, until killed */
+static int watch(Tsdb* db, const char* dir, Sink* sinks, int nsinks,
+		const char* command, WatchStats* stats) {
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(8)));
+	char** files = NULL;
+	int64_t watermark[RECORD_SENSORS];
+	int64_t first = INT64_MIN, last = INT64_MIN;
+	struct pollfd fds[2 + 1 + METRICS_CLIENTS];
+	struct sigaction sa;
+	Refresh r = { command, 0, 0, INT64_MIN, INT64_MIN };
+	Latest* latest = stats->latest;
+	TimeCache tc;
+	double start = util_now();
+	long count = 0, n;
+	int fd, nfds, nfiles = 0, i, rc;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (command != NULL) {
+		if (pipe2(sigchld_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+			perror("pipe");
+			return 1;
+		}
+		sa.sa_handler = on_sigchld;
+		sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigaction(SIGCHLD, &sa, NULL);
+	}
+
+	// watch before the scan, so no dump falls in between
+	fd = inotify_init();
+	if (fd == -1 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		perror(dir);
+		return 1;
+	}
+	if (dump_scan(dir, &files, &nfiles) == -1) {
+		perror(dir);
+		return 1;
+	}
+	timecache_init(&tc);
+	load_watermarks(db, watermark);
+
+	// catch up with the dumps that are there already, in one go
+	for (i = 0; i < nfiles; i++) {
+		n = watch_dump(db, files[i], watermark, sinks, nsinks, latest, &first, &last, &tc);
+		if (n > 0) count += n;
+		count_dump(stats, n);
+		free(files[i]);
+	}
+	free(files);
+	fprintf(stderr, "I: %ld new records in %d dumps, watching %s.\n", count, nfiles, dir);
+	rc = finish_batch(db, watermark, sinks, nsinks, &r, count, first, last);
+	stats->batch = util_now() - start;
+	stats->batch_time = time(NULL);
+
+	// scrapes are answered between batches, a batch is over in
+	// milliseconds; the command runs meanwhile
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = sigchld_pipe[0];
+	fds[1].events = POLLIN;
+	while (!stop && rc == 0) {
+		ssize_t len;
+		char* p;
+
+		nfds = 2;
+		if (stats->metrics != NULL) nfds += metrics_pollfds(stats->metrics, fds + 2);
+		if (poll(fds, nfds, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			rc = -1;
+			break;
+		}
+		if (stats->metrics != NULL) metrics_handle(stats->metrics, fds + 2, nfds - 2);
+		if (fds[1].revents & POLLIN) {
+			while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+			reap_refresh(&r, 0);
+		}
+		if (!(fds[0].revents & POLLIN)) continue;
+
+		len = read(fd, buf, sizeof(buf));
+		if (len == -1 && errno == EINTR) continue;
+		if (len <= 0) {
+			perror("inotify");
+			rc = -1;
+			break;
+		}
+
+		start = util_now();
+		first = last = INT64_MIN;
+		count = 0;
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			struct inotify_event* ev = (struct inotify_event*)p;
+			char path[PATH_MAX];
+
+			if (ev->len == 0 || !dump_filename(ev->name)) continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, ev->name);
+			n = watch_dump(db, path, watermark, sinks, nsinks, latest, &first, &last, &tc);
+			count_dump(stats, n);
+			if (n > 0) {
+				fprintf(stderr, "I: %s: %ld new records.\n", ev->name, n);
+				count += n;
+			}
+		}
+		rc = finish_batch(db, watermark, sinks, nsinks, &r, count, first, last);
+		stats->batch = util_now() - start;
+		stats->batch_time = time(NULL);
+	}
+	close(fd);
+	reap_refresh(&r, 1);
+	if (command != NULL) {
+		close(sigchld_pipe[0]);
+		close(sigchld_pipe[1]);
+	}
+	return rc == 0 ? 0 : 1;
+}
+
+static void open_sink(Sink* sink, char* arg) {
+	char* colon = strchr(arg, ':');
+
+	if (colon == NULL) print_usage();
+	*colon = 0;
+	sink->format = output_format(arg);
+	if (sink->format < 0) {
+		fprintf(stderr, "E: unknown output format %s\n", arg);
+		print_usage();
+	}
+	sink->f = fopen(colon + 1, "a");
+	if (sink->f == NULL) {
+		fprintf(stderr, "E: cannot open %s: %s\n", colon + 1, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	// a new file gets the column names
+	if (ftell(sink->f) == 0) output_header(sink->f, sink->format, RECORD_SENSORS);
+}
+
+int main(int argc, char *argv[]) {
+	Tsdb db;
+	TimeCache tc;
+	Sink sinks[MAX_SINKS];
+	Latest latest;
+	Metrics metrics;
+	WatchStats stats;
+	const char* command = NULL;
+	const char* station = NULL;
+	const char* address = NULL;
+	long added = 0;
+	int watching = 0;
+	int nsinks = 0;
+	int failed = 0;
+	int total = 0;
+	int i, j, c;
+
+	static const struct option options[] = {
+		{ "watch", no_argument, NULL, 'w' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "exec", required_argument, NULL, 'e' },
+		{ "publish", required_argument, NULL, 'p' },
+		{ "listen", required_argument, NULL, 'l' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "wo:e:p:l:", options, NULL)) != -1) {
+		switch (c) {
+		case 'w':
+			watching = 1;
+			break;
+		case 'o':
+			if (nsinks == MAX_SINKS) print_usage();
+			open_sink(&sinks[nsinks++], optarg);
+			break;
+		case 'e':
+			command = optarg;
+			break;
+		case 'p':
+			station = optarg;
+			break;
+		case 'l':
+			address = optarg;
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind < 2) print_usage();
+	if (!watching && (nsinks > 0 || command != NULL || station != NULL)) print_usage();
+	if (watching && argc - optind != 2) print_usage();
+	// the station is a label value of the metrics
+	if (address != NULL && (station == NULL || strpbrk(station, "\"\\\n") != NULL)) print_usage();
+
+	if (tsdb_open(&db, argv[optind], 1) == -1) {
+		if (errno == EWOULDBLOCK)
+			fprintf(stderr, "E: database %s is being written by another process\n", argv[optind]);
+		else
+			fprintf(stderr, "E: can't open database %s: %s\n", argv[optind], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (watching) {
+		int rc;
+
+		if (station != NULL && latest_open(&latest, station, 1) == -1) {
+			fprintf(stderr, "E: can't open the shared memory of %s: %s\n", station, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		memset(&stats, 0, sizeof(stats));
+		stats.station = station;
+		stats.latest = station != NULL ? &latest : NULL;
+		if (address != NULL) {
+			if (metrics_listen(&metrics, address, render_metrics, &stats) == -1) {
+				fprintf(stderr, "E: can't listen on %s: %s\n", address, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			stats.metrics = &metrics;
+		}
+		rc = watch(&db, argv[optind + 1], sinks, nsinks, command, &stats);
+
+		if (address != NULL) metrics_close(&metrics);
+		if (station != NULL) latest_close(&latest);
+		for (i = 0; i < nsinks; i++) fclose(sinks[i].f);
+		if (tsdb_close(&db) == -1) {
+			fprintf(stderr, "E: writing database %s failed: %s\n", argv[optind], strerror(errno));
+			return 1;
+		}
+		return rc;
+	}
+	timecache_init(&tc);
+
+	for (i = optind + 1; i < argc; i++) {
+		char** files = NULL;
+		int nfiles = 0;
+		long n;
+
+		if (strcmp(argv[i], "-") == 0) {
+			n = ingest_stream(&db, stdin);
+			total++;
+			if (n == -1) failed++;
+			else added += n;
+			continue;
+		}
+
+		if (dump_scan(argv[i], &files, &nfiles) == -1) {
+			perror(argv[i]);
+			failed++;
+			continue;
+		}
+		for (j = 0; j < nfiles; j++) {
+			n = ingest_dump(&db, files[j], &tc);
+			if (n == -1) failed++;
+			else added += n;
+			free(files[j]);
+		}
+		free(files);
+		total += nfiles;
+	}
+
+	if (tsdb_close(&db) == -1) {
+		fprintf(stderr, "E: writing database %s failed: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "Added %ld sensor readings from %d files.\n", added, total - failed);
+	return failed ? 1 : 0;
+}
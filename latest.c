@@ -0,0 +1,195 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "latest.h"
+
+/* how often a reader looks at an odd sequence number before giving up on
+ * the writer */
+#define MAX_SPINS 10000000
+
+/* writers take turns on the whole segment */
+static void writer_lock(const Latest* l) {
+	while (flock(l->fd, LOCK_EX) == -1 && errno == EINTR);
+}
+
+static void writer_unlock(const Latest* l) {
+	flock(l->fd, LOCK_UN);
+}
+
+/* make seq even again if the writer holding it died halfway; only called
+ * under writer_lock(), when no writer can be at it */
+static void seq_repair(atomic_uint* seq) {
+	unsigned start = atomic_load_explicit(seq, memory_order_relaxed);
+
+	if (start & 1) atomic_store_explicit(seq, start + 1, memory_order_release);
+}
+
+int latest_open(Latest* l, const char* station, int writable) {
+	char name[256];
+	struct stat st;
+	int fd, err;
+
+	memset(l, 0, sizeof(*l));
+	l->fd = -1;
+	if (strchr(station, '/') != NULL
+			|| snprintf(name, sizeof(name), "%s%s", LATEST_PREFIX, station) >= sizeof(name)) {
+		errno = EINVAL;
+		return -1;
+	}
+	fd = shm_open(name, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd == -1) return -1;
+	if (fstat(fd, &st) == -1
+			|| (writable && st.st_size < sizeof(LatestSegment)
+				&& ftruncate(fd, sizeof(LatestSegment)) == -1))
+		goto fail;
+	if (!writable && st.st_size < sizeof(LatestSegment)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	l->seg = mmap(NULL, sizeof(LatestSegment), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	if (l->seg == MAP_FAILED) {
+		l->seg = NULL;
+		goto fail;
+	}
+	l->writable = writable;
+	if (writable) l->fd = fd;
+	else close(fd);
+
+	// what is in there is only as old as the last dump, a segment of
+	// another version is started over
+	if (writable) {
+		writer_lock(l);
+		if (memcmp(l->seg->magic, LATEST_MAGIC, 4) != 0
+				|| l->seg->version != LATEST_VERSION
+				|| l->seg->size != sizeof(LatestSegment)) {
+			memset(l->seg, 0, sizeof(LatestSegment));
+			l->seg->version = LATEST_VERSION;
+			l->seg->size = sizeof(LatestSegment);
+			atomic_init(&l->seg->seq, 0);
+			atomic_init(&l->seg->bus_seq, 0);
+			memcpy(l->seg->magic, LATEST_MAGIC, 4);
+		} else {
+			seq_repair(&l->seg->seq);
+			seq_repair(&l->seg->bus_seq);
+		}
+		writer_unlock(l);
+	}
+	if (memcmp(l->seg->magic, LATEST_MAGIC, 4) != 0
+			|| l->seg->version != LATEST_VERSION
+			|| l->seg->size != sizeof(LatestSegment)) {
+		latest_close(l);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void latest_close(Latest* l) {
+	if (l->seg != NULL) munmap(l->seg, sizeof(LatestSegment));
+	if (l->fd != -1) close(l->fd);
+	l->seg = NULL;
+	l->fd = -1;
+}
+
+/* copy len bytes at src out to dst under sequence lock seq */
+static int seq_read(atomic_uint* seq, const void* src, void* dst, size_t len) {
+	unsigned start;
+	long spins = 0;
+
+	do {
+		while ((start = atomic_load_explicit(seq, memory_order_acquire)) & 1) {
+			if (++spins == MAX_SPINS) {
+				errno = EBUSY;
+				return -1;
+			}
+		}
+		memcpy(dst, src, len);
+		// the copy is done before the sequence number is looked at again
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load_explicit(seq, memory_order_relaxed) != start);
+	return 0;
+}
+
+static void seq_write(atomic_uint* seq, void* dst, const void* src, size_t len) {
+	unsigned start = atomic_load_explicit(seq, memory_order_relaxed);
+
+	atomic_store_explicit(seq, start + 1, memory_order_relaxed);
+	// the odd sequence number is seen before any of the new data
+	atomic_thread_fence(memory_order_release);
+	memcpy(dst, src, len);
+	atomic_store_explicit(seq, start + 2, memory_order_release);
+}
+
+int latest_read(const Latest* l, LatestReading* out) {
+	if (seq_read(&l->seg->seq, &l->seg->reading, out, sizeof(*out)) == -1)
+		return -1;
+	if (out->count == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+void latest_publish(Latest* l, LatestReading* r) {
+	writer_lock(l);
+	r->count = l->seg->reading.count + 1;
+	r->published = time(NULL);
+	seq_write(&l->seg->seq, &l->seg->reading, r, sizeof(*r));
+	writer_unlock(l);
+}
+
+int latest_read_bus(const Latest* l, LatestBus* out) {
+	if (seq_read(&l->seg->bus_seq, &l->seg->bus, out, sizeof(*out)) == -1)
+		return -1;
+	if (out->count == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+void latest_publish_bus(Latest* l, LatestBus* b) {
+	const LatestBus* prev = &l->seg->bus;
+
+	writer_lock(l);
+	b->count = prev->count + 1;
+	b->bytes_total = prev->bytes_total + b->bytes;
+	b->retries_total = prev->retries_total + b->retries;
+	b->ack_failures_total = prev->ack_failures_total + b->ack_failures;
+	b->failed_total = prev->failed_total + !b->ok;
+	seq_write(&l->seg->bus_seq, &l->seg->bus, b, sizeof(*b));
+	writer_unlock(l);
+}
+
+void latest_publish_record(Latest* l, const unsigned char* data,
+		const DumpHeader* h, const RecordBin* b) {
+	LatestReading r;
+
+	memset(&r, 0, sizeof(r));
+	r.time = b->time;
+	r.sensors = h->sensors;
+	r.interval = h->interval;
+	r.records = h->records;
+	r.log_count = h->log_count;
+	r.overflow = h->overflow;
+	r.bin = *b;
+	record_parse(data + dump_slot(h, b->index), &r.record, h->sensors - 1);
+	latest_publish(l, &r);
+}
@@ -0,0 +1,112 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_LATEST_H_
+#define _INCLUDE_LATEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "record.h"
+#include "output.h"
+#include "dump.h"
+
+/* Latest reading of a station, in POSIX shared memory (/tfa.<station>).
+ *
+ * It has two parts, each with its own writer: ingest_tfa --watch with
+ * --publish writes the newest record of every dump it ingests, with the
+ * header fields of the dump, and dump_tfa --publish the bus statistics of
+ * the dump it took. Any number of local readers map the segment read-only
+ * and copy them out. Each part is guarded by a sequence lock: the writer
+ * makes the sequence number odd, writes, and makes it even again; a reader
+ * copies while it is even and unchanged, and retries otherwise. Readers
+ * take no lock and make no system call after latest_open(), and never hold
+ * up the writer.
+ *
+ * Writers hold an exclusive flock() on the segment while they publish, so
+ * two of them on the same part (dump_tfa runs that overlap) take turns and
+ * no count is lost. A sequence number found odd under that lock was left
+ * by a writer that died halfway, and only then is it made even again.
+ */
+
+#define LATEST_MAGIC "TFAL"
+#define LATEST_VERSION 2
+#define LATEST_PREFIX "/tfa."
+#define LATEST_CACHE_LINE 64
+
+typedef struct _LatestReading {
+	int64_t time;           /* unix timestamp of the record */
+	int64_t published;      /* when it was published */
+	uint32_t count;         /* publications so far, 0 if none yet */
+	/* DumpHeader of the dump it came from */
+	int32_t sensors;
+	int32_t interval;       /* minutes */
+	int32_t records;
+	int32_t log_count;
+	int32_t overflow;
+	Record record;          /* as record_parse() decoded it */
+	RecordBin bin;          /* converted, flags set by the plausibility checks */
+} LatestReading;
+
+/* how the last dump went on the bus, and totals over all dumps */
+typedef struct _LatestBus {
+	int64_t time;           /* when the dump was taken */
+	uint32_t count;         /* dumps so far, 0 if none yet */
+	uint32_t ok;            /* 1 if the last dump got all bytes */
+	uint32_t bytes;         /* read from the eeprom */
+	uint32_t retries;       /* reopens of the station after a failed read */
+	uint32_t ack_failures;  /* reads the eeprom did not acknowledge */
+	uint32_t consistent;    /* 1 if no record was logged while it was read, or
+	                         * the slots logged meanwhile were read again */
+	double connect;         /* seconds opening the station */
+	double read;            /* seconds reading the eeprom */
+	double duration;        /* seconds for the whole dump */
+	uint64_t bytes_total;
+	uint64_t retries_total;
+	uint64_t ack_failures_total;
+	uint64_t failed_total;  /* dumps with bytes missing */
+} LatestBus;
+
+typedef struct _LatestSegment {
+	char magic[4];
+	uint16_t version;
+	uint16_t size;          /* sizeof(LatestSegment) */
+	char pad0[LATEST_CACHE_LINE - 8];
+	atomic_uint seq;        /* odd while the writer is at it */
+	char pad1[LATEST_CACHE_LINE - sizeof(atomic_uint)];
+	LatestReading reading;
+	char pad2[LATEST_CACHE_LINE];
+	atomic_uint bus_seq;    /* the same for bus */
+	char pad3[LATEST_CACHE_LINE - sizeof(atomic_uint)];
+	LatestBus bus;
+} LatestSegment;
+
+typedef struct _Latest {
+	LatestSegment* seg;
+	int fd;                 /* of the segment for writers, to flock(); -1 for readers */
+	int writable;
+} Latest;
+
+/* map the segment of a station, creating it if writable. returns -1 and
+ * sets errno on failure (ENOENT if nothing was ever published). */
+extern int latest_open(Latest* l, const char* station, int writable);
+extern void latest_close(Latest* l);
+
+/* copy the latest reading out. returns -1 with errno ENOENT if nothing was
+ * published yet, EBUSY if the writer died while publishing. */
+extern int latest_read(const Latest* l, LatestReading* out);
+
+/* publish a reading; r->count and r->published are filled in */
+extern void latest_publish(Latest* l, LatestReading* r);
+
+/* copy the bus statistics out. returns -1 like latest_read(). */
+extern int latest_read_bus(const Latest* l, LatestBus* out);
+
+/* publish the statistics of a dump; b->count and the totals are filled
+ * in */
+extern void latest_publish_bus(Latest* l, LatestBus* b);
+
+/* publish record b (decoded by dump_decode()) of an eeprom image */
+extern void latest_publish_record(Latest* l, const unsigned char* data,
+		const DumpHeader* h, const RecordBin* b);
+
+#endif /* _INCLUDE_LATEST_H_ */
@@ -0,0 +1,78 @@
+/* vim:set expandtab! ts=4: */
+
+/* latest_tfa - print the newest record of a station, as published in
+ * shared memory by ingest_tfa --watch with --publish (see latest.h),
+ * without touching the serial port. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include "latest.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: latest_tfa [--format=text|csv|ndjson|bin] <station>\n");
+	fprintf(stderr, "       latest_tfa --sensor <in|1..5> <station>\n");
+	fprintf(stderr, "  --sensor prints temperature, humidity and age in seconds of one sensor\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	LatestReading r;
+	Latest latest;
+	int format = FORMAT_TEXT;
+	int sensor = -1;
+	int c, i;
+
+	static const struct option options[] = {
+		{ "format", required_argument, NULL, 'f' },
+		{ "sensor", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "f:s:", options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			format = output_format(optarg);
+			if (format < 0) {
+				fprintf(stderr, "E: unknown output format %s\n", optarg);
+				print_usage();
+			}
+			break;
+		case 's':
+			for (i = 0; i < RECORD_SENSORS; i++) {
+				if (strcmp(optarg, sensor_name(i)) == 0) sensor = i;
+			}
+			if (sensor == -1) {
+				fprintf(stderr, "E: unknown sensor %s\n", optarg);
+				print_usage();
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind != 1) print_usage();
+
+	if (latest_open(&latest, argv[optind], 0) == -1 || latest_read(&latest, &r) == -1) {
+		fprintf(stderr, "E: nothing published for %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	latest_close(&latest);
+
+	if (sensor >= 0) {
+		if (sensor >= r.sensors || r.bin.t[sensor] == RECORD_NA_T) printf("U");
+		else printf("%.1f", r.bin.t[sensor] / 10.0);
+		if (sensor >= r.sensors || r.bin.h[sensor] == RECORD_NA) printf(" U");
+		else printf(" %d", r.bin.h[sensor]);
+		printf(" %lld\n", (long long)(time(NULL) - r.time));
+		return 0;
+	}
+
+	output_header(stdout, format, r.sensors);
+	if (format == FORMAT_TEXT) output_record(stdout, format, r.bin.index, &r.record, r.time, r.sensors);
+	else output_record_bin(stdout, format, &r.bin, r.sensors);
+	return 0;
+}
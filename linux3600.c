@@ -13,23 +13,19 @@
 #define DEBUG 0
 
 #include "eeprom.h"
+#include "emulator.h"
 #include "mcdelay.h"
 #include "mcdelay.c"
 
+/* ws is a connection to a station emulator, see emulator.h */
+static int emulated;
+
 /********************************************************************
- * open_weatherstation, Windows version
- *
- * Input:   devicename (COM1, COM2 etc)
- * 
- * Returns: Handle to the weatherstation (type WEATHERSTATION)
- *
+ * open_serial - opens and sets up the serial port
  ********************************************************************/
-WEATHERSTATION open_weatherstation (char *device) {
+static WEATHERSTATION open_serial(char *device) {
   WEATHERSTATION ws;
   struct termios adtio;
-  unsigned char buffer[BUFFER_SIZE];
-  long i;
-  print_log(1,"open_weatherstation");
 
   //calibrate nanodelay function
   microdelay_init(1);
@@ -90,7 +86,54 @@ WEATHERSTATION open_weatherstation (char *device) {
 	  exit(0);
   }
   tcflush(ws, TCIOFLUSH);
-  
+  return ws;
+}
+
+/********************************************************************
+ * open_emulator - connects to a station emulator instead, the lines
+ * go over the unix socket at device (see emulator.h)
+ ********************************************************************/
+static WEATHERSTATION open_emulator(char *device) {
+  WEATHERSTATION ws;
+
+  if ((ws = emulator_connect(device)) < 0)
+  {
+    printf("\nUnable to connect to station emulator %s\n", device);
+    exit(EXIT_FAILURE);
+  }
+  emulated = 1;
+  return ws;
+}
+
+/********************************************************************
+ * device_is_emulator - the device is the unix socket of a station
+ * emulator, which needs neither a serial port nor root
+ ********************************************************************/
+int device_is_emulator(char *device) {
+  struct stat st;
+
+  return stat(device, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+/********************************************************************
+ * open_weatherstation, Windows version
+ *
+ * Input:   devicename (COM1, COM2 etc)
+ * 
+ * Returns: Handle to the weatherstation (type WEATHERSTATION)
+ *
+ ********************************************************************/
+WEATHERSTATION open_weatherstation (char *device) {
+  WEATHERSTATION ws;
+  unsigned char buffer[BUFFER_SIZE];
+  long i;
+  print_log(1,"open_weatherstation");
+
+  if (device_is_emulator(device))
+    ws = open_emulator(device);
+  else
+    ws = open_serial(device);
+
   for (i = 0; i < 448; i++) {
     buffer[i] = 'U';
   }
@@ -161,6 +204,11 @@ void set_DTR(WEATHERSTATION ws, int val)
 {
   //TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
   int portstatus;
+  if (emulated)
+  {
+    emulator_line(ws, EMULATOR_DTR | (val != 0));
+    return;
+  }
   ioctl(ws, TIOCMGET, &portstatus);	// get current port status
   if (val)
   {
@@ -195,6 +243,11 @@ void set_RTS(WEATHERSTATION ws, int val)
 {
   //TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
   int portstatus;
+  if (emulated)
+  {
+    emulator_line(ws, EMULATOR_RTS | (val != 0));
+    return;
+  }
   ioctl(ws, TIOCMGET, &portstatus);	// get current port status
   if (val)
   {
@@ -230,6 +283,8 @@ void set_RTS(WEATHERSTATION ws, int val)
 int get_DSR(WEATHERSTATION ws)
 {
   int portstatus;
+  if (emulated)
+    return (emulator_status(ws) & EMULATOR_DSR) != 0;
   ioctl(ws, TIOCMGET, &portstatus);	// get current port status
 
   if (portstatus & TIOCM_DSR)
@@ -258,6 +313,8 @@ int get_DSR(WEATHERSTATION ws)
 int get_CTS(WEATHERSTATION ws)
 {
   int portstatus;
+  if (emulated)
+    return (emulator_status(ws) & EMULATOR_CTS) != 0;
   ioctl(ws, TIOCMGET, &portstatus);	// get current port status
 
   if (portstatus & TIOCM_CTS)
@@ -287,6 +344,16 @@ void sleep_short(int milliseconds)
 
 /* Note: if you see timing issues, maybe you need to adjust this ... */
 void nanodelay() {
-	microdelay(10);
+	struct timespec start, ts;
+
+	if (!emulated) {
+		microdelay(10);
+		return;
+	}
+	// no port 0x80 to write to, but the same 10 us of busy waiting
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	} while ((ts.tv_sec - start.tv_sec) * 1000000000L + ts.tv_nsec - start.tv_nsec < 10000);
 }
 
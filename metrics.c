@@ -0,0 +1,269 @@
+/* vim:set expandtab! ts=4: */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+#define DEFAULT_HOST "localhost"
+#define CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+static int listen_unix(Metrics* m, const char* path) {
+	struct sockaddr_un sa;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	// one left behind by a collector that was killed
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+	m->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m->fd == -1) return -1;
+	if (bind(m->fd, (struct sockaddr*)&sa, sizeof(sa)) == -1) return -1;
+	m->path = strdup(path);
+	return 0;
+}
+
+static int listen_inet(Metrics* m, const char* addr) {
+	struct addrinfo hints, *ai;
+	const char* colon = strrchr(addr, ':');
+	char host[256];
+	int one = 1;
+	int err;
+
+	if (colon == NULL || colon - addr >= sizeof(host)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (colon == addr) {
+		strcpy(host, DEFAULT_HOST);
+	} else if (addr[0] == '[' && colon[-1] == ']') {
+		// [::1]:port
+		memcpy(host, addr + 1, colon - addr - 2);
+		host[colon - addr - 2] = 0;
+	} else {
+		memcpy(host, addr, colon - addr);
+		host[colon - addr] = 0;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	err = getaddrinfo(host, colon + 1, &hints, &ai);
+	if (err != 0) {
+		fprintf(stderr, "E: %s: %s\n", addr, gai_strerror(err));
+		errno = EINVAL;
+		return -1;
+	}
+	m->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m->fd == -1
+			|| setsockopt(m->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1
+			|| bind(m->fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+		err = errno;
+		freeaddrinfo(ai);
+		errno = err;
+		return -1;
+	}
+	freeaddrinfo(ai);
+	return 0;
+}
+
+int metrics_listen(Metrics* m, const char* addr, MetricsRender render, void* arg) {
+	int i, rc, err;
+
+	memset(m, 0, sizeof(*m));
+	m->fd = -1;
+	for (i = 0; i < METRICS_CLIENTS; i++) m->client[i].fd = -1;
+	m->render = render;
+	m->arg = arg;
+
+	rc = strchr(addr, '/') != NULL ? listen_unix(m, addr) : listen_inet(m, addr);
+	if (rc == 0) rc = listen(m->fd, METRICS_CLIENTS);
+	if (rc == -1) {
+		err = errno;
+		if (m->fd != -1) close(m->fd);
+		free(m->path);
+		m->fd = -1;
+		m->path = NULL;
+		errno = err;
+	}
+	return rc;
+}
+
+static void drop(MetricsClient* c) {
+	close(c->fd);
+	free(c->answer);
+	c->fd = -1;
+	c->answer = NULL;
+}
+
+void metrics_close(Metrics* m) {
+	int i;
+
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		if (m->client[i].fd != -1) drop(&m->client[i]);
+	}
+	if (m->fd != -1) close(m->fd);
+	if (m->path != NULL) unlink(m->path);
+	free(m->path);
+	m->fd = -1;
+	m->path = NULL;
+}
+
+int metrics_pollfds(const Metrics* m, struct pollfd* fds) {
+	int i, n = 0;
+
+	fds[n].fd = m->fd;
+	fds[n++].events = POLLIN;
+	for (i = 0; i < METRICS_CLIENTS; i++) {
+		const MetricsClient* c = &m->client[i];
+
+		if (c->fd == -1) continue;
+		fds[n].fd = c->fd;
+		fds[n++].events = c->answer != NULL ? POLLOUT : POLLIN;
+	}
+	return n;
+}
+
+static void accept_clients(Metrics* m) {
+	int fd;
+
+	while ((fd = accept4(m->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		MetricsClient* c = &m->client[0];
+		int i;
+
+		// a free slot, or else the one of the oldest connection
+		for (i = 1; i < METRICS_CLIENTS && c->fd != -1; i++) {
+			if (m->client[i].fd == -1 || m->client[i].serial < c->serial) c = &m->client[i];
+		}
+		if (c->fd != -1) drop(c);
+		c->fd = fd;
+		c->serial = m->serial++;
+		c->have = 0;
+		c->len = c->sent = 0;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+		perror("W: metrics: accept");
+}
+
+/* returns -1 when the connection is done with */
+static int send_answer(MetricsClient* c) {
+	while (c->sent < c->len) {
+		ssize_t n = send(c->fd, c->answer + c->sent, c->len - c->sent, MSG_NOSIGNAL);
+
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) return -1;
+		c->sent += n;
+	}
+	return -1;
+}
+
+static void answer(Metrics* m, MetricsClient* c, const char* status, int head) {
+	char* body = NULL;
+	size_t len = 0;
+	FILE* out;
+	int rc;
+
+	out = open_memstream(&body, &len);
+	if (out == NULL) {
+		drop(c);
+		return;
+	}
+	if (strcmp(status, "200 OK") == 0) {
+		m->render(out, m->arg);
+		m->scrapes++;
+	} else {
+		fprintf(out, "%s\n", status);
+	}
+	fclose(out);
+
+	rc = asprintf(&c->answer, "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+			"Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+			status, CONTENT_TYPE, len, head ? "" : body);
+	free(body);
+	if (rc == -1) {
+		c->answer = NULL;
+		drop(c);
+		return;
+	}
+	c->len = rc;
+	c->sent = 0;
+	// usually it goes out in one piece, right away
+	if (send_answer(c) == -1) drop(c);
+}
+
+/* answer the request once its header is complete */
+static void read_request(Metrics* m, MetricsClient* c) {
+	char* end;
+	char* path;
+	ssize_t n;
+	int head;
+
+	n = recv(c->fd, c->request + c->have, sizeof(c->request) - 1 - c->have, 0);
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+	if (n <= 0) {
+		drop(c);
+		return;
+	}
+	c->have += n;
+	c->request[c->have] = 0;
+
+	if (strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL) {
+		if (c->have == sizeof(c->request) - 1) answer(m, c, "400 Bad Request", 0);
+		return;
+	}
+
+	head = strncmp(c->request, "HEAD ", 5) == 0;
+	if (strncmp(c->request, "GET ", 4) != 0 && !head) {
+		answer(m, c, "405 Method Not Allowed", 0);
+		return;
+	}
+	path = c->request + (head ? 5 : 4);
+	end = path + strcspn(path, " ?\r\n");
+	if (end - path == 8 && strncmp(path, "/metrics", 8) == 0)
+		answer(m, c, "200 OK", head);
+	else
+		answer(m, c, "404 Not Found", head);
+}
+
+void metrics_handle(Metrics* m, const struct pollfd* fds, int n) {
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		if (fds[i].revents == 0) continue;
+		if (fds[i].fd == m->fd) {
+			accept_clients(m);
+			continue;
+		}
+		for (j = 0; j < METRICS_CLIENTS; j++) {
+			MetricsClient* c = &m->client[j];
+
+			if (c->fd != fds[i].fd) continue;
+			if (c->answer != NULL && (fds[i].revents & (POLLOUT | POLLERR | POLLHUP))) {
+				if (send_answer(c) == -1) drop(c);
+			} else if (c->answer == NULL) {
+				read_request(m, c);
+			}
+			break;
+		}
+	}
+}
+
+void metrics_header(FILE* out, const char* name, const char* type, const char* help) {
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
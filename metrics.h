@@ -0,0 +1,64 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_METRICS_H_
+#define _INCLUDE_METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <poll.h>
+
+/* A tiny HTTP server for Prometheus to scrape, run inside a collector's
+ * own poll() loop: one thread, non-blocking sockets, no fork.
+ *
+ * The collector adds metrics_pollfds() to the descriptors it polls and
+ * passes what came back to metrics_handle(). A connection is read up to
+ * the end of the request header; GET /metrics is answered with what the
+ * render callback writes, in the text exposition format, anything else
+ * with an error, and the connection is closed once the answer is out
+ * (HTTP/1.0). The callback only copies out what the collector has at
+ * hand, so a scrape takes microseconds and never waits for the station.
+ * When all client slots are taken, the oldest connection is dropped.
+ */
+
+#define METRICS_CLIENTS 8
+#define METRICS_REQUEST_MAX 2048
+
+/* writes the metrics to out */
+typedef void (*MetricsRender)(FILE* out, void* arg);
+
+typedef struct _MetricsClient {
+	int fd;                 /* -1 if the slot is free */
+	uint64_t serial;        /* when it came, to find the oldest */
+	size_t have;            /* bytes of the request read */
+	char request[METRICS_REQUEST_MAX];
+	char* answer;           /* NULL until the request is complete */
+	size_t len, sent;
+} MetricsClient;
+
+typedef struct _Metrics {
+	int fd;                 /* listening socket */
+	char* path;             /* of a unix socket, removed on close */
+	MetricsRender render;
+	void* arg;
+	uint64_t serial;
+	uint64_t scrapes;       /* answered with metrics */
+	MetricsClient client[METRICS_CLIENTS];
+} Metrics;
+
+/* listen on addr: "[host]:port" (host defaults to localhost) or the path
+ * of a unix socket (anything with a '/'). returns -1 and sets errno on
+ * failure. */
+extern int metrics_listen(Metrics* m, const char* addr, MetricsRender render, void* arg);
+extern void metrics_close(Metrics* m);
+
+/* fill fds with the descriptors to poll, at most 1 + METRICS_CLIENTS.
+ * returns their number. */
+extern int metrics_pollfds(const Metrics* m, struct pollfd* fds);
+
+/* accept, read and answer, after poll() returned fds[0..n) */
+extern void metrics_handle(Metrics* m, const struct pollfd* fds, int n);
+
+/* # HELP and # TYPE lines of a metric */
+extern void metrics_header(FILE* out, const char* name, const char* type, const char* help);
+
+#endif /* _INCLUDE_METRICS_H_ */
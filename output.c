@@ -0,0 +1,156 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+
+static const char* sensor_names[RECORD_SENSORS] = { "in", "1", "2", "3", "4", "5" };
+
+static const char* format_names[] = { "text", "csv", "ndjson", "bin" };
+
+const char* sensor_name(int sensor) {
+	return sensor_names[sensor];
+}
+
+int output_format(const char* name) {
+	int i;
+
+	for (i = 0; i < sizeof(format_names)/sizeof(format_names[0]); i++) {
+		if (strcmp(name, format_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void output_bin(RecordBin* b, int index, const Record* r, time_t t) {
+	short tv[RECORD_SENSORS];
+	unsigned char hv[RECORD_SENSORS];
+	int i;
+
+	memset(b, 0, sizeof(*b));
+	record_values(r, tv, hv);
+	b->time = t;
+	b->index = index;
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		b->t[i] = tv[i];
+		b->h[i] = hv[i];
+	}
+}
+
+/* print tenths of a degree without going through float */
+static void print_tenths(FILE* f, int v) {
+	if (v < 0) {
+		fputc('-', f);
+		v = -v;
+	}
+	fprintf(f, "%d.%d", v / 10, v % 10);
+}
+
+void output_header(FILE* f, int format, int sensors) {
+	int i;
+
+	if (format == FORMAT_CSV) {
+		fputs("index,time", f);
+		for (i = 0; i < sensors; i++) {
+			fprintf(f, ",t_%s,h_%s", sensor_names[i], sensor_names[i]);
+		}
+		fputs(",flags\n", f);
+	} else if (format == FORMAT_BIN) {
+		RecordBinHeader h;
+
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, RECORD_BIN_MAGIC, 4);
+		h.version = RECORD_BIN_VERSION;
+		h.record_size = sizeof(RecordBin);
+		h.sensors = sensors;
+		fwrite(&h, sizeof(h), 1, f);
+	}
+}
+
+static void output_text(FILE* f, int index, const Record* r) {
+	fprintf(f, "%04d %02d.%02d.20%02d %02d:%02d ",
+		index, r->date_d, r->date_m, r->date_y, r->time_h, r->time_m);
+
+#define TEXT_PAIR(name, t, h) \
+	if ((t) != RECORD_NA) fprintf(f, "T%s: %02.1f ", name, (t)); \
+	if ((h) != RECORD_NA) fprintf(f, "H%s: %02.1f ", name, (float)(h));
+
+	TEXT_PAIR("in", r->t_in, r->h_in);
+	TEXT_PAIR("1", r->t_1, r->h_1);
+	TEXT_PAIR("2", r->t_2, r->h_2);
+	TEXT_PAIR("3", r->t_3, r->h_3);
+	TEXT_PAIR("4", r->t_4, r->h_4);
+	TEXT_PAIR("5", r->t_5, r->h_5);
+#undef TEXT_PAIR
+
+	fputc('\n', f);
+}
+
+static void output_text_bin(FILE* f, const RecordBin* b) {
+	struct tm tm;
+	time_t t = b->time;
+	int i;
+
+	localtime_r(&t, &tm);
+	fprintf(f, "%04u %02d.%02d.20%02d %02d:%02d ", b->index,
+		tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100, tm.tm_hour, tm.tm_min);
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (b->t[i] != RECORD_NA_T)
+			fprintf(f, "T%s: %02.1f ", sensor_names[i], b->t[i] / 10.0);
+		if (b->h[i] != RECORD_NA)
+			fprintf(f, "H%s: %02.1f ", sensor_names[i], (float)b->h[i]);
+	}
+	fputc('\n', f);
+}
+
+void output_record_bin(FILE* f, int format, const RecordBin* b, int sensors) {
+	int i;
+
+	if (format == FORMAT_TEXT) {
+		output_text_bin(f, b);
+		return;
+	}
+
+	if (format == FORMAT_BIN) {
+		fwrite(b, sizeof(*b), 1, f);
+		return;
+	}
+
+	if (format == FORMAT_CSV) {
+		fprintf(f, "%u,%lld", b->index, (long long)b->time);
+		for (i = 0; i < sensors; i++) {
+			fputc(',', f);
+			if (b->t[i] != RECORD_NA_T) print_tenths(f, b->t[i]);
+			fputc(',', f);
+			if (b->h[i] != RECORD_NA) fprintf(f, "%d", b->h[i]);
+		}
+		fprintf(f, ",%u\n", b->flags);
+		return;
+	}
+
+	// FORMAT_NDJSON
+	fprintf(f, "{\"index\":%u,\"time\":%lld", b->index, (long long)b->time);
+	for (i = 0; i < sensors; i++) {
+		fprintf(f, ",\"t_%s\":", sensor_names[i]);
+		if (b->t[i] != RECORD_NA_T) print_tenths(f, b->t[i]);
+		else fputs("null", f);
+		fprintf(f, ",\"h_%s\":", sensor_names[i]);
+		if (b->h[i] != RECORD_NA) fprintf(f, "%d", b->h[i]);
+		else fputs("null", f);
+	}
+	fprintf(f, ",\"flags\":%u}\n", b->flags);
+}
+
+void output_record(FILE* f, int format, int index, const Record* r,
+		time_t t, int sensors) {
+	RecordBin b;
+
+	if (format == FORMAT_TEXT) {
+		output_text(f, index, r);
+		return;
+	}
+
+	output_bin(&b, index, r, t);
+	output_record_bin(f, format, &b, sensors);
+}
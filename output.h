@@ -0,0 +1,58 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_OUTPUT_H_
+#define _INCLUDE_OUTPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "record.h"
+
+/* output formats of decode_tfa */
+#define FORMAT_TEXT   0  /* human readable, see README.DATA */
+#define FORMAT_CSV    1  /* one line per record, typed columns */
+#define FORMAT_NDJSON 2  /* one JSON object per line */
+#define FORMAT_BIN    3  /* RecordBinHeader + RecordBin[] */
+
+#define RECORD_BIN_MAGIC "TFAB"
+#define RECORD_BIN_VERSION 1
+
+/* Binary format: a 16 byte header followed by fixed 32 byte records, in
+ * host byte order. The record count follows from the file size, so
+ * consumers can mmap the file and index the records directly. */
+typedef struct _RecordBinHeader {
+	char magic[4];          /* RECORD_BIN_MAGIC */
+	uint16_t version;       /* RECORD_BIN_VERSION */
+	uint16_t record_size;   /* sizeof(RecordBin) */
+	uint8_t sensors;        /* number of sensors with data (1..6) */
+	uint8_t reserved[7];
+} RecordBinHeader;
+
+typedef struct _RecordBin {
+	int64_t time;           /* unix timestamp */
+	uint32_t index;         /* record slot in the eeprom, or position in a merged series */
+	int16_t t[RECORD_SENSORS];  /* tenths of deg C, RECORD_NA_T if missing */
+	uint8_t h[RECORD_SENSORS];  /* %RH, RECORD_NA if missing */
+	uint16_t flags;         /* failed plausibility checks, INVALID_* in validate.h */
+} RecordBin;
+
+/* name of a sensor column: "in", "1" .. "5" */
+extern const char* sensor_name(int sensor);
+
+/* look up a format by name ("text", "csv", "ndjson", "bin"), -1 if unknown */
+extern int output_format(const char* name);
+
+/* fill a RecordBin from a parsed record */
+extern void output_bin(RecordBin* b, int index, const Record* r, time_t t);
+
+/* write the format's file header (CSV column names, binary header) */
+extern void output_header(FILE* f, int format, int sensors);
+
+/* write one record; t is the record's unix timestamp */
+extern void output_record(FILE* f, int format, int index, const Record* r,
+		time_t t, int sensors);
+
+/* write one already converted record */
+extern void output_record_bin(FILE* f, int format, const RecordBin* b,
+		int sensors);
+
+#endif /* _INCLUDE_OUTPUT_H_ */
@@ -0,0 +1,437 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pack.h"
+#include "record.h"
+#include "tsdb.h"
+#include "hash.h"
+
+static inline uint32_t zigzag(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t v) {
+	return (v >> 1) ^ -(v & 1);
+}
+
+/* bit-pack n values, a width byte per mini-block. returns the end. */
+static unsigned char* pack_values(unsigned char* p, const uint32_t* v, int n) {
+	int i, k;
+
+	for (i = 0; i < n; i += PACK_MINIBLOCK) {
+		int m = n - i < PACK_MINIBLOCK ? n - i : PACK_MINIBLOCK;
+		uint32_t all = 0;
+		uint64_t acc = 0;
+		int w = 0, bits = 0;
+
+		for (k = 0; k < m; k++) all |= v[i + k];
+		while (w < 32 && (all >> w) != 0) w++;
+		*p++ = w;
+		if (w == 0) continue;
+
+		for (k = 0; k < m; k++) {
+			acc |= (uint64_t)v[i + k] << bits;
+			for (bits += w; bits >= 8; bits -= 8) {
+				*p++ = acc;
+				acc >>= 8;
+			}
+		}
+		if (bits > 0) *p++ = acc;
+	}
+	return p;
+}
+
+/* unpack n values from p, not past end (there are PACK_PAD bytes after
+ * it). returns the end of them, NULL if they do not fit. */
+static const unsigned char* unpack_values(const unsigned char* p,
+		const unsigned char* end, uint32_t* v, int n) {
+	int i, k;
+
+	for (i = 0; i < n; i += PACK_MINIBLOCK) {
+		int m = n - i < PACK_MINIBLOCK ? n - i : PACK_MINIBLOCK;
+		uint64_t mask;
+		size_t bytes;
+		int w;
+
+		if (p >= end) return NULL;
+		w = *p++;
+		bytes = ((size_t)m * w + 7) / 8;
+		if (w > 32 || bytes > (size_t)(end - p)) return NULL;
+		if (w == 0) {
+			memset(v + i, 0, m * sizeof(*v));
+			continue;
+		}
+
+		mask = ((uint64_t)1 << w) - 1;
+		for (k = 0; k < m; k++) {
+			size_t bit = (size_t)k * w;
+			uint64_t x;
+
+			memcpy(&x, p + (bit >> 3), sizeof(x));
+			v[i + k] = (le64toh(x) >> (bit & 7)) & mask;
+		}
+		p += bytes;
+	}
+	return p;
+}
+
+/* the bitmap (unless all or none of the rows have a reading) and the deltas
+ * of a column of readings, na where there is none */
+static unsigned char* pack_readings(unsigned char* p, const int32_t* x,
+		int rows, int32_t na, int* count, int32_t* first) {
+	uint32_t v[PACK_BLOCK_ROWS];
+	int32_t prev = 0;
+	int i, n = 0;
+
+	*first = 0;
+	for (i = 0; i < rows; i++) {
+		if (x[i] == na) continue;
+		if (n == 0) *first = x[i];
+		else v[n - 1] = zigzag(x[i] - prev);
+		prev = x[i];
+		n++;
+	}
+	*count = n;
+	if (n == 0) return p;
+	if (n < rows) {
+		memset(p, 0, (rows + 7) / 8);
+		for (i = 0; i < rows; i++)
+			if (x[i] != na) p[i >> 3] |= 1 << (i & 7);
+		p += (rows + 7) / 8;
+	}
+	return pack_values(p, v, n - 1);
+}
+
+static const unsigned char* unpack_readings(const unsigned char* p,
+		const unsigned char* end, int rows, int count, int32_t first,
+		int32_t na, int32_t* x) {
+	uint32_t v[PACK_BLOCK_ROWS];
+	const unsigned char* bitmap = NULL;
+	uint32_t cur = first;
+	int i, k;
+
+	if (count == 0) {
+		for (i = 0; i < rows; i++) x[i] = na;
+		return p;
+	}
+	if (count < rows) {
+		bitmap = p;
+		p += (rows + 7) / 8;
+		if (p > end) return NULL;
+	}
+	p = unpack_values(p, end, v, count - 1);
+	if (p == NULL) return NULL;
+
+	if (bitmap == NULL) {
+		x[0] = first;
+		for (i = 1; i < rows; i++) x[i] = cur += unzigzag(v[i - 1]);
+		return p;
+	}
+	for (i = 0, k = 0; i < rows; i++) {
+		if ((bitmap[i >> 3] >> (i & 7) & 1) == 0) {
+			x[i] = na;
+			continue;
+		}
+		if (k == count) return NULL;
+		if (k > 0) cur += unzigzag(v[k - 1]);
+		x[i] = cur;
+		k++;
+	}
+	return k == count ? p : NULL;
+}
+
+int pack_encode(const int64_t* time, const int16_t* t, const uint8_t* h,
+		const uint8_t* flags, int rows, unsigned char* out) {
+	PackBlock b;
+	uint32_t v[PACK_BLOCK_ROWS];
+	int32_t x[PACK_BLOCK_ROWS];
+	unsigned char* p = out + sizeof(PackBlock);
+	int32_t first;
+	int i, count;
+
+	if (rows < 1 || rows > PACK_BLOCK_ROWS) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 1; i < rows; i++) {
+		if (time[i] <= time[i - 1] || time[i] - time[i - 1] > INT32_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.rows = rows;
+	b.first = time[0];
+	b.last = time[rows - 1];
+	b.delta = rows > 1 ? time[1] - time[0] : 0;
+	for (i = 2; i < rows; i++)
+		v[i - 2] = zigzag((time[i] - time[i - 1]) - (time[i - 1] - time[i - 2]));
+	p = pack_values(p, v, rows > 2 ? rows - 2 : 0);
+
+	for (i = 0; i < rows; i++) x[i] = t[i];
+	p = pack_readings(p, x, rows, RECORD_NA_T, &count, &first);
+	b.t_count = count;
+	b.t_first = first;
+
+	for (i = 0; i < rows; i++) x[i] = h[i];
+	p = pack_readings(p, x, rows, RECORD_NA, &count, &first);
+	b.h_count = count;
+	b.h_first = first;
+
+	for (i = 0; i < rows && flags[i] == 0; i++);
+	if (i < rows) {
+		size_t len = (rows + 7) / 8;
+
+		b.flagged = 1;
+		memset(p, 0, 2 * len);
+		for (i = 0; i < rows; i++) {
+			if (flags[i] & TSDB_FLAG_T) p[i >> 3] |= 1 << (i & 7);
+			if (flags[i] & TSDB_FLAG_H) p[len + (i >> 3)] |= 1 << (i & 7);
+		}
+		p += 2 * len;
+	}
+
+	memset(p, 0, PACK_PAD);
+	p += PACK_PAD;
+	b.length = p - out;
+	b.hash = hash_fnv1a(HASH_INIT, out + sizeof(b), b.length - sizeof(b));
+	memcpy(out, &b, sizeof(b));
+	return b.length;
+}
+
+int pack_decode(const unsigned char* block, size_t len,
+		int64_t* time, int16_t* t, uint8_t* h, uint8_t* flags) {
+	PackBlock b;
+	uint32_t v[PACK_BLOCK_ROWS];
+	int32_t x[PACK_BLOCK_ROWS];
+	const unsigned char* p = block + sizeof(b);
+	const unsigned char* end;
+	uint64_t cur, delta;
+	int i;
+
+	if (len < sizeof(b)) goto damaged;
+	memcpy(&b, block, sizeof(b));
+	if (b.length < sizeof(b) + PACK_PAD || b.length > len
+			|| b.rows < 1 || b.rows > PACK_BLOCK_ROWS
+			|| b.t_count > b.rows || b.h_count > b.rows
+			|| (uint32_t)hash_fnv1a(HASH_INIT, p, b.length - sizeof(b)) != b.hash)
+		goto damaged;
+	end = block + b.length - PACK_PAD;
+
+	p = unpack_values(p, end, v, b.rows > 2 ? b.rows - 2 : 0);
+	if (p == NULL) goto damaged;
+	cur = time[0] = b.first;
+	delta = (int64_t)b.delta;
+	if (b.rows > 1) cur = time[1] = b.first + b.delta;
+	for (i = 2; i < b.rows; i++) {
+		delta += (int64_t)(int32_t)unzigzag(v[i - 2]);
+		time[i] = cur += delta;
+	}
+	if (time[b.rows - 1] != b.last) goto damaged;
+
+	p = unpack_readings(p, end, b.rows, b.t_count, b.t_first, RECORD_NA_T, x);
+	if (p == NULL) goto damaged;
+	for (i = 0; i < b.rows; i++) t[i] = x[i];
+
+	p = unpack_readings(p, end, b.rows, b.h_count, b.h_first, RECORD_NA, x);
+	if (p == NULL) goto damaged;
+	for (i = 0; i < b.rows; i++) h[i] = x[i];
+
+	memset(flags, 0, b.rows);
+	if (b.flagged) {
+		size_t n = (b.rows + 7) / 8;
+
+		if (2 * n > (size_t)(end - p)) goto damaged;
+		for (i = 0; i < b.rows; i++) {
+			if (p[i >> 3] >> (i & 7) & 1) flags[i] |= TSDB_FLAG_T;
+			if (p[n + (i >> 3)] >> (i & 7) & 1) flags[i] |= TSDB_FLAG_H;
+		}
+	}
+
+	return b.rows;
+
+damaged:
+	errno = EILSEQ;
+	return -1;
+}
+
+int pack_create(PackWriter* w, const char* path, int sensor) {
+	PackHeader hdr;
+	char tmp[4096];
+
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	w->path = strdup(path);
+	if (w->path == NULL) return -1;
+	w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd == -1) goto fail;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACK_MAGIC, 4);
+	hdr.version = PACK_VERSION;
+	hdr.sensor = sensor;
+	hdr.block_rows = PACK_BLOCK_ROWS;
+	if (write(w->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
+	w->bytes = sizeof(hdr);
+	return 0;
+
+fail:
+	pack_abort(w);
+	return -1;
+}
+
+static int write_block(PackWriter* w) {
+	unsigned char buf[PACK_BLOCK_MAX];
+	ssize_t n;
+	int len;
+
+	if (w->n == 0) return 0;
+	len = pack_encode(w->time, w->t, w->h, w->flags, w->n, buf);
+	if (len == -1) return -1;
+	n = write(w->fd, buf, len);
+	if (n != len) {
+		if (n >= 0) errno = ENOSPC;
+		return -1;
+	}
+	w->bytes += len;
+	w->blocks++;
+	w->n = 0;
+	return 0;
+}
+
+int pack_append(PackWriter* w, int64_t time, int16_t t, uint8_t h,
+		uint8_t flags) {
+	if (w->n > 0) {
+		if (time <= w->time[w->n - 1]) {
+			errno = EINVAL;
+			return -1;
+		}
+		// a gap of more than 68 years starts a new block
+		if (time - w->time[w->n - 1] > INT32_MAX && write_block(w) == -1)
+			return -1;
+	}
+	if (w->n == PACK_BLOCK_ROWS && write_block(w) == -1) return -1;
+
+	w->time[w->n] = time;
+	w->t[w->n] = t;
+	w->h[w->n] = h;
+	w->flags[w->n] = flags;
+	w->n++;
+	w->rows++;
+	return 0;
+}
+
+int pack_finish(PackWriter* w) {
+	char tmp[4096];
+	int rc = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", w->path);
+	if (write_block(w) == -1) rc = -1;
+	if (close(w->fd) == -1) rc = -1;
+	w->fd = -1;
+	if (rc == 0) rc = rename(tmp, w->path);
+	if (rc == -1) {
+		pack_abort(w);
+		return -1;
+	}
+	free(w->path);
+	w->path = NULL;
+	return 0;
+}
+
+void pack_abort(PackWriter* w) {
+	char tmp[4096];
+	int err = errno;
+
+	if (w->fd != -1) close(w->fd);
+	w->fd = -1;
+	if (w->path != NULL) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", w->path);
+		unlink(tmp);
+		free(w->path);
+		w->path = NULL;
+	}
+	errno = err;
+}
+
+int pack_open(PackReader* r, const char* path) {
+	PackHeader hdr;
+	struct stat st;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(path, O_RDONLY);
+	if (r->fd == -1) return -1;
+	if (fstat(r->fd, &st) == -1) goto fail;
+	if ((size_t)st.st_size < sizeof(hdr)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	r->len = st.st_size;
+	r->map = mmap(NULL, r->len, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		goto fail;
+	}
+	madvise((void*)r->map, r->len, MADV_SEQUENTIAL);
+
+	memcpy(&hdr, r->map, sizeof(hdr));
+	if (memcmp(hdr.magic, PACK_MAGIC, 4) != 0 || hdr.version != PACK_VERSION
+			|| hdr.block_rows != PACK_BLOCK_ROWS || hdr.sensor >= RECORD_SENSORS) {
+		errno = EINVAL;
+		goto fail;
+	}
+	r->sensor = hdr.sensor;
+	r->pos = sizeof(hdr);
+	return 0;
+
+fail:
+	err = errno;
+	pack_close(r);
+	errno = err;
+	return -1;
+}
+
+void pack_close(PackReader* r) {
+	if (r->map != NULL) munmap((void*)r->map, r->len);
+	if (r->fd != -1) close(r->fd);
+	r->map = NULL;
+	r->fd = -1;
+}
+
+void pack_seek(PackReader* r, int64_t from) {
+	PackBlock b;
+
+	while (r->len - r->pos >= sizeof(b)) {
+		memcpy(&b, r->map + r->pos, sizeof(b));
+		if (b.last >= from || b.length < sizeof(b) || b.length > r->len - r->pos)
+			break;
+		r->pos += b.length;
+	}
+}
+
+int pack_next(PackReader* r, int64_t* time, int16_t* t, uint8_t* h,
+		uint8_t* flags) {
+	uint32_t length;
+	int rows;
+
+	if (r->pos == r->len) return 0;
+	rows = pack_decode(r->map + r->pos, r->len - r->pos, time, t, h, flags);
+	if (rows == -1) return -1;
+	memcpy(&length, r->map + r->pos, sizeof(length));
+	r->pos += length;
+	return rows;
+}
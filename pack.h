@@ -0,0 +1,123 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_PACK_H_
+#define _INCLUDE_PACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compressed series of one sensor, for long-term storage.
+ *
+ * A pack file is a PackHeader followed by blocks of up to PACK_BLOCK_ROWS
+ * rows. Each block starts with a PackBlock, holding the time range and the
+ * first readings, and decodes on its own. The payload has, each section
+ * starting on a byte:
+ *
+ *  time    the deltas of the deltas of the timestamps, 0 at a steady
+ *          interval (rows 2..rows-1)
+ *  t       a bitmap of the rows with a temperature, left out if all or none
+ *          have one, then the deltas between consecutive temperatures
+ *  h       the same for the humidity
+ *  flags   only if flagged is set: a bitmap of the rows with a temperature
+ *          that failed the plausibility checks (TSDB_FLAG_T), then one of
+ *          those with a humidity that did (TSDB_FLAG_H)
+ *
+ * The deltas are zig-zag encoded (0, -1, 1, -2 ... become 0, 1, 2, 3 ...)
+ * and bit-packed PACK_MINIBLOCK at a time, after a byte with the width of
+ * the largest one, so a steady interval takes no bits at all and a slowly
+ * changing temperature two or three. Unpacking is a load, a shift and a
+ * mask per value; the PACK_PAD zero bytes at the end of a block let every
+ * load take 64 bits.
+ */
+
+#define PACK_MAGIC "TFAP"
+#define PACK_VERSION 1
+#define PACK_BLOCK_ROWS 4096
+#define PACK_MINIBLOCK 128
+#define PACK_PAD 8
+
+typedef struct _PackHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t sensor;
+	uint16_t block_rows;
+	uint8_t reserved[6];
+} PackHeader;
+
+typedef struct _PackBlock {
+	uint32_t length;        /* bytes of the block, this header included */
+	uint32_t hash;          /* low bits of hash_fnv1a() of the payload */
+	int64_t first;          /* time of the first and the last row */
+	int64_t last;
+	int32_t delta;          /* time between the first two rows */
+	uint16_t rows;
+	uint16_t t_count;       /* rows with a temperature and with a humidity */
+	uint16_t h_count;
+	int16_t t_first;        /* first temperature and humidity */
+	uint8_t h_first;
+	uint8_t flagged;        /* the flag bitmaps follow the readings */
+	uint8_t reserved[2];
+} PackBlock;
+
+/* room for a block of PACK_BLOCK_ROWS rows at the worst: deltas of 32, 17
+ * and 9 bits, the bitmaps, a width per mini-block and the padding */
+#define PACK_BLOCK_MAX (sizeof(PackBlock) \
+		+ (size_t)PACK_BLOCK_ROWS * (32 + 17 + 9 + 4) / 8 \
+		+ 3 * (PACK_BLOCK_ROWS / PACK_MINIBLOCK) + PACK_PAD)
+
+typedef struct _PackWriter {
+	int fd;
+	char* path;             /* of the file, written to path.tmp until pack_finish() */
+	int n;                  /* rows of the block being filled */
+	int64_t time[PACK_BLOCK_ROWS];
+	int16_t t[PACK_BLOCK_ROWS];
+	uint8_t h[PACK_BLOCK_ROWS];
+	uint8_t flags[PACK_BLOCK_ROWS];
+	uint64_t rows;
+	uint64_t bytes;
+	uint64_t blocks;
+} PackWriter;
+
+typedef struct _PackReader {
+	int fd;
+	const unsigned char* map;
+	size_t len;
+	size_t pos;             /* of the next block */
+	int sensor;
+} PackReader;
+
+/* encode rows <= PACK_BLOCK_ROWS rows with increasing times, and the
+ * TSDB_FLAG_* of their readings, into out, which has room for
+ * PACK_BLOCK_MAX bytes. returns the length of the block, -1 with errno
+ * EINVAL if the times do not increase. */
+extern int pack_encode(const int64_t* time, const int16_t* t, const uint8_t* h,
+		const uint8_t* flags, int rows, unsigned char* out);
+
+/* decode the block of len bytes at block into PACK_BLOCK_ROWS sized columns;
+ * missing readings are RECORD_NA_T and RECORD_NA. returns the rows, -1 with
+ * errno EILSEQ if the block is damaged. */
+extern int pack_decode(const unsigned char* block, size_t len,
+		int64_t* time, int16_t* t, uint8_t* h, uint8_t* flags);
+
+/* write a pack file of sensor to path, replacing it at pack_finish(). the
+ * rows are appended in the order of time. returns -1 and sets errno on
+ * failure; pack_abort() throws the new file away. */
+extern int pack_create(PackWriter* w, const char* path, int sensor);
+extern int pack_append(PackWriter* w, int64_t time, int16_t t, uint8_t h,
+		uint8_t flags);
+extern int pack_finish(PackWriter* w);
+extern void pack_abort(PackWriter* w);
+
+/* map a pack file for reading. returns -1 and sets errno on failure. */
+extern int pack_open(PackReader* r, const char* path);
+extern void pack_close(PackReader* r);
+
+/* skip the blocks that end before from, by their headers alone */
+extern void pack_seek(PackReader* r, int64_t from);
+
+/* decode the next block into PACK_BLOCK_ROWS sized columns. returns the
+ * rows, 0 at the end of the file, -1 with errno EILSEQ if it is damaged. */
+extern int pack_next(PackReader* r, int64_t* time, int16_t* t, uint8_t* h,
+		uint8_t* flags);
+
+#endif /* _INCLUDE_PACK_H_ */
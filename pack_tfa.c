@@ -0,0 +1,203 @@
+/* vim:set expandtab! ts=4: */
+
+/* pack_tfa - compress the series of a tsdb database for long-term storage,
+ * one pack file per sensor (see pack.h), and read them back. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "record.h"
+#include "tsdb.h"
+#include "pack.h"
+#include "util.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: pack_tfa pack <dbdir> <packdir>\n");
+	fprintf(stderr, "       pack_tfa cat <packfile> <from> [to]\n");
+	fprintf(stderr, "       pack_tfa [--time=<seconds>] scan <packfile>...\n");
+	fprintf(stderr, "  from, to: unix time, \"now\" or relative to now, like -1d\n");
+	exit(EXIT_FAILURE);
+}
+
+/* the columns of one block */
+static int64_t times[PACK_BLOCK_ROWS];
+static int16_t temps[PACK_BLOCK_ROWS];
+static uint8_t hums[PACK_BLOCK_ROWS];
+static uint8_t flags[PACK_BLOCK_ROWS];
+
+#define READ_ROWS 65536
+
+static int cmd_pack(const char* dbdir, const char* packdir) {
+	static TsdbPoint points[READ_ROWS];
+	Tsdb db;
+	int sensor, rc = 0;
+
+	if (tsdb_open(&db, dbdir, 0) == -1) {
+		fprintf(stderr, "E: can't open database %s: %s\n", dbdir, strerror(errno));
+		return 1;
+	}
+	if (mkdir(packdir, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "E: can't create %s: %s\n", packdir, strerror(errno));
+		tsdb_close(&db);
+		return 1;
+	}
+
+	for (sensor = 0; sensor < RECORD_SENSORS; sensor++) {
+		uint64_t rows = tsdb_rows(&db, sensor), row;
+		PackWriter* w;
+		char path[4096];
+		long n, i;
+
+		if (rows == 0) continue;
+		snprintf(path, sizeof(path), "%s/sensor_%s.pack", packdir, sensor_name(sensor));
+		w = malloc(sizeof(PackWriter));
+		if (w == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		if (pack_create(w, path, sensor) == -1) {
+			fprintf(stderr, "E: can't create %s: %s\n", path, strerror(errno));
+			free(w);
+			rc = 1;
+			continue;
+		}
+
+		for (row = 0; row < rows; row += n) {
+			n = tsdb_read(&db, sensor, row, READ_ROWS, points);
+			if (n <= 0) break;
+			for (i = 0; i < n; i++) {
+				if (pack_append(w, points[i].time, points[i].t, points[i].h,
+						points[i].flags) == -1)
+					break;
+			}
+			if (i < n) break;
+		}
+		if (row < rows || pack_finish(w) == -1) {
+			fprintf(stderr, "E: packing sensor %s into %s failed: %s\n",
+					sensor_name(sensor), path, strerror(errno));
+			pack_abort(w);
+			rc = 1;
+		} else {
+			printf("%s %llu rows, %llu blocks, %llu bytes, %.2f bits/row\n",
+					path, (unsigned long long)w->rows, (unsigned long long)w->blocks,
+					(unsigned long long)w->bytes, w->bytes * 8.0 / w->rows);
+		}
+		free(w);
+	}
+
+	tsdb_close(&db);
+	return rc;
+}
+
+static void open_pack(PackReader* r, const char* path) {
+	if (pack_open(r, path) == -1) {
+		fprintf(stderr, "E: can't open %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int cmd_cat(const char* path, int64_t from, int64_t to) {
+	PackReader r;
+	int n, i;
+
+	open_pack(&r, path);
+	pack_seek(&r, from);
+
+	printf("# time t h\n");
+	while ((n = pack_next(&r, times, temps, hums, flags)) > 0) {
+		for (i = 0; i < n && times[i] <= to; i++) {
+			if (times[i] < from) continue;
+			printf("%lld", (long long)times[i]);
+			if (temps[i] != RECORD_NA_T && !(flags[i] & TSDB_FLAG_T))
+				printf(" %.1f", temps[i] / 10.0);
+			else printf(" U");
+			if (hums[i] != RECORD_NA && !(flags[i] & TSDB_FLAG_H))
+				printf(" %d\n", hums[i]);
+			else printf(" U\n");
+		}
+		if (i < n) break;
+	}
+	if (n == -1)
+		fprintf(stderr, "E: %s: damaged block at offset %zu\n", path, r.pos);
+	pack_close(&r);
+	return n == -1 ? 1 : 0;
+}
+
+/* decode all of the files over and over for seconds, for the speed */
+static int cmd_scan(char** paths, int npaths, double seconds) {
+	int f, rc = 0;
+
+	printf("# file rows bytes bits/row ratio Mrows/s MB/s\n");
+	for (f = 0; f < npaths; f++) {
+		PackReader r;
+		uint64_t rows = 0, passes = 0;
+		double start = util_now(), t;
+		int n = 0;
+
+		open_pack(&r, paths[f]);
+		do {
+			r.pos = sizeof(PackHeader);
+			while ((n = pack_next(&r, times, temps, hums, flags)) > 0) rows += n;
+			passes++;
+			t = util_now() - start;
+		} while (n == 0 && t < seconds);
+
+		if (n == -1) {
+			fprintf(stderr, "E: %s: damaged block at offset %zu\n", paths[f], r.pos);
+			rc = 1;
+		} else if (rows > 0) {
+			// rows / passes rows of 8 + 2 + 1 + 1 bytes in the tsdb columns
+			double raw = rows / passes * (double)(sizeof(int64_t) + sizeof(int16_t) + 2 * sizeof(uint8_t));
+
+			printf("%s %llu %zu %.2f %.1f %.1f %.0f\n", paths[f],
+					(unsigned long long)(rows / passes), r.len,
+					r.len * 8.0 / (rows / passes), raw / r.len,
+					rows / t / 1e6, raw * passes / t / 1e6);
+		}
+		pack_close(&r);
+	}
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = 1;
+	const char* cmd;
+	int ch;
+
+	static const struct option options[] = {
+		{ "time", required_argument, NULL, 't' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	// options only up front, so relative times like -1w are not taken for them
+	while ((ch = getopt_long(argc, argv, "+t:", options, NULL)) != -1) {
+		switch (ch) {
+		case 't':
+			seconds = atof(optarg);
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (argc - optind < 2) print_usage();
+	cmd = argv[optind];
+
+	if (strcmp(cmd, "pack") == 0 && argc - optind == 3) {
+		return cmd_pack(argv[optind+1], argv[optind+2]);
+	} else if (strcmp(cmd, "cat") == 0 && (argc - optind == 3 || argc - optind == 4)) {
+		time_t t = time(NULL);
+		int64_t from = util_parse_time(argv[optind+2], t);
+		int64_t to = argc - optind == 4 ? util_parse_time(argv[optind+3], t) : t;
+
+		if (from == -1 || to == -1) print_usage();
+		return cmd_cat(argv[optind+1], from, to);
+	} else if (strcmp(cmd, "scan") == 0) {
+		return cmd_scan(argv + optind + 1, argc - optind - 1, seconds);
+	}
+	print_usage();
+	return 1;
+}
@@ -0,0 +1,263 @@
+/* vim:set expandtab! ts=4: */
+
+/* query_tfa - min/max/average/last of sensors of a tsdb database over a
+ * time window, like the GPRINT lines of DRAW.pl; or percentiles of them,
+ * per window or per step, over one or several databases. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include "record.h"
+#include "output.h"
+#include "tsdb.h"
+#include "util.h"
+
+static void print_usage() {
+	fprintf(stderr, "Usage: query_tfa <dbdir> <sensor|all> <from> [to]\n");
+	fprintf(stderr, "       query_tfa --percentiles=<p,...> [--step=<time>] <dbdir>[,<dbdir>...] <sensor|all> <from> [to]\n");
+	fprintf(stderr, "  from, to: unix time, \"now\" or relative to now, like -1d\n");
+	fprintf(stderr, "            (units s, m, h, d, w, M = 30 days, y = 365 days)\n");
+	fprintf(stderr, "  step: seconds or with a unit, like 1h or 1d\n");
+	exit(EXIT_FAILURE);
+}
+
+/* parse a step like 3600, 60m or 1h, 0 on error */
+static int64_t parse_step(const char* arg) {
+	char* end;
+	long long n = strtoll(arg, &end, 10);
+
+	if (end == arg || n <= 0) return 0;
+	if (*end == 0) return n;
+	if (end[1] != 0) return 0;
+
+	switch (*end) {
+	case 's': return n;
+	case 'm': return n * 60;
+	case 'h': return n * 3600;
+	case 'd': return n * 86400;
+	case 'w': return n * 7 * 86400;
+	default: return 0;
+	}
+}
+
+/* parse a list of percentiles like 5,50,95 into q[] (0..1). returns the
+ * count, 0 on error. */
+static int parse_percentiles(const char* arg, double* q, int size) {
+	int n = 0;
+
+	while (n < size) {
+		char* end;
+		double p = strtod(arg, &end);
+
+		if (end == arg || p < 0 || p > 100) return 0;
+		q[n++] = p / 100;
+		if (*end == 0) return n;
+		if (*end != ',') return 0;
+		arg = end + 1;
+	}
+	return 0;
+}
+
+static void print_tenths(long long v) {
+	putchar(' ');
+	if (v < 0) {
+		putchar('-');
+		v = -v;
+	}
+	printf("%lld.%lld", v / 10, v % 10);
+}
+
+#define MAX_PERCENTILES 16
+
+static void print_quantile(double v, int tenths) {
+	if (isnan(v)) printf(" U");
+	else if (tenths) printf(" %.1f", v / 10);
+	else printf(" %.0f", v);
+}
+
+/* the percentiles of each sensor over [from, to), per step, with the
+ * readings of all databases put together */
+static int query_percentiles(Tsdb* dbs, int ndbs, int first, int last,
+		int64_t from, int64_t to, int64_t step, const double* q, int nq) {
+	int sensor, i, k, rc = 0;
+	int64_t start;
+
+	printf("# sensor from readings");
+	for (k = 0; k < nq; k++) printf(" t_p%g", q[k] * 100);
+	for (k = 0; k < nq; k++) printf(" h_p%g", q[k] * 100);
+	printf("\n");
+
+	for (sensor = first; sensor <= last; sensor++) {
+		int64_t lo = INT64_MAX, hi = INT64_MIN;
+
+		// no need to look at the steps before the first or after the last
+		// reading
+		for (i = 0; i < ndbs; i++) {
+			TsdbPoint p;
+
+			if (tsdb_rows(&dbs[i], sensor) == 0
+					|| tsdb_read(&dbs[i], sensor, 0, 1, &p) != 1)
+				continue;
+			if (p.time < lo) lo = p.time;
+			if (tsdb_last(&dbs[i], sensor) > hi) hi = tsdb_last(&dbs[i], sensor);
+		}
+		start = from;
+		if (lo > from && lo != INT64_MAX) start += (lo - from) / step * step;
+
+		for (; start < to; start += step) {
+			int64_t end = to - start > step ? start + step : to;
+			Sketch t, h;
+
+			if (start > hi && step < to - from) break;
+
+			sketch_init(&t);
+			sketch_init(&h);
+			for (i = 0; i < ndbs; i++) {
+				if (tsdb_quantiles(&dbs[i], sensor, start, end, &t, &h) == -1) {
+					fprintf(stderr, "E: reading sensor %s failed: %s\n", sensor_name(sensor), strerror(errno));
+					rc = 1;
+				}
+			}
+			if (t.count == 0 && h.count == 0 && (first != last || step < to - from))
+				continue;
+
+			printf("%s %lld %u", sensor_name(sensor), (long long)start,
+					t.count > h.count ? t.count : h.count);
+			for (k = 0; k < nq; k++) print_quantile(sketch_quantile(&t, q[k]), 1);
+			for (k = 0; k < nq; k++) print_quantile(sketch_quantile(&h, q[k]), 0);
+			printf("\n");
+		}
+	}
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+	Tsdb db;
+	time_t now = time(NULL);
+	int64_t from, to, step = 0;
+	double q[MAX_PERCENTILES];
+	int nq = 0;
+	int sensor, first = 0, last = RECORD_SENSORS - 1;
+	int ch, rc = 0;
+
+	static const struct option options[] = {
+		{ "percentiles", required_argument, NULL, 'p' },
+		{ "step", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	// options only up front, so relative times like -1w are not taken for them
+	while ((ch = getopt_long(argc, argv, "+p:s:", options, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			nq = parse_percentiles(optarg, q, MAX_PERCENTILES);
+			if (nq == 0) {
+				fprintf(stderr, "E: bad percentiles %s\n", optarg);
+				print_usage();
+			}
+			break;
+		case 's':
+			step = parse_step(optarg);
+			if (step == 0) {
+				fprintf(stderr, "E: bad step %s\n", optarg);
+				print_usage();
+			}
+			break;
+		default:
+			print_usage();
+		}
+	}
+	if (step != 0 && nq == 0) print_usage();
+	argc -= optind - 1;
+	argv += optind - 1;
+	if (argc != 4 && argc != 5) print_usage();
+
+	if (strcmp(argv[2], "all") != 0) {
+		for (sensor = 0; sensor < RECORD_SENSORS; sensor++) {
+			if (strcmp(argv[2], sensor_name(sensor)) == 0) break;
+		}
+		if (sensor == RECORD_SENSORS) {
+			fprintf(stderr, "E: unknown sensor %s\n", argv[2]);
+			print_usage();
+		}
+		first = last = sensor;
+	}
+
+	from = util_parse_time(argv[3], now);
+	to = argc == 5 ? util_parse_time(argv[4], now) : now;
+	if (from == -1 || to == -1) print_usage();
+
+	if (nq > 0) {
+		// a comma separated list of databases, of several stations
+		char* list = strdup(argv[1]);
+		char* dir;
+		Tsdb* dbs = NULL;
+		int i, ndbs = 0;
+
+		for (dir = strtok(list, ","); dir != NULL; dir = strtok(NULL, ",")) {
+			dbs = realloc(dbs, (ndbs + 1) * sizeof(Tsdb));
+			if (dbs == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+			if (tsdb_open(&dbs[ndbs], dir, 0) == -1) {
+				fprintf(stderr, "E: can't open database %s: %s\n", dir, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			ndbs++;
+		}
+		if (ndbs == 0) print_usage();
+
+		// to is inclusive on the command line
+		rc = query_percentiles(dbs, ndbs, first, last, from, to + 1,
+				step > 0 ? step : to + 1 - from, q, nq);
+		for (i = 0; i < ndbs; i++) tsdb_close(&dbs[i]);
+		free(dbs);
+		free(list);
+		return rc;
+	}
+
+	if (tsdb_open(&db, argv[1], 0) == -1) {
+		fprintf(stderr, "E: can't open database %s: %s\n", argv[1], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	printf("# sensor readings t_min t_max t_avg t_last h_min h_max h_avg h_last\n");
+	for (sensor = first; sensor <= last; sensor++) {
+		AggSummary s;
+		TsdbPoint p;
+
+		// to is inclusive on the command line
+		if (tsdb_aggregate(&db, sensor, from, to + 1, &s, &p) == -1) {
+			fprintf(stderr, "E: reading sensor %s failed: %s\n", sensor_name(sensor), strerror(errno));
+			rc = 1;
+			continue;
+		}
+		if (s.t_count == 0 && s.h_count == 0 && first != last) continue;
+
+		printf("%s %u", sensor_name(sensor), s.t_count > s.h_count ? s.t_count : s.h_count);
+		if (s.t_count > 0) {
+			print_tenths(s.t_min);
+			print_tenths(s.t_max);
+			printf(" %.2f", s.t_sum / 10.0 / s.t_count);
+		} else {
+			printf(" U U U");
+		}
+		if (tsdb_t(&p) != RECORD_NA_T) print_tenths(p.t);
+		else printf(" U");
+		if (s.h_count > 0) {
+			printf(" %d %d %.2f", s.h_min, s.h_max, (double)s.h_sum / s.h_count);
+		} else {
+			printf(" U U U");
+		}
+		if (tsdb_h(&p) != RECORD_NA) printf(" %d\n", p.h);
+		else printf(" U\n");
+	}
+
+	tsdb_close(&db);
+	return rc;
+}
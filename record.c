@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <math.h>
 #include "record.h"
 
 void printTemp(const char* name, float value) {
@@ -22,6 +24,10 @@ int record_parse(const void* data, Record* r, int sensors) {
 		return -1;
 	}
 
+	// sensors beyond the requested count stay "not available"
+	r->t_2 = r->t_3 = r->t_4 = r->t_5 = RECORD_NA;
+	r->h_2 = r->h_3 = r->h_4 = r->h_5 = RECORD_NA;
+
 	// hh:mm positions are reversed in eeprom
 	r->time_m = (((ptr[0] & 0xF0) >> 4) * 10) + (ptr[0] & 0x0F);
 	r->time_h = (((ptr[1] & 0xF0) >> 4) * 10) + (ptr[1] & 0x0F);
@@ -48,7 +54,11 @@ int record_parse(const void* data, Record* r, int sensors) {
 	r->t_2 = (ptr[10] & 0x0F) + ((ptr[10] >> 4) * 10) + (ptr[11] & 0x0F)*100;
 	r->t_2 -= 300; r->t_2 /= 10;
 	r->h_2 = (ptr[11] >> 4) + (ptr[12] & 0x0F)*10;
-	if (ptr[11] == 0xaa || ptr[10] == 0xaa || (ptr[12] & 0x0F) == 0x0a) { r->t_2 = r->h_2 = 0xFF; }
+	// T2 and H2 share byte 11, either one can be missing on its own
+	if (ptr[10] == 0xaa) { r->t_2 = 0xFF; }
+	if ((ptr[11] & 0xF0) == 0xa0 && (ptr[12] & 0x0F) == 0x0a) { r->h_2 = 0xFF; }
+
+	if (sensors < 3) return 0;
 
 	r->t_3 = (ptr[12] >> 4) + (ptr[13] >> 4)*100 + (ptr[13] & 0x0F)*10;
 	r->t_3 -= 300; r->t_3 /= 10;
@@ -61,7 +71,10 @@ int record_parse(const void* data, Record* r, int sensors) {
 	r->t_4 = (ptr[15] & 0x0F) + ((ptr[15] >> 4) * 10) + (ptr[16] & 0x0F)*100;
 	r->t_4 -= 300; r->t_4 /= 10;
 	r->h_4 = (ptr[16] >> 4) + (ptr[17] & 0x0F)*10;
-	if (ptr[16] == 0xaa || ptr[15] == 0xaa || (ptr[17] & 0x0F) == 0x0a) { r->t_4 = r->h_4 = 0xFF; }
+	if (ptr[15] == 0xaa) { r->t_4 = 0xFF; }
+	if ((ptr[16] & 0xF0) == 0xa0 && (ptr[17] & 0x0F) == 0x0a) { r->h_4 = 0xFF; }
+
+	if (sensors < 5) return 0;
 
 	r->t_5 = (ptr[17] >> 4) + (ptr[18] >> 4)*100 + (ptr[18] & 0x0F)*10;
 	r->t_5 -= 300; r->t_5 /= 10;
@@ -72,3 +85,53 @@ int record_parse(const void* data, Record* r, int sensors) {
 	return 0;
 }
 
+
+void timecache_init(TimeCache* tc) {
+	tc->key = -1;
+	tc->exact = 0;
+	tc->midnight = 0;
+}
+
+static time_t local_time(int y, int m, int d, int hh, int mm) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = 100 + y;
+	tm.tm_mon = m - 1;
+	tm.tm_mday = d;
+	tm.tm_hour = hh;
+	tm.tm_min = mm;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+time_t record_time(const Record* r, TimeCache* tc) {
+	int key = (r->date_y * 16 + r->date_m) * 32 + r->date_d;
+
+	if (key != tc->key) {
+		// days without a DST switch are exactly 24h long, everything
+		// within them is a fixed offset from midnight
+		tc->midnight = local_time(r->date_y, r->date_m, r->date_d, 0, 0);
+		tc->exact = (local_time(r->date_y, r->date_m, r->date_d + 1, 0, 0)
+				- tc->midnight) == 86400;
+		tc->key = key;
+	}
+	if (!tc->exact) {
+		return local_time(r->date_y, r->date_m, r->date_d, r->time_h, r->time_m);
+	}
+	return tc->midnight + r->time_h * 3600 + r->time_m * 60;
+}
+
+static short temp_tenths(float value) {
+	if (value == RECORD_NA) return RECORD_NA_T;
+	return (short)lrintf(value * 10);
+}
+
+void record_values(const Record* r, short* t, unsigned char* h) {
+	t[0] = temp_tenths(r->t_in); h[0] = r->h_in;
+	t[1] = temp_tenths(r->t_1);  h[1] = r->h_1;
+	t[2] = temp_tenths(r->t_2);  h[2] = r->h_2;
+	t[3] = temp_tenths(r->t_3);  h[3] = r->h_3;
+	t[4] = temp_tenths(r->t_4);  h[4] = r->h_4;
+	t[5] = temp_tenths(r->t_5);  h[5] = r->h_5;
+}
@@ -1,5 +1,19 @@
 /* vim:set expandtab! ts=4: */
 
+#ifndef _INCLUDE_RECORD_H_
+#define _INCLUDE_RECORD_H_
+
+#include <time.h>
+
+/* number of sensors a record can hold (internal + 5 external) */
+#define RECORD_SENSORS 6
+
+/* value of a Record field if the sensor had no reading */
+#define RECORD_NA 0xFF
+
+/* record_values() temperature if the sensor had no reading */
+#define RECORD_NA_T (-32768)
+
 typedef struct _Record {
 	int date_d, date_m, date_y;
 	int time_h, time_m;
@@ -7,12 +21,30 @@ typedef struct _Record {
 	float t_in, t_1, t_2, t_3, t_4, t_5;
 } Record;
 
+/* caches the local midnight of the last day seen by record_time(), so
+ * mktime() only runs once per day instead of once per record. */
+typedef struct _TimeCache {
+	int key;
+	int exact;
+	time_t midnight;
+} TimeCache;
+
 /* parse a record, pointed to by *data, into Record *r. Decode a maximum of
  * sensors sensors. */
 extern int record_parse(const void* data, Record* r, int sensors);
 
+/* unix timestamp of a record, interpreting its date as local time. tc must
+ * be set up with timecache_init() before first use. */
+extern void timecache_init(TimeCache* tc);
+extern time_t record_time(const Record* r, TimeCache* tc);
+
+/* fill t[] with tenths of degrees and h[] with %RH, in sensor order
+ * (in, 1..5). missing readings are RECORD_NA_T and RECORD_NA. */
+extern void record_values(const Record* r, short* t, unsigned char* h);
+
 
 /* helper functions for users */
 extern void printTemp(const char* name, float value);
 extern void printHumidity(const char* name, float value);
 
+#endif /* _INCLUDE_RECORD_H_ */
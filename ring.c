@@ -0,0 +1,45 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+int ring_init(Ring* r, size_t elems, size_t elem_size) {
+	size_t size = 1;
+
+	while (size < elems) size <<= 1;
+	r->buf = malloc(size * elem_size);
+	if (r->buf == NULL) return -1;
+	r->elem_size = elem_size;
+	r->mask = size - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	return 0;
+}
+
+int ring_push(Ring* r, const void* elem) {
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head - tail > r->mask) return -1;
+	memcpy(r->buf + (head & r->mask) * r->elem_size, elem, r->elem_size);
+	// publish the element only after it is copied
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return 0;
+}
+
+int ring_pop(Ring* r, void* elem) {
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if (head == tail) return -1;
+	memcpy(elem, r->buf + (tail & r->mask) * r->elem_size, r->elem_size);
+	// the slot may be reused once it is copied out
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+void ring_free(Ring* r) {
+	free(r->buf);
+	r->buf = NULL;
+}
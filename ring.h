@@ -0,0 +1,44 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_RING_H_
+#define _INCLUDE_RING_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Lock-free ring buffer of fixed size elements, for one producer thread
+ * and one consumer thread.
+ *
+ * Each side only writes its own index, the other side reads it with
+ * acquire ordering, so neither push nor pop ever waits: the producer
+ * sees a full ring, the consumer an empty one. The indexes are on
+ * cache lines of their own.
+ */
+
+#define RING_CACHE_LINE 64
+
+typedef struct _Ring {
+	unsigned char* buf;
+	size_t elem_size;
+	size_t mask;            /* elements - 1, a power of two */
+	char pad0[RING_CACHE_LINE];
+	atomic_size_t head;     /* next element to push, written by the producer */
+	char pad1[RING_CACHE_LINE - sizeof(atomic_size_t)];
+	atomic_size_t tail;     /* next element to pop, written by the consumer */
+	char pad2[RING_CACHE_LINE - sizeof(atomic_size_t)];
+} Ring;
+
+/* room for at least elems elements of elem_size bytes each. returns -1
+ * (with errno set) if memory runs out. */
+extern int ring_init(Ring* r, size_t elems, size_t elem_size);
+
+/* copy an element in, producer only. returns -1 if the ring is full. */
+extern int ring_push(Ring* r, const void* elem);
+
+/* copy the oldest element out, consumer only. returns -1 if the ring is
+ * empty. */
+extern int ring_pop(Ring* r, void* elem);
+
+extern void ring_free(Ring* r);
+
+#endif /* _INCLUDE_RING_H_ */
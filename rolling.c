@@ -0,0 +1,168 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rolling.h"
+
+#define INITIAL_SIZE 8
+
+static int queue_init(RollingQueue* q) {
+	q->seq = malloc(INITIAL_SIZE * sizeof(uint32_t));
+	q->size = INITIAL_SIZE;
+	q->head = q->tail = 0;
+	return q->seq == NULL ? -1 : 0;
+}
+
+static int queue_push(RollingQueue* q, uint32_t seq) {
+	if (q->head - q->tail == q->size) {
+		uint32_t* grown = malloc(2 * q->size * sizeof(uint32_t));
+		uint32_t i;
+
+		if (grown == NULL) return -1;
+		for (i = q->tail; i != q->head; i++)
+			grown[(i - q->tail)] = q->seq[i & (q->size - 1)];
+		free(q->seq);
+		q->seq = grown;
+		q->head -= q->tail;
+		q->tail = 0;
+		q->size *= 2;
+	}
+	q->seq[q->head++ & (q->size - 1)] = seq;
+	return 0;
+}
+
+#define QUEUE_EMPTY(q) ((q)->head == (q)->tail)
+#define QUEUE_FRONT(q) ((q)->seq[(q)->tail & ((q)->size - 1)])
+#define QUEUE_BACK(q)  ((q)->seq[((q)->head - 1) & ((q)->size - 1)])
+
+int rolling_init(Rolling* r, int n, const int64_t* length) {
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	if (n < 1 || n > ROLLING_WINDOWS) return -1;
+	r->nwindows = n;
+	r->size = INITIAL_SIZE;
+	r->time = malloc(r->size * sizeof(int64_t));
+	r->value = malloc(r->size * sizeof(int16_t));
+	if (r->time == NULL || r->value == NULL) goto fail;
+
+	for (i = 0; i < n; i++) {
+		r->w[i].length = length[i];
+		if (queue_init(&r->w[i].min) == -1 || queue_init(&r->w[i].max) == -1)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	rolling_free(r);
+	return -1;
+}
+
+void rolling_free(Rolling* r) {
+	int i;
+
+	for (i = 0; i < ROLLING_WINDOWS; i++) {
+		free(r->w[i].min.seq);
+		free(r->w[i].max.seq);
+	}
+	free(r->time);
+	free(r->value);
+	memset(r, 0, sizeof(*r));
+}
+
+void rolling_expire(Rolling* r, int64_t time) {
+	int i;
+
+	for (i = 0; i < r->nwindows; i++) {
+		RollingWindow* w = &r->w[i];
+
+		while (w->first != r->next
+				&& r->time[w->first & (r->size - 1)] <= time - w->length) {
+			if (!QUEUE_EMPTY(&w->min) && QUEUE_FRONT(&w->min) == w->first) w->min.tail++;
+			if (!QUEUE_EMPTY(&w->max) && QUEUE_FRONT(&w->max) == w->first) w->max.tail++;
+			w->sum -= r->value[w->first & (r->size - 1)];
+			w->first++;
+		}
+	}
+}
+
+/* make room in the ring for one more reading than the longest window
+ * holds */
+static int grow(Rolling* r) {
+	uint32_t oldest = r->next, size = 2 * r->size, seq;
+	int64_t* time;
+	int16_t* value;
+	int i;
+
+	for (i = 0; i < r->nwindows; i++) {
+		if (r->next - r->w[i].first > r->next - oldest) oldest = r->w[i].first;
+	}
+	if (r->next - oldest < r->size) return 0;
+
+	time = malloc(size * sizeof(int64_t));
+	value = malloc(size * sizeof(int16_t));
+	if (time == NULL || value == NULL) {
+		free(time);
+		free(value);
+		return -1;
+	}
+	for (seq = oldest; seq != r->next; seq++) {
+		time[seq & (size - 1)] = r->time[seq & (r->size - 1)];
+		value[seq & (size - 1)] = r->value[seq & (r->size - 1)];
+	}
+	free(r->time);
+	free(r->value);
+	r->time = time;
+	r->value = value;
+	r->size = size;
+	return 0;
+}
+
+int rolling_add(Rolling* r, int64_t time, int16_t value) {
+	uint32_t seq = r->next;
+	int i;
+
+	rolling_expire(r, time);
+	if (grow(r) == -1) return -1;
+
+	r->time[seq & (r->size - 1)] = time;
+	r->value[seq & (r->size - 1)] = value;
+	r->next++;
+
+	for (i = 0; i < r->nwindows; i++) {
+		RollingWindow* w = &r->w[i];
+
+		// readings no longer the smallest (largest) of the ones after them
+		// never will be again
+		while (!QUEUE_EMPTY(&w->min)
+				&& r->value[QUEUE_BACK(&w->min) & (r->size - 1)] >= value)
+			w->min.head--;
+		while (!QUEUE_EMPTY(&w->max)
+				&& r->value[QUEUE_BACK(&w->max) & (r->size - 1)] <= value)
+			w->max.head--;
+		if (queue_push(&w->min, seq) == -1 || queue_push(&w->max, seq) == -1)
+			return -1;
+		w->sum += value;
+	}
+	return 0;
+}
+
+int rolling_stats(const Rolling* r, int i, RollingStats* out) {
+	const RollingWindow* w = &r->w[i];
+	uint32_t mask = r->size - 1;
+	int64_t dt;
+
+	memset(out, 0, sizeof(*out));
+	out->count = r->next - w->first;
+	if (out->count == 0) return 0;
+
+	out->min = r->value[QUEUE_FRONT(&w->min) & mask];
+	out->max = r->value[QUEUE_FRONT(&w->max) & mask];
+	out->last = r->value[(r->next - 1) & mask];
+	out->mean = (double)w->sum / out->count;
+
+	dt = r->time[(r->next - 1) & mask] - r->time[w->first & mask];
+	out->rate = dt > 0 ? (out->last - r->value[w->first & mask]) * 3600.0 / dt : NAN;
+	return out->count;
+}
@@ -0,0 +1,69 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_ROLLING_H_
+#define _INCLUDE_ROLLING_H_
+
+#include <stdint.h>
+
+/* Rolling windows over one series of readings (one sensor, temperature or
+ * humidity), updated as readings arrive.
+ *
+ * The readings of the longest window are kept in a ring, numbered by a
+ * running sequence number. Each window is the part of the ring from its
+ * first reading on, with the sum of its readings and two monotonic deques
+ * of sequence numbers: readings that are the smallest (largest) of the
+ * ones after them. A reading enters every window once and leaves it once,
+ * so an update is O(1) amortized per window, and min, max, mean and rate
+ * of change are read off in O(1). Ring and deques start small and grow to
+ * what the windows hold, a 24h window at a 5 minute interval takes about
+ * 5k.
+ */
+
+#define ROLLING_WINDOWS 4       /* at most */
+
+typedef struct _RollingQueue {
+	uint32_t* seq;
+	uint32_t size;          /* power of two */
+	uint32_t head, tail;    /* positions, head - tail entries */
+} RollingQueue;
+
+typedef struct _RollingWindow {
+	int64_t length;         /* seconds */
+	uint32_t first;         /* sequence number of the oldest reading */
+	int64_t sum;
+	RollingQueue min, max;
+} RollingWindow;
+
+typedef struct _Rolling {
+	int64_t* time;          /* ring of readings, by sequence number */
+	int16_t* value;
+	uint32_t size;          /* power of two */
+	uint32_t next;          /* sequence number of the next reading */
+	int nwindows;
+	RollingWindow w[ROLLING_WINDOWS];
+} Rolling;
+
+typedef struct _RollingStats {
+	uint32_t count;         /* readings in the window */
+	int16_t min, max, last;
+	double mean;
+	double rate;            /* change per hour from the oldest to the
+	                           newest reading, NAN if there is just one */
+} RollingStats;
+
+/* set up n windows of length[i] seconds. returns -1 if n is out of range
+ * or memory runs out. */
+extern int rolling_init(Rolling* r, int n, const int64_t* length);
+extern void rolling_free(Rolling* r);
+
+/* move the windows to end at time, dropping the readings that fell out */
+extern void rolling_expire(Rolling* r, int64_t time);
+
+/* add a reading, newer than the ones before. returns -1 if memory runs
+ * out. */
+extern int rolling_add(Rolling* r, int64_t time, int16_t value);
+
+/* min/max/mean/rate of window i. returns the number of readings in it. */
+extern int rolling_stats(const Rolling* r, int i, RollingStats* out);
+
+#endif /* _INCLUDE_ROLLING_H_ */
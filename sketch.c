@@ -0,0 +1,115 @@
+/* vim:set expandtab! ts=4: */
+
+#include <string.h>
+#include <math.h>
+#include "sketch.h"
+
+void sketch_init(Sketch* s) {
+	memset(s, 0, sizeof(*s));
+}
+
+/* merge neighbouring centroids of c[0..n-1], total readings, until at most
+ * size are left. returns the new n. */
+static int compress(SketchCentroid* c, int n, uint32_t total, int size) {
+	while (n > size) {
+		double best_cost = HUGE_VAL;
+		double cum = 0;
+		int best = 0, i;
+
+		for (i = 0; i + 1 < n; i++) {
+			double count = (double)c[i].count + c[i + 1].count;
+			double q = (cum + count / 2) / total;
+			int lo = c[i].lo < c[i + 1].lo ? c[i].lo : c[i + 1].lo;
+			int hi = c[i].hi > c[i + 1].hi ? c[i].hi : c[i + 1].hi;
+			double cost = count * (hi - lo) / (q * (1 - q) + 1.0 / total);
+
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = i;
+			}
+			cum += c[i].count;
+		}
+
+		c[best].mean = ((double)c[best].mean * c[best].count
+				+ (double)c[best + 1].mean * c[best + 1].count)
+			/ ((double)c[best].count + c[best + 1].count);
+		if (c[best + 1].lo < c[best].lo) c[best].lo = c[best + 1].lo;
+		if (c[best + 1].hi > c[best].hi) c[best].hi = c[best + 1].hi;
+		c[best].count += c[best + 1].count;
+		memmove(&c[best + 1], &c[best + 2], (n - best - 2) * sizeof(SketchCentroid));
+		n--;
+	}
+	return n;
+}
+
+void sketch_add(Sketch* s, int16_t v) {
+	int i;
+
+	s->count++;
+	for (i = 0; i < s->n && s->c[i].mean < v; i++);
+	if (i < s->n && s->c[i].lo == v && s->c[i].hi == v) {
+		s->c[i].count++;
+		return;
+	}
+
+	if (s->n == SKETCH_SIZE) {
+		s->n = compress(s->c, s->n, s->count - 1, SKETCH_SIZE - 1);
+		for (i = 0; i < s->n && s->c[i].mean < v; i++);
+	}
+	memmove(&s->c[i + 1], &s->c[i], (s->n - i) * sizeof(SketchCentroid));
+	s->c[i].mean = v;
+	s->c[i].lo = s->c[i].hi = v;
+	s->c[i].count = 1;
+	s->n++;
+}
+
+void sketch_merge(Sketch* dst, const Sketch* src) {
+	SketchCentroid c[2 * SKETCH_SIZE];
+	int i = 0, j = 0, n = 0;
+
+	if (src->count == 0) return;
+	if (dst->count == 0) {
+		*dst = *src;
+		return;
+	}
+
+	while (i < dst->n || j < src->n) {
+		if (j == src->n || (i < dst->n && dst->c[i].mean < src->c[j].mean)) {
+			c[n++] = dst->c[i++];
+		} else if (i == dst->n || src->c[j].mean < dst->c[i].mean
+				|| src->c[j].lo != dst->c[i].lo || src->c[j].hi != dst->c[i].hi) {
+			c[n++] = src->c[j++];
+		} else {
+			// the same single reading
+			c[n] = dst->c[i++];
+			c[n++].count += src->c[j++].count;
+		}
+	}
+
+	dst->count += src->count;
+	dst->n = compress(c, n, dst->count, SKETCH_SIZE);
+	memcpy(dst->c, c, dst->n * sizeof(SketchCentroid));
+}
+
+double sketch_quantile(const Sketch* s, double q) {
+	const SketchCentroid* c;
+	uint32_t rank, cum = 0;
+	double f;
+	int i;
+
+	if (s->count == 0) return NAN;
+	rank = ceil(q * s->count);
+	if (rank <= 1) return s->c[0].lo;
+	if (rank >= s->count) return s->c[s->n - 1].hi;
+
+	for (i = 0; i + 1 < s->n && cum + s->c[i].count < rank; i++)
+		cum += s->c[i].count;
+	c = &s->c[i];
+	if (c->lo == c->hi) return c->lo;
+
+	// the readings of a centroid are taken to rise evenly from lo to the
+	// mean and on to hi
+	f = (rank - cum - 0.5) / c->count;
+	if (f < 0.5) return c->lo + (c->mean - c->lo) * f * 2;
+	return c->mean + (c->hi - c->mean) * (f - 0.5) * 2;
+}
@@ -0,0 +1,48 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_SKETCH_H_
+#define _INCLUDE_SKETCH_H_
+
+#include <stdint.h>
+
+/* Quantile sketch of a series of readings, in a fixed size.
+ *
+ * A sorted list of at most SKETCH_SIZE centroids (number, mean and range
+ * of a run of readings), like a t-digest. When it overflows, the two
+ * neighbours whose merged range times readings is smallest are merged,
+ * weighted so the tails stay finer than the middle. Readings are tenths of
+ * deg C or %RH, so equal readings merge first, at no cost: as long as a
+ * sketch has at most SKETCH_SIZE distinct readings it is exact, and a
+ * quantile is never off by more than the range of its centroid. Sketches
+ * of any buckets (or stations) merge into a sketch of all their readings.
+ */
+
+#define SKETCH_SIZE 32
+
+typedef struct _SketchCentroid {
+	float mean;
+	int16_t lo, hi;         /* smallest and largest reading */
+	uint32_t count;
+} SketchCentroid;
+
+typedef struct _Sketch {
+	uint32_t count;         /* readings */
+	uint16_t n;             /* centroids in use */
+	uint16_t reserved;
+	SketchCentroid c[SKETCH_SIZE];  /* by mean */
+} Sketch;
+
+/* reset a sketch to "no readings" */
+extern void sketch_init(Sketch* s);
+
+/* add one reading */
+extern void sketch_add(Sketch* s, int16_t v);
+
+/* add the readings of src to dst */
+extern void sketch_merge(Sketch* dst, const Sketch* src);
+
+/* the reading of rank ceil(q * count), 0 <= q <= 1, interpolated within
+ * its centroid; the extremes are exact. NAN if the sketch is empty. */
+extern double sketch_quantile(const Sketch* s, double q);
+
+#endif /* _INCLUDE_SKETCH_H_ */
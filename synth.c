@@ -0,0 +1,175 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dump.h"
+#include "synth.h"
+
+#define GAP_MAX 20              /* longest drop out, in records */
+
+/* readings that are not available */
+#define NO_T (-1000)
+#define NO_H (-1)
+
+typedef struct _Walk {
+	int t, h;                   /* tenths of deg C, %RH */
+	int gap;                    /* records left in a drop out */
+	int gap_type;               /* 0: T and H missing, 1: T, 2: H */
+} Walk;
+
+static unsigned char bcd(int v) {
+	return ((v / 10) << 4) | (v % 10);
+}
+
+static int random_range(unsigned int* seed, int lo, int hi) {
+	return lo + rand_r(seed) % (hi - lo + 1);
+}
+
+/* nibbles of a reading, units first */
+static void put_t(unsigned char* n, int t) {
+	int v = t + 300;
+
+	if (t == NO_T) {
+		n[0] = n[1] = n[2] = 0x0A;
+		return;
+	}
+	n[0] = v % 10;
+	n[1] = v / 10 % 10;
+	n[2] = v / 100;
+}
+
+static void put_h(unsigned char* n, int h) {
+	if (h == NO_H) {
+		n[0] = n[1] = 0x0A;
+		return;
+	}
+	n[0] = h % 10;
+	n[1] = h / 10;
+}
+
+static void write_header(unsigned char* image, const SynthOptions* o,
+		time_t newest, long records, int overflow) {
+	struct tm tm;
+	int i;
+
+	localtime_r(&newest, &tm);
+	image[0x00] = bcd(tm.tm_min);
+	image[0x01] = bcd(tm.tm_hour);
+	// weekday (1 = monday) and the date are shifted by a nibble
+	image[0x02] = ((tm.tm_mday % 10) << 4) | (tm.tm_wday == 0 ? 7 : tm.tm_wday);
+	image[0x03] = ((tm.tm_mon + 1) % 10 << 4) | (tm.tm_mday / 10);
+	image[0x04] = ((tm.tm_year % 10) << 4) | ((tm.tm_mon + 1) / 10);
+	image[0x05] = (tm.tm_year % 100) / 10;
+	image[0x06] = 0x00;         // timezone
+	image[0x07] = 0xFF;
+	image[0x08] = o->interval;
+	image[0x09] = bcd(records % 100);
+	image[0x0A] = bcd(records / 100 % 100);
+	image[0x0B] = overflow ? 0x04 : 0x00;
+	image[0x0C] = o->sensors - 1;
+	image[0x0D] = image[0x0E] = 0xFF;
+	memset(image + 0x0F, 0, 0x21 - 0x0F);      // calibration
+
+	// alarm limits at the factory defaults: H 10..70, T 10.0..30.0
+	for (i = 0; i < 6; i++) {
+		image[0x21 + 2 * i] = 0x70;
+		image[0x22 + 2 * i] = 0x10;
+		image[0x2D + 5 * i] = 0x00;
+		image[0x2E + 5 * i] = 0x00;
+		image[0x2F + 5 * i] = 0x06;
+		image[0x30 + 5 * i] = 0x00;
+		image[0x31 + 5 * i] = 0x40;
+	}
+	for (i = 0; i < 5; i++) image[0x4B + i] = 0x10 + i;
+	image[0x50] = (1 << (o->sensors - 1)) - 1;
+}
+
+static void write_record(unsigned char* rec, int len, time_t t,
+		Walk* walk, int sensors, unsigned int* seed, const SynthOptions* o) {
+	unsigned char n[30];
+	struct tm tm;
+	int i;
+
+	localtime_r(&t, &tm);
+	rec[0] = bcd(tm.tm_min);
+	rec[1] = bcd(tm.tm_hour);
+	rec[2] = bcd(tm.tm_mday);
+	rec[3] = bcd(tm.tm_mon + 1);
+	rec[4] = bcd(tm.tm_year % 100);
+
+	memset(n, 0, sizeof(n));
+	for (i = 0; i < 6; i++) {
+		Walk* w = &walk[i];
+		int tv, hv;
+
+		w->t += random_range(seed, -5, 5);
+		if (w->t < -300) w->t = -300;
+		if (w->t > 500) w->t = 500;
+		w->h += random_range(seed, -2, 2);
+		if (w->h < 1) w->h = 1;
+		if (w->h > 99) w->h = 99;
+
+		if (w->gap == 0 && random_range(seed, 0, 99) < o->gap_percent) {
+			w->gap = random_range(seed, 1, GAP_MAX);
+			w->gap_type = random_range(seed, 0, 99) < o->partial_percent
+					? random_range(seed, 1, 2) : 0;
+		}
+		tv = w->t;
+		hv = w->h;
+		if (i >= sensors) {
+			tv = NO_T;
+			hv = NO_H;
+		} else if (w->gap > 0) {
+			w->gap--;
+			if (w->gap_type != 2) tv = NO_T;
+			if (w->gap_type != 1) hv = NO_H;
+		}
+
+		// nibble layout, see decode_tfa.py: T0 T1 H0 H1, then T H pairs
+		if (i < 2) {
+			put_t(n + 3 * i, tv);
+			put_h(n + 6 + 2 * i, hv);
+		} else {
+			put_t(n + 5 * i, tv);
+			put_h(n + 5 * i + 3, hv);
+		}
+	}
+	for (i = 5; i < len; i++) {
+		rec[i] = n[2 * (i - 5)] | (n[2 * (i - 5) + 1] << 4);
+	}
+}
+
+int synth_image(unsigned char* image, const SynthOptions* o,
+		unsigned int* seed) {
+	DumpHeader h;
+	Walk walk[6];
+	long first, k;
+	int overflow, i;
+
+	memset(image, 0xFF, SYNTH_IMAGE_SIZE);
+	write_header(image, o, o->start, 0, 0);
+	dump_header(image, SYNTH_IMAGE_SIZE, &h);
+
+	// the slot after the newest record is erased once the log wraps
+	// around, so a full log holds one record less than it has slots
+	overflow = o->records >= h.records;
+	first = overflow ? o->records - (h.records - 1) : 0;
+
+	for (i = 0; i < 6; i++) {
+		walk[i].t = random_range(seed, -100, 300);
+		walk[i].h = random_range(seed, 20, 90);
+		walk[i].gap = 0;
+		walk[i].gap_type = 0;
+	}
+	for (k = first; k < o->records; k++) {
+		write_record(image + dump_slot(&h, k % h.records), h.record_len,
+				o->start + k * h.interval * 60, walk, o->sensors, seed, o);
+	}
+
+	write_header(image, o, o->start + (o->records - 1) * h.interval * 60,
+			overflow ? h.records : o->records, overflow);
+	image[DUMP_EOF_OFFSET] = 0x5A;
+	image[DUMP_EOF_OFFSET + 1] = 0x2F;
+	return o->records - first;
+}
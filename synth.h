@@ -0,0 +1,33 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_SYNTH_H_
+#define _INCLUDE_SYNTH_H_
+
+#include <time.h>
+
+/* Synthetic eeprom images, laid out like the ones dump_tfa reads (see
+ * documentation.txt), for benchmarks and for cross-checking decoders.
+ *
+ * Readings follow a random walk per sensor. Sensors drop out for a few
+ * records at random ("AA" readings); a station that has written more
+ * records than fit has the overflow flag set, and the slot after the
+ * newest record erased (the interim EOF decode_tfa.py looks for).
+ */
+
+#define SYNTH_IMAGE_SIZE 0x7FFF     /* bytes dump_tfa reads */
+
+typedef struct _SynthOptions {
+	int sensors;            /* 1..6, including the internal one */
+	long records;           /* records written since the log was cleared */
+	int interval;           /* LI code, 0..12 */
+	int gap_percent;        /* chance of a sensor dropping out per record */
+	int partial_percent;    /* chance that only one of T and H drops out */
+	time_t start;           /* time of the first record */
+} SynthOptions;
+
+/* write an image of SYNTH_IMAGE_SIZE bytes. seed is passed to rand_r().
+ * returns the number of records in the image. */
+extern int synth_image(unsigned char* image, const SynthOptions* o,
+		unsigned int* seed);
+
+#endif /* _INCLUDE_SYNTH_H_ */
@@ -0,0 +1,203 @@
+/* vim:set expandtab! ts=4: */
+
+/* test_pack - encode blocks of random rows, with gaps, runs of missing
+ * readings and flags, and of the widest deltas there are, and check that
+ * they decode to what went in, within PACK_BLOCK_MAX bytes. a flipped
+ * byte or a short block has to be turned away. run by make check. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "record.h"
+#include "tsdb.h"
+#include "pack.h"
+
+#define BASE 1258185600         /* 2009-11-14 08:00 UTC */
+#define BLOCKS 300
+#define FLIPS 32
+#define GUARD 64
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "E: " __VA_ARGS__); \
+		if (++failures > 10) exit(EXIT_FAILURE); \
+	} \
+} while (0)
+
+static int64_t time_[PACK_BLOCK_ROWS];
+static int16_t t[PACK_BLOCK_ROWS];
+static uint8_t h[PACK_BLOCK_ROWS];
+static uint8_t flags[PACK_BLOCK_ROWS];
+
+static unsigned char block[PACK_BLOCK_MAX + GUARD];
+
+/* a random number below n, for n up to INT32_MAX + 1 */
+static int64_t below(unsigned int* seed, int64_t n) {
+	uint64_t r = (uint64_t)rand_r(seed) << 31 | rand_r(seed);
+
+	return r % n;
+}
+
+/* random rows: mostly a steady interval with some jitter, now and then a
+ * gap of up to 68 years; readings that wander, with runs of missing ones
+ * and flags here and there, or none at all */
+static int random_rows(unsigned int* seed) {
+	int rows = 1 + below(seed, PACK_BLOCK_ROWS);
+	int interval = 60 * (1 + below(seed, 30));
+	int na_t = below(seed, 4), na_h = below(seed, 4), flagged = below(seed, 3);
+	int run_t = 0, run_h = 0;
+	int32_t cur_t = below(seed, 1000) - 400, cur_h = below(seed, 100);
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		if (i == 0) time_[i] = BASE + below(seed, 86400);
+		else switch (below(seed, 20)) {
+		case 0: time_[i] = time_[i - 1] + 1 + below(seed, (int64_t)INT32_MAX); break;
+		case 1: time_[i] = time_[i - 1] + 1 + below(seed, 2 * interval); break;
+		default: time_[i] = time_[i - 1] + interval; break;
+		}
+
+		cur_t += below(seed, 21) - 10;
+		if (cur_t < -999 || cur_t > 999) cur_t = 0;
+		cur_h += below(seed, 5) - 2;
+		if (cur_h < 1 || cur_h > 99) cur_h = 50;
+
+		// na_* 0: no reading is missing, 1: all are, else runs of them
+		if (run_t == 0 && na_t > 1 && below(seed, 50) == 0) run_t = 1 + below(seed, 300);
+		if (run_h == 0 && na_h > 1 && below(seed, 50) == 0) run_h = 1 + below(seed, 300);
+		t[i] = na_t == 1 || run_t > 0 ? RECORD_NA_T : cur_t;
+		h[i] = na_h == 1 || run_h > 0 ? RECORD_NA : cur_h;
+		if (run_t > 0) run_t--;
+		if (run_h > 0) run_h--;
+
+		flags[i] = 0;
+		if (flagged && below(seed, 40) == 0) flags[i] |= TSDB_FLAG_T;
+		if (flagged && below(seed, 40) == 0) flags[i] |= TSDB_FLAG_H;
+	}
+	return rows;
+}
+
+/* a full block of the widest deltas: the time steps between 1 s and 68
+ * years, temperatures and humidities between their extremes, one of each
+ * missing so the bitmaps go in too, and every reading flagged */
+static int worst_rows(void) {
+	int i;
+
+	for (i = 0; i < PACK_BLOCK_ROWS; i++) {
+		time_[i] = i == 0 ? BASE : time_[i - 1] + (i % 2 ? INT32_MAX : 1);
+		t[i] = i % 2 ? -32767 : 32767;
+		h[i] = i % 2 ? 0 : 254;
+		flags[i] = TSDB_FLAG_T | TSDB_FLAG_H;
+	}
+	t[0] = RECORD_NA_T;
+	h[PACK_BLOCK_ROWS - 1] = RECORD_NA;
+	return PACK_BLOCK_ROWS;
+}
+
+/* encode rows, checking the length and that nothing is written past it */
+static int encode(int rows, const char* what) {
+	int len, i;
+
+	memset(block, 0xa5, sizeof(block));
+	len = pack_encode(time_, t, h, flags, rows, block);
+	CHECK(len > 0 && (size_t)len <= PACK_BLOCK_MAX,
+			"%s: %d rows encode to %d bytes, at most %zu fit\n", what, rows,
+			len, PACK_BLOCK_MAX);
+	if (len <= 0) return -1;
+	for (i = len; i < (int)sizeof(block); i++) {
+		if (block[i] != 0xa5) {
+			CHECK(0, "%s: %d rows written past the %d bytes of the block\n",
+					what, rows, len);
+			break;
+		}
+	}
+	return len;
+}
+
+static void check_decode(int len, int rows, const char* what) {
+	static int64_t time2[PACK_BLOCK_ROWS];
+	static int16_t t2[PACK_BLOCK_ROWS];
+	static uint8_t h2[PACK_BLOCK_ROWS];
+	static uint8_t flags2[PACK_BLOCK_ROWS];
+	int n, i;
+
+	n = pack_decode(block, len, time2, t2, h2, flags2);
+	CHECK(n == rows, "%s: %d rows decode to %d: %s\n", what, rows, n,
+			n == -1 ? strerror(errno) : "");
+	if (n != rows) return;
+	for (i = 0; i < rows; i++) {
+		if (time2[i] != time_[i] || t2[i] != t[i] || h2[i] != h[i]
+				|| flags2[i] != flags[i]) {
+			CHECK(0, "%s: row %d of %d is %lld %d %d %x instead of %lld %d %d %x\n",
+					what, i, rows, (long long)time2[i], t2[i], h2[i], flags2[i],
+					(long long)time_[i], t[i], h[i], flags[i]);
+			return;
+		}
+	}
+}
+
+/* a flipped bit anywhere in the payload, or a block cut short, is damage */
+static void check_damage(unsigned int* seed, int len, const char* what) {
+	static int64_t time2[PACK_BLOCK_ROWS];
+	static int16_t t2[PACK_BLOCK_ROWS];
+	static uint8_t h2[PACK_BLOCK_ROWS];
+	static uint8_t flags2[PACK_BLOCK_ROWS];
+	int k, n;
+
+	for (k = 0; k < FLIPS; k++) {
+		int pos = sizeof(PackBlock) + below(seed, len - sizeof(PackBlock));
+		unsigned char bit = 1 << below(seed, 8);
+
+		block[pos] ^= bit;
+		errno = 0;
+		n = pack_decode(block, len, time2, t2, h2, flags2);
+		CHECK(n == -1 && errno == EILSEQ,
+				"%s: byte %d of %d flipped, and the block decodes to %d rows\n",
+				what, pos, len, n);
+		block[pos] ^= bit;
+	}
+
+	errno = 0;
+	n = pack_decode(block, len - 1, time2, t2, h2, flags2);
+	CHECK(n == -1 && errno == EILSEQ, "%s: a block cut short decodes to %d rows\n",
+			what, n);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int seed = 1;
+	char what[32];
+	int i, rows, len;
+
+	for (i = 0; i < BLOCKS; i++) {
+		snprintf(what, sizeof(what), "block %d", i);
+		rows = random_rows(&seed);
+		len = encode(rows, what);
+		if (len == -1) continue;
+		check_decode(len, rows, what);
+		check_damage(&seed, len, what);
+	}
+
+	rows = worst_rows();
+	len = encode(rows, "worst case");
+	if (len != -1) {
+		check_decode(len, rows, "worst case");
+		check_damage(&seed, len, "worst case");
+	}
+
+	// the times have to increase, by at most 68 years
+	time_[0] = BASE;
+	time_[1] = BASE;
+	CHECK(pack_encode(time_, t, h, flags, 2, block) == -1 && errno == EINVAL,
+			"a repeated time encodes\n");
+	time_[1] = BASE + (int64_t)INT32_MAX + 1;
+	CHECK(pack_encode(time_, t, h, flags, 2, block) == -1 && errno == EINVAL,
+			"a gap of more than 68 years encodes\n");
+
+	if (failures > 0) return 1;
+	printf("test_pack: ok\n");
+	return 0;
+}
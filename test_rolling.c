@@ -0,0 +1,135 @@
+/* vim:set expandtab! ts=4: */
+
+/* test_rolling - feed random readings, with gaps that empty the windows,
+ * runs of the same value and jumps to the extremes, into rolling windows
+ * and check every window after every reading, and after moving them on
+ * without one, against the readings it ought to hold. run by make check. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "rolling.h"
+
+#define BASE 1258185600         /* 2009-11-14 08:00 UTC */
+#define READINGS 20000
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "E: " __VA_ARGS__); \
+		if (++failures > 10) exit(EXIT_FAILURE); \
+	} \
+} while (0)
+
+static const int64_t lengths[ROLLING_WINDOWS] = { 300, 3600, 86400, 7 * 86400 };
+
+static int64_t times[READINGS];
+static int16_t values[READINGS];
+
+/* the readings of window i at now, by going through all of them */
+static void brute_force(int n, int i, int64_t now, RollingStats* s) {
+	int64_t sum = 0;
+	int k, first;
+
+	memset(s, 0, sizeof(*s));
+	for (first = n; first > 0 && times[first - 1] > now - lengths[i]; first--);
+	if (first == n) return;
+
+	s->count = n - first;
+	s->min = s->max = values[first];
+	for (k = first; k < n; k++) {
+		if (values[k] < s->min) s->min = values[k];
+		if (values[k] > s->max) s->max = values[k];
+		sum += values[k];
+	}
+	s->last = values[n - 1];
+	s->mean = (double)sum / s->count;
+	s->rate = n - first > 1 ? (values[n - 1] - values[first]) * 3600.0
+			/ (times[n - 1] - times[first]) : NAN;
+}
+
+static void check_windows(const Rolling* r, int n, int64_t now) {
+	RollingStats got, want;
+	int i, count;
+
+	for (i = 0; i < r->nwindows; i++) {
+		count = rolling_stats(r, i, &got);
+		brute_force(n, i, now, &want);
+		CHECK(count == (int)got.count && got.count == want.count
+				&& got.min == want.min && got.max == want.max
+				&& got.last == want.last && fabs(got.mean - want.mean) < 1e-9
+				&& (isnan(want.rate) ? isnan(got.rate)
+					: fabs(got.rate - want.rate) < 1e-9),
+				"window of %lld s at %lld after %d readings: %u %d..%d %d %g %g"
+				" instead of %u %d..%d %d %g %g\n", (long long)lengths[i],
+				(long long)now, n, got.count, got.min, got.max, got.last,
+				got.mean, got.rate, want.count, want.min, want.max, want.last,
+				want.mean, want.rate);
+	}
+}
+
+/* the next reading: mostly a small step from the last one, now and then
+ * the same again or one of the extremes */
+static int16_t next_value(unsigned int* seed, int16_t last) {
+	int32_t v;
+
+	switch (rand_r(seed) % 20) {
+	case 0: return INT16_MIN;
+	case 1: return INT16_MAX;
+	case 2: case 3: case 4: return last;
+	default:
+		v = last + rand_r(seed) % 41 - 20;
+		return v < INT16_MIN || v > INT16_MAX ? 0 : v;
+	}
+}
+
+/* the time to the next reading: mostly a few minutes, sometimes a gap
+ * longer than some of the windows */
+static int64_t next_step(unsigned int* seed) {
+	switch (rand_r(seed) % 100) {
+	case 0: return 1 + rand_r(seed) % (2 * 86400);
+	case 1: case 2: return 1 + rand_r(seed) % 7200;
+	default: return 1 + rand_r(seed) % 600;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int seed = 1;
+	Rolling r;
+	int64_t now = BASE;
+	int16_t value = 0;
+	int n;
+
+	if (rolling_init(&r, ROLLING_WINDOWS, lengths) == -1) {
+		fprintf(stderr, "E: can't set up the windows\n");
+		exit(EXIT_FAILURE);
+	}
+	check_windows(&r, 0, now);
+
+	for (n = 0; n < READINGS; n++) {
+		// move the windows on to somewhere before the next reading
+		if (rand_r(&seed) % 10 == 0) {
+			now += rand_r(&seed) % next_step(&seed);
+			rolling_expire(&r, now);
+			check_windows(&r, n, now);
+		}
+
+		now += next_step(&seed);
+		value = next_value(&seed, value);
+		times[n] = now;
+		values[n] = value;
+		if (rolling_add(&r, now, value) == -1) {
+			fprintf(stderr, "E: adding reading %d failed\n", n);
+			exit(EXIT_FAILURE);
+		}
+		check_windows(&r, n + 1, now);
+	}
+	rolling_free(&r);
+
+	if (failures > 0) return 1;
+	printf("test_rolling: ok\n");
+	return 0;
+}
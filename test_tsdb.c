@@ -0,0 +1,229 @@
+/* vim:set expandtab! ts=4: */
+
+/* test_tsdb - kill a writer right after a segment rollover, reopen the
+ * database, append on and check every row, lookup and rollup against the
+ * readings that went in, some of them flagged as implausible. a second
+ * writer has to be turned away. run by make check. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "record.h"
+#include "output.h"
+#include "tsdb.h"
+#include "validate.h"
+
+#define BASE 1258185600         /* 2009-11-14 08:00 UTC */
+#define STEP 30
+#define KILLED_AT (TSDB_SEGMENT_ROWS + 1000)
+#define ROWS (2 * TSDB_SEGMENT_ROWS + 500)
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "E: " __VA_ARGS__); \
+		if (++failures > 10) exit(EXIT_FAILURE); \
+	} \
+} while (0)
+
+/* reading number i */
+static void reading(uint64_t i, RecordBin* b) {
+	memset(b, 0, sizeof(*b));
+	b->time = BASE + (int64_t)i * STEP;
+	b->t[0] = i % 97 == 0 ? RECORD_NA_T : (int16_t)((i * 7) % 500) - 100;
+	b->h[0] = i % 89 == 1 && i % 97 != 0 ? RECORD_NA : 20 + i % 70;
+	if (i % 31 == 5) b->flags |= INVALID_RANGE | INVALID_T(0);
+	if (i % 43 == 7) b->flags |= INVALID_SPIKE | INVALID_H(0);
+}
+
+/* the readings of b that count */
+static int16_t valid_t(const RecordBin* b) {
+	return b->flags & INVALID_T(0) ? RECORD_NA_T : b->t[0];
+}
+
+static uint8_t valid_h(const RecordBin* b) {
+	return b->flags & INVALID_H(0) ? RECORD_NA : b->h[0];
+}
+
+static void append(Tsdb* db, uint64_t from, uint64_t to) {
+	RecordBin b;
+	uint64_t i;
+
+	for (i = from; i < to; i++) {
+		reading(i, &b);
+		if (tsdb_append(db, &b, 1) != 1) {
+			fprintf(stderr, "E: appending row %llu failed: %s\n",
+					(unsigned long long)i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void check_rows(Tsdb* db) {
+	static TsdbPoint points[4096];
+	uint64_t row = 0;
+	RecordBin b;
+	long n, i;
+
+	CHECK(tsdb_rows(db, 0) == ROWS, "%llu rows instead of %d\n",
+			(unsigned long long)tsdb_rows(db, 0), ROWS);
+	while (row < tsdb_rows(db, 0)) {
+		n = tsdb_read(db, 0, row, sizeof(points)/sizeof(points[0]), points);
+		if (n <= 0) {
+			fprintf(stderr, "E: reading row %llu failed\n", (unsigned long long)row);
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < n; i++) {
+			reading(row + i, &b);
+			CHECK(points[i].time == b.time && points[i].t == b.t[0]
+					&& points[i].h == b.h[0] && tsdb_t(&points[i]) == valid_t(&b)
+					&& tsdb_h(&points[i]) == valid_h(&b),
+					"row %llu is %lld %d %d %x\n", (unsigned long long)(row + i),
+					(long long)points[i].time, points[i].t, points[i].h,
+					points[i].flags);
+		}
+		row += n;
+	}
+
+	for (row = 0; row < ROWS; row += 997) {
+		reading(row, &b);
+		CHECK(tsdb_find(db, 0, b.time) == row, "time of row %llu found at %llu\n",
+				(unsigned long long)row, (unsigned long long)tsdb_find(db, 0, b.time));
+	}
+}
+
+static void check_rollups(Tsdb* db) {
+	int level;
+
+	for (level = 0; level < TSDB_ROLLUPS; level++) {
+		int step = tsdb_rollup_steps[level];
+		TsdbRollup* r;
+		RecordBin b;
+		uint64_t row = 0;
+		long n, i;
+
+		n = tsdb_rollups(db, 0, level, INT64_MIN, INT64_MAX, &r);
+		CHECK(n == (BASE + (ROWS - 1) * STEP) / step - BASE / step + 1,
+				"%ld rollups of %d s\n", n, step);
+		for (i = 0; i < n; i++) {
+			int64_t t_sum = 0, h_sum = 0;
+			uint32_t t_count = 0, h_count = 0;
+
+			for (; row < ROWS; row++) {
+				reading(row, &b);
+				if (b.time >= r[i].start + step) break;
+				if (valid_t(&b) != RECORD_NA_T) t_sum += b.t[0], t_count++;
+				if (valid_h(&b) != RECORD_NA) h_sum += b.h[0], h_count++;
+			}
+			CHECK(r[i].t_sum == t_sum && r[i].t_count == t_count
+					&& r[i].h_sum == h_sum && r[i].h_count == h_count,
+					"rollup of %d s at %lld counts %d/%u %u/%u instead of %lld/%u %lld/%u\n",
+					step, (long long)r[i].start, r[i].t_sum, r[i].t_count,
+					r[i].h_sum, r[i].h_count, (long long)t_sum, t_count,
+					(long long)h_sum, h_count);
+		}
+		free(r);
+	}
+}
+
+static void check_aggregate(Tsdb* db) {
+	AggSummary a;
+	TsdbPoint last;
+	RecordBin b;
+	int64_t t_sum = 0;
+	uint32_t t_count = 0;
+	uint64_t row;
+
+	for (row = 0; row < ROWS; row++) {
+		reading(row, &b);
+		if (valid_t(&b) != RECORD_NA_T) t_sum += b.t[0], t_count++;
+	}
+	if (tsdb_aggregate(db, 0, INT64_MIN, INT64_MAX, &a, &last) == -1) {
+		fprintf(stderr, "E: aggregate failed\n");
+		exit(EXIT_FAILURE);
+	}
+	CHECK(a.t_sum == t_sum && a.t_count == t_count,
+			"aggregate is %lld/%u instead of %lld/%u\n", (long long)a.t_sum,
+			a.t_count, (long long)t_sum, t_count);
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/test_tsdb.XXXXXX";
+	char cmd[64];
+	Tsdb db;
+	pid_t pid;
+	int status;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+
+	// a writer that dies with rows of the new segment half written
+	pid = fork();
+	if (pid == 0) {
+		if (tsdb_open(&db, dir, 1) == -1) {
+			perror("tsdb_open");
+			_exit(EXIT_FAILURE);
+		}
+		append(&db, 0, KILLED_AT);
+		kill(getpid(), SIGKILL);
+	}
+	if (pid == -1 || waitpid(pid, &status, 0) == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (!WIFSIGNALED(status)) {
+		fprintf(stderr, "E: the writer was not killed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// the next one appends from where the columns end
+	if (tsdb_open(&db, dir, 1) == -1) {
+		perror("tsdb_open");
+		exit(EXIT_FAILURE);
+	}
+	CHECK(db.recover, "the crash went unnoticed\n");
+	{
+		Tsdb other;
+
+		CHECK(tsdb_open(&other, dir, 1) == -1 && errno == EWOULDBLOCK,
+				"a second writer got in\n");
+	}
+	CHECK(tsdb_rows(&db, 0) <= KILLED_AT, "%llu rows after the crash\n",
+			(unsigned long long)tsdb_rows(&db, 0));
+	append(&db, tsdb_rows(&db, 0), ROWS);
+	if (tsdb_close(&db) == -1) {
+		perror("tsdb_close");
+		exit(EXIT_FAILURE);
+	}
+
+	if (tsdb_open(&db, dir, 0) == -1) {
+		perror("tsdb_open");
+		exit(EXIT_FAILURE);
+	}
+	check_rows(&db);
+	check_rollups(&db);
+	check_aggregate(&db);
+	tsdb_close(&db);
+
+	// a clean close leaves nothing to recover
+	if (tsdb_open(&db, dir, 1) == -1) {
+		perror("tsdb_open");
+		exit(EXIT_FAILURE);
+	}
+	CHECK(!db.recover, "recovering after a clean close\n");
+	tsdb_close(&db);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0) fprintf(stderr, "W: can't remove %s\n", dir);
+
+	if (failures > 0) return 1;
+	printf("test_tsdb: ok\n");
+	return 0;
+}
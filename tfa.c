@@ -0,0 +1,163 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "record.h"
+#include "dump.h"
+#include "batch.h"
+#include "tsdb.h"
+#include "validate.h"
+#include "tfa.h"
+
+struct _TfaSeries {
+	Batch b;
+};
+
+static TfaSeries* series_new() {
+	TfaSeries* s = calloc(1, sizeof(TfaSeries));
+
+	if (s == NULL) perror("calloc");
+	return s;
+}
+
+TfaSeries* tfa_decode(const unsigned char* data, size_t len) {
+	TfaSeries* s;
+	RecordBin* all;
+	DumpHeader h;
+	TimeCache tc;
+	int n;
+
+	if (dump_header(data, len, &h) == -1) return NULL;
+
+	s = series_new();
+	all = malloc(h.records * sizeof(RecordBin));
+	if (s != NULL) s->b.records = malloc(h.records * sizeof(RecordBin));
+	if (s == NULL || all == NULL || s->b.records == NULL) {
+		perror("malloc");
+		free(all);
+		tfa_free(s);
+		return NULL;
+	}
+
+	timecache_init(&tc);
+	n = dump_decode(data, len, &h, all, &tc);
+	s->b.count = dump_order(all, n, &h, s->b.records);
+	s->b.sensors = h.sensors;
+	free(all);
+	return s;
+}
+
+TfaSeries* tfa_load(const char* const* paths, int npaths, int threads) {
+	TfaSeries* s;
+	char** files = NULL;
+	int nfiles = 0;
+	int i;
+
+	for (i = 0; i < npaths; i++) {
+		if (dump_scan(paths[i], &files, &nfiles) == -1) {
+			perror(paths[i]);
+			break;
+		}
+	}
+	s = i == npaths ? series_new() : NULL;
+	if (s != NULL && batch_decode(files, nfiles, threads, &s->b) == -1) {
+		perror("batch_decode");
+		free(s);
+		s = NULL;
+	}
+
+	for (i = 0; i < nfiles; i++) free(files[i]);
+	free(files);
+	return s;
+}
+
+TfaSeries* tfa_query(const char* dbdir, int sensor, int64_t from,
+		int64_t to) {
+	TfaSeries* s = NULL;
+	TsdbPoint* points = NULL;
+	uint64_t row, end;
+	Tsdb db;
+	long n, i;
+	int j;
+
+	if (sensor < 0 || sensor >= RECORD_SENSORS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (tsdb_open(&db, dbdir, 0) == -1) return NULL;
+
+	row = tsdb_find(&db, sensor, from);
+	end = tsdb_find(&db, sensor, to);
+	n = end > row ? end - row : 0;
+	points = malloc((n + 1) * sizeof(TsdbPoint));
+	s = series_new();
+	if (s != NULL) s->b.records = malloc((n + 1) * sizeof(RecordBin));
+	if (points == NULL || s == NULL || s->b.records == NULL) goto fail;
+
+	n = tsdb_read(&db, sensor, row, n, points);
+	if (n == -1) goto fail;
+	for (i = 0; i < n; i++) {
+		RecordBin* b = &s->b.records[i];
+
+		b->time = points[i].time;
+		b->index = row + i;
+		for (j = 0; j < RECORD_SENSORS; j++) {
+			b->t[j] = RECORD_NA_T;
+			b->h[j] = RECORD_NA;
+		}
+		b->t[sensor] = points[i].t;
+		b->h[sensor] = points[i].h;
+		b->flags = 0;
+		if (points[i].flags & TSDB_FLAG_T) b->flags |= INVALID_T(sensor);
+		if (points[i].flags & TSDB_FLAG_H) b->flags |= INVALID_H(sensor);
+	}
+	s->b.count = n;
+	s->b.sensors = sensor + 1;
+	free(points);
+	tsdb_close(&db);
+	return s;
+
+fail:
+	j = errno;
+	free(points);
+	tfa_free(s);
+	tsdb_close(&db);
+	errno = j;
+	return NULL;
+}
+
+size_t tfa_count(const TfaSeries* s) {
+	return s->b.count;
+}
+
+int tfa_sensors(const TfaSeries* s) {
+	return s->b.sensors;
+}
+
+int tfa_failed(const TfaSeries* s) {
+	return s->b.failed;
+}
+
+/* one pass per column, so each one is written sequentially */
+void tfa_columns(const TfaSeries* s, int64_t* time, int16_t** t,
+		uint8_t** h, uint16_t* flags, uint32_t* index) {
+	const RecordBin* r = s->b.records;
+	size_t n = s->b.count, i;
+	int j;
+
+	if (time != NULL) for (i = 0; i < n; i++) time[i] = r[i].time;
+	if (flags != NULL) for (i = 0; i < n; i++) flags[i] = r[i].flags;
+	if (index != NULL) for (i = 0; i < n; i++) index[i] = r[i].index;
+	for (j = 0; j < RECORD_SENSORS; j++) {
+		if (t != NULL && t[j] != NULL) for (i = 0; i < n; i++) t[j][i] = r[i].t[j];
+		if (h != NULL && h[j] != NULL) for (i = 0; i < n; i++) h[j][i] = r[i].h[j];
+	}
+}
+
+void tfa_free(TfaSeries* s) {
+	if (s == NULL) return;
+	batch_free(&s->b);
+	free(s);
+}
@@ -0,0 +1,48 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_TFA_H_
+#define _INCLUDE_TFA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dump.h"
+
+/* Entry points of libtfa.so, for tfa.py (through ctypes).
+ *
+ * A dump or a whole archive is decoded in one call; the records are then
+ * copied into one array per column, which the caller allocates, so NumPy
+ * (or anything else taking the buffer protocol) can use them as they are.
+ * dump_header() and dump_info() are exported as well.
+ */
+
+typedef struct _TfaSeries TfaSeries;
+
+/* decode the image of len bytes at data, oldest record first (the order
+ * decode_tfa.py lists them in), with index = record slot. NULL if the
+ * image is not understood. */
+extern TfaSeries* tfa_decode(const unsigned char* data, size_t len);
+
+/* decode the dump files and directories of them in paths[0..npaths-1]
+ * into one time ordered series, see batch.h. NULL if a path can not be
+ * read. */
+extern TfaSeries* tfa_load(const char* const* paths, int npaths, int threads);
+
+/* read the rows of sensor with from <= time < to from the database
+ * directory of ingest_tfa (see tsdb.h); the readings are in column sensor,
+ * the other columns are missing. NULL (with errno set) on error. */
+extern TfaSeries* tfa_query(const char* dbdir, int sensor, int64_t from,
+		int64_t to);
+
+extern size_t tfa_count(const TfaSeries* s);
+extern int tfa_sensors(const TfaSeries* s);
+extern int tfa_failed(const TfaSeries* s);
+
+/* copy the records into columns of tfa_count() entries each. t and h point
+ * to RECORD_SENSORS columns, one per sensor; any pointer may be NULL to
+ * skip that column. */
+extern void tfa_columns(const TfaSeries* s, int64_t* time, int16_t** t,
+		uint8_t** h, uint16_t* flags, uint32_t* index);
+
+extern void tfa_free(TfaSeries* s);
+
+#endif /* _INCLUDE_TFA_H_ */
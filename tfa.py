@@ -0,0 +1,166 @@
+# Python binding of the C decoder (libtfa.so, see tfa.h), for Python 2 and 3.
+#
+#   import tfa
+#   s = tfa.load(["/srv/klimalogger/dumps"])    # an archive, time ordered
+#   s = tfa.decode_file("tfa.dump.20091114.0908")   # one dump, oldest first
+#   s = tfa.query("/srv/klimalogger/db", 1, 1230764400, 1262300400)
+#   s.time, s.t[0], s.h[0], s.flags, s.index
+#   tfa.header(open("tfa.dump.20091114.0908", "rb").read())
+#
+# The columns are ctypes arrays, filled by the library in one pass each.
+# They support the buffer protocol, so numpy.frombuffer(s.t[1]) or
+# s.arrays() wrap them without a copy. Times are unix timestamps,
+# temperatures tenths of deg C (NA_T if missing), humidity %RH (NA if
+# missing), flags the failed plausibility checks (see validate.h).
+# Sensor 0 is the internal one.
+
+import ctypes
+import os
+
+SENSORS = 6         # RECORD_SENSORS
+NA = 0xFF           # RECORD_NA
+NA_T = -32768       # RECORD_NA_T
+
+class DumpHeader(ctypes.Structure):
+    _fields_ = [("sensors", ctypes.c_int),
+                ("record_len", ctypes.c_int),
+                ("records", ctypes.c_int),
+                ("interval", ctypes.c_int),
+                ("log_count", ctypes.c_int),
+                ("overflow", ctypes.c_int)]
+
+class DumpInfo(ctypes.Structure):
+    _fields_ = [("time", ctypes.c_long),
+                ("weekday", ctypes.c_int),
+                ("timezone", ctypes.c_int),
+                ("t_max", ctypes.c_short * SENSORS),
+                ("t_min", ctypes.c_short * SENSORS),
+                ("h_max", ctypes.c_ubyte * SENSORS),
+                ("h_min", ctypes.c_ubyte * SENSORS),
+                ("sensor_id", ctypes.c_ubyte * (SENSORS - 1)),
+                ("valid", ctypes.c_int)]
+
+def _load_library():
+    path = os.environ.get("TFA_LIBRARY",
+                          os.path.join(os.path.dirname(os.path.abspath(__file__)), "libtfa.so"))
+    lib = ctypes.CDLL(path, use_errno=True)
+    series = ctypes.c_void_p
+    lib.tfa_decode.restype = series
+    lib.tfa_decode.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+    lib.tfa_load.restype = series
+    lib.tfa_load.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_int, ctypes.c_int]
+    lib.tfa_query.restype = series
+    lib.tfa_query.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int64, ctypes.c_int64]
+    lib.tfa_count.restype = ctypes.c_size_t
+    lib.tfa_count.argtypes = [series]
+    lib.tfa_sensors.argtypes = [series]
+    lib.tfa_failed.argtypes = [series]
+    lib.tfa_columns.restype = None
+    lib.tfa_columns.argtypes = [series, ctypes.c_void_p,
+                                ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_void_p),
+                                ctypes.c_void_p, ctypes.c_void_p]
+    lib.tfa_free.restype = None
+    lib.tfa_free.argtypes = [series]
+    lib.dump_header.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(DumpHeader)]
+    lib.dump_info.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(DumpInfo)]
+    return lib
+
+_lib = _load_library()
+
+class Series(object):
+    """the columns of a decoded dump or archive"""
+
+    def __init__(self, handle):
+        try:
+            self.count = n = _lib.tfa_count(handle)
+            self.sensors = _lib.tfa_sensors(handle)
+            self.failed = _lib.tfa_failed(handle)
+
+            self.time = (ctypes.c_int64 * n)()
+            self.flags = (ctypes.c_uint16 * n)()
+            self.index = (ctypes.c_uint32 * n)()
+            # one buffer per quantity, sensor after sensor, so it can also
+            # be used as a (sensors, count) matrix
+            self._t = (ctypes.c_int16 * (self.sensors * n))()
+            self._h = (ctypes.c_uint8 * (self.sensors * n))()
+            self.t = [(ctypes.c_int16 * n).from_buffer(self._t, 2 * n * i) for i in range(self.sensors)]
+            self.h = [(ctypes.c_uint8 * n).from_buffer(self._h, n * i) for i in range(self.sensors)]
+
+            t = (ctypes.c_void_p * SENSORS)()
+            h = (ctypes.c_void_p * SENSORS)()
+            for i in range(self.sensors):
+                t[i] = ctypes.addressof(self.t[i])
+                h[i] = ctypes.addressof(self.h[i])
+            _lib.tfa_columns(handle, ctypes.addressof(self.time), t, h,
+                             ctypes.addressof(self.flags), ctypes.addressof(self.index))
+        finally:
+            _lib.tfa_free(handle)
+
+    def __len__(self):
+        return self.count
+
+    def arrays(self):
+        """the columns as NumPy arrays, sharing the memory of the series;
+        t and h are (sensors, count)"""
+        import numpy
+        n = self.count
+        return {
+            "time": numpy.frombuffer(self.time, dtype=numpy.int64),
+            "t": numpy.frombuffer(self._t, dtype=numpy.int16).reshape(self.sensors, n),
+            "h": numpy.frombuffer(self._h, dtype=numpy.uint8).reshape(self.sensors, n),
+            "flags": numpy.frombuffer(self.flags, dtype=numpy.uint16),
+            "index": numpy.frombuffer(self.index, dtype=numpy.uint32),
+        }
+
+def decode(data):
+    """decode an eeprom image (bytes), oldest record first"""
+    handle = _lib.tfa_decode(data, len(data))
+    if not handle:
+        raise ValueError("don't understand the data")
+    return Series(handle)
+
+def decode_file(fname):
+    f = open(fname, "rb")
+    try:
+        return decode(f.read())
+    finally:
+        f.close()
+
+def load(paths, threads=None):
+    """decode dump files and directories of them into one time ordered
+    series, records found in several dumps once"""
+    if isinstance(paths, (str, bytes)):
+        paths = [paths]
+    paths = [p.encode() if not isinstance(p, bytes) else p for p in paths]
+    if threads is None:
+        threads = len(os.sched_getaffinity(0)) if hasattr(os, "sched_getaffinity") else 1
+    args = (ctypes.c_char_p * len(paths))(*paths)
+    handle = _lib.tfa_load(args, len(paths), threads)
+    if not handle:
+        raise IOError("can not read %s" % b", ".join(paths).decode())
+    return Series(handle)
+
+def query(dbdir, sensor, start, end):
+    """the readings of sensor (0 = internal) with start <= time < end from
+    the database of ingest_tfa, in s.t[sensor] and s.h[sensor]. reading
+    the store is much faster than decoding the dumps again."""
+    if not isinstance(dbdir, bytes):
+        dbdir = dbdir.encode()
+    handle = _lib.tfa_query(dbdir, sensor, start, end)
+    if not handle:
+        errno = ctypes.get_errno()
+        raise IOError(errno, os.strerror(errno), dbdir.decode())
+    return Series(handle)
+
+def header(data):
+    """the parameter section of an eeprom image as a dict"""
+    h = DumpHeader()
+    info = DumpInfo()
+    if _lib.dump_header(data, len(data), ctypes.byref(h)) == -1:
+        raise ValueError("don't understand the data")
+    _lib.dump_info(data, len(data), ctypes.byref(info))
+    result = dict((name, getattr(h, name)) for name, _ in DumpHeader._fields_)
+    for name, _ in DumpInfo._fields_:
+        value = getattr(info, name)
+        result[name] = list(value) if isinstance(value, ctypes.Array) else value
+    return result
@@ -0,0 +1,884 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "tsdb.h"
+#include "validate.h"
+
+const int tsdb_rollup_steps[TSDB_ROLLUPS] = { 60, 5*60, 12*3600 };
+
+static void series_path(const TsdbSeries* s, char* buf, const char* fmt, long n) {
+	int len = snprintf(buf, PATH_MAX, "%s/", s->dir);
+	snprintf(buf + len, PATH_MAX - len, fmt, n);
+}
+
+static off_t file_size(const char* path) {
+	struct stat st;
+
+	if (stat(path, &st) == -1) return 0;
+	return st.st_size;
+}
+
+static int write_segments(TsdbSeries* s) {
+	char path[PATH_MAX];
+	int fd;
+	ssize_t len = s->nsegments * sizeof(TsdbSegment);
+
+	series_path(s, path, "segments", 0);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return -1;
+	if (write(fd, s->segments, len) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+/* open the columns of the last segment for appending. the files of a
+ * segment without rows are truncated: rows a crash left there before the
+ * segment made it into the segments file are not part of the series. */
+static int open_columns(TsdbSeries* s) {
+	char path[PATH_MAX];
+	int seg = s->nsegments - 1;
+	const char* mode = s->segments[seg].rows == 0 ? "w" : "a";
+
+	series_path(s, path, "%06ld.time", seg);
+	s->time_f = fopen(path, mode);
+	series_path(s, path, "%06ld.temp", seg);
+	s->temp_f = fopen(path, mode);
+	series_path(s, path, "%06ld.hum", seg);
+	s->hum_f = fopen(path, mode);
+	series_path(s, path, "%06ld.flag", seg);
+	s->flag_f = fopen(path, mode);
+	if (s->time_f == NULL || s->temp_f == NULL || s->hum_f == NULL
+			|| s->flag_f == NULL)
+		return -1;
+	return 0;
+}
+
+static void close_columns(TsdbSeries* s) {
+	if (s->time_f != NULL) fclose(s->time_f);
+	if (s->temp_f != NULL) fclose(s->temp_f);
+	if (s->hum_f != NULL) fclose(s->hum_f);
+	if (s->flag_f != NULL) fclose(s->flag_f);
+	s->time_f = s->temp_f = s->hum_f = s->flag_f = NULL;
+}
+
+static void add_segment(TsdbSeries* s) {
+	s->segments = realloc(s->segments, (s->nsegments + 1) * sizeof(TsdbSegment));
+	if (s->segments == NULL) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(&s->segments[s->nsegments++], 0, sizeof(TsdbSegment));
+}
+
+/* the column files of the last segment are the truth: an interrupted
+ * append may have left them longer than the segments file says, or of
+ * different lengths */
+static int repair_last_segment(TsdbSeries* s, int writable) {
+	TsdbSegment* seg = &s->segments[s->nsegments - 1];
+	char time_path[PATH_MAX], temp_path[PATH_MAX], hum_path[PATH_MAX];
+	char flag_path[PATH_MAX];
+	off_t rows;
+
+	series_path(s, time_path, "%06ld.time", s->nsegments - 1);
+	series_path(s, temp_path, "%06ld.temp", s->nsegments - 1);
+	series_path(s, hum_path, "%06ld.hum", s->nsegments - 1);
+	series_path(s, flag_path, "%06ld.flag", s->nsegments - 1);
+
+	rows = file_size(time_path) / sizeof(int64_t);
+	if (file_size(temp_path) / (off_t)sizeof(int16_t) < rows)
+		rows = file_size(temp_path) / sizeof(int16_t);
+	if (file_size(hum_path) < rows)
+		rows = file_size(hum_path);
+	if (file_size(flag_path) < rows)
+		rows = file_size(flag_path);
+
+	if (writable && rows > 0) {
+		if (truncate(time_path, rows * sizeof(int64_t)) == -1
+				|| truncate(temp_path, rows * sizeof(int16_t)) == -1
+				|| truncate(hum_path, rows) == -1
+				|| truncate(flag_path, rows) == -1)
+			return -1;
+	}
+
+	seg->rows = rows;
+	if (rows > 0) {
+		int fd = open(time_path, O_RDONLY);
+		int64_t t;
+
+		if (fd == -1) return -1;
+		if (pread(fd, &t, sizeof(t), 0) != sizeof(t)) t = 0;
+		seg->first = t;
+		if (pread(fd, &t, sizeof(t), (rows - 1) * sizeof(t)) != sizeof(t)) t = 0;
+		seg->last = t;
+		close(fd);
+	}
+	return 0;
+}
+
+/* (re)create the summary index of a series from its columns */
+static int rebuild_agg(Tsdb* db, int sensor) {
+	TsdbSeries* s = &db->series[sensor];
+	TsdbPoint buf[4096];
+	uint64_t row = 0;
+
+	if (agg_reset(&s->agg) == -1) return -1;
+	while (row < s->rows) {
+		long i, n = tsdb_read(db, sensor, row, sizeof(buf)/sizeof(buf[0]), buf);
+
+		if (n <= 0) return -1;
+		for (i = 0; i < n; i++) {
+			if (agg_append(&s->agg, tsdb_t(&buf[i]), tsdb_h(&buf[i])) == -1) return -1;
+		}
+		row += n;
+	}
+	return agg_flush(&s->agg);
+}
+
+static void rollup_add(TsdbRollup* r, int16_t t, uint8_t h) {
+	if (t != RECORD_NA_T) {
+		if (r->t_count == 0 || t < r->t_min) r->t_min = t;
+		if (r->t_count == 0 || t > r->t_max) r->t_max = t;
+		r->t_sum += t;
+		r->t_count++;
+	}
+	if (h != RECORD_NA) {
+		if (r->h_count == 0 || h < r->h_min) r->h_min = h;
+		if (r->h_count == 0 || h > r->h_max) r->h_max = h;
+		r->h_sum += h;
+		r->h_count++;
+	}
+}
+
+/* add a reading to the rollup buckets, writing out the buckets it is past */
+static int add_rollups(TsdbSeries* s, int64_t time, int16_t t, uint8_t h) {
+	int i;
+
+	for (i = 0; i < TSDB_ROLLUPS; i++) {
+		TsdbRollup* r = &s->rollup[i];
+		int64_t start = time - time % tsdb_rollup_steps[i];
+
+		if (r->start != start) {
+			if (r->start != INT64_MIN) {
+				if (pwrite(s->rollup_fd[i], r, sizeof(*r), s->rollup_pos[i]) != sizeof(*r))
+					return -1;
+				s->rollup_pos[i] += sizeof(*r);
+			}
+			memset(r, 0, sizeof(*r));
+			r->start = start;
+		}
+		rollup_add(r, t, h);
+	}
+	return 0;
+}
+
+static int flush_rollups(TsdbSeries* s) {
+	int i;
+
+	for (i = 0; i < TSDB_ROLLUPS; i++) {
+		if (s->rollup_fd[i] == -1 || s->rollup[i].start == INT64_MIN) continue;
+		if (pwrite(s->rollup_fd[i], &s->rollup[i], sizeof(TsdbRollup),
+				s->rollup_pos[i]) != sizeof(TsdbRollup))
+			return -1;
+	}
+	return 0;
+}
+
+/* (re)create the rollups of a series from its columns */
+static int rebuild_rollups(Tsdb* db, int sensor) {
+	TsdbSeries* s = &db->series[sensor];
+	TsdbPoint buf[4096];
+	uint64_t row = 0;
+	int i;
+
+	for (i = 0; i < TSDB_ROLLUPS; i++) {
+		if (ftruncate(s->rollup_fd[i], 0) == -1) return -1;
+		s->rollup[i].start = INT64_MIN;
+		s->rollup_pos[i] = 0;
+	}
+	while (row < s->rows) {
+		long n = tsdb_read(db, sensor, row, sizeof(buf)/sizeof(buf[0]), buf);
+
+		if (n <= 0) return -1;
+		for (i = 0; i < n; i++) {
+			if (add_rollups(s, buf[i].time, tsdb_t(&buf[i]), tsdb_h(&buf[i])) == -1)
+				return -1;
+		}
+		row += n;
+	}
+	return flush_rollups(s);
+}
+
+/* add a reading to the sketch of its day, writing out the previous day's
+ * when a new day starts */
+static int add_sketch(TsdbSeries* s, int64_t time, int16_t t, uint8_t h) {
+	TsdbSketch* k = &s->sketch;
+	int64_t start = time - time % TSDB_SKETCH_STEP;
+
+	if (k->start != start) {
+		if (k->start != INT64_MIN) {
+			if (pwrite(s->sketch_fd, k, sizeof(*k), s->sketch_pos) != sizeof(*k))
+				return -1;
+			s->sketch_pos += sizeof(*k);
+		}
+		k->start = start;
+		sketch_init(&k->t);
+		sketch_init(&k->h);
+	}
+	if (t != RECORD_NA_T) sketch_add(&k->t, t);
+	if (h != RECORD_NA) sketch_add(&k->h, h);
+	return 0;
+}
+
+static int flush_sketch(TsdbSeries* s) {
+	if (s->sketch_fd == -1 || s->sketch.start == INT64_MIN) return 0;
+	if (pwrite(s->sketch_fd, &s->sketch, sizeof(TsdbSketch), s->sketch_pos)
+			!= sizeof(TsdbSketch))
+		return -1;
+	return 0;
+}
+
+/* (re)create the daily sketches of a series from its columns, for
+ * databases from before they existed */
+static int rebuild_sketches(Tsdb* db, int sensor) {
+	TsdbSeries* s = &db->series[sensor];
+	TsdbPoint buf[4096];
+	uint64_t row = 0;
+
+	if (ftruncate(s->sketch_fd, 0) == -1) return -1;
+	s->sketch.start = INT64_MIN;
+	s->sketch_pos = 0;
+	while (row < s->rows) {
+		long i, n = tsdb_read(db, sensor, row, sizeof(buf)/sizeof(buf[0]), buf);
+
+		if (n <= 0) return -1;
+		for (i = 0; i < n; i++) {
+			if (add_sketch(s, buf[i].time, tsdb_t(&buf[i]), tsdb_h(&buf[i])) == -1)
+				return -1;
+		}
+		row += n;
+	}
+	return flush_sketch(s);
+}
+
+static int series_open(Tsdb* db, const char* path_db, int sensor) {
+	TsdbSeries* s = &db->series[sensor];
+	char path[PATH_MAX];
+	off_t size;
+	int i, fd;
+
+	memset(s, 0, sizeof(*s));
+	for (i = 0; i < AGG_LEVELS; i++) s->agg.fd[i] = -1;
+	s->sensor = sensor;
+	s->last = INT64_MIN;
+	for (i = 0; i < TSDB_ROLLUPS; i++) s->rollup_fd[i] = -1;
+	s->sketch_fd = -1;
+	if (strlen(path_db) + 16 > sizeof(s->dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	sprintf(s->dir, "%s/sensor_%s", path_db, sensor_name(sensor));
+
+	if (db->writable && mkdir(s->dir, 0755) == -1 && errno != EEXIST)
+		return -1;
+
+	series_path(s, path, "segments", 0);
+	fd = open(path, O_RDONLY);
+	if (fd != -1) {
+		struct stat st;
+
+		if (fstat(fd, &st) == -1) {
+			close(fd);
+			return -1;
+		}
+		s->nsegments = st.st_size / sizeof(TsdbSegment);
+		s->segments = malloc((s->nsegments + 1) * sizeof(TsdbSegment));
+		if (s->segments == NULL
+				|| read(fd, s->segments, s->nsegments * sizeof(TsdbSegment))
+					!= s->nsegments * sizeof(TsdbSegment)) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	if (s->nsegments == 0) {
+		if (!db->writable) return 0;
+		add_segment(s);
+	}
+	if (repair_last_segment(s, db->writable) == -1) return -1;
+
+	for (i = 0; i < s->nsegments; i++) s->rows += s->segments[i].rows;
+	for (i = s->nsegments - 1; i >= 0; i--) {
+		if (s->segments[i].rows > 0) {
+			s->last = s->segments[i].last;
+			break;
+		}
+	}
+
+	if (agg_open(&s->agg, s->dir, s->rows, db->writable) == -1) return -1;
+	if (!db->writable) return 0;
+
+	if (open_columns(s) == -1) return -1;
+	if ((!s->agg.valid || db->recover) && rebuild_agg(db, sensor) == -1) return -1;
+
+	for (i = 0; i < TSDB_ROLLUPS; i++) {
+		series_path(s, path, "rollup.%ld", tsdb_rollup_steps[i]);
+		s->rollup_fd[i] = open(path, O_RDWR | O_CREAT, 0644);
+		if (s->rollup_fd[i] == -1) return -1;
+
+		size = lseek(s->rollup_fd[i], 0, SEEK_END);
+		size -= size % sizeof(TsdbRollup);
+		s->rollup[i].start = INT64_MIN;
+		s->rollup_pos[i] = 0;
+		if (size > 0) {
+			s->rollup_pos[i] = size - sizeof(TsdbRollup);
+			if (pread(s->rollup_fd[i], &s->rollup[i], sizeof(TsdbRollup),
+					s->rollup_pos[i]) != sizeof(TsdbRollup))
+				return -1;
+		}
+	}
+	if (db->recover && rebuild_rollups(db, sensor) == -1) return -1;
+
+	series_path(s, path, "sketch.%ld", TSDB_SKETCH_STEP);
+	s->sketch_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (s->sketch_fd == -1) return -1;
+	size = lseek(s->sketch_fd, 0, SEEK_END);
+	size -= size % sizeof(TsdbSketch);
+	s->sketch.start = INT64_MIN;
+	s->sketch_pos = 0;
+	if (size > 0) {
+		s->sketch_pos = size - sizeof(TsdbSketch);
+		if (pread(s->sketch_fd, &s->sketch, sizeof(TsdbSketch), s->sketch_pos)
+				!= sizeof(TsdbSketch))
+			return -1;
+	}
+	// missing, or behind the columns (not flushed before a crash)
+	if (s->rows > 0 && (db->recover
+				|| s->sketch.start != s->last - s->last % TSDB_SKETCH_STEP)
+			&& rebuild_sketches(db, sensor) == -1)
+		return -1;
+	return 0;
+}
+
+static int series_flush(TsdbSeries* s) {
+	int rc = 0;
+
+	if (s->time_f == NULL) return 0;
+	if (fflush(s->time_f) == EOF || fflush(s->temp_f) == EOF
+			|| fflush(s->hum_f) == EOF || fflush(s->flag_f) == EOF)
+		rc = -1;
+	if (flush_rollups(s) == -1 || flush_sketch(s) == -1
+			|| write_segments(s) == -1 || agg_flush(&s->agg) == -1)
+		rc = -1;
+	return rc;
+}
+
+static int series_close(TsdbSeries* s) {
+	int rc = series_flush(s);
+	int i;
+
+	close_columns(s);
+	agg_close(&s->agg);
+	for (i = 0; i < TSDB_ROLLUPS; i++) {
+		if (s->rollup_fd[i] != -1) close(s->rollup_fd[i]);
+		s->rollup_fd[i] = -1;
+	}
+	if (s->sketch_fd != -1) close(s->sketch_fd);
+	s->sketch_fd = -1;
+	free(s->segments);
+	s->segments = NULL;
+	return rc;
+}
+
+/* the writer holds an flock() of <db>/lock for as long as it has the
+ * database open, and keeps a byte in the file until tsdb_close(). the file
+ * is never removed, so every writer locks the same one. */
+static int lock_writer(Tsdb* db) {
+	char path[PATH_MAX + 8];
+	struct stat st;
+	int err;
+
+	snprintf(path, sizeof(path), "%s/lock", db->path);
+	db->lock_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (db->lock_fd == -1) return -1;
+	// EWOULDBLOCK: another writer has it
+	if (flock(db->lock_fd, LOCK_EX | LOCK_NB) == -1 || fstat(db->lock_fd, &st) == -1)
+		goto fail;
+
+	// the last writer did not get to tsdb_close(), so the rollups,
+	// sketches and summaries may count rows the columns lost
+	db->recover = st.st_size > 0;
+	if (!db->recover && write(db->lock_fd, "", 1) != 1) goto fail;
+	return 0;
+
+fail:
+	err = errno;
+	close(db->lock_fd);
+	db->lock_fd = -1;
+	errno = err;
+	return -1;
+}
+
+int tsdb_open(Tsdb* db, const char* path, int writable) {
+	int i;
+
+	memset(db, 0, sizeof(*db));
+	snprintf(db->path, sizeof(db->path), "%s", path);
+	db->writable = writable;
+	db->lock_fd = -1;
+
+	if (writable) {
+		if (mkdir(path, 0755) == -1 && errno != EEXIST)
+			return -1;
+		if (lock_writer(db) == -1) return -1;
+	}
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (series_open(db, path, i) == -1) {
+			int err = errno;
+
+			while (i >= 0) series_close(&db->series[i--]);
+			if (db->lock_fd != -1) close(db->lock_fd);
+			errno = err;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int tsdb_close(Tsdb* db) {
+	int i, rc = 0;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (series_close(&db->series[i]) == -1) rc = -1;
+	}
+	if (db->lock_fd != -1) {
+		if (rc == 0 && ftruncate(db->lock_fd, 0) == -1) rc = -1;
+		close(db->lock_fd);
+		db->lock_fd = -1;
+	}
+	return rc;
+}
+
+int tsdb_flush(Tsdb* db) {
+	int i, rc = 0;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		if (series_flush(&db->series[i]) == -1) rc = -1;
+	}
+	return rc;
+}
+
+int64_t tsdb_last(Tsdb* db, int sensor) {
+	return db->series[sensor].last;
+}
+
+uint64_t tsdb_rows(Tsdb* db, int sensor) {
+	return db->series[sensor].rows;
+}
+
+/* append a row; t and h are stored as they are, the summaries leave out
+ * the ones flags marks as implausible */
+static int series_append(TsdbSeries* s, int64_t time, int16_t t, uint8_t h,
+		uint8_t flags) {
+	TsdbSegment* seg = &s->segments[s->nsegments - 1];
+	int16_t valid_t = flags & TSDB_FLAG_T ? RECORD_NA_T : t;
+	uint8_t valid_h = flags & TSDB_FLAG_H ? RECORD_NA : h;
+
+	if (seg->rows == TSDB_SEGMENT_ROWS) {
+		if (series_flush(s) == -1) return -1;
+		close_columns(s);
+		add_segment(s);
+		seg = &s->segments[s->nsegments - 1];
+		// list the new segment before anything is written to it, so
+		// repair_last_segment() finds its rows after a crash
+		if (write_segments(s) == -1 || open_columns(s) == -1) return -1;
+	}
+
+	if (fwrite(&time, sizeof(time), 1, s->time_f) != 1
+			|| fwrite(&t, sizeof(t), 1, s->temp_f) != 1
+			|| fwrite(&h, sizeof(h), 1, s->hum_f) != 1
+			|| fwrite(&flags, sizeof(flags), 1, s->flag_f) != 1)
+		return -1;
+
+	if (agg_append(&s->agg, valid_t, valid_h) == -1) return -1;
+
+	if (seg->rows == 0) seg->first = time;
+	seg->last = time;
+	seg->rows++;
+	s->rows++;
+	s->last = time;
+
+	if (add_rollups(s, time, valid_t, valid_h) == -1) return -1;
+	return add_sketch(s, time, valid_t, valid_h);
+}
+
+int tsdb_append(Tsdb* db, const RecordBin* b, int sensors) {
+	int i, n = 0;
+
+	if (!db->writable) {
+		errno = EBADF;
+		return -1;
+	}
+	if (b->flags & INVALID_TIME) return 0;
+
+	for (i = 0; i < sensors && i < RECORD_SENSORS; i++) {
+		TsdbSeries* s = &db->series[i];
+		uint8_t flags = 0;
+
+		if (b->t[i] == RECORD_NA_T && b->h[i] == RECORD_NA) continue;
+		if (b->time <= s->last) continue;
+		if (b->flags & INVALID_T(i)) flags |= TSDB_FLAG_T;
+		if (b->flags & INVALID_H(i)) flags |= TSDB_FLAG_H;
+		if (series_append(s, b->time, b->t[i], b->h[i], flags) == -1) return -1;
+		n++;
+	}
+	return n;
+}
+
+/* map the time column of segment seg */
+static int64_t* map_times(TsdbSeries* s, int seg) {
+	char path[PATH_MAX];
+	int64_t* times;
+	int fd;
+
+	if (s->segments[seg].rows == 0) return NULL;
+	series_path(s, path, "%06ld.time", seg);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	times = mmap(NULL, s->segments[seg].rows * sizeof(int64_t), PROT_READ,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	return times == MAP_FAILED ? NULL : times;
+}
+
+uint64_t tsdb_find(Tsdb* db, int sensor, int64_t t) {
+	TsdbSeries* s = &db->series[sensor];
+	uint64_t row = 0;
+	int64_t* times;
+	uint32_t lo, hi;
+	int seg;
+
+	if (s->time_f != NULL) fflush(s->time_f);
+
+	for (seg = 0; seg < s->nsegments; seg++) {
+		if (s->segments[seg].rows > 0 && s->segments[seg].last >= t) break;
+		row += s->segments[seg].rows;
+	}
+	if (seg == s->nsegments) return row;
+
+	times = map_times(s, seg);
+	if (times == NULL) return row;
+	lo = 0;
+	hi = s->segments[seg].rows;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (times[mid] < t) lo = mid + 1;
+		else hi = mid;
+	}
+	munmap(times, s->segments[seg].rows * sizeof(int64_t));
+	return row + lo;
+}
+
+static int read_column(TsdbSeries* s, const char* ext, int seg, uint32_t pos,
+		long n, size_t width, void* buf) {
+	char path[PATH_MAX];
+	char name[32];
+	int fd;
+	ssize_t len = n * width;
+
+	snprintf(name, sizeof(name), "%%06ld.%s", ext);
+	series_path(s, path, name, seg);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) return -1;
+	if (pread(fd, buf, len, (off_t)pos * width) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+long tsdb_read(Tsdb* db, int sensor, uint64_t row, long n, TsdbPoint* out) {
+	TsdbSeries* s = &db->series[sensor];
+	int64_t* times;
+	int16_t* temps;
+	uint8_t* hums;
+	uint8_t* flags;
+	long done = 0;
+	int seg;
+
+	if (s->time_f != NULL && (fflush(s->time_f) == EOF
+			|| fflush(s->temp_f) == EOF || fflush(s->hum_f) == EOF
+			|| fflush(s->flag_f) == EOF))
+		return -1;
+
+	times = malloc(n * sizeof(int64_t));
+	temps = malloc(n * sizeof(int16_t));
+	hums = malloc(n);
+	flags = malloc(n);
+	if (times == NULL || temps == NULL || hums == NULL || flags == NULL) goto fail;
+
+	for (seg = 0; seg < s->nsegments && done < n; seg++) {
+		uint32_t rows = s->segments[seg].rows;
+		long len, i;
+
+		if (row >= rows) {
+			row -= rows;
+			continue;
+		}
+		len = rows - row;
+		if (len > n - done) len = n - done;
+		if (read_column(s, "time", seg, row, len, sizeof(int64_t), times) == -1
+				|| read_column(s, "temp", seg, row, len, sizeof(int16_t), temps) == -1
+				|| read_column(s, "hum", seg, row, len, sizeof(uint8_t), hums) == -1
+				|| read_column(s, "flag", seg, row, len, sizeof(uint8_t), flags) == -1)
+			goto fail;
+		for (i = 0; i < len; i++) {
+			out[done + i].time = times[i];
+			out[done + i].t = temps[i];
+			out[done + i].h = hums[i];
+			out[done + i].flags = flags[i];
+		}
+		done += len;
+		row = 0;
+	}
+
+	free(times); free(temps); free(hums); free(flags);
+	return done;
+
+fail:
+	free(times); free(temps); free(hums); free(flags);
+	return -1;
+}
+
+/* index of the first of the n buckets in fd that starts at or after t, -1
+ * on error */
+static long rollup_find(int fd, long n, int64_t t) {
+	long lo = 0, hi = n;
+
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		int64_t start;
+
+		if (pread(fd, &start, sizeof(start), (off_t)mid * sizeof(TsdbRollup))
+				!= sizeof(start))
+			return -1;
+		if (start < t) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+long tsdb_rollups(Tsdb* db, int sensor, int level, int64_t from,
+		int64_t to, TsdbRollup** out) {
+	TsdbSeries* s = &db->series[sensor];
+	char path[PATH_MAX];
+	TsdbRollup* r;
+	long n, lo, hi;
+	off_t size;
+	ssize_t len;
+	int fd;
+
+	*out = NULL;
+	if (flush_rollups(s) == -1) return -1;
+
+	series_path(s, path, "rollup.%ld", tsdb_rollup_steps[level]);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) return errno == ENOENT ? 0 : -1;
+	size = lseek(fd, 0, SEEK_END);
+	n = size / sizeof(TsdbRollup);
+
+	// the buckets are in the order of time, only the window is read
+	lo = rollup_find(fd, n, from);
+	hi = from < to ? rollup_find(fd, n, to) : lo;
+	if (lo == -1 || hi == -1) {
+		close(fd);
+		return -1;
+	}
+	len = (hi - lo) * sizeof(TsdbRollup);
+	r = malloc(len + sizeof(TsdbRollup));
+	if (r == NULL || (len > 0 && pread(fd, r, len, (off_t)lo * sizeof(TsdbRollup)) != len)) {
+		free(r);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	*out = r;
+	return hi - lo;
+}
+
+static int aggregate_rows(Tsdb* db, int sensor, uint64_t lo, uint64_t hi,
+		AggSummary* out) {
+	TsdbPoint buf[2 * AGG_FANOUT];
+
+	while (lo < hi) {
+		long i, n = hi - lo;
+
+		if (n > sizeof(buf)/sizeof(buf[0])) n = sizeof(buf)/sizeof(buf[0]);
+		n = tsdb_read(db, sensor, lo, n, buf);
+		if (n <= 0) return -1;
+		for (i = 0; i < n; i++) agg_add(out, tsdb_t(&buf[i]), tsdb_h(&buf[i]));
+		lo += n;
+	}
+	return 0;
+}
+
+static int aggregate_units(AggIndex* a, int level, uint64_t lo, uint64_t hi,
+		AggSummary* out) {
+	AggSummary buf[AGG_FANOUT];
+
+	while (lo < hi) {
+		long i, n = hi - lo;
+
+		if (n > AGG_FANOUT) n = AGG_FANOUT;
+		if (agg_units(a, level, lo, n, buf) == -1) return -1;
+		for (i = 0; i < n; i++) agg_merge(out, &buf[i]);
+		lo += n;
+	}
+	return 0;
+}
+
+/* aggregate units lo..hi of level (-1 being single rows) */
+static int aggregate(Tsdb* db, int sensor, int level, uint64_t lo, uint64_t hi,
+		AggSummary* out) {
+	if (level < 0) return aggregate_rows(db, sensor, lo, hi, out);
+	return aggregate_units(&db->series[sensor].agg, level, lo, hi, out);
+}
+
+int tsdb_aggregate(Tsdb* db, int sensor, int64_t from, int64_t to,
+		AggSummary* out, TsdbPoint* last) {
+	TsdbSeries* s = &db->series[sensor];
+	uint64_t lo, hi;
+	int level = -1;
+
+	agg_init(out);
+	last->time = INT64_MIN;
+	last->t = RECORD_NA_T;
+	last->h = RECORD_NA;
+	last->flags = 0;
+	if (s->rows == 0 || from >= to) return 0;
+
+	lo = tsdb_find(db, sensor, from);
+	hi = tsdb_find(db, sensor, to);
+	if (lo >= hi) return 0;
+	if (tsdb_read(db, sensor, hi - 1, 1, last) != 1) return -1;
+
+	if (!s->agg.valid) return aggregate_rows(db, sensor, lo, hi, out);
+
+	// the partial blocks at both ends are added from the level below,
+	// the whole blocks in between from the next level up
+	while (lo < hi) {
+		if (level + 1 < AGG_LEVELS) {
+			uint64_t alo = (lo + AGG_FANOUT - 1) / AGG_FANOUT * AGG_FANOUT;
+			uint64_t ahi = hi / AGG_FANOUT * AGG_FANOUT;
+
+			if (alo < ahi) {
+				if (aggregate(db, sensor, level, lo, alo, out) == -1
+						|| aggregate(db, sensor, level, ahi, hi, out) == -1)
+					return -1;
+				lo = alo / AGG_FANOUT;
+				hi = ahi / AGG_FANOUT;
+				level++;
+				continue;
+			}
+		}
+		return aggregate(db, sensor, level, lo, hi, out);
+	}
+	return 0;
+}
+
+static int sketch_rows(Tsdb* db, int sensor, int64_t from, int64_t to,
+		Sketch* t, Sketch* h) {
+	TsdbPoint buf[4096];
+	uint64_t lo, hi;
+
+	if (from >= to) return 0;
+	lo = tsdb_find(db, sensor, from);
+	hi = tsdb_find(db, sensor, to);
+	while (lo < hi) {
+		long i, n = hi - lo;
+
+		if (n > sizeof(buf)/sizeof(buf[0])) n = sizeof(buf)/sizeof(buf[0]);
+		n = tsdb_read(db, sensor, lo, n, buf);
+		if (n <= 0) return -1;
+		for (i = 0; i < n; i++) {
+			if (tsdb_t(&buf[i]) != RECORD_NA_T) sketch_add(t, buf[i].t);
+			if (tsdb_h(&buf[i]) != RECORD_NA) sketch_add(h, buf[i].h);
+		}
+		lo += n;
+	}
+	return 0;
+}
+
+int tsdb_quantiles(Tsdb* db, int sensor, int64_t from, int64_t to,
+		Sketch* t, Sketch* h) {
+	TsdbSeries* s = &db->series[sensor];
+	const TsdbSketch* days = NULL;
+	char path[PATH_MAX];
+	int64_t lo, hi;
+	size_t n = 0, len = 0, i;
+	off_t size;
+	int fd;
+
+	if (s->rows == 0 || from >= to) return 0;
+	if (flush_sketch(s) == -1) return -1;
+
+	series_path(s, path, "sketch.%ld", TSDB_SKETCH_STEP);
+	fd = open(path, O_RDONLY);
+	if (fd == -1 && errno != ENOENT) return -1;
+	if (fd != -1) {
+		size = lseek(fd, 0, SEEK_END);
+		n = size / sizeof(TsdbSketch);
+		len = n * sizeof(TsdbSketch);
+		if (n > 0) {
+			days = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+			if (days == MAP_FAILED) {
+				close(fd);
+				return -1;
+			}
+		}
+		close(fd);
+	}
+
+	// the whole days in the window, as far as there are sketches of them
+	lo = from + (TSDB_SKETCH_STEP - from % TSDB_SKETCH_STEP) % TSDB_SKETCH_STEP;
+	hi = to - to % TSDB_SKETCH_STEP;
+	if (n == 0) hi = lo;
+	else if (hi > days[n - 1].start + TSDB_SKETCH_STEP)
+		hi = days[n - 1].start + TSDB_SKETCH_STEP;
+
+	if (lo < hi) {
+		size_t a = 0, b = n;
+
+		while (a < b) {
+			size_t mid = (a + b) / 2;
+
+			if (days[mid].start < lo) a = mid + 1;
+			else b = mid;
+		}
+		for (i = a; i < n && days[i].start < hi; i++) {
+			sketch_merge(t, &days[i].t);
+			sketch_merge(h, &days[i].h);
+		}
+	} else {
+		lo = hi = to;
+	}
+	if (days != NULL) munmap((void*)days, len);
+
+	if (sketch_rows(db, sensor, from, lo, t, h) == -1
+			|| sketch_rows(db, sensor, hi, to, t, h) == -1)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,161 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_TSDB_H_
+#define _INCLUDE_TSDB_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include "record.h"
+#include "output.h"
+#include "agg.h"
+#include "sketch.h"
+
+/* Append-only time series store, one directory per sensor:
+ *
+ *  <db>/sensor_<name>/segments         TsdbSegment per segment
+ *  <db>/sensor_<name>/NNNNNN.time      int64 unix timestamps
+ *  <db>/sensor_<name>/NNNNNN.temp      int16 tenths of deg C
+ *  <db>/sensor_<name>/NNNNNN.hum       uint8 %RH
+ *  <db>/sensor_<name>/NNNNNN.flag      uint8 TSDB_FLAG_*
+ *  <db>/sensor_<name>/rollup.<step>    TsdbRollup per step seconds
+ *  <db>/sensor_<name>/sketch.86400     TsdbSketch per day
+ *  <db>/lock                           flock()ed by the writer, not empty
+ *                                      while it has the database open
+ *
+ * Every record is kept at full resolution. The columns are split into
+ * segments of TSDB_SEGMENT_ROWS rows; the segments file holds the time range
+ * of each one, so a time lookup scans the (few) segment ranges and then
+ * does a binary search over the time column of a single segment. The
+ * rollups (same steps as the rrd archives UPDATE.pl creates, sorted by
+ * bucket start, so a window is found by a binary search), the daily quantile
+ * sketches (sketch.h) and the block summary index (agg.h, agg.<level>
+ * files) are updated as records are appended. After a crash the columns
+ * are cut back to their last whole row and everything derived from them is
+ * rebuilt on the next writable open. There is one writer at a time.
+ */
+
+#define TSDB_SEGMENT_ROWS 65536
+#define TSDB_ROLLUPS 3
+#define TSDB_SKETCH_STEP 86400
+
+/* rollup steps in seconds */
+extern const int tsdb_rollup_steps[TSDB_ROLLUPS];
+
+typedef struct _TsdbSegment {
+	int64_t first;
+	int64_t last;
+	uint32_t rows;
+	uint32_t reserved;
+} TsdbSegment;
+
+typedef struct _TsdbRollup {
+	int64_t start;
+	int32_t t_sum;
+	uint32_t t_count;
+	int16_t t_min, t_max;
+	uint32_t h_sum;
+	uint32_t h_count;
+	uint8_t h_min, h_max;
+	uint8_t reserved[2];
+} TsdbRollup;
+
+typedef struct _TsdbSketch {
+	int64_t start;
+	Sketch t;
+	Sketch h;
+} TsdbSketch;
+
+/* TsdbPoint.flags: the reading is implausible. it is kept, but left out
+ * of the rollups, sketches and summaries. */
+#define TSDB_FLAG_T 0x01
+#define TSDB_FLAG_H 0x02
+
+typedef struct _TsdbPoint {
+	int64_t time;
+	int16_t t;              /* RECORD_NA_T if missing */
+	uint8_t h;              /* RECORD_NA if missing */
+	uint8_t flags;          /* TSDB_FLAG_* */
+} TsdbPoint;
+
+/* the readings of a point that are not flagged, missing otherwise */
+#define tsdb_t(p) ((p)->flags & TSDB_FLAG_T ? RECORD_NA_T : (p)->t)
+#define tsdb_h(p) ((p)->flags & TSDB_FLAG_H ? RECORD_NA : (p)->h)
+
+typedef struct _TsdbSeries {
+	char dir[PATH_MAX];
+	int sensor;
+	int nsegments;
+	TsdbSegment* segments;
+	FILE* time_f;           /* open columns of the last segment */
+	FILE* temp_f;
+	FILE* hum_f;
+	FILE* flag_f;
+	uint64_t rows;          /* total rows */
+	int64_t last;           /* last timestamp, INT64_MIN if empty */
+	int rollup_fd[TSDB_ROLLUPS];
+	TsdbRollup rollup[TSDB_ROLLUPS];    /* current (last) bucket */
+	off_t rollup_pos[TSDB_ROLLUPS];     /* where it is stored */
+	int sketch_fd;
+	TsdbSketch sketch;      /* current (last) day */
+	off_t sketch_pos;
+	AggIndex agg;
+} TsdbSeries;
+
+typedef struct _Tsdb {
+	char path[PATH_MAX];
+	int writable;
+	int recover;            /* the last writer crashed, derived files are rebuilt */
+	int lock_fd;            /* <db>/lock, held by a writer; -1 for readers */
+	TsdbSeries series[RECORD_SENSORS];
+} Tsdb;
+
+/* open a database directory, creating it if writable. returns -1 and sets
+ * errno on failure, EWOULDBLOCK if writable and another writer has it open. */
+extern int tsdb_open(Tsdb* db, const char* path, int writable);
+
+/* flush pending appends and close */
+extern int tsdb_close(Tsdb* db);
+
+/* write pending appends out, so other readers of the database see them */
+extern int tsdb_flush(Tsdb* db);
+
+/* last timestamp stored for a sensor, INT64_MIN if none */
+extern int64_t tsdb_last(Tsdb* db, int sensor);
+
+/* append the readings of the first sensors sensors of a record. readings
+ * flagged as implausible (b->flags) are stored with TSDB_FLAG_T/H; sensors
+ * missing entirely, or not newer than what is stored, are skipped. returns
+ * the number of sensors appended, -1 on error. */
+extern int tsdb_append(Tsdb* db, const RecordBin* b, int sensors);
+
+/* number of rows stored for a sensor */
+extern uint64_t tsdb_rows(Tsdb* db, int sensor);
+
+/* first row with a timestamp >= t */
+extern uint64_t tsdb_find(Tsdb* db, int sensor, int64_t t);
+
+/* read up to n rows starting at row into out[], flagged readings
+ * included (see tsdb_t() and tsdb_h()). returns rows read, -1 on error. */
+extern long tsdb_read(Tsdb* db, int sensor, uint64_t row, long n, TsdbPoint* out);
+
+/* read the rollup buckets of step tsdb_rollup_steps[level] with
+ * from <= start < to into a malloc'ed array. returns the count, -1 on
+ * error. */
+extern long tsdb_rollups(Tsdb* db, int sensor, int level, int64_t from,
+		int64_t to, TsdbRollup** out);
+
+/* min/max/sum/count of the readings with from <= time < to, and the last
+ * reading in that window (last->time is INT64_MIN if there is none). uses
+ * the block summary index, so it runs in logarithmic time. */
+extern int tsdb_aggregate(Tsdb* db, int sensor, int64_t from, int64_t to,
+		AggSummary* out, TsdbPoint* last);
+
+/* add the readings with from <= time < to to the sketches t and h (so the
+ * readings of several windows, sensors or databases can be put together).
+ * whole days come from the daily sketches, only the rows of the partial
+ * days at both ends are read. */
+extern int tsdb_quantiles(Tsdb* db, int sensor, int64_t from, int64_t to,
+		Sketch* t, Sketch* h);
+
+#endif /* _INCLUDE_TSDB_H_ */
@@ -0,0 +1,36 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+double util_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int64_t util_parse_time(const char* arg, time_t now) {
+	char* end;
+	long long n;
+
+	if (strcmp(arg, "now") == 0) return now;
+
+	n = strtoll(arg, &end, 10);
+	if (end == arg) return -1;
+	if (*end == 0) return n;
+	if (arg[0] != '-' || end[1] != 0) return -1;
+
+	switch (*end) {
+	case 's': break;
+	case 'm': n *= 60; break;
+	case 'h': n *= 3600; break;
+	case 'd': n *= 86400; break;
+	case 'w': n *= 7 * 86400; break;
+	case 'M': n *= 30 * 86400; break;
+	case 'y': n *= 365 * 86400; break;
+	default: return -1;
+	}
+	return now + n;
+}
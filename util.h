@@ -0,0 +1,16 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_UTIL_H_
+#define _INCLUDE_UTIL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* seconds on the monotonic clock, for timing */
+extern double util_now(void);
+
+/* parse a time argument: a unix time, "now" or relative to now like -1d
+ * (units s, m, h, d, w, M = 30 days, y = 365 days). -1 on error. */
+extern int64_t util_parse_time(const char* arg, time_t now);
+
+#endif /* _INCLUDE_UTIL_H_ */
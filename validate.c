@@ -0,0 +1,183 @@
+/* vim:set expandtab! ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dump.h"
+#include "validate.h"
+
+/* alarm limits the station comes with, meaning "not set" */
+#define DEFAULT_T_MAX 300
+#define DEFAULT_T_MIN 100
+#define DEFAULT_H_MAX 70
+#define DEFAULT_H_MIN 10
+
+/* the reading each nibble of a record (from byte 5 on) belongs to,
+ * { high nibble, low nibble }; see record_parse() */
+static const uint16_t nibble_owner[20][2] = {
+	{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	{ INVALID_T(0), INVALID_T(0) },
+	{ INVALID_T(1), INVALID_T(0) },
+	{ INVALID_T(1), INVALID_T(1) },
+	{ INVALID_H(0), INVALID_H(0) },
+	{ INVALID_H(1), INVALID_H(1) },
+	{ INVALID_T(2), INVALID_T(2) },
+	{ INVALID_H(2), INVALID_T(2) },
+	{ INVALID_T(3), INVALID_H(2) },
+	{ INVALID_T(3), INVALID_T(3) },
+	{ INVALID_H(3), INVALID_H(3) },
+	{ INVALID_T(4), INVALID_T(4) },
+	{ INVALID_H(4), INVALID_T(4) },
+	{ INVALID_T(5), INVALID_H(4) },
+	{ INVALID_T(5), INVALID_T(5) },
+	{ INVALID_H(5), INVALID_H(5) },
+};
+
+/* 1 if a nibble is above 9 */
+#define BAD_NIBBLE(n) (((n) + 6) >> 4)
+
+/* the same for 8 bytes at a time: add 6 to every nibble and look for
+ * carries out of it */
+#define NIBBLES 0x0F0F0F0F0F0F0F0FULL
+#define SIX     0x0606060606060606ULL
+#define CARRY   0x1010101010101010ULL
+
+static int bcd(unsigned char b) {
+	return (b >> 4) * 10 + (b & 0x0F);
+}
+
+void validate_reset(Validator* v) {
+	int i;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		v->t_time[i] = v->h_time[i] = INT64_MIN;
+		v->t_last[i] = v->h_last[i] = 0;
+	}
+}
+
+void validate_init(Validator* v, const unsigned char* data, size_t len) {
+	DumpInfo info;
+	int i;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		v->t_lo[i] = VALID_T_MIN;
+		v->t_hi[i] = VALID_T_MAX;
+		v->h_lo[i] = VALID_H_MIN;
+		v->h_hi[i] = VALID_H_MAX;
+	}
+	v->max_time = time(NULL) + VALID_TIME_AHEAD;
+	validate_reset(v);
+
+	if (data == NULL || dump_info(data, len, &info) == -1) return;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		int t_max = info.t_max[i], t_min = info.t_min[i];
+		int h_max = info.h_max[i], h_min = info.h_min[i];
+
+		if (t_max != RECORD_NA_T && t_min != RECORD_NA_T && t_min < t_max
+				&& (t_max != DEFAULT_T_MAX || t_min != DEFAULT_T_MIN)) {
+			if (t_min - VALID_T_MARGIN > v->t_lo[i]) v->t_lo[i] = t_min - VALID_T_MARGIN;
+			if (t_max + VALID_T_MARGIN < v->t_hi[i]) v->t_hi[i] = t_max + VALID_T_MARGIN;
+		}
+		if (h_max != RECORD_NA && h_min != RECORD_NA && h_min < h_max
+				&& (h_max != DEFAULT_H_MAX || h_min != DEFAULT_H_MIN)) {
+			if (h_min - VALID_H_MARGIN > v->h_lo[i]) v->h_lo[i] = h_min - VALID_H_MARGIN;
+			if (h_max + VALID_H_MARGIN < v->h_hi[i]) v->h_hi[i] = h_max + VALID_H_MARGIN;
+		}
+	}
+}
+
+/* the timestamp checks: INVALID_TIME and INVALID_BCD if they failed */
+static unsigned int check_time(const Validator* v, const unsigned char* raw,
+		const RecordBin* b) {
+	unsigned int flags = 0, minute, hour, day, month;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		flags |= (BAD_NIBBLE(raw[i] >> 4) | BAD_NIBBLE(raw[i] & 0x0F)) * (INVALID_TIME | INVALID_BCD);
+	}
+	minute = bcd(raw[0]);
+	hour = bcd(raw[1]);
+	day = bcd(raw[2]);
+	month = bcd(raw[3]);
+	flags |= ((minute > 59) | (hour > 23) | (day - 1 > 30) | (month - 1 > 11)
+			| (b->time > v->max_time)) * INVALID_TIME;
+	return flags;
+}
+
+int validate_time(const Validator* v, const unsigned char* raw,
+		const RecordBin* b) {
+	return (check_time(v, raw, b) & INVALID_TIME) == 0;
+}
+
+/* apart from the lookup of bad nibbles the checks are written without
+ * branches on the data: the comparisons turn into flag arithmetic and
+ * conditional moves, so noisy records cost no mispredicted branches */
+uint16_t validate_record(Validator* v, const unsigned char* raw, int len,
+		RecordBin* b) {
+	unsigned int flags, bad = 0, range = 0, spike = 0, na = 0;
+	uint64_t word[2];
+	int i, skip;
+
+	if (len > 20) len = 20;
+
+	flags = check_time(v, raw, b);
+
+	// nibbles of the readings, 8 bytes at a time; "AA" (not available) is
+	// fine, that is sorted out below. only a record with a bad nibble
+	// looks up which readings they belong to.
+	memset(word, 0, sizeof(word));
+	memcpy(word, raw + 5, len - 5);
+	if ((((word[0] & NIBBLES) + SIX) | (((word[0] >> 4) & NIBBLES) + SIX)
+			| ((word[1] & NIBBLES) + SIX) | (((word[1] >> 4) & NIBBLES) + SIX))
+			& CARRY) {
+		for (i = 5; i < len; i++) {
+			bad |= -BAD_NIBBLE(raw[i] >> 4) & nibble_owner[i][0];
+			bad |= -BAD_NIBBLE(raw[i] & 0x0F) & nibble_owner[i][1];
+		}
+	}
+
+	// readings of a record with a broken timestamp do not count as the
+	// previous reading
+	skip = (flags & INVALID_TIME) != 0;
+
+	for (i = 0; i < RECORD_SENSORS; i++) {
+		int t = b->t[i], h = b->h[i];
+		int t_na = t == RECORD_NA_T, h_na = h == RECORD_NA;
+		int t_bcd = (bad & INVALID_T(i)) != 0, h_bcd = (bad & INVALID_H(i)) != 0;
+		int64_t t_dt = b->time - v->t_time[i];
+		int64_t h_dt = b->time - v->h_time[i];
+		int t_bad, h_bad, t_jump, h_jump;
+		int64_t t_max, h_max;
+
+		na |= t_na * INVALID_T(i) | h_na * INVALID_H(i);
+
+		t_bad = !t_na & ((unsigned)(t - v->t_lo[i]) > (unsigned)(v->t_hi[i] - v->t_lo[i]));
+		h_bad = !h_na & ((unsigned)(h - v->h_lo[i]) > (unsigned)(v->h_hi[i] - v->h_lo[i]));
+		range |= t_bad * INVALID_T(i) | h_bad * INVALID_H(i);
+
+		// the allowed change grows with the time since the last plausible
+		// reading; an older or no previous reading allows anything (the
+		// ring buffer wraps around)
+		// (in 1/60 units, to stay clear of divisions)
+		t_max = (t_dt >= 0) & (t_dt < 86400) ? SPIKE_T_BASE * 60 + SPIKE_T_RATE * t_dt : INT64_MAX;
+		h_max = (h_dt >= 0) & (h_dt < 86400) ? SPIKE_H_BASE * 60 + SPIKE_H_RATE * h_dt : INT64_MAX;
+		t_jump = !t_na & !t_bad & !t_bcd & ((int64_t)abs(t - v->t_last[i]) * 60 > t_max);
+		h_jump = !h_na & !h_bad & !h_bcd & ((int64_t)abs(h - v->h_last[i]) * 60 > h_max);
+		spike |= t_jump * INVALID_T(i) | h_jump * INVALID_H(i);
+
+		t_bad |= t_na | t_bcd | t_jump | skip;
+		h_bad |= h_na | h_bcd | h_jump | skip;
+		v->t_last[i] = t_bad ? v->t_last[i] : t;
+		v->t_time[i] = t_bad ? v->t_time[i] : b->time;
+		v->h_last[i] = h_bad ? v->h_last[i] : h;
+		v->h_time[i] = h_bad ? v->h_time[i] : b->time;
+	}
+
+	bad &= ~na;
+	flags |= (bad != 0) * INVALID_BCD | (range != 0) * INVALID_RANGE
+			| (spike != 0) * INVALID_SPIKE | bad | range | spike;
+	b->flags = flags;
+	return flags;
+}
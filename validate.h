@@ -0,0 +1,75 @@
+/* vim:set expandtab! ts=4: */
+
+#ifndef _INCLUDE_VALIDATE_H_
+#define _INCLUDE_VALIDATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "record.h"
+#include "output.h"
+
+/* Plausibility checks of decoded records, in the same pass as decoding.
+ *
+ * Every reading is checked against a plausible range, derived from the
+ * alarm limits of its sensor in the eeprom (widened by a margin, and
+ * ignored while they are at the factory defaults), and against the last
+ * plausible reading of the same sensor, allowing a change that grows with
+ * the time in between. Nibbles above 9 and impossible timestamps are
+ * flagged as well. The result is a bitmask in RecordBin.flags: one bit per
+ * failed check, and one per reading that failed a check.
+ */
+
+#define INVALID_TIME  0x0001    /* date or time field out of range, or in the future */
+#define INVALID_BCD   0x0002    /* a nibble above 9 */
+#define INVALID_RANGE 0x0004    /* reading outside the plausible range */
+#define INVALID_SPIKE 0x0008    /* reading jumped against the previous one */
+#define INVALID_T(i)  (0x0010 << (i))   /* temperature of sensor i failed */
+#define INVALID_H(i)  (0x0400 << (i))   /* humidity of sensor i failed */
+
+/* how far ahead of the host's clock a timestamp may be, for clock skew */
+#define VALID_TIME_AHEAD 86400
+
+/* what the sensors can measure at all, tenths of deg C and %RH */
+#define VALID_T_MIN (-400)
+#define VALID_T_MAX 700
+#define VALID_H_MIN 1
+#define VALID_H_MAX 99
+
+/* plausible readings are at most this far outside the alarm limits */
+#define VALID_T_MARGIN 200
+#define VALID_H_MARGIN 30
+
+/* largest plausible change between readings: base + rate per minute */
+#define SPIKE_T_BASE 50
+#define SPIKE_T_RATE 10
+#define SPIKE_H_BASE 25
+#define SPIKE_H_RATE 5
+
+typedef struct _Validator {
+	int16_t t_lo[RECORD_SENSORS], t_hi[RECORD_SENSORS];
+	int16_t h_lo[RECORD_SENSORS], h_hi[RECORD_SENSORS];
+	int64_t max_time;
+	/* last plausible reading of each sensor */
+	int64_t t_time[RECORD_SENSORS], h_time[RECORD_SENSORS];
+	int16_t t_last[RECORD_SENSORS], h_last[RECORD_SENSORS];
+} Validator;
+
+/* set up the checks for the records of an eeprom image, taking the alarm
+ * limits from its header. data may be NULL to check against the sensor
+ * limits only. */
+extern void validate_init(Validator* v, const unsigned char* data, size_t len);
+
+/* check record b, decoded from the len bytes at raw. sets b->flags and
+ * returns it. */
+extern uint16_t validate_record(Validator* v, const unsigned char* raw,
+		int len, RecordBin* b);
+
+/* 1 if the timestamp of record b, decoded from raw, passes the checks. it
+ * does not depend on the records checked before. */
+extern int validate_time(const Validator* v, const unsigned char* raw,
+		const RecordBin* b);
+
+/* forget the previous readings, before checking an unrelated series */
+extern void validate_reset(Validator* v);
+
+#endif /* _INCLUDE_VALIDATE_H_ */